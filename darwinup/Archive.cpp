@@ -32,23 +32,23 @@
 
 #include "Archive.h"
 #include "Depot.h"
+#include "Digest.h"
+#include "DownloadCache.h"
 #include "File.h"
+#include "Pack.h"
+#include "ThreadPool.h"
 #include "Utils.h"
 
 #include <assert.h>
+#include <copyfile.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <fts.h>
 #include <libgen.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-
-#if TARGET_OS_EMBEDDED
-# define COMPACT_SUFFIX ".tar"
-# define COMPACT_COMPRESSION ""
-#else
-# define COMPACT_SUFFIX ".tar.bz2"
-# define COMPACT_COMPRESSION "j"
-#endif
+#include <sys/stat.h>
 
 extern char** environ;
 
@@ -56,10 +56,13 @@ Archive::Archive(const char* path) {
 	m_serial = 0;
 	uuid_generate_random(m_uuid);
 	m_path = strdup(path);
-	m_name = strdup(basename(m_path));
+	char name[PATH_MAX];
+	m_name = strdup(path_basename(m_path, name, sizeof(name)));
+	m_build = NULL;
 	m_info = 0;
 	m_date_installed = time(NULL);
 	m_is_superseded = -1;  // unknown
+	m_refcount = 1;
 }
 
 Archive::Archive(uint64_t serial, uuid_t uuid, const char* name, const char* path, 
@@ -72,6 +75,7 @@ Archive::Archive(uint64_t serial, uuid_t uuid, const char* name, const char* pat
 	m_info = info;
 	m_date_installed = date_installed;
 	m_is_superseded = -1; // unknown
+	m_refcount = 1;
 }
 
 
@@ -81,6 +85,15 @@ Archive::~Archive() {
 	if (m_build) free(m_build);
 }
 
+Archive* Archive::retain() {
+	m_refcount++;
+	return this;
+}
+
+void Archive::release() {
+	if (--m_refcount == 0) delete this;
+}
+
 uint64_t	Archive::serial()		{ return m_serial; }
 uint8_t*	Archive::uuid()			{ return m_uuid; }
 const char*	Archive::name()			{ return m_name; }
@@ -113,12 +126,111 @@ char* Archive::create_directory(const char* prefix) {
 	return path;
 }
 
+// tools which decompress on every core, tried in order, and the
+//  options they need for it
+static const char* bzip2_decompressors[] = { "lbzip2", "pbzip2", NULL };
+static const char* gzip_decompressors[] = { "pigz", NULL };
+static const char* xz_decompressors[] = { "xz -T0", NULL };
+static const char* zstd_decompressors[] = { "zstd -T0", NULL };
+static const char* decompressor_dirs[] = { 
+	"/usr/bin", "/usr/local/bin", "/opt/local/bin", "/opt/homebrew/bin", NULL 
+};
+
+// returns a tar(1) option to decompress format with a parallel
+//  decompressor, or NULL if none is installed. Caller must free it.
+static char* parallel_decompressor(archive_format_t format) {
+	const char** names = NULL;
+	switch (format) {
+		case ARCHIVE_FORMAT_BZIP2: names = bzip2_decompressors; break;
+		case ARCHIVE_FORMAT_GZIP: names = gzip_decompressors; break;
+		case ARCHIVE_FORMAT_XZ: names = xz_decompressors; break;
+		case ARCHIVE_FORMAT_ZSTD: names = zstd_decompressors; break;
+		default: return NULL;
+	}
+	for (uint32_t i = 0; names[i]; i++) {
+		// only the tool's name, not its options
+		char name[PATH_MAX];
+		strlcpy(name, names[i], sizeof(name));
+		name[strcspn(name, " ")] = 0;
+		for (uint32_t j = 0; decompressor_dirs[j]; j++) {
+			char* tool;
+			join_path(&tool, decompressor_dirs[j], name);
+			bool found = (access(tool, X_OK) == 0);
+			free(tool);
+			if (found) {
+				char* option;
+				asprintf(&option, "--use-compress-program=%s/%s", 
+						 decompressor_dirs[j], names[i]);
+				return option;
+			}
+		}
+	}
+	return NULL;
+}
+
+// extracts the tar archive at path, compressed as format, into destdir.
+//  flags are the tar(1) flags to use when no parallel decompressor is
+//  installed. If members is given, only the NUL separated names read
+//  from it are extracted.
+static int extract_tar(const char* path, const char* destdir, const char* flags,
+					   archive_format_t format, bool preserve, FILE* members) {
+	char* program = parallel_decompressor(format);
+	if (program) IF_DEBUG("extracting %s with %s\n", path, program);
+	const char* args[12];
+	int argc = 0;
+	args[argc++] = "/usr/bin/tar";
+	args[argc++] = program ? "xf" : flags;
+	args[argc++] = path;
+	args[argc++] = "-C";
+	args[argc++] = destdir;
+	if (preserve) args[argc++] = "-p";	// --preserve-permissions
+	if (program) args[argc++] = program;
+	if (members) {
+		args[argc++] = "--null";
+		args[argc++] = "-T";
+		args[argc++] = "-";
+	}
+	args[argc] = NULL;
+
+	int res = 0;
+	if (members) {
+		posix_spawn_file_actions_t fa;
+		res = posix_spawn_file_actions_init(&fa);
+		if (res == 0) res = posix_spawn_file_actions_adddup2(&fa, fileno(members), 0);
+		if (res == 0) {
+			res = exec_with_args_fa(args, &fa);
+		} else {
+			fprintf(stderr, "Error: (%d) unable to set up file actions for %s\n", res, path);
+		}
+		posix_spawn_file_actions_destroy(&fa);
+	} else {
+		res = exec_with_args(args);
+	}
+	free(program);
+	return res;
+}
+
+char* Archive::compacted_path(const char* prefix) {
+	char* path = NULL;
+	char uuidstr[37];
+	uuid_unparse_upper(m_uuid, uuidstr);
+	asprintf(&path, "%s/%s" COMPACT_SUFFIX, prefix, uuidstr);
+	return path;
+}
+
+char* Archive::packed_path(const char* prefix) {
+	char* path = NULL;
+	char uuidstr[37];
+	uuid_unparse_upper(m_uuid, uuidstr);
+	asprintf(&path, "%s/%s" PACK_SUFFIX, prefix, uuidstr);
+	return path;
+}
+
 int Archive::compact_directory(const char* prefix) {
 	int res = 0;
-	char* tarpath = NULL;
 	char uuidstr[37];
 	uuid_unparse_upper(m_uuid, uuidstr);
-	asprintf(&tarpath, "%s/%s" COMPACT_SUFFIX, prefix, uuidstr);
+	char* tarpath = this->compacted_path(prefix);
 	if (tarpath) {
 		const char* args[] = {
 			"/usr/bin/tar",
@@ -136,40 +248,185 @@ int Archive::compact_directory(const char* prefix) {
 	return res;
 }
 
+// extracts the paths of the pack of archive into its backing-store
+//  directory, or all of them if paths is NULL
+static int extract_packed(Archive* archive, const char* prefix, char** paths, 
+						  uint32_t count, bool* found) {
+	char* packpath = archive->packed_path(prefix);
+	char* dirpath = archive->directory_name(prefix);
+	int res = -1;
+	if (packpath && dirpath) {
+		Pack pack(packpath);
+		res = pack.extract(dirpath, paths, count, found);
+	}
+	free(packpath);
+	free(dirpath);
+	return res;
+}
+
 int Archive::expand_directory(const char* prefix) {
 	int res = 0;
-	char* tarpath = NULL;
-	char uuidstr[37];
-	uuid_unparse_upper(m_uuid, uuidstr);
-	asprintf(&tarpath, "%s/%s" COMPACT_SUFFIX, prefix, uuidstr);
+	char* tarpath = this->compacted_path(prefix);
 	if (tarpath) {
-		const char* args[] = {
-			"/usr/bin/tar",
-			"xf" COMPACT_COMPRESSION, tarpath,
-			"-C", prefix,
-			"-p",	// --preserve-permissions
-			NULL
-		};
-		res = exec_with_args(args);
+		res = extract_tar(tarpath, prefix, "xf" COMPACT_COMPRESSION, COMPACT_FORMAT, true, NULL);
 		free(tarpath);
 	} else {
 		fprintf(stderr, "%s:%d: out of memory\n", __FILE__, __LINE__);
 		res = -1;
 	}
+	if (res == 0) res = extract_packed(this, prefix, NULL, 0, NULL);
 	return res;
 }
 
-int Archive::prune_compacted_archive(const char* prefix) {
-	int res = 0;
-	char* tarpath = NULL;
+static int compare_paths(const void* a, const void* b) {
+	return strcmp(*(const char**)a, *(const char**)b);
+}
+
+int Archive::expand_files(const char* prefix, char** paths, uint32_t count) {
 	char uuidstr[37];
 	uuid_unparse_upper(m_uuid, uuidstr);
-	asprintf(&tarpath, "%s/%s" COMPACT_SUFFIX, prefix, uuidstr);
+	char* tarpath = this->compacted_path(prefix);
+	FILE* members = tmpfile();
+	char** sorted = (char**)malloc((count + 1) * sizeof(char*));
+	bool* found = (bool*)calloc(count + 1, sizeof(bool));
+	if (!tarpath || !members || !sorted || !found) {
+		fprintf(stderr, "%s:%d: could not list files to expand: %s (%d)\n", 
+				__FILE__, __LINE__, strerror(errno), errno);
+		free(tarpath);
+		if (members) fclose(members);
+		free(sorted);
+		free(found);
+		return -1;
+	}
+
+	// small files come from the pack, the others from the tar
+	memcpy(sorted, paths, count * sizeof(char*));
+	qsort(sorted, count, sizeof(char*), compare_paths);
+	int res = extract_packed(this, prefix, sorted, count, found);
+
+	// names in the store start with the uuid, see compact_directory
+	uint32_t members_count = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		if (found[i]) continue;
+		const char* path = sorted[i];
+		while (*path == '/') path++;
+		fprintf(members, "%s/%s%c", uuidstr, path, 0);
+		members_count++;
+	}
+	if (res == 0 && (fflush(members) == EOF || fseek(members, 0, SEEK_SET) == -1)) {
+		perror("tmpfile");
+		res = -1;
+	}
+	IF_DEBUG("expanding %u files of %s\n", members_count, tarpath);
+	if (res == 0 && members_count) {
+		res = extract_tar(tarpath, prefix, "xf" COMPACT_COMPRESSION, 
+						  COMPACT_FORMAT, true, members);
+	}
+	fclose(members);
+	free(tarpath);
+	free(sorted);
+	free(found);
+	return res;
+}
+
+int Archive::prune_compacted_archive(const char* prefix) {
+	int res = 0;
+	char* tarpath = this->compacted_path(prefix);
 	if (tarpath) {
 		res = unlink(tarpath);
 		if (res) perror(tarpath);
 		free(tarpath);
 	}
+	char* packpath = this->packed_path(prefix);
+	if (packpath && unlink(packpath) == -1 && errno != ENOENT) {
+		perror(packpath);
+		res = -1;
+	}
+	free(packpath);
+	return res;
+}
+
+int Archive::list_compacted(const char* prefix, char*** names, uint32_t* count) {
+	int res = 0;
+	*names = NULL;
+	*count = 0;
+	char* tarpath = this->compacted_path(prefix);
+	if (!tarpath) {
+		fprintf(stderr, "%s:%d: out of memory\n", __FILE__, __LINE__);
+		return -1;
+	}
+
+	FILE* list = tmpfile();
+	if (!list) {
+		fprintf(stderr, "%s:%d: could not create temporary file: %s (%d)\n", 
+				__FILE__, __LINE__, strerror(errno), errno);
+		free(tarpath);
+		return -1;
+	}
+	const char* args[] = {
+		"/usr/bin/tar",
+		"tf" COMPACT_COMPRESSION, tarpath,
+		NULL
+	};
+	res = exec_with_args_pipe(args, fileno(list));
+	free(tarpath);
+	if (res) {
+		fclose(list);
+		return res;
+	}
+	rewind(list);
+
+	// entries are stored as UUID/path, directories with a trailing slash
+	char uuidstr[37];
+	uuid_unparse_upper(m_uuid, uuidstr);
+	size_t uuidlen = strlen(uuidstr);
+	uint32_t maxnames = 256;
+	*names = (char**)malloc(maxnames * sizeof(char*));
+	char* line = NULL;
+	size_t linecap = 0;
+	ssize_t len;
+	while (*names && (len = getline(&line, &linecap, list)) > 0) {
+		while (len > 0 && (line[len-1] == '\n' || line[len-1] == '/')) line[--len] = 0;
+		if (strncmp(line, uuidstr, uuidlen) != 0) continue;
+		const char* name = line + uuidlen;
+		if (name[0] == 0) continue;
+		if (*count >= maxnames) {
+			maxnames *= 2;
+			*names = (char**)realloc(*names, maxnames * sizeof(char*));
+			if (!*names) break;
+		}
+		(*names)[(*count)++] = strdup(name);
+	}
+	free(line);
+	fclose(list);
+	if (!*names) {
+		fprintf(stderr, "%s:%d: out of memory\n", __FILE__, __LINE__);
+		*count = 0;
+		return -1;
+	}
+
+	// and the small files kept beside it
+	char* packpath = this->packed_path(prefix);
+	char** packed = NULL;
+	uint32_t packed_count = 0;
+	if (packpath) {
+		Pack pack(packpath);
+		res = pack.list(&packed, &packed_count);
+	}
+	if (res == 0 && packed_count) {
+		char** all = (char**)realloc(*names, (*count + packed_count) * sizeof(char*));
+		if (all) {
+			*names = all;
+			memcpy(*names + *count, packed, packed_count * sizeof(char*));
+			*count += packed_count;
+			packed_count = 0;
+		} else {
+			res = -1;
+		}
+	}
+	for (uint32_t i = 0; i < packed_count; i++) free(packed[i]);
+	free(packed);
+	free(packpath);
 	return res;
 }
 
@@ -178,6 +435,204 @@ int Archive::extract(const char* destdir) {
 	return -1;
 }
 
+Digest* Archive::staged_digest(const char* path, const struct stat* sb) {
+	return NULL;
+}
+
+
+
+// a regular file in a stage, and its digest
+struct StagedFile {
+	char*   path;  // relative to the stage, as in File::path()
+	char*   fullpath;
+	off_t   size;
+	time_t  mtime;
+	Digest* digest;
+};
+
+struct Stage {
+	char*       source;     // the path given to stage_archive()
+	char*       path;       // the archive's own path, which names it
+	char*       directory;  // where it was extracted
+	StagedFile* files;      // sorted by path
+	uint32_t    count;
+	bool        ready;      // extracted and digested without errors
+};
+
+static Stage**  stages = NULL;
+static uint32_t stage_count = 0;
+
+static int staged_file_compare(const void* a, const void* b) {
+	return strcmp(((StagedFile*)a)->path, ((StagedFile*)b)->path);
+}
+
+static void stage_digest_file(uint32_t index, void* context) {
+	StagedFile* file = ((Stage*)context)->files + index;
+	file->digest = new SHA1Digest(file->fullpath);
+}
+
+int stage_archive(const char* path, const char* tmppath) {
+	Archive* archive = ArchiveFactory(path, tmppath);
+	if (!archive) return -1;
+
+	Stage* stage = (Stage*)calloc(1, sizeof(Stage));
+	Stage** list = (Stage**)realloc(stages, (stage_count + 1) * sizeof(Stage*));
+	if (!stage || !list) {
+		fprintf(stderr, "%s:%d: out of memory\n", __FILE__, __LINE__);
+		free(stage);
+		archive->release();
+		return -1;
+	}
+	stages = list;
+	stage->source = strdup(path);
+	stage->path = strdup(archive->path());
+	asprintf(&stage->directory, "%s/stage.XXXXXX", tmppath);
+	int res = 0;
+	if (!stage->directory || !mkdtemp(stage->directory)) {
+		perror(tmppath);
+		res = -1;
+	}
+	if (res == 0) res = archive->extract(stage->directory);
+	archive->release();
+
+	// list the regular files, then digest them on every CPU
+	uint32_t capacity = 0;
+	const char* path_argv[] = { stage->directory, NULL };
+	FTS* fts = res ? NULL : fts_open((char**)path_argv, FTS_PHYSICAL | FTS_XDEV, fts_compare);
+	FTSENT* ent;
+	while (fts && (ent = fts_read(fts)) != NULL) {
+		if (ent->fts_info != FTS_F) continue;
+		if (stage->count == capacity) {
+			capacity = capacity ? capacity * 2 : 256;
+			StagedFile* files = (StagedFile*)realloc(stage->files, 
+													 capacity * sizeof(StagedFile));
+			if (!files) {
+				res = -1;
+				break;
+			}
+			stage->files = files;
+		}
+		StagedFile* file = stage->files + stage->count++;
+		char filename[PATH_MAX];
+		filename[0] = 0;
+		ftsent_filename(ent, filename, sizeof(filename));
+		file->path = strdup(filename);
+		file->fullpath = strdup(ent->fts_path);
+		file->size = ent->fts_statp->st_size;
+		file->mtime = ent->fts_statp->st_mtime;
+		file->digest = NULL;
+	}
+	if (fts) fts_close(fts);
+	if (res == 0) {
+		ThreadPool pool(0);
+		pool.apply(stage->count, &stage_digest_file, stage);
+		qsort(stage->files, stage->count, sizeof(StagedFile), &staged_file_compare);
+	}
+
+	// a stage which failed is still recorded, so it gets cleaned up
+	stages[stage_count++] = stage;
+	stage->ready = (res == 0);
+	if (res) fprintf(stderr, "Error: unable to stage %s\n", path);
+	IF_DEBUG("[stage] %s: %u files in %s\n", path, stage->count, stage->directory);
+	return res;
+}
+
+void unstage_archives() {
+	for (uint32_t i = 0; i < stage_count; i++) {
+		Stage* stage = stages[i];
+		if (stage->directory && is_directory(stage->directory)) {
+			remove_directory(stage->directory);
+		}
+		for (uint32_t j = 0; j < stage->count; j++) {
+			free(stage->files[j].path);
+			free(stage->files[j].fullpath);
+			delete stage->files[j].digest;
+		}
+		free(stage->files);
+		free(stage->source);
+		free(stage->path);
+		free(stage->directory);
+		free(stage);
+	}
+	free(stages);
+	stages = NULL;
+	stage_count = 0;
+}
+
+
+
+StagedArchive::StagedArchive(const char* path, Stage* stage) : Archive(path) {
+	m_stage = stage;
+}
+
+int StagedArchive::extract(const char* destdir) {
+	// clone rather than copy wherever the filesystem allows, and keep
+	//  hard links within the root
+#ifdef COPYFILE_CLONE
+	const uint32_t flags = COPYFILE_ALL | COPYFILE_NOFOLLOW | COPYFILE_CLONE;
+#else
+	const uint32_t flags = COPYFILE_ALL | COPYFILE_NOFOLLOW;
+#endif
+	int res = 0;
+	LinkGroups links;
+	const char* path_argv[] = { m_stage->directory, NULL };
+	FTS* fts = fts_open((char**)path_argv, FTS_PHYSICAL | FTS_XDEV, fts_compare);
+	FTSENT* ent = fts ? fts_read(fts) : NULL; // the stage itself
+	if (!ent) res = -1;
+	while (res == 0 && (ent = fts_read(fts)) != NULL) {
+		if (ent->fts_level == 0) continue;
+		char filename[PATH_MAX];
+		filename[0] = 0;
+		ftsent_filename(ent, filename, sizeof(filename));
+		char* dstpath;
+		join_path(&dstpath, destdir, filename);
+		struct stat* sb = ent->fts_statp;
+		HardLink* link = NULL;
+		switch (ent->fts_info) {
+			case FTS_D:
+				res = mkdir(dstpath, 0700);
+				break;
+			case FTS_DP:
+				// after the children, which change its times
+				res = copyfile(ent->fts_path, dstpath, NULL, 
+							   COPYFILE_ACL | COPYFILE_STAT | COPYFILE_XATTR | 
+							   COPYFILE_NOFOLLOW);
+				break;
+			case FTS_F:
+				if (sb->st_nlink > 1) link = links.find(sb);
+				if (link) {
+					res = ::link(link->path, dstpath);
+					break;
+				}
+				res = copyfile(ent->fts_path, dstpath, NULL, flags);
+				if (res == 0 && sb->st_nlink > 1) links.add(sb, dstpath, NULL);
+				break;
+			default:
+				res = copyfile(ent->fts_path, dstpath, NULL, 
+							   COPYFILE_ALL | COPYFILE_NOFOLLOW);
+				break;
+		}
+		if (res) {
+			fprintf(stderr, "%s:%d: %s: %s (%d)\n", 
+					__FILE__, __LINE__, dstpath, strerror(errno), errno);
+		}
+		free(dstpath);
+	}
+	if (fts) fts_close(fts);
+	return res;
+}
+
+Digest* StagedArchive::staged_digest(const char* path, const struct stat* sb) {
+	StagedFile key;
+	key.path = (char*)path;
+	StagedFile* file = (StagedFile*)bsearch(&key, m_stage->files, m_stage->count, 
+											sizeof(StagedFile), &staged_file_compare);
+	if (!file || file->size != sb->st_size || file->mtime != sb->st_mtime) {
+		return NULL;
+	}
+	return file->digest->copy();
+}
+
 
 
 RollbackArchive::RollbackArchive() : Archive("<Rollback>") {
@@ -239,26 +694,28 @@ int TarArchive::extract(const char* destdir) {
 TarGZArchive::TarGZArchive(const char* path) : Archive(path) {}
 
 int TarGZArchive::extract(const char* destdir) {
-	const char* args[] = {
-		"/usr/bin/tar",
-		"xzf", m_path,
-		"-C", destdir,
-		NULL
-	};
-	return exec_with_args(args);
+	return extract_tar(m_path, destdir, "xzf", ARCHIVE_FORMAT_GZIP, false, NULL);
 }
 
 
 TarBZ2Archive::TarBZ2Archive(const char* path) : Archive(path) {}
 
 int TarBZ2Archive::extract(const char* destdir) {
-	const char* args[] = {
-		"/usr/bin/tar",
-		"xjf", m_path,
-		"-C", destdir,
-		NULL
-	};
-	return exec_with_args(args);
+	return extract_tar(m_path, destdir, "xjf", ARCHIVE_FORMAT_BZIP2, false, NULL);
+}
+
+
+TarXZArchive::TarXZArchive(const char* path) : Archive(path) {}
+
+int TarXZArchive::extract(const char* destdir) {
+	return extract_tar(m_path, destdir, "xJf", ARCHIVE_FORMAT_XZ, false, NULL);
+}
+
+
+TarZstdArchive::TarZstdArchive(const char* path) : Archive(path) {}
+
+int TarZstdArchive::extract(const char* destdir) {
+	return extract_tar(m_path, destdir, "xf", ARCHIVE_FORMAT_ZSTD, false, NULL);
 }
 
 #if __MAC_OS_X_VERSION_MIN_REQUIRED >= 1060
@@ -288,15 +745,54 @@ int ZipArchive::extract(const char* destdir) {
 }
 
 
+// reads the first bytes of path to tell what kind of archive it is
+static archive_format_t archive_format(const char* path) {
+	unsigned char buf[512];
+	memset(buf, 0, sizeof(buf));
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) return ARCHIVE_FORMAT_UNKNOWN;
+	ssize_t len = read(fd, buf, sizeof(buf));
+	close(fd);
+	if (len < 6) return ARCHIVE_FORMAT_UNKNOWN;
+
+	if (buf[0] == 0x1f && buf[1] == 0x8b) return ARCHIVE_FORMAT_GZIP;
+	if (memcmp(buf, "BZh", 3) == 0) return ARCHIVE_FORMAT_BZIP2;
+	if (memcmp(buf, "\xfd" "7zXZ\0", 6) == 0) return ARCHIVE_FORMAT_XZ;
+	if (memcmp(buf, "\x28\xb5\x2f\xfd", 4) == 0) return ARCHIVE_FORMAT_ZSTD;
+	if (memcmp(buf, "xar!", 4) == 0) return ARCHIVE_FORMAT_XAR;
+	if (memcmp(buf, "PK\3\4", 4) == 0) return ARCHIVE_FORMAT_ZIP;
+	// odc and newc headers, and binary headers of either byte order
+	if (memcmp(buf, "070707", 6) == 0 || memcmp(buf, "070701", 6) == 0 ||
+		memcmp(buf, "070702", 6) == 0) return ARCHIVE_FORMAT_CPIO;
+	if ((buf[0] == 0xc7 && buf[1] == 0x71) || 
+		(buf[0] == 0x71 && buf[1] == 0xc7)) return ARCHIVE_FORMAT_CPIO;
+	if (len >= 262 && memcmp(buf + 257, "ustar", 5) == 0) return ARCHIVE_FORMAT_TAR;
+	return ARCHIVE_FORMAT_UNKNOWN;
+}
+
+// a suffix is believed unless the file says otherwise
+static bool agrees(archive_format_t format, archive_format_t expected) {
+	return format == ARCHIVE_FORMAT_UNKNOWN || format == expected;
+}
+
 Archive* ArchiveFactory(const char* path, const char* tmppath) {
 	Archive* archive = NULL;
 
+	// roots which were staged are already fetched and extracted
+	for (uint32_t i = 0; i < stage_count; i++) {
+		if (stages[i]->ready && strcmp(stages[i]->source, path) == 0) {
+			IF_DEBUG("using staged copy of %s\n", path);
+			return new StagedArchive(stages[i]->path, stages[i]);
+		}
+	}
+
 	// actual path to archive
 	char* actpath = NULL; 
 	
 	// fetch remote archives if needed
 	if (is_url_path(path)) {
-		actpath = fetch_url(path, tmppath);
+		DownloadCache cache(tmppath, DOWNLOAD_CACHE_LIMIT);
+		actpath = cache.fetch(path);
 		if (!actpath) {
 			fprintf(stderr, "Error: could not fetch remote URL: %s \n", path);
 			return NULL;
@@ -320,34 +816,71 @@ Archive* ArchiveFactory(const char* path, const char* tmppath) {
 		return NULL;
 	}
 	
-	// use file extension to guess archive format
+	// use file extension to guess archive format, checked against the
+	// first bytes of the file so misnamed downloads still work
+	archive_format_t format = ARCHIVE_FORMAT_UNKNOWN;
+	if (!is_directory(actpath, true)) format = archive_format(actpath);
+	IF_DEBUG("archive format of %s is %d\n", actpath, format);
+
 	if (is_directory(actpath, true)) {
 		archive = new DittoArchive(actpath);
-	} else if (has_suffix(actpath, ".cpio")) {
+	} else if (has_suffix(actpath, ".cpio") && agrees(format, ARCHIVE_FORMAT_CPIO)) {
 		archive = new CpioArchive(actpath);
-	} else if (has_suffix(actpath, ".cpio.gz") || has_suffix(actpath, ".cpgz")) {
+	} else if ((has_suffix(actpath, ".cpio.gz") || has_suffix(actpath, ".cpgz"))
+			   && agrees(format, ARCHIVE_FORMAT_GZIP)) {
 		archive = new CpioGZArchive(actpath);
-	} else if (has_suffix(actpath, ".cpio.bz2") || has_suffix(actpath, ".cpbz2")) {
+	} else if ((has_suffix(actpath, ".cpio.bz2") || has_suffix(actpath, ".cpbz2"))
+			   && agrees(format, ARCHIVE_FORMAT_BZIP2)) {
 		archive = new CpioBZ2Archive(actpath);
-	} else if (has_suffix(actpath, ".pax")) {
+	} else if (has_suffix(actpath, ".pax") 
+			   && (agrees(format, ARCHIVE_FORMAT_TAR) || format == ARCHIVE_FORMAT_CPIO)) {
 		archive = new PaxArchive(actpath);
-	} else if (has_suffix(actpath, ".pax.gz") || has_suffix(actpath, ".pgz")) {
+	} else if ((has_suffix(actpath, ".pax.gz") || has_suffix(actpath, ".pgz"))
+			   && agrees(format, ARCHIVE_FORMAT_GZIP)) {
 		archive = new PaxGZArchive(actpath);
-	} else if (has_suffix(actpath, ".pax.bz2") || has_suffix(actpath, ".pbz2")) {
+	} else if ((has_suffix(actpath, ".pax.bz2") || has_suffix(actpath, ".pbz2"))
+			   && agrees(format, ARCHIVE_FORMAT_BZIP2)) {
 		archive = new PaxBZ2Archive(actpath);		
-	} else if (has_suffix(actpath, ".tar")) {
+	} else if (has_suffix(actpath, ".tar") && agrees(format, ARCHIVE_FORMAT_TAR)) {
 		archive = new TarArchive(actpath);
-	} else if (has_suffix(actpath, ".tar.gz") || has_suffix(actpath, ".tgz")) {
+	} else if ((has_suffix(actpath, ".tar.gz") || has_suffix(actpath, ".tgz"))
+			   && agrees(format, ARCHIVE_FORMAT_GZIP)) {
 		archive = new TarGZArchive(actpath);
-	} else if (has_suffix(actpath, ".tar.bz2") 
+	} else if ((has_suffix(actpath, ".tar.bz2") 
 				|| has_suffix(actpath, ".tbz2") 
-				|| has_suffix(actpath, ".tbz")) {
+				|| has_suffix(actpath, ".tbz"))
+			   && agrees(format, ARCHIVE_FORMAT_BZIP2)) {
 		archive = new TarBZ2Archive(actpath);		
+	} else if ((has_suffix(actpath, ".tar.xz") || has_suffix(actpath, ".txz"))
+			   && agrees(format, ARCHIVE_FORMAT_XZ)) {
+		archive = new TarXZArchive(actpath);
+	} else if ((has_suffix(actpath, ".tar.zst") || has_suffix(actpath, ".tzst"))
+			   && agrees(format, ARCHIVE_FORMAT_ZSTD)) {
+		archive = new TarZstdArchive(actpath);
+#if __MAC_OS_X_VERSION_MIN_REQUIRED >= 1060
+	} else if (has_suffix(actpath, ".xar") && agrees(format, ARCHIVE_FORMAT_XAR)) {
+		archive = new XarArchive(actpath);
+#endif
+	} else if (has_suffix(actpath, ".zip") && agrees(format, ARCHIVE_FORMAT_ZIP)) {
+		archive = new ZipArchive(actpath);
+	} else if (format == ARCHIVE_FORMAT_TAR) {
+		archive = new TarArchive(actpath);
+	} else if (format == ARCHIVE_FORMAT_CPIO) {
+		archive = new CpioArchive(actpath);
+	} else if (format == ARCHIVE_FORMAT_GZIP) {
+		// compressed tar is by far the most common
+		archive = new TarGZArchive(actpath);
+	} else if (format == ARCHIVE_FORMAT_BZIP2) {
+		archive = new TarBZ2Archive(actpath);
+	} else if (format == ARCHIVE_FORMAT_XZ) {
+		archive = new TarXZArchive(actpath);
+	} else if (format == ARCHIVE_FORMAT_ZSTD) {
+		archive = new TarZstdArchive(actpath);
 #if __MAC_OS_X_VERSION_MIN_REQUIRED >= 1060
-	} else if (has_suffix(actpath, ".xar")) {
+	} else if (format == ARCHIVE_FORMAT_XAR) {
 		archive = new XarArchive(actpath);
 #endif
-	} else if (has_suffix(actpath, ".zip")) {
+	} else if (format == ARCHIVE_FORMAT_ZIP) {
 		archive = new ZipArchive(actpath);
 	} else {
 		fprintf(stderr, "Error: unknown archive type: %s\n", path);
@@ -54,8 +54,42 @@ enum archive_keyword_t {
 //
 const uint64_t ARCHIVE_INFO_ROLLBACK	= 0x0001;
 
+//
+// archive formats, as told by the first bytes of the file. Compressed
+// archives are only known by their compression.
+//
+enum archive_format_t {
+	ARCHIVE_FORMAT_UNKNOWN,
+	ARCHIVE_FORMAT_TAR,
+	ARCHIVE_FORMAT_CPIO,
+	ARCHIVE_FORMAT_XAR,
+	ARCHIVE_FORMAT_ZIP,
+	ARCHIVE_FORMAT_GZIP,
+	ARCHIVE_FORMAT_BZIP2,
+	ARCHIVE_FORMAT_XZ,
+	ARCHIVE_FORMAT_ZSTD
+};
+
+//
+// suffix, tar(1) flag and format of compacted backing-store files
+//
+#if TARGET_OS_EMBEDDED
+# define COMPACT_SUFFIX ".tar"
+# define COMPACT_COMPRESSION ""
+# define COMPACT_FORMAT ARCHIVE_FORMAT_TAR
+#else
+# define COMPACT_SUFFIX ".tar.bz2"
+# define COMPACT_COMPRESSION "j"
+# define COMPACT_FORMAT ARCHIVE_FORMAT_BZIP2
+#endif
+
+// suffix of the pack holding the small files of a backing store
+#define PACK_SUFFIX ".pack"
+
 struct Archive;
 struct Depot;
+struct Digest;
+struct Stage;
 
 ////
 //  Archive
@@ -68,18 +102,36 @@ struct Depot;
 //
 //  ArchiveFactory exists to return the correct
 //  concrete subclass for a given archive to be
-//  installed.  Currently this is determined
-//  by the file's suffix. The tmppath parameter
+//  installed.  This is determined by the file's
+//  suffix, unless the first bytes of the file say
+//  it is something else. The tmppath parameter
 //  is the path where files can be stored during
 //  processing, such as fetching remote archives. 
 ////
 
 Archive* ArchiveFactory(const char* path, const char* tmppath);
 
+// Fetches, extracts and digests the archive at path once, into a
+//  directory under tmppath. ArchiveFactory then returns a StagedArchive
+//  for path, so a process installing one root into several prefixes
+//  only does that work one time.
+int stage_archive(const char* path, const char* tmppath);
+
+// Removes every staged directory.
+void unstage_archives();
+
 struct Archive {
 	Archive(const char* path);
 	virtual ~Archive();
 
+	// Archives are shared between the database's archive cache and
+	//  the File objects which belong to them. Whoever creates one
+	//  holds the first reference, and release() deletes the archive
+	//  along with the last. Not thread safe; archives are only
+	//  shared on the thread which uses the database.
+	Archive* retain();
+	void     release();
+
 	////
 	//  Public Accessor functions
 	////
@@ -118,6 +170,10 @@ struct Archive {
 	// by concrete subclasses.
 	virtual int extract(const char* destdir);
 
+	// The digest of the extracted file at path, if it is already known
+	// and sb still matches it, otherwise NULL. Caller must delete it.
+	virtual Digest* staged_digest(const char* path, const struct stat* sb);
+
 	// Returns the backing-store directory name for the archive.
 	// This is prefix/uuid.
 	// The result should be released with free(3).
@@ -130,12 +186,34 @@ struct Archive {
 	// Compacts the backing-store directory into a single file.
 	int compact_directory(const char* prefix);
 	
-	// Expands the backing-store directory from its single file.
+	// Expands the backing-store directory from its single file,
+	//  and its pack if it has one.
 	int expand_directory(const char* prefix);
 
-	// Removes the compacted backing-store file from disk.
+	// Expands only the given paths of the backing-store directory from
+	//  its single file and pack.
+	int expand_files(const char* prefix, char** paths, uint32_t count);
+
+	// Removes the compacted backing-store file and pack from disk.
 	int prune_compacted_archive(const char* prefix);
 
+	// Returns the path of the compacted backing-store file.
+	// This is prefix/uuid followed by COMPACT_SUFFIX.
+	// The result should be released with free(3).
+	char* compacted_path(const char* prefix);
+
+	// Returns the path of the pack of small files kept beside the
+	// compacted backing-store file, which only rollback archives have.
+	// This is prefix/uuid followed by PACK_SUFFIX.
+	// The result should be released with free(3).
+	char* packed_path(const char* prefix);
+
+	// Lists the paths stored in the compacted backing-store file and
+	// pack, relative to the backing-store directory ("/usr/bin/foo").
+	// Returns non-zero if the file is missing or cannot be read.
+	// Caller must free each name and the list.
+	int list_compacted(const char* prefix, char*** names, uint32_t* count);
+
 	protected:
 
 	// Constructor for subclasses and Depot to use when 
@@ -154,6 +232,8 @@ struct Archive {
 	// -1 unknown, 0 false, 1 true
 	int       m_is_superseded;
 	
+	uint32_t  m_refcount;
+	
 	friend struct Depot;
 	friend struct DarwinupDatabase;
 };
@@ -171,6 +251,23 @@ struct RollbackArchive : public Archive {
 };
 
 
+////
+//  StagedArchive
+//
+//  Not a file format.  A root which stage_archive() has already
+//  extracted and digested into a shared directory.  Extracting clones
+//  that directory, and analysis reuses its digests.
+////
+struct StagedArchive : public Archive {
+	StagedArchive(const char* path, Stage* stage);
+	virtual int extract(const char* destdir);
+	virtual Digest* staged_digest(const char* path, const struct stat* sb);
+
+	protected:
+	Stage* m_stage;
+};
+
+
 ////
 //  DittoArchive
 //
@@ -303,6 +400,32 @@ struct TarBZ2Archive : public Archive {
         virtual int extract(const char* destdir);
 };
 
+
+////
+//  TarXZArchive
+//
+//  Corresponds to the tar(1) file format, compressed with xz(1).
+//  This installs archives using the tar(1) command line tool with
+//  the -J option.
+////
+struct TarXZArchive : public Archive {
+        TarXZArchive(const char* path);
+        virtual int extract(const char* destdir);
+};
+
+
+////
+//  TarZstdArchive
+//
+//  Corresponds to the tar(1) file format, compressed with zstd(1).
+//  This installs archives using the tar(1) command line tool, which
+//  recognizes the compression itself.
+////
+struct TarZstdArchive : public Archive {
+        TarZstdArchive(const char* path);
+        virtual int extract(const char* destdir);
+};
+
 #if __MAC_OS_X_VERSION_MIN_REQUIRED >= 1060
 ////
 //  XarArchive
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2013 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#ifndef _CONTEXT_H
+#define _CONTEXT_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+struct Progress;
+
+////
+//  Context
+//
+//  Options that affect how darwinup operations behave. These used to be
+//  process globals set from the command line. Each thread now has a
+//  current Context, which lets a library client drive several depots
+//  from one process, one thread per depot.
+//
+//  A thread that never sets a context gets a shared default with every
+//  option off, which prints its results to stdout.
+////
+
+struct Context {
+	Context();
+
+	uint32_t verbosity;  // VERBOSE* bits
+	uint32_t force;      // push through unsafe situations
+	uint32_t dryrun;     // analyze but do not modify anything
+	Progress* progress;  // reports on long operations, or NULL
+	FILE*    output;     // where results for the user are printed
+
+	// Returns the calling thread's current context.
+	static Context* current();
+
+	// Makes context current for the calling thread.
+	// Returns the previously current context, which may be NULL.
+	static Context* set_current(Context* context);
+};
+
+#endif
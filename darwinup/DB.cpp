@@ -32,16 +32,36 @@
 
 #include "DB.h"
 
+// file records as the rest of darwinup reads them, with the whole
+//  path in the name column
+#define FILE_COLUMNS \
+	"files.serial, files.archive, files.info, files.mode, files.uid, " \
+	"files.gid, files.size, files.digest, directories.path || files.name, " \
+	"files.mtime, files.dir"
+#define FILES_JOIN \
+	"files JOIN directories ON directories.serial = files.dir"
+
+// splits path after its last slash. Returns the directory, which the
+//  caller must free, and points name into path.
+static char* split_path(const char* path, const char** name) {
+	const char* slash = strrchr(path, '/');
+	*name = slash ? slash + 1 : path;
+	return strndup(path, *name - path);
+}
 
 DarwinupDatabase::DarwinupDatabase(const char* path) : Database(path) {
+	for (uint32_t i = 0; i < ARCHIVE_CACHE_SIZE; i++) {
+		this->m_archive_cache[i] = NULL;
+		this->m_archive_cache_used[i] = 0;
+	}
+	this->m_archive_cache_clock = 0;
 	this->connect();
-	this->last_archive = NULL;
 }
 
 DarwinupDatabase::~DarwinupDatabase() {
 	// parent automatically deallocates schema objects
 
-	if (this->last_archive) delete this->last_archive;
+	this->clear_archive_cache();
 }
 
 int DarwinupDatabase::init_schema() {
@@ -58,7 +78,43 @@ int DarwinupDatabase::init_schema() {
 	ADD_INTEGER(m_archives_table, "active");
 	ADD_INTEGER(m_archives_table, "info");	
 
-	
+	// files stored their full path until schema version 4, when the
+	//  table was rebuilt around directories; see pre_upgrade()
+
+
+	SCHEMA_VERSION(1);
+
+	ADD_TEXT(m_archives_table, "osbuild");
+
+	SCHEMA_VERSION(2);
+
+	// files gained mtime
+
+	SCHEMA_VERSION(3);
+
+	// totals kept up to date as files are inserted and deleted, so
+	//  listing archives never has to read their files
+	this->m_summary_table = new Table("archive_summary");
+	ADD_TABLE(this->m_summary_table);
+	ADD_PK(m_summary_table, "archive");
+	ADD_INTEGER(m_summary_table, "files");
+	ADD_INTEGER(m_summary_table, "bytes");
+	ADD_INTEGER(m_summary_table, "rollback_bytes");
+	ADD_INTEGER(m_summary_table, "current_files");
+	ADD_INTEGER(m_summary_table, "unchanged_files");
+	ADD_INTEGER(m_summary_table, "verified");
+
+	SCHEMA_VERSION(4);
+
+	// each directory path is stored once, and files refer to it
+	this->m_directories_table = new Table("directories");
+	ADD_TABLE(this->m_directories_table);
+	ADD_PK(m_directories_table, "serial");
+	ADD_COLUMN(m_directories_table, "path", TYPE_TEXT, false, false, true);
+
+	// a file's path is its directory's path, which ends in a slash,
+	//  followed by name. Records read back carry the whole path in
+	//  name; see FILE_COLUMNS.
 	this->m_files_table = new Table("files");
 	ADD_TABLE(this->m_files_table);
 	ADD_PK(m_files_table, "serial");
@@ -69,20 +125,80 @@ int DarwinupDatabase::init_schema() {
 	ADD_INTEGER(m_files_table, "gid");
 	ADD_INTEGER(m_files_table, "size");
 	ADD_BLOB(m_files_table, "digest");
-	ADD_INDEX(m_files_table, "path", TYPE_TEXT, false);
-	
-	// custom index to protect from duplicate files
-	assert(this->m_files_table->set_custom_create("CREATE UNIQUE INDEX files_archive_path " 
-												  "ON files (archive, path);") == 0);
+	ADD_TEXT(m_files_table, "name");
+	// lets verify skip hashing files which have not changed.
+	//  0 for files recorded before schema version 2.
+	ADD_INTEGER(m_files_table, "mtime");
+	ADD_INTEGER(m_files_table, "dir");
 
+	// custom index to look up paths and protect from duplicate files
+	assert(this->m_files_table->set_custom_create("CREATE UNIQUE INDEX files_dir_name_archive " 
+												  "ON files (dir, name, archive);") == 0);
 
-	SCHEMA_VERSION(1);
+	SCHEMA_VERSION(5);
 
-	ADD_TEXT(m_archives_table, "osbuild");
+	// names for the depot as it was when archive was the newest archive,
+	//  which undo goes back to
+	this->m_checkpoints_table = new Table("checkpoints");
+	ADD_TABLE(this->m_checkpoints_table);
+	ADD_PK(m_checkpoints_table, "serial");
+	ADD_COLUMN(m_checkpoints_table, "name", TYPE_TEXT, false, false, true);
+	ADD_INTEGER(m_checkpoints_table, "archive");
+	ADD_INTEGER(m_checkpoints_table, "date_added");
 	
 	return 0;
 }
 
+int DarwinupDatabase::pre_upgrade(uint32_t version) {
+	int res = SQLITE_OK;
+	if (version < 4) {
+		// move the old files table and its indexes out of the way of
+		//  the new one, post_upgrade() copies its records over
+		res = this->sql_once("ALTER TABLE files RENAME TO files_v3;");
+		if (res == SQLITE_OK) res = this->sql_once("DROP INDEX IF EXISTS files_archive;");
+		if (res == SQLITE_OK) res = this->sql_once("DROP INDEX IF EXISTS files_path;");
+		if (res == SQLITE_OK) res = this->sql_once("DROP INDEX IF EXISTS files_archive_path;");
+	}
+	if (res != SQLITE_OK) return DB_ERROR;
+	return DB_OK;
+}
+
+int DarwinupDatabase::post_upgrade(uint32_t version) {
+	int res = SQLITE_OK;
+	if (version < 4) {
+		// rtrim() with every other character of the path leaves its
+		//  directory, up to and including the last slash
+		res = this->sql_once("INSERT OR IGNORE INTO directories (path) "
+							 "SELECT DISTINCT rtrim(path, replace(path, '/', '')) "
+							 "FROM files_v3;");
+		if (res == SQLITE_OK) res = this->sql_once(
+			"INSERT INTO files "
+			"(serial, archive, info, mode, uid, gid, size, digest, name, mtime, dir) "
+			"SELECT old.serial, old.archive, old.info, old.mode, old.uid, old.gid, "
+			" old.size, old.digest, substr(old.path, length(directories.path) + 1), "
+			" %s, directories.serial "
+			"FROM files_v3 old JOIN directories "
+			"ON directories.path = rtrim(old.path, replace(old.path, '/', ''));",
+			(version < 2 ? "0" : "old.mtime"));
+		// keep serials of deleted files from being handed out again
+		if (res == SQLITE_OK) res = this->sql_once("DELETE FROM sqlite_sequence "
+												   "WHERE name = 'files';");
+		if (res == SQLITE_OK) res = this->sql_once("UPDATE sqlite_sequence SET name = 'files' "
+												   "WHERE name = 'files_v3';");
+		if (res == SQLITE_OK) res = this->sql_once("DROP TABLE files_v3;");
+	}
+	if (res == SQLITE_OK && version < 3) {
+		// summarize every archive installed by older versions
+		res = this->sql_once("CREATE TEMP TABLE IF NOT EXISTS stale_summaries "
+							 "(archive INTEGER PRIMARY KEY);");
+		if (res == SQLITE_OK) res = this->sql_once("INSERT OR IGNORE INTO stale_summaries "
+												   "SELECT serial FROM archives;");
+		if (res == SQLITE_OK) res = this->update_archive_summaries();
+	}
+	if (res != SQLITE_OK) return DB_ERROR;
+	return DB_OK;
+}
+
 int DarwinupDatabase::activate_archive(uint64_t serial) {
 	uint64_t active = 1;
 	return this->set_archive_active(serial, &active);
@@ -94,7 +210,7 @@ int DarwinupDatabase::deactivate_archive(uint64_t serial) {
 }
 
 int DarwinupDatabase::set_archive_active(uint64_t serial, uint64_t* active) {
-	this->clear_last_archive();
+	this->clear_archive_cache();
 	return this->update_value("activate_archive", 
 							  this->m_archives_table,
 							  this->m_archives_table->column(4), // active
@@ -107,7 +223,7 @@ int DarwinupDatabase::set_archive_active(uint64_t serial, uint64_t* active) {
 int DarwinupDatabase::update_archive(uint64_t serial, uuid_t uuid, const char* name,
 									 time_t date_added, uint32_t active, uint64_t info,
 									 const char* build) {
-	this->clear_last_archive();
+	this->clear_archive_cache();
 	return this->update(this->m_archives_table, serial,
 						(uint8_t*)uuid,
 						(uint32_t)sizeof(uuid_t),
@@ -164,27 +280,23 @@ File* DarwinupDatabase::make_file(uint8_t* data) {
 		memcpy(digest->m_data, dp, CC_SHA1_DIGEST_LENGTH);
 	}
 	
+	// the whole path, not just the name; see FILE_COLUMNS
 	char* path;
 	memcpy(&path, &data[this->file_offset(8)], sizeof(char*));
+	uint64_t mtime;
+	memcpy(&mtime, &data[this->file_offset(9)], sizeof(uint64_t));
 	
-	// get archive, which may be stored in last_archive
-	int res = DB_OK;
-	bool cached = false;
-	Archive* archive = this->get_last_archive(archive_serial);
-	if (archive) {
-		cached = true;
-	} else {
-		uint8_t* archive_data;
-		res = this->get_archive(&archive_data, archive_serial);
-		this->set_last_archive(archive_data);
-		archive = this->last_archive;
-	}
+	// get archive, which is usually in the archive cache
+	Archive* archive = this->archive(archive_serial);
 	if (!archive) {
-		fprintf(stderr, "Error: DB::make_file could not find the archive for file: %s: %d \n", path, res);
+		fprintf(stderr, "Error: DB::make_file could not find the archive for file: %s \n", path);
 		return NULL;
 	}
 
+	// the file holds its own reference to the archive
 	File* result = FileFactory(serial, archive, (uint32_t)info, (const char*)path, mode, (uid_t)uid, (gid_t)gid, size, digest);
+	if (result) result->mtime((time_t)mtime);
+	archive->release();
 	this->m_files_table->free_result(data);
 	
 	return result;
@@ -192,27 +304,95 @@ File* DarwinupDatabase::make_file(uint8_t* data) {
 
 
 
+FileRecord* DarwinupDatabase::make_record(FilePool* pool, uint8_t* data) {
+	uint64_t serial;
+	memcpy(&serial, &data[this->file_offset(0)], sizeof(uint64_t));
+	uint64_t archive_serial;
+	memcpy(&archive_serial, &data[this->file_offset(1)], sizeof(uint64_t));
+	uint64_t info;
+	memcpy(&info, &data[this->file_offset(2)], sizeof(uint64_t));
+	uint64_t mode;
+	memcpy(&mode, &data[this->file_offset(3)], sizeof(uint64_t));
+	uint64_t uid;
+	memcpy(&uid, &data[this->file_offset(4)], sizeof(uint64_t));
+	uint64_t gid;
+	memcpy(&gid, &data[this->file_offset(5)], sizeof(uint64_t));
+	uint64_t size;
+	memcpy(&size, &data[this->file_offset(6)], sizeof(uint64_t));
+	uint8_t* dp;
+	memcpy(&dp, (uint8_t**)&data[this->file_offset(7)], sizeof(uint8_t*));
+	char* path;
+	memcpy(&path, &data[this->file_offset(8)], sizeof(char*));
+	uint64_t mtime;
+	memcpy(&mtime, &data[this->file_offset(9)], sizeof(uint64_t));
+
+	FileRecord* record = NULL;
+	Archive* archive = this->archive(archive_serial);
+	if (!archive) {
+		fprintf(stderr, "Error: DB::make_record could not find the archive for file: %s \n", path);
+	} else {
+		record = pool->add(archive, path);
+		if (!record) fprintf(stderr, "Error: ran out of memory in DB::make_record\n");
+		archive->release();
+	}
+	if (record) {
+		record->serial = serial;
+		record->info = (uint32_t)info;
+		record->mode = (mode_t)mode;
+		record->uid = (uid_t)uid;
+		record->gid = (gid_t)gid;
+		record->size = (off_t)size;
+		record->mtime = (time_t)mtime;
+		if (dp) {
+			record->digest_size = CC_SHA1_DIGEST_LENGTH;
+			memcpy(record->digest, dp, CC_SHA1_DIGEST_LENGTH);
+		}
+	}
+	this->m_files_table->free_result(data);
+	return record;
+}
+
+struct RecordContext {
+	DarwinupDatabase* db;
+	FilePool* pool;
+};
+
+static int add_record(uint8_t* row, void* context) {
+	RecordContext* records = (RecordContext*)context;
+	return records->db->make_record(records->pool, row) ? 0 : -1;
+}
+
 int DarwinupDatabase::get_next_file(uint8_t** data, File* file, file_starseded_t star) {
 	int res = SQLITE_OK;
 	
 	char comp = '<';
 	const char* name = "file_preceded";
-	int order = ORDER_BY_DESC;
+	const char* query = "SELECT " FILE_COLUMNS " FROM " FILES_JOIN " "
+						"WHERE directories.path = ? AND files.name = ? "
+						"AND files.archive < ? "
+						"ORDER BY files.archive DESC LIMIT 1;";
 	if (star == FILE_SUPERSEDED) {
 		comp = '>';
 		name = "file_superseded";
-		order = ORDER_BY_ASC;
+		query = "SELECT " FILE_COLUMNS " FROM " FILES_JOIN " "
+				"WHERE directories.path = ? AND files.name = ? "
+				"AND files.archive > ? "
+				"ORDER BY files.archive ASC LIMIT 1;";
 	}
-	res = this->get_row_ordered(name,
-								data,
-								this->m_files_table,
-								this->m_files_table->column(1), // order by archive
-								order,
-								2,
-								this->m_files_table->column(1), // archive
-								comp, file->archive()->serial(),
-								this->m_files_table->column(8), // path
-								'=', file->path());
+	const char* filename;
+	char* dir = split_path(file->path(), &filename);
+	res = this->get_row_sql(name,
+							data,
+							this->m_files_table,
+							query,
+							3,
+							this->m_directories_table->column(1), // path
+							'=', dir,
+							this->m_files_table->column(8), // name
+							'=', filename,
+							this->m_files_table->column(1), // archive
+							comp, file->archive()->serial());
+	free(dir);
 	
 	if (res == SQLITE_ROW) return (DB_FOUND | DB_OK);
 	if (res == SQLITE_DONE) return DB_OK;
@@ -220,37 +400,78 @@ int DarwinupDatabase::get_next_file(uint8_t** data, File* file, file_starseded_t
 }
 
 int DarwinupDatabase::get_file_serial_from_archive(Archive* archive, const char* path, uint64_t** serial) {
-	int res = this->get_value("file_serial__archive_path",
-							  (void**)serial,
-							  this->m_files_table,
-							  this->m_files_table->column(0), // serial
-							  2,                              // number of where conditions
-							  this->m_files_table->column(1), // archive
-							  '=', (uint64_t)archive->serial(),
-							  this->m_files_table->column(8), // path
-							  '=', path);
+	uint8_t* data;
+	const char* filename;
+	char* dir = split_path(path, &filename);
+	int res = this->get_row_sql("file_serial__archive_path",
+								&data,
+								this->m_files_table,
+								"SELECT " FILE_COLUMNS " FROM " FILES_JOIN " "
+								"WHERE directories.path = ? AND files.name = ? "
+								"AND files.archive = ?;",
+								3,
+								this->m_directories_table->column(1), // path
+								'=', dir,
+								this->m_files_table->column(8), // name
+								'=', filename,
+								this->m_files_table->column(1), // archive
+								'=', (uint64_t)archive->serial());
+	free(dir);
+	*serial = (uint64_t*)calloc(1, sizeof(uint64_t));
+	if (res == SQLITE_ROW && *serial) {
+		memcpy(*serial, &data[this->file_offset(0)], sizeof(uint64_t));
+	}
+	this->free_file(data);
 	
 	if (res == SQLITE_ROW) return (DB_FOUND | DB_OK);
 	if (res == SQLITE_DONE) return DB_OK;
 	return DB_ERROR;
 }
 
+uint64_t DarwinupDatabase::directory_serial(const char* path) {
+	uint64_t* serial = NULL;
+	int res = this->get_value("directory_serial__path",
+							  (void**)&serial,
+							  this->m_directories_table,
+							  this->m_directories_table->column(0), // serial
+							  1,
+							  this->m_directories_table->column(1), // path
+							  '=', path);
+	uint64_t result = (res == SQLITE_ROW) ? *serial : 0;
+	free(serial);
+	if (res == SQLITE_ROW) return result;
+	if (res == SQLITE_DONE) res = this->insert(this->m_directories_table, path);
+	if (res != SQLITE_OK) {
+		fprintf(stderr, "Error: unable to insert directory %s: %s \n",
+				path, this->error());
+		return 0;
+	}
+	return this->last_insert_id();
+}
+
 int DarwinupDatabase::update_file(uint64_t serial, Archive* archive, uint64_t info, mode_t mode, 
-								   uid_t uid, gid_t gid, Digest* digest, const char* path) {
+								   uid_t uid, gid_t gid, off_t size, time_t mtime, 
+								   Digest* digest, const char* path) {
 
-	int res = SQLITE_OK;
+	const char* filename;
+	char* dir = split_path(path, &filename);
+	uint64_t dir_serial = this->directory_serial(dir);
+	free(dir);
+	if (!dir_serial) return SQLITE_ERROR;
 								  
 	// update the information
-	res = this->update(this->m_files_table, serial,
+	int res = this->update(this->m_files_table, serial,
 					   (uint64_t)archive->serial(),
 					   (uint64_t)info,
 					   (uint64_t)mode,
 					   (uint64_t)uid,
 					   (uint64_t)gid,
-					   (uint64_t)0, 
+					   (uint64_t)size, 
 					   (uint8_t*)(digest ? digest->data() : NULL), 
 					   (uint32_t)(digest ? digest->size() : 0), 
-					   path);
+					   filename,
+					   (uint64_t)mtime,
+					   dir_serial);
 
 	if (res != SQLITE_OK) {
 		fprintf(stderr, "Error: unable to update file with serial %llu and path %s: %s \n",
@@ -261,7 +482,13 @@ int DarwinupDatabase::update_file(uint64_t serial, Archive* archive, uint64_t in
 }
 										  
 uint64_t DarwinupDatabase::insert_file(uint64_t info, mode_t mode, uid_t uid, gid_t gid, 
-									   Digest* digest, Archive* archive, const char* path) {
+									   off_t size, time_t mtime, Digest* digest, 
+									   Archive* archive, const char* path) {
+	const char* filename;
+	char* dir = split_path(path, &filename);
+	uint64_t dir_serial = this->directory_serial(dir);
+	free(dir);
+	if (!dir_serial) return 0;
 	
 	int res = this->insert(this->m_files_table,
 							(uint64_t)archive->serial(),
@@ -269,10 +496,12 @@ uint64_t DarwinupDatabase::insert_file(uint64_t info, mode_t mode, uid_t uid, gi
 							(uint64_t)mode,
 							(uint64_t)uid,
 							(uint64_t)gid,
-							(uint64_t)0, 
+							(uint64_t)size, 
 							(uint8_t*)(digest ? digest->data() : NULL), 
 							(uint32_t)(digest ? digest->size() : 0), 
-							path);
+							filename,
+							(uint64_t)mtime,
+							dir_serial);
 	if (res != SQLITE_OK) {
 		fprintf(stderr, "Error: unable to insert file at %s: %s \n",
 				path, this->error());
@@ -283,21 +512,75 @@ uint64_t DarwinupDatabase::insert_file(uint64_t info, mode_t mode, uid_t uid, gi
 }
 
 uint64_t DarwinupDatabase::count_files(Archive* archive, const char* path) {
+	// an archive has at most one record of a path
+	uint64_t* serial = NULL;
+	int res = this->get_file_serial_from_archive(archive, path, &serial);
+	free(serial);
+	if (res == DB_ERROR) {
+		fprintf(stderr, "Error: unable to count files: %d \n", res);
+		return 0;
+	}
+	return FOUND(res) ? 1 : 0;
+}
+
+uint64_t DarwinupDatabase::count_archive_files(Archive* archive, uint64_t info) {
 	int res = SQLITE_OK;
 	uint64_t* c;
-	res = this->count("count_files",
-					  (void**)&c,
-					  this->m_files_table,
-					  2,                              // number of where conditions
-					  this->m_files_table->column(1), // archive
-					  '=', (uint64_t)archive->serial(),
-					  this->m_files_table->column(8), // path
-					  '=', path);	
+	if (info == FILE_INFO_NONE) {
+		res = this->count("count_archive_files",
+						  (void**)&c,
+						  this->m_files_table,
+						  1,
+						  this->m_files_table->column(1), // archive
+						  '=', (uint64_t)archive->serial());
+	} else {
+		res = this->count("count_archive_files_info",
+						  (void**)&c,
+						  this->m_files_table,
+						  2,
+						  this->m_files_table->column(1), // archive
+						  '=', (uint64_t)archive->serial(),
+						  this->m_files_table->column(2), // info
+						  '&', info);
+	}
+	uint64_t result = *c;
+	free(c);
 	if (res != SQLITE_ROW) {
 		fprintf(stderr, "Error: unable to count files: %d \n", res);
 		return 0;
 	}
-	return *c;
+	return result;
+}
+
+uint64_t DarwinupDatabase::size_archive_files(Archive* archive, uint64_t info) {
+	int res = SQLITE_OK;
+	uint64_t* size;
+	if (info == FILE_INFO_NONE) {
+		res = this->sum("size_archive_files",
+						(void**)&size,
+						this->m_files_table,
+						this->m_files_table->column(6), // size
+						1,
+						this->m_files_table->column(1), // archive
+						'=', (uint64_t)archive->serial());
+	} else {
+		res = this->sum("size_archive_files_info",
+						(void**)&size,
+						this->m_files_table,
+						this->m_files_table->column(6), // size
+						2,
+						this->m_files_table->column(1), // archive
+						'=', (uint64_t)archive->serial(),
+						this->m_files_table->column(2), // info
+						'&', info);
+	}
+	uint64_t result = *size;
+	free(size);
+	if (res != SQLITE_ROW) {
+		fprintf(stderr, "Error: unable to sum file sizes: %d \n", res);
+		return 0;
+	}
+	return result;
 }
 
 uint64_t DarwinupDatabase::count_archives(bool include_rollbacks) {
@@ -323,13 +606,12 @@ uint64_t DarwinupDatabase::count_archives(bool include_rollbacks) {
 }
 
 int DarwinupDatabase::delete_archive(Archive* archive) {
-	int res = this->del(this->m_archives_table, archive->serial());
-	if (res != SQLITE_OK) return DB_ERROR;
-	return DB_OK;
+	return this->delete_archive(archive->serial());
 }
 
 int DarwinupDatabase::delete_archive(uint64_t serial) {
 	int res = this->del(this->m_archives_table, serial);
+	if (res == SQLITE_OK) res = this->delete_orphaned_archive_summaries();
 	if (res != SQLITE_OK) return DB_ERROR;
 	return DB_OK;
 }
@@ -341,10 +623,165 @@ int DarwinupDatabase::delete_empty_archives() {
 						" (SELECT serial FROM archives "
 						"  WHERE serial NOT IN "
 						"   (SELECT DISTINCT archive FROM files));");	
+	if (res == SQLITE_OK) res = this->delete_orphaned_archive_summaries();
+	if (res != SQLITE_OK) return DB_ERROR;
+	return DB_OK;
+}
+
+int DarwinupDatabase::delete_orphaned_directories() {
+	return this->sql("delete_orphaned_directories",
+					 "DELETE FROM directories WHERE NOT EXISTS "
+					 " (SELECT 1 FROM files WHERE files.dir = directories.serial);");
+}
+
+int DarwinupDatabase::delete_unreachable_rollback_files() {
+	const char* unreachable = 
+		"archive IN "
+		" (SELECT serial FROM archives rollback "
+		"  WHERE name = '<Rollback>' AND NOT EXISTS "
+		"   (SELECT 1 FROM archives "
+		"    WHERE serial = rollback.serial + 1 "
+		"    AND name != '<Rollback>')) "
+		"AND NOT EXISTS "
+		" (SELECT 1 FROM files newer "
+		"  JOIN archives ON newer.archive = archives.serial "
+		"  WHERE newer.dir = files.dir AND newer.name = files.name "
+		"  AND newer.archive > files.archive "
+		"  AND archives.name != '<Rollback>')";
+	// older records of those paths may become current
+	int res = this->sql_once("CREATE TEMP TABLE IF NOT EXISTS stale_summaries "
+							 "(archive INTEGER PRIMARY KEY);");
+	if (res == SQLITE_OK) res = this->sql_once("INSERT OR IGNORE INTO stale_summaries "
+											   "SELECT DISTINCT archive FROM files other "
+											   "WHERE EXISTS "
+											   " (SELECT 1 FROM files WHERE files.dir = other.dir "
+											   "  AND files.name = other.name AND %s);",
+											   unreachable);
+	if (res == SQLITE_OK) res = this->sql_once("DELETE FROM files WHERE %s;", unreachable);
+	if (res == SQLITE_OK) res = this->delete_orphaned_directories();
+	if (res == SQLITE_OK) res = this->update_archive_summaries();
+	if (res != SQLITE_OK) return DB_ERROR;
+	return DB_OK;
+}
+
+int DarwinupDatabase::stale_archive_summaries(Archive* archive) {
+	uint64_t serial = archive->serial();
+	int res = this->sql_once("CREATE TEMP TABLE IF NOT EXISTS stale_summaries "
+							 "(archive INTEGER PRIMARY KEY);");
+	// the archive, its rollback, and every archive sharing a path with it
+	if (res == SQLITE_OK) res = this->sql_once("INSERT OR IGNORE INTO stale_summaries "
+											   "SELECT %llu UNION SELECT %llu "
+											   "UNION SELECT DISTINCT other.archive "
+											   " FROM files other JOIN files mine "
+											   " ON other.dir = mine.dir AND other.name = mine.name "
+											   " WHERE mine.archive = %llu;",
+											   serial, serial - 1, serial);
 	if (res != SQLITE_OK) return DB_ERROR;
 	return DB_OK;
 }
 
+int DarwinupDatabase::update_archive_summaries() {
+	// rollback_bytes is what an archive's rollback saved from the disk.
+	//  Files are current until a newer record of their path exists, the 
+	//  same test get_next_file does for FILE_SUPERSEDED. A new summary
+	//  has not been verified, since the disk changed underneath it.
+	int res = this->sql_once("CREATE TEMP TABLE IF NOT EXISTS stale_summaries "
+							 "(archive INTEGER PRIMARY KEY);");
+	if (res == SQLITE_OK) res = this->sql_once(
+		"INSERT OR REPLACE INTO archive_summary "
+		"SELECT a.serial, "
+		" (SELECT COUNT(*) FROM files WHERE archive = a.serial), "
+		" (SELECT IFNULL(SUM(size), 0) FROM files WHERE archive = a.serial), "
+		" (SELECT IFNULL(SUM(size), 0) FROM files "
+		"  WHERE (info & %u) != 0 AND archive = "
+		"   (SELECT serial FROM archives rollback "
+		"    WHERE rollback.serial = a.serial - 1 "
+		"    AND rollback.name = '<Rollback>' AND a.name != '<Rollback>')), "
+		" (SELECT COUNT(*) FROM files mine WHERE mine.archive = a.serial "
+		"  AND NOT EXISTS (SELECT 1 FROM files newer "
+		"   WHERE newer.dir = mine.dir AND newer.name = mine.name "
+		"   AND newer.archive > mine.archive)), "
+		" 0, 0 "
+		"FROM archives a "
+		"WHERE a.serial IN (SELECT archive FROM stale_summaries);",
+		FILE_INFO_ROLLBACK_DATA);
+	if (res == SQLITE_OK) res = this->sql_once("DELETE FROM stale_summaries;");
+	if (res == SQLITE_OK) res = this->delete_orphaned_archive_summaries();
+	if (res != SQLITE_OK) return DB_ERROR;
+	return DB_OK;
+}
+
+int DarwinupDatabase::delete_orphaned_archive_summaries() {
+	return this->sql("delete_orphaned_archive_summaries",
+					 "DELETE FROM archive_summary "
+					 "WHERE archive NOT IN (SELECT serial FROM archives);");
+}
+
+int DarwinupDatabase::get_archive_summary(Archive* archive, uint64_t* files, 
+										  uint64_t* bytes, uint64_t* rollback_bytes) {
+	uint8_t* data;
+	*files = 0;
+	*bytes = 0;
+	*rollback_bytes = 0;
+	int res = this->get_row("archive_summary",
+							&data,
+							this->m_summary_table,
+							1,
+							this->m_summary_table->column(0), // archive
+							'=', archive->serial());
+	if (res == SQLITE_ROW) {
+		memcpy(files, &data[this->m_summary_table->offset(1)], sizeof(uint64_t));
+		memcpy(bytes, &data[this->m_summary_table->offset(2)], sizeof(uint64_t));
+		memcpy(rollback_bytes, &data[this->m_summary_table->offset(3)], sizeof(uint64_t));
+	}
+	this->m_summary_table->free_result(data);
+	if (res == SQLITE_ROW) return (DB_FOUND | DB_OK);
+	if (res == SQLITE_DONE) return DB_OK;
+	return DB_ERROR;
+}
+
+int DarwinupDatabase::set_archive_verified(Archive* archive, uint64_t unchanged, 
+										   time_t date) {
+	int res = this->sql_once("UPDATE archive_summary "
+							 "SET unchanged_files = %llu, verified = %lld "
+							 "WHERE archive = %llu;",
+							 unchanged, (long long)date, archive->serial());
+	if (res != SQLITE_OK) return DB_ERROR;
+	return DB_OK;
+}
+
+int DarwinupDatabase::get_superseded_archives(uint8_t*** data, uint32_t* count,
+												bool replaced_only) {
+	int res;
+	if (replaced_only) {
+		res = this->get_all_sql("replaced_archives",
+								data, count,
+								this->m_archives_table,
+								"SELECT archives.* FROM archives "
+								"JOIN archive_summary "
+								"ON archive_summary.archive = archives.serial "
+								"WHERE name != '<Rollback>' "
+								"AND current_files = 0 "
+								"ORDER BY serial DESC;",
+								0);
+	} else {
+		res = this->get_all_sql("superseded_archives",
+								data, count,
+								this->m_archives_table,
+								"SELECT archives.* FROM archives "
+								"JOIN archive_summary "
+								"ON archive_summary.archive = archives.serial "
+								"WHERE name != '<Rollback>' "
+								"AND (current_files = 0 "
+								"     OR (verified != 0 AND unchanged_files = 0)) "
+								"ORDER BY serial DESC;",
+								0);
+	}
+	if ((res == SQLITE_DONE) && *count) return (DB_OK | DB_FOUND);
+	if (res == SQLITE_DONE) return DB_OK;
+	return DB_ERROR;
+}
+
 int DarwinupDatabase::free_archive(uint8_t* data) {
 	return this->m_archives_table->free_result(data);
 }
@@ -367,6 +804,7 @@ int DarwinupDatabase::delete_files(Archive* archive) {
 						1,                               // number of where conditions
 						this->m_files_table->column(1),  // archive
 						'=', (uint64_t)archive->serial());
+	if (res == SQLITE_OK) res = this->delete_orphaned_directories();
 	if (res != SQLITE_OK) return DB_ERROR;
 	return DB_OK;
 }
@@ -388,22 +826,115 @@ int DarwinupDatabase::get_inactive_archive_serials(uint64_t** serials, uint32_t*
 	return DB_ERROR;
 }
 
-int DarwinupDatabase::get_files(uint8_t*** data, uint32_t* count, Archive* archive, bool reverse) {
-	int order = ORDER_BY_ASC;
+int DarwinupDatabase::get_empty_archives(uint8_t*** data, uint32_t* count) {
+	int res = this->get_all_sql("empty_archives",
+								data, count,
+								this->m_archives_table,
+								"SELECT * FROM archives "
+								"WHERE serial NOT IN "
+								" (SELECT DISTINCT archive FROM files) "
+								"ORDER BY serial;",
+								0);
+	if ((res == SQLITE_DONE) && *count) return (DB_OK | DB_FOUND);
+	if (res == SQLITE_DONE) return DB_OK;
+	return DB_ERROR;
+}
+
+int DarwinupDatabase::get_files(FilePool* pool, Archive* archive, bool reverse) {
 	const char* name = "files_archive";
+	const char* query = "SELECT " FILE_COLUMNS " FROM " FILES_JOIN " "
+						"WHERE files.archive = ? "
+						"ORDER BY directories.path || files.name ASC;";
 	if (reverse) {
-		order = ORDER_BY_DESC;
 		name = "files_archive_reverse";
+		query = "SELECT " FILE_COLUMNS " FROM " FILES_JOIN " "
+				"WHERE files.archive = ? "
+				"ORDER BY directories.path || files.name DESC;";
 	}
-	int res = this->get_all_ordered(name,
-									data, count,
-									this->m_files_table,
-									this->m_files_table->column(8), // order by path
-									order,
-									1,
-									this->m_files_table->column(1),
-									'=', archive->serial());
+	uint32_t count = pool->count();
+	RecordContext records = { this, pool };
+	int res = this->each_sql(name,
+								&add_record, &records,
+								this->m_files_table,
+								query,
+								1,
+								this->m_files_table->column(1), // archive
+								'=', archive->serial());
 	
+	if ((res == SQLITE_DONE) && pool->count() > count) return (DB_OK | DB_FOUND);
+	if (res == SQLITE_DONE) return DB_OK;
+	return DB_ERROR;
+}
+
+int DarwinupDatabase::get_current_files(FilePool* pool) {
+	uint32_t count = pool->count();
+	RecordContext records = { this, pool };
+	int res = this->each_sql("current_files",
+								&add_record, &records,
+								this->m_files_table,
+								"SELECT " FILE_COLUMNS " FROM " FILES_JOIN " "
+								"JOIN (SELECT dir, name, MAX(archive) AS owner "
+								"      FROM files WHERE archive IN "
+								"       (SELECT serial FROM archives "
+								"        WHERE archives.name != '<Rollback>') "
+								"      GROUP BY dir, name) current "
+								"ON files.dir = current.dir "
+								"AND files.name = current.name "
+								"AND files.archive = current.owner "
+								"ORDER BY directories.path || files.name;",
+								0);
+	if ((res == SQLITE_DONE) && pool->count() > count) return (DB_OK | DB_FOUND);
+	if (res == SQLITE_DONE) return DB_OK;
+	return DB_ERROR;
+}
+
+int DarwinupDatabase::get_installed_files(FilePool* pool) {
+	uint32_t count = pool->count();
+	RecordContext records = { this, pool };
+	int res = this->each_sql("installed_files",
+								&add_record, &records,
+								this->m_files_table,
+								"SELECT " FILE_COLUMNS " FROM " FILES_JOIN " "
+								"WHERE files.archive IN "
+								" (SELECT serial FROM archives "
+								"  WHERE archives.name != '<Rollback>') "
+								"ORDER BY directories.path || files.name, "
+								"files.archive DESC;",
+								0);
+	if ((res == SQLITE_DONE) && pool->count() > count) return (DB_OK | DB_FOUND);
+	if (res == SQLITE_DONE) return DB_OK;
+	return DB_ERROR;
+}
+
+int DarwinupDatabase::get_undo_files(FilePool* pool, uint64_t archive) {
+	uint32_t count = pool->count();
+	RecordContext records = { this, pool };
+	int res = this->each_sql("undo_files",
+								&add_record, &records,
+								this->m_files_table,
+								"SELECT " FILE_COLUMNS " FROM " FILES_JOIN " "
+								"WHERE files.archive > ? AND files.archive IN "
+								" (SELECT serial FROM archives "
+								"  WHERE archives.name != '<Rollback>') "
+								"ORDER BY directories.path || files.name DESC, "
+								"files.archive ASC;",
+								1,
+								this->m_files_table->column(1), // archive
+								'>', archive);
+	if ((res == SQLITE_DONE) && pool->count() > count) return (DB_OK | DB_FOUND);
+	if (res == SQLITE_DONE) return DB_OK;
+	return DB_ERROR;
+}
+
+int DarwinupDatabase::get_dangling_files(uint8_t*** data, uint32_t* count) {
+	int res = this->get_all_sql("dangling_files",
+								data, count,
+								this->m_files_table,
+								"SELECT " FILE_COLUMNS " FROM " FILES_JOIN " "
+								"WHERE files.archive NOT IN "
+								" (SELECT serial FROM archives) "
+								"ORDER BY directories.path || files.name;",
+								0);
 	if ((res == SQLITE_DONE) && *count) return (DB_OK | DB_FOUND);
 	if (res == SQLITE_DONE) return DB_OK;
 	return DB_ERROR;
@@ -526,21 +1057,162 @@ int DarwinupDatabase::file_offset(int column) {
 	return this->m_files_table->offset(column);
 }
 
-Archive* DarwinupDatabase::get_last_archive(uint64_t serial) {
-	if (this->last_archive && this->last_archive->serial() == serial) {
-		return this->last_archive;
+int DarwinupDatabase::get_fsck_checkpoint(uint64_t* serial, time_t* date) {
+	char** value = NULL;
+	*serial = 0;
+	*date = 0;
+	int res = this->get_information_value("fsck_serial", &value);
+	if (res == SQLITE_ROW) {
+		*serial = strtoull(*value, NULL, 10);
+		free(*value);
+		res = this->get_information_value("fsck_date", &value);
+	}
+	if (res == SQLITE_ROW) {
+		*date = (time_t)strtoll(*value, NULL, 10);
+		free(*value);
+		return (DB_OK | DB_FOUND);
 	}
-	return NULL;
+	// no checkpoint yet, everything needs checking
+	*serial = 0;
+	if (res == SQLITE_DONE) return DB_OK;
+	return DB_ERROR;
 }
 
-int DarwinupDatabase::clear_last_archive() {
-	delete this->last_archive;
-	this->last_archive = NULL;
-	return 0;
+int DarwinupDatabase::set_fsck_checkpoint(uint64_t serial, time_t date) {
+	int res = DB_OK;
+	char* value;
+	asprintf(&value, "%llu", serial);
+	if (!value) return DB_ERROR;
+	res = this->update_information_value("fsck_serial", value);
+	free(value);
+	asprintf(&value, "%lld", (long long)date);
+	if (!value) return DB_ERROR;
+	if (res == SQLITE_OK) res = this->update_information_value("fsck_date", value);
+	free(value);
+	if (res != SQLITE_OK) return DB_ERROR;
+	return DB_OK;
+}
+
+int DarwinupDatabase::get_archives_after(uint8_t*** data, uint32_t* count, uint64_t serial) {
+	int res = this->get_all_ordered("archives_after",
+									data, count,
+									this->m_archives_table,
+									this->m_archives_table->column(0), // order by serial
+									ORDER_BY_DESC,
+									1,
+									this->m_archives_table->column(0), // serial
+									'>', serial);
+	if ((res == SQLITE_DONE) && *count) return (DB_OK | DB_FOUND);
+	if (res == SQLITE_DONE) return DB_OK;
+	return DB_ERROR;	
+}
+
+int DarwinupDatabase::insert_checkpoint(const char* name, uint64_t archive, time_t date) {
+	// a name given again moves the checkpoint
+	int res = this->del("checkpoint__name_delete",
+						this->m_checkpoints_table,
+						1,
+						this->m_checkpoints_table->column(1), // name
+						'=', name);
+	if (res == SQLITE_OK) res = this->insert(this->m_checkpoints_table,
+											 name,
+											 (uint64_t)archive,
+											 (uint64_t)date);
+	if (res != SQLITE_OK) {
+		fprintf(stderr, "Error: unable to insert checkpoint %s: %s \n",
+				name, this->error());
+		return DB_ERROR;
+	}
+	return DB_OK;
+}
+
+int DarwinupDatabase::delete_checkpoints_after(uint64_t archive) {
+	int res = this->del("checkpoints_after_delete",
+						this->m_checkpoints_table,
+						1,
+						this->m_checkpoints_table->column(2), // archive
+						'>', archive);
+	if (res != SQLITE_OK) return DB_ERROR;
+	return DB_OK;
+}
+
+int DarwinupDatabase::get_checkpoint(uint8_t** data, const char* name) {
+	int res;
+	if (name) {
+		res = this->get_row("checkpoint__name",
+							data,
+							this->m_checkpoints_table,
+							1,
+							this->m_checkpoints_table->column(1), // name
+							'=', name);
+	} else {
+		res = this->get_row_ordered("checkpoint_newest",
+									data,
+									this->m_checkpoints_table,
+									this->m_checkpoints_table->column(0), // order by serial
+									ORDER_BY_DESC,
+									0);
+	}
+	if (res == SQLITE_ROW) return (DB_FOUND | DB_OK);
+	if (res == SQLITE_DONE) return DB_OK;
+	return DB_ERROR;	
+}
+
+int DarwinupDatabase::get_checkpoints(uint8_t*** data, uint32_t* count) {
+	int res = this->get_all_ordered("checkpoints",
+									data, count,
+									this->m_checkpoints_table,
+									this->m_checkpoints_table->column(0), // order by serial
+									ORDER_BY_DESC,
+									0);
+	if ((res == SQLITE_DONE) && *count) return (DB_OK | DB_FOUND);
+	if (res == SQLITE_DONE) return DB_OK;
+	return DB_ERROR;	
+}
+
+int DarwinupDatabase::checkpoint_offset(int column) {
+	return this->m_checkpoints_table->offset(column);
 }
 
-int DarwinupDatabase::set_last_archive(uint8_t* data) {
-	this->last_archive = this->make_archive(data);
-	if (this->last_archive) return 0;
-	return 1;
+int DarwinupDatabase::free_checkpoint(uint8_t* data) {
+	return this->m_checkpoints_table->free_result(data);
+}
+
+Archive* DarwinupDatabase::archive(uint64_t serial) {
+	uint32_t slot = 0;
+	for (uint32_t i = 0; i < ARCHIVE_CACHE_SIZE; i++) {
+		Archive* cached = this->m_archive_cache[i];
+		if (cached && cached->serial() == serial) {
+			this->m_archive_cache_used[i] = ++this->m_archive_cache_clock;
+			return cached->retain();
+		}
+		// reuse an empty slot, or else the least recently used
+		if (this->m_archive_cache[slot] && 
+			(!cached || this->m_archive_cache_used[i] < this->m_archive_cache_used[slot])) {
+			slot = i;
+		}
+	}
+
+	uint8_t* data;
+	int res = this->get_archive(&data, serial);
+	if (!FOUND(res)) {
+		this->free_archive(data);
+		return NULL;
+	}
+	Archive* archive = this->make_archive(data);
+	if (!archive) return NULL;
+
+	// files made from other cached archives keep those alive
+	if (this->m_archive_cache[slot]) this->m_archive_cache[slot]->release();
+	this->m_archive_cache[slot] = archive;
+	this->m_archive_cache_used[slot] = ++this->m_archive_cache_clock;
+	return archive->retain();
+}
+
+int DarwinupDatabase::clear_archive_cache() {
+	for (uint32_t i = 0; i < ARCHIVE_CACHE_SIZE; i++) {
+		if (this->m_archive_cache[i]) this->m_archive_cache[i]->release();
+		this->m_archive_cache[i] = NULL;
+	}
+	return 0;
 }
@@ -44,6 +44,8 @@
 #include "Digest.h"
 #include "File.h"
 
+// number of archives DarwinupDatabase keeps made
+const uint32_t ARCHIVE_CACHE_SIZE = 64;
 
 /**
  *
@@ -59,6 +61,10 @@ struct DarwinupDatabase : Database {
 	int init_schema();
 	
 	uint64_t count_files(Archive* archive, const char* path);
+	// number and total size of the archive's records with any of the info
+	//  bits set, or of all its records if info is FILE_INFO_NONE
+	uint64_t count_archive_files(Archive* archive, uint64_t info);
+	uint64_t size_archive_files(Archive* archive, uint64_t info);
 	uint64_t count_archives(bool include_rollbacks);
 	
 	// Archives
@@ -69,6 +75,10 @@ struct DarwinupDatabase : Database {
 	int      get_archive(uint8_t** data, const char* name);
 	int      get_archive(uint8_t** data, archive_keyword_t keyword);
 	int      get_inactive_archive_serials(uint64_t** serials, uint32_t* count);
+	int      get_empty_archives(uint8_t*** data, uint32_t* count);
+	// every archive, rollbacks included, with a serial after serial,
+	//  newest first
+	int      get_archives_after(uint8_t*** data, uint32_t* count, uint64_t serial);
 	int      archive_offset(int column);
 	int      activate_archive(uint64_t serial);
 	int      deactivate_archive(uint64_t serial);
@@ -78,42 +88,104 @@ struct DarwinupDatabase : Database {
 	uint64_t insert_archive(uuid_t uuid, uint64_t info, const char* name, 
 							time_t date, const char* build);
 	int      delete_empty_archives();
+	// deletes rollback records that no uninstall can restore anymore, those
+	//  of rollbacks whose archive is gone for paths no newer archive has
+	int      delete_unreachable_rollback_files();
 	int      delete_archive(Archive* archive);
 	int      delete_archive(uint64_t serial);
 	int      free_archive(uint8_t* data);
 
 	// Files
 	File*    make_file(uint8_t* data);
+	// adds the file in data to pool and frees data
+	FileRecord* make_record(FilePool* pool, uint8_t* data);
 	int      get_next_file(uint8_t** data, File* file, file_starseded_t star);
 	int      get_file_serials(uint64_t** serials, uint32_t* count);
 	int      get_file_serial_from_archive(Archive* archive, const char* path, 
 										  uint64_t** serial);
-	int      get_files(uint8_t*** data, uint32_t* count, Archive* archive, bool reverse);
+	// the file lists below add their records to pool, in order
+	int      get_files(FilePool* pool, Archive* archive, bool reverse);
+	// the newest installed record of every path, ordered by path
+	int      get_current_files(FilePool* pool);
+	// every record of the installed archives, ordered by path and then
+	//  newest archive first
+	int      get_installed_files(FilePool* pool);
+	// the records of installed archives after archive, ordered by path
+	//  descending and then oldest archive first, as undo visits them
+	int      get_undo_files(FilePool* pool, uint64_t archive);
+	// records whose archive no longer exists
+	int      get_dangling_files(uint8_t*** data, uint32_t* count);
 	int      file_offset(int column);
 	int      update_file(uint64_t serial, Archive* archive, uint64_t info, mode_t mode,
-						 uid_t uid, gid_t gid, Digest* digest, const char* path);
+						 uid_t uid, gid_t gid, off_t size, time_t mtime, 
+						 Digest* digest, const char* path);
 	uint64_t insert_file(uint64_t info, mode_t mode, uid_t uid, gid_t gid,
-						 Digest* digest, Archive* archive, const char* path);
+						 off_t size, time_t mtime, Digest* digest, 
+						 Archive* archive, const char* path);
 	int      delete_file(uint64_t serial);
 	int      delete_file(File* file);
 	int      delete_files(Archive* archive);
 	int      free_file(uint8_t* data);
 	
+	// Archive summaries
+	//  one row per archive with its file count and sizes, how many of its
+	//  files no newer record replaces, and how many matched the disk at its
+	//  last verify. Mark the archives a change will touch stale before
+	//  making it, then update them in the same transaction.
+	int      stale_archive_summaries(Archive* archive);
+	int      update_archive_summaries();
+	int      get_archive_summary(Archive* archive, uint64_t* files, 
+								 uint64_t* bytes, uint64_t* rollback_bytes);
+	int      set_archive_verified(Archive* archive, uint64_t unchanged, time_t date);
+	// archives superseded by newer archives, or whose files all differed
+	//  from the disk when last verified, newest first. replaced_only leaves
+	//  out the latter, whose files may still be on disk.
+	int      get_superseded_archives(uint8_t*** data, uint32_t* count,
+									 bool replaced_only);
+
+	// the newest archive serial and start time of the last clean fsck
+	int      get_fsck_checkpoint(uint64_t* serial, time_t* date);
+	int      set_fsck_checkpoint(uint64_t serial, time_t date);
+
+	// Checkpoints
+	//  a name for the depot as it was when archive was its newest
+	//  archive. get_checkpoint() finds the newest one for a NULL name.
+	int      insert_checkpoint(const char* name, uint64_t archive, time_t date);
+	int      delete_checkpoints_after(uint64_t archive);
+	int      get_checkpoint(uint8_t** data, const char* name);
+	int      get_checkpoints(uint8_t*** data, uint32_t* count);
+	int      checkpoint_offset(int column);
+	int      free_checkpoint(uint8_t* data);
+
 	// memoization
-	Archive* get_last_archive(uint64_t serial);
-	int      clear_last_archive();
-	int      set_last_archive(uint8_t* data);
+	//  a bounded cache of archives by serial, shared with the File
+	//  objects made from records. archive() returns a reference the
+	//  caller must release, or NULL if there is no such archive.
+	Archive* archive(uint64_t serial);
+	int      clear_archive_cache();
 	
 
 protected:
 	
 	int      set_archive_active(uint64_t serial, uint64_t* active);
+	int      delete_orphaned_archive_summaries();
+	// serial of the directory record for path, which ends in a slash,
+	//  adding it if needed. 0 on error.
+	uint64_t directory_serial(const char* path);
+	int      delete_orphaned_directories();
+	virtual int pre_upgrade(uint32_t version);
+	virtual int post_upgrade(uint32_t version);
 	
 	Table*        m_archives_table;
 	Table*        m_files_table;
+	Table*        m_summary_table;
+	Table*        m_directories_table;
+	Table*        m_checkpoints_table;
 	
-	// memoize some get_archive calls
-	Archive*      last_archive;
+	// memoize some get_archive calls, least recently used goes first
+	Archive*      m_archive_cache[ARCHIVE_CACHE_SIZE];
+	uint64_t      m_archive_cache_used[ARCHIVE_CACHE_SIZE];
+	uint64_t      m_archive_cache_clock;
 	
 };
 
@@ -31,6 +31,7 @@
  */
 
 #include "Database.h"
+#include "Probes.h"
 
 /**
  * sqlite3_trace callback for debugging
@@ -45,6 +46,7 @@ Database::Database() {
 	m_table_count = 0;
 	m_tables = (Table**)malloc(sizeof(Table*) * m_table_max);
 	this->init_cache();
+	m_data_version = NULL;
 	m_db = NULL;	
 	m_path = NULL;
 	m_error_size = ERROR_BUF_SIZE;
@@ -57,6 +59,7 @@ Database::Database(const char* path) {
 	m_table_count = 0;
 	m_tables = (Table**)malloc(sizeof(Table*) * m_table_max);
 	this->init_cache();
+	m_data_version = NULL;
 	m_db = NULL;		
 	m_path = strdup(path);
 	if (!m_path) {
@@ -76,6 +79,7 @@ Database::~Database() {
 	sqlite3_finalize(m_begin_transaction);
 	sqlite3_finalize(m_rollback_transaction);
 	sqlite3_finalize(m_commit_transaction);
+	sqlite3_finalize(m_data_version);
 
 	free(m_tables);
 	free(m_path);
@@ -100,6 +104,16 @@ int Database::post_table_creation() {
 	return DB_OK;
 }
 
+int Database::pre_upgrade(uint32_t version) {
+	// clients can implement this
+	return DB_OK;
+}
+
+int Database::post_upgrade(uint32_t version) {
+	// clients can implement this
+	return DB_OK;
+}
+
 const char* Database::path() {
 	return m_path;
 }
@@ -125,7 +139,8 @@ int Database::connect() {
 	// test our access level
 	int exists = is_regular_file(m_path);
 	bool readonly = false;
-	if (!exists && access(dirname(m_path), W_OK | X_OK)) {
+	char dir[PATH_MAX];
+	if (!exists && access(path_dirname(m_path, dir, sizeof(dir)), W_OK | X_OK)) {
 		// does not exist and we cannot write to the directory
 		fprintf(stderr, 
 				"Error: Unable to create new darwinup database. "
@@ -208,9 +223,15 @@ int Database::post_connect() {
 	if (res == DB_OK) 
 		res = sqlite3_prepare_v2(m_db, "COMMIT TRANSACTION", 19,
 								 &m_commit_transaction, NULL);	
+	// older sqlite lacks data_version, which is not fatal
+	if (res == DB_OK &&
+		sqlite3_prepare_v2(m_db, "PRAGMA data_version", 20,
+						   &m_data_version, NULL) != SQLITE_OK) {
+		m_data_version = NULL;
+	}
 
 	// debug settings
-	extern uint32_t verbosity;
+	uint32_t verbosity = Context::current()->verbosity;
 	if (verbosity & VERBOSE_SQL) {
 		sqlite3_trace(m_db, dbtrace, NULL);
 	}
@@ -325,7 +346,9 @@ int Database::bind_columns(sqlite3_stmt* stmt, uint32_t count, int param,
     sqlite3_stmt** pps; \
 	char* key = strdup(name); \
 	cache_get_and_retain(m_statement_cache, key, (void**)&pps); \
+	if (pps) PROBE1(cache__hit, name); \
 	if (!pps) { \
+		PROBE1(cache__miss, name); \
 		va_list args; \
 		va_start(args, count); \
 		pps = expr; \
@@ -351,6 +374,23 @@ int Database::count(const char* name, void** output, Table* table,
 	return res;
 }
 
+int Database::sum(const char* name, void** output, Table* table, 
+				  Column* value_column, uint32_t count, ...) {
+	va_list args;
+	va_start(args, count);
+	__get_stmt(table->sum(m_db, value_column, count, args));
+	int res = SQLITE_OK;
+	res = this->bind_va_columns(stmt, count, args);
+	// an empty sum is NULL, which is stored as 0
+	*output = malloc(sizeof(uint64_t));
+	assert(*output);
+	res = this->step_once(stmt, *(uint8_t**)output, NULL);
+	sqlite3_reset(stmt);
+	cache_release_value(m_statement_cache, pps);
+	va_end(args);
+	return res;
+}
+
 int Database::get_value(const char* name, void** output, Table* table, 
 						Column* value_column, uint32_t count, ...) {
 	va_list args;
@@ -391,8 +431,7 @@ int Database::get_row(const char* name, uint8_t** output, Table* table,
 	__get_stmt(table->get_row(m_db, count, args));
 	int res = SQLITE_OK;
 	this->bind_va_columns(stmt, count, args);
-	*output = table->alloc_result();
-	res = this->step_once(stmt, *output, NULL);
+	res = this->step_result(stmt, table, output);
 	sqlite3_reset(stmt);
 	cache_release_value(m_statement_cache, pps);
 	va_end(args);
@@ -406,8 +445,7 @@ int Database::get_row_ordered(const char* name, uint8_t** output, Table* table,
 	__get_stmt(table->get_row_ordered(m_db, order_by, order, count, args));
 	int res = SQLITE_OK;
 	this->bind_va_columns(stmt, count, args);
-	*output = table->alloc_result();
-	res = this->step_once(stmt, *output, NULL);
+	res = this->step_result(stmt, table, output);
 	sqlite3_reset(stmt);
 	cache_release_value(m_statement_cache, pps);
 	va_end(args);
@@ -438,13 +476,10 @@ int Database::get_all_ordered(const char* name, uint8_t*** output,
 				return DB_ERROR;
 			}
 		}
-		current = table->alloc_result();
-		res = this->step_once(stmt, current, NULL);
+		res = this->step_result(stmt, table, &current);
 		if (res == SQLITE_ROW) {
 			(*output)[(*result_count)] = current;
 			(*result_count)++;
-		} else {
-			table->free_result(current);
 		}
 	}
 
@@ -454,6 +489,115 @@ int Database::get_all_ordered(const char* name, uint8_t*** output,
 	return res;
 }
 
+sqlite3_stmt** Database::prepare_sql(const char* name, const char* query) {
+	sqlite3_stmt* stmt;
+	sqlite3_stmt** pps;
+	char* key = strdup(name);
+	cache_get_and_retain(m_statement_cache, key, (void**)&pps);
+	if (pps) PROBE1(cache__hit, name);
+	if (!pps) {
+		PROBE1(cache__miss, name);
+		int res = sqlite3_prepare_v2(m_db, query, -1, &stmt, NULL);
+		if (res != SQLITE_OK) {
+			fprintf(stderr, "Error: unable to prepare statement for query: %s\n"
+					        "Error: %s\n",
+					query, sqlite3_errmsg(m_db));
+			free(key);
+			return NULL;
+		}
+		pps = (sqlite3_stmt**)malloc(sizeof(sqlite3_stmt*));
+		*pps = stmt;
+		cache_set_and_retain(m_statement_cache, key, pps, 0);
+	}
+	free(key);
+	return pps;
+}
+
+int Database::get_row_sql(const char* name, uint8_t** output, Table* table, 
+						  const char* query, uint32_t count, ...) {
+	*output = NULL;
+	sqlite3_stmt** pps = this->prepare_sql(name, query);
+	if (!pps) return SQLITE_ERROR;
+	sqlite3_stmt* stmt = *pps;
+	va_list args;
+	va_start(args, count);
+	int res = this->bind_va_columns(stmt, count, args);
+	if (res == SQLITE_OK) res = this->step_result(stmt, table, output);
+	sqlite3_reset(stmt);
+	cache_release_value(m_statement_cache, pps);
+	va_end(args);
+	return res;
+}
+
+int Database::get_all_sql(const char* name, uint8_t*** output, 
+						  uint32_t* result_count, Table* table, const char* query,
+						  uint32_t count, ...) {
+	*result_count = 0;
+	*output = NULL;
+	sqlite3_stmt** pps = this->prepare_sql(name, query);
+	if (!pps) return SQLITE_ERROR;
+	sqlite3_stmt* stmt = *pps;
+	va_list args;
+	va_start(args, count);
+	int res = this->bind_va_columns(stmt, count, args);
+	va_end(args);
+	if (res != SQLITE_OK) {
+		sqlite3_reset(stmt);
+		cache_release_value(m_statement_cache, pps);
+		return res;
+	}
+
+	uint8_t* current = NULL;
+	uint32_t output_max = INITIAL_ROWS;
+	*output = (uint8_t**)calloc(output_max, sizeof(uint8_t*));
+	
+	res = SQLITE_ROW;
+	while (res == SQLITE_ROW) {
+		if ((*result_count) >= output_max) {
+			output_max *= REALLOC_FACTOR;
+			*output = (uint8_t**)realloc((*output), output_max * sizeof(uint8_t*));
+			if (!(*output)) {
+				fprintf(stderr, "Error: ran out of memory trying to realloc output"
+						        "in get_all_sql.\n");
+				return DB_ERROR;
+			}
+		}
+		res = this->step_result(stmt, table, &current);
+		if (res == SQLITE_ROW) {
+			(*output)[(*result_count)] = current;
+			(*result_count)++;
+		}
+	}
+
+	sqlite3_reset(stmt);
+	cache_release_value(m_statement_cache, pps);
+	return res;
+}
+
+int Database::each_sql(const char* name, RowFunc func, void* context, 
+					   Table* table, const char* query, uint32_t count, ...) {
+	sqlite3_stmt** pps = this->prepare_sql(name, query);
+	if (!pps) return SQLITE_ERROR;
+	sqlite3_stmt* stmt = *pps;
+	va_list args;
+	va_start(args, count);
+	int res = this->bind_va_columns(stmt, count, args);
+	va_end(args);
+	if (res == SQLITE_OK) res = SQLITE_ROW;
+
+	uint8_t* current = NULL;
+	while (res == SQLITE_ROW) {
+		res = this->step_result(stmt, table, &current);
+		if (res == SQLITE_ROW && func(current, context) != 0) {
+			res = SQLITE_ABORT;
+		}
+	}
+
+	sqlite3_reset(stmt);
+	cache_release_value(m_statement_cache, pps);
+	return res;
+}
+
 int Database::update_value(const char* name, Table* table, Column* value_column, 
 						   void** value, uint32_t count, ...) {
 	va_list args;
@@ -573,6 +717,17 @@ uint64_t Database::last_insert_id() {
 	return (uint64_t)sqlite3_last_insert_rowid(m_db);
 }
 
+int Database::data_version(uint64_t* version) {
+	int res = DB_ERROR;
+	if (!m_data_version) return res;
+	if (sqlite3_step(m_data_version) == SQLITE_ROW) {
+		*version = (uint64_t)sqlite3_column_int64(m_data_version, 0);
+		res = DB_OK;
+	}
+	sqlite3_reset(m_data_version);
+	return res;
+}
+
 
 
 int Database::sql_once(const char* fmt, ...) {
@@ -600,9 +755,15 @@ int Database::sql_once(const char* fmt, ...) {
 
 int Database::sql(const char* name, const char* fmt, ...) {
 	sqlite3_stmt* stmt;
+	sqlite3_stmt** pps;
 	char* key = strdup(name);
-	cache_get_and_retain(m_statement_cache, key, (void**)&stmt);
-	if (!stmt) {
+	cache_get_and_retain(m_statement_cache, key, (void**)&pps);
+	if (pps) {
+		PROBE1(cache__hit, name);
+		stmt = *pps;
+		free(key);
+	} else {
+		PROBE1(cache__miss, name);
 		va_list args;
 		va_start(args, fmt);
 		char* query = sqlite3_vmprintf(fmt, args);
@@ -615,7 +776,10 @@ int Database::sql(const char* name, const char* fmt, ...) {
 			free(key);
 			return res;
 		}
-		cache_set_and_retain(m_statement_cache, key, stmt, 0); \
+		// the cache holds sqlite3_stmt** like the Table statements
+		pps = (sqlite3_stmt**)malloc(sizeof(sqlite3_stmt*));
+		*pps = stmt;
+		cache_set_and_retain(m_statement_cache, key, pps, 0);
 		free(key);
 	}
 	return this->execute(stmt);
@@ -624,6 +788,7 @@ int Database::sql(const char* name, const char* fmt, ...) {
 int Database::execute(sqlite3_stmt* stmt) {
 	int res = SQLITE_OK;
 	res = sqlite3_step(stmt);
+	PROBE3(execute, sqlite3_sql(stmt), res, sqlite3_changes(m_db));
 	if (res == SQLITE_DONE) {
 		res = SQLITE_OK;
 	} else {
@@ -704,6 +869,8 @@ int Database::upgrade_schema(uint32_t version) {
 		return res;
 	}			
 	
+	res = this->pre_upgrade(version);
+	
 	for (uint32_t ti = 0; res == DB_OK && ti < m_table_count; ti++) {
 		if (m_tables[ti]->version() > version) {
 			// entire table is new
@@ -711,7 +878,7 @@ int Database::upgrade_schema(uint32_t version) {
 		} else {
 			// table is same version, so check for new columns
 			for (uint32_t ci = 0; res == DB_OK && ci < m_tables[ti]->column_count(); ci++) {
-				if (m_tables[ti]->column(ci)->version() < version) {
+				if (m_tables[ti]->column(ci)->version() < m_tables[ti]->version()) {
 					// this should never happen
 					fprintf(stderr, "Error: internal error with schema versioning."
 									" Column %s is older than its table %s. \n",
@@ -731,6 +898,8 @@ int Database::upgrade_schema(uint32_t version) {
 		}
 	}
 	
+	if (res == DB_OK) res = this->post_upgrade(version);
+	
 	if (res == DB_OK) {
 		this->commit_transaction();
 	} else {
@@ -882,6 +1051,7 @@ size_t Database::store_column(sqlite3_stmt* stmt, int column, uint8_t* output) {
 int Database::step_once(sqlite3_stmt* stmt, uint8_t* output, uint32_t* used) {
 	int res = SQLITE_OK;
 	res = sqlite3_step(stmt);
+	PROBE2(step, sqlite3_sql(stmt), res);
 	uint8_t* current = output;
 	if (used) *used = 0;
 	if (res == SQLITE_ROW) {
@@ -897,6 +1067,77 @@ int Database::step_once(sqlite3_stmt* stmt, uint8_t* output, uint32_t* used) {
 	return res;
 }
 
+/**
+ *   like store_column(), but copies text and blob values into *data
+ *   and advances it, instead of allocating them separately
+ */
+size_t Database::store_column(sqlite3_stmt* stmt, int column, uint8_t* output,
+							  uint8_t** data) {
+	int type = sqlite3_column_type(stmt, column);
+	const void* value;
+	int size;
+	switch(type) {
+		case SQLITE_TEXT:
+			value = sqlite3_column_text(stmt, column);
+			size = sqlite3_column_bytes(stmt, column);
+			memcpy(*data, value, size);
+			(*data)[size] = 0;
+			*(uint8_t**)output = *data;
+			*data += size + 1;
+			return sizeof(char*);
+		case SQLITE_BLOB:
+			value = sqlite3_column_blob(stmt, column);
+			size = sqlite3_column_bytes(stmt, column);
+			if (size) {
+				memcpy(*data, value, size);
+				*(uint8_t**)output = *data;
+				*data += size;
+			} else {
+				fprintf(stderr, "Error: unable to get blob from database stmt.\n");
+				*(uint8_t**)output = NULL;
+			}
+			return sizeof(void*);
+		default:
+			return this->store_column(stmt, column, output);
+	}
+}
+
+/**
+ *   steps stmt and stores the row in a single record allocated from
+ *   table, sized to hold the row's text and blob values as well.
+ *   Sets output to NULL if there was no row.
+ */
+int Database::step_result(sqlite3_stmt* stmt, Table* table, uint8_t** output) {
+	*output = NULL;
+	int res = sqlite3_step(stmt);
+	PROBE2(step, sqlite3_sql(stmt), res);
+	if (res != SQLITE_ROW) return res;
+
+	int count = sqlite3_column_count(stmt);
+	size_t data_size = 0;
+	for (int i = 0; i < count; i++) {
+		switch (sqlite3_column_type(stmt, i)) {
+			case SQLITE_TEXT:
+				// fetch as text first so bytes counts the text encoding
+				sqlite3_column_text(stmt, i);
+				data_size += sqlite3_column_bytes(stmt, i) + 1;
+				break;
+			case SQLITE_BLOB:
+				data_size += sqlite3_column_bytes(stmt, i);
+				break;
+		}
+	}
+
+	uint8_t* current = table->alloc_result(data_size);
+	if (!current) return SQLITE_NOMEM;
+	*output = current;
+	uint8_t* data = current + table->row_size();
+	for (int i = 0; i < count; i++) {
+		current += this->store_column(stmt, i, current, &data);
+	}
+	return res;
+}
+
 int Database::step_all(sqlite3_stmt* stmt, void** output, uint32_t size, 
 					   uint32_t* count) {
 	uint32_t used = 0;
@@ -919,6 +1160,7 @@ int Database::step_all(sqlite3_stmt* stmt, void** output, uint32_t size,
 			}
 		}		
 	}
+	PROBE2(rows, sqlite3_sql(stmt), *count);
     sqlite3_reset(stmt);
 	return res;
 }
@@ -955,4 +1197,5 @@ void cache_key_retain(void* key_in, void** key_out, void* user_data) {
 
 void cache_statement_release(void* value, void* user_data) {
 	sqlite3_finalize(*(sqlite3_stmt**)value);
+	free(value);
 }
@@ -86,7 +86,7 @@
 // retry an operation a few times if we hit a lock
 #define __retry_if_locked(operation) \
     do { \
-    extern uint32_t verbosity; \
+    uint32_t verbosity = Context::current()->verbosity; \
     fprintf(stderr, "retry: verbosity %u \n", verbosity); \
     res = operation; \
     fprintf(stderr, "retry: initial res %d \n", res); \
@@ -105,6 +105,9 @@
 	} \
     } while (0);
 
+// called by Database::each_sql() with each row
+typedef int (*RowFunc)(uint8_t* row, void* context);
+
 
 /**
  * 
@@ -132,6 +135,14 @@ struct Database {
 	// initial sets of data
 	virtual int  post_table_creation();
 	
+	// called inside the upgrade transaction, before new tables and
+	// columns are created, so clients can move older tables aside
+	virtual int  pre_upgrade(uint32_t version);
+	
+	// called inside the upgrade transaction, after new tables and
+	// columns exist, so clients can fill them from older data
+	virtual int  post_upgrade(uint32_t version);
+	
 	const char*  path();
 	const char*  error();
 	int          connect();
@@ -151,7 +162,7 @@ struct Database {
 	 * - va_list should have sets of 3 (integer and text) or 4 (blob) 
 	 *     parameters for WHERE clause like Column*, char, value(s)
 	 *      - Column* is the column to match against
-	 *      - char is how to compare, one of '=', '!', '>', or '<'
+	 *      - char is how to compare, one of '=', '!', '>', '<', or '&'
 	 *      - value(s) is the value to match
 	 *          - text columns require a char* arg
 	 *          - integer columns require a uint64_t arg
@@ -161,6 +172,8 @@ struct Database {
 	 *
 	 */
 	int  count(const char* name, void** output, Table* table, uint32_t count, ...);
+	int  sum(const char* name, void** output, Table* table, Column* value_column,
+			 uint32_t count, ...);
 	int  get_value(const char* name, void** output, Table* table, Column* value_column, 
 				   uint32_t count, ...);
 	int  get_column(const char* name, void** output, uint32_t* result_count, 
@@ -170,6 +183,19 @@ struct Database {
 						 int order, uint32_t count, ...);
 	int  get_all_ordered(const char* name, uint8_t*** output, uint32_t* result_count,
 						 Table* table, Column* order_by, int order, uint32_t count, ...);
+	// like get_row() and get_all_ordered() for queries the WHERE sets
+	//  above cannot express. query must select every column of table,
+	//  in order. Each set of parameters binds the next ? in query, and
+	//  its comparison char is ignored.
+	int  get_row_sql(const char* name, uint8_t** output, Table* table, 
+					 const char* query, uint32_t count, ...);
+	int  get_all_sql(const char* name, uint8_t*** output, uint32_t* result_count,
+					 Table* table, const char* query, uint32_t count, ...);
+	// like get_all_sql(), but hands each row to func as it is stepped
+	//  instead of keeping them all. func owns the row, and stepping
+	//  stops when it returns non-zero.
+	int  each_sql(const char* name, RowFunc func, void* context, Table* table,
+				  const char* query, uint32_t count, ...);
 	int  update_value(const char* name, Table* table, Column* value_column, void** value, 
 					  uint32_t count, ...);
 	int  del(const char* name, Table* table, uint32_t count, ...);
@@ -198,6 +224,9 @@ struct Database {
 	
 	uint64_t last_insert_id();
 	
+	// counter that changes when another connection commits
+	int  data_version(uint64_t* version);
+	
 	
 protected:
 
@@ -222,6 +251,8 @@ protected:
 	int   sql_once(const char* fmt, ...);
 	// cache statement with name, execute query with printf-style format
 	int   sql(const char* name, const char* fmt, ...);
+	// retained cached statement for query, which the caller releases
+	sqlite3_stmt** prepare_sql(const char* name, const char* query);
 	int   execute(sqlite3_stmt* stmt);
 	
 	int   add_table(Table*);
@@ -246,7 +277,10 @@ protected:
 	 * step and store functions
 	 */
 	size_t store_column(sqlite3_stmt* stmt, int column, uint8_t* output);
+	size_t store_column(sqlite3_stmt* stmt, int column, uint8_t* output,
+						uint8_t** data);
 	int step_once(sqlite3_stmt* stmt, uint8_t* output, uint32_t* used);
+	int step_result(sqlite3_stmt* stmt, Table* table, uint8_t** output);
 	int step_all(sqlite3_stmt* stmt, void** output, uint32_t size, uint32_t* count);
 	
 	// libcache
@@ -269,6 +303,7 @@ protected:
 	sqlite3_stmt*    m_begin_transaction;
 	sqlite3_stmt*    m_rollback_transaction;
 	sqlite3_stmt*    m_commit_transaction;
+	sqlite3_stmt*    m_data_version;
 	
 	char*            m_error;
 	size_t           m_error_size;
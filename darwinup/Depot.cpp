@@ -33,10 +33,16 @@
 #include "Archive.h"
 #include "Depot.h"
 #include "File.h"
+#include "Pack.h"
+#include "Probes.h"
+#include "Progress.h"
 #include "SerialSet.h"
+#include "Snapshot.h"
+#include "ThreadPool.h"
 #include "Utils.h"
 #include <assert.h>
 #include <copyfile.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <grp.h>
@@ -48,6 +54,8 @@
 #include <unistd.h>
 #include <sys/stat.h>
 
+// files install moves into the prefix between syncs of the journal
+#define JOURNAL_BATCH 512
 
 Depot::Depot() {
 	m_prefix = NULL;
@@ -55,10 +63,20 @@ Depot::Depot() {
 	m_database_path = NULL;
 	m_archives_path = NULL;
 	m_downloads_path = NULL;
+	m_service_path = NULL;
+	m_journal_path = NULL;
+	m_jobs_path = NULL;
+	m_hooks_path = NULL;
+	m_snapshot_path = NULL;
 	m_build = NULL;
+	m_journal_fd = -1;
 	m_db = NULL;
+	m_pool = NULL;
+	m_verify_mode = VERIFY_DEEP;
 	m_lock_fd = -1;
 	m_is_locked = 0;
+	m_data_version = 0;
+	m_snapshot_stale = false;
 	m_depot_mode = 0750;
 	m_is_dirty = false;
 	m_modified_extensions = false;
@@ -66,10 +84,16 @@ Depot::Depot() {
 }
 
 Depot::Depot(const char* prefix) {
+	m_db = NULL;
+	m_pool = NULL;
+	m_verify_mode = VERIFY_DEEP;
 	m_lock_fd = -1;
 	m_is_locked = 0;
+	m_data_version = 0;
+	m_snapshot_stale = false;
 	m_depot_mode = 0750;
 	m_build = NULL;
+	m_journal_fd = -1;
 	m_is_dirty = false;
 	m_modified_extensions = false;
 	m_modified_xpc_services = false;
@@ -79,6 +103,11 @@ Depot::Depot(const char* prefix) {
 	join_path(&m_database_path, m_depot_path, "/Database-V100");
 	join_path(&m_archives_path, m_depot_path, "/Archives");
 	join_path(&m_downloads_path, m_depot_path, "/Downloads");
+	join_path(&m_service_path, m_depot_path, "/darwinup.sock");
+	join_path(&m_journal_path, m_depot_path, "/Journal");
+	join_path(&m_jobs_path, m_depot_path, "/Jobs");
+	join_path(&m_hooks_path, m_depot_path, "/Hooks");
+	join_path(&m_snapshot_path, m_depot_path, "/Snapshot");
 }
 
 Depot::~Depot() {
@@ -86,17 +115,27 @@ Depot::~Depot() {
 	// XXX: this is expensive, but is it necessary?
 	//this->check_consistency();
 
+	if (m_journal_fd != -1)	close(m_journal_fd);
 	if (m_lock_fd != -1)	this->unlock();
+	delete m_pool;
 	delete m_db;
 	if (m_prefix)           free(m_prefix);
 	if (m_depot_path)	free(m_depot_path);
 	if (m_database_path)	free(m_database_path);
 	if (m_archives_path)	free(m_archives_path);
 	if (m_downloads_path)	free(m_downloads_path);
+	if (m_service_path)	free(m_service_path);
+	if (m_journal_path)	free(m_journal_path);
+	if (m_jobs_path)	free(m_jobs_path);
+	if (m_hooks_path)	free(m_hooks_path);
+	if (m_snapshot_path)	free(m_snapshot_path);
 }
 
 const char*	Depot::archives_path()		      { return m_archives_path; }
 const char*	Depot::downloads_path()		      { return m_downloads_path; }
+const char*	Depot::service_path()		      { return m_service_path; }
+const char*	Depot::jobs_path()		          { return m_jobs_path; }
+const char*	Depot::hooks_path()		          { return m_hooks_path; }
 const char* Depot::prefix()                   { return m_prefix; }
 bool        Depot::is_dirty()                 { return m_is_dirty; }
 bool        Depot::has_modified_extensions()  { return m_modified_extensions; }
@@ -162,8 +201,9 @@ int Depot::initialize(bool writable) {
 	if (writable) {
 		uid_t uid = getuid();
 		if (uid) {
-			fprintf(stdout, "You must be root to perform that operation.\n");
-			exit(3);
+			fprintf(Context::current()->output,
+					"You must be root to perform that operation.\n");
+			return DEPOT_PERM_DENIED;
 		}			
 		
 		res = this->create_storage();
@@ -194,6 +234,9 @@ int Depot::initialize(bool writable) {
 		
 	res = this->connect();
 
+	// finish whatever a crash interrupted before anyone looks
+	if (writable && res == 0) res = this->recover();
+
 	return res;
 }
 
@@ -216,14 +259,7 @@ Archive* Depot::archive(uuid_t uuid) {
 // Unserialize an archive from the database.
 // Find the archive by serial.
 Archive* Depot::archive(uint64_t serial) {
-	int res = 0;
-	Archive* archive = NULL;
-	uint8_t* data;
-	
-	res = this->m_db->get_archive(&data, serial);
-	if (FOUND(res)) archive = this->m_db->make_archive(data);
-
-	return archive;
+	return this->m_db->archive(serial);
 }
 
 // Unserialize an archive from the database.
@@ -285,7 +321,7 @@ Archive* Depot::get_archive(const char* arg) {
 }
 
 Archive** Depot::get_all_archives(uint32_t* count) {
-	extern uint32_t verbosity;
+	uint32_t verbosity = Context::current()->verbosity;
 	int res = DB_OK;
 	uint8_t** archlist;
 	res = this->m_db->get_archives(&archlist, count, verbosity & VERBOSE_DEBUG);
@@ -312,10 +348,12 @@ Archive** Depot::get_all_archives(uint32_t* count) {
 	return list;	
 }
 
-Archive** Depot::get_superseded_archives(uint32_t* count) {
+Archive** Depot::get_superseded_archives(uint32_t* count, bool replaced_only) {
 	int res = DB_OK;
 	uint8_t** archlist;
-	res = this->m_db->get_archives(&archlist, count, false); // rollbacks cannot be superseded
+	// read the candidates from the archive summaries, rollbacks cannot
+	//  be superseded
+	res = this->m_db->get_superseded_archives(&archlist, count, replaced_only);
 	
 	Archive** list = (Archive**)malloc(sizeof(Archive*) * (*count));
 	if (!list) {
@@ -328,9 +366,16 @@ Archive** Depot::get_superseded_archives(uint32_t* count) {
 	if (FOUND(res)) {
 		while (i < *count) {
 			Archive* archive = this->m_db->make_archive(archlist[i++]);
-			if (archive && this->is_superseded(archive)) {
-				list[cur++] = archive;
-			} else if (!archive) {
+			if (archive) {
+				// the last verify may be out of date, so check the disk
+				//  again before callers act on it
+				archive->m_is_superseded = replaced_only ? 1 : -1;
+				if (this->is_superseded(archive)) {
+					list[cur++] = archive;
+				} else {
+					archive->release();
+				}
+			} else {
 				fprintf(stderr, "%s:%d: DB::make_archive returned NULL\n",
 						__FILE__, __LINE__);
 				res = -1;
@@ -338,13 +383,31 @@ Archive** Depot::get_superseded_archives(uint32_t* count) {
 			}
 		}
 	}
-	// adjust count based on our is_superseded filtering
 	*count = cur;
 	return list;	
 }
 
+Archive** Depot::get_archives(const char* archspec, uint32_t* count) {
+	Archive** list = NULL;
+	if (strncasecmp(archspec, "all", 3) == 0 && strlen(archspec) == 3) {
+		list = this->get_all_archives(count);
+	} else if (strncasecmp(archspec, "superseded", 10) == 0 && strlen(archspec) == 10) {
+		list = this->get_superseded_archives(count, false);
+	} else {
+		// make a list of 1 Archive
+		list = (Archive**)malloc(sizeof(Archive*));
+		if (!list) {
+			fprintf(stderr, "Error: ran out of memory in Depot::get_archives\n");
+			return NULL;
+		}
+		list[0] = this->get_archive(archspec);
+		*count = 1;
+	}
+	return list;
+}
+
 uint64_t Depot::count_archives() {
-	extern uint32_t verbosity;
+	uint32_t verbosity = Context::current()->verbosity;
 	uint64_t c = this->m_db->count_archives((bool)(verbosity & VERBOSE_DEBUG));
 	return c;
 }
@@ -357,11 +420,51 @@ struct InstallContext {
 		files_added = 0;
 		files_removed = 0;
 		files_to_remove = new SerialSet();
+		files_seen = 0;
+		files_skip = 0;
+		journaled = false;
 		reverse_files = false;
+		links = new LinkGroups();
+		pack = NULL;
+		moved_trees = NULL;
+		moved_tree_count = 0;
 	}
 	
 	~InstallContext() {
 		delete files_to_remove;
+		delete links;
+		delete pack;
+		for (uint32_t i = 0; i < moved_tree_count; i++) free(moved_trees[i]);
+		free(moved_trees);
+	}
+
+	// whether path is beneath a directory already moved into place whole.
+	//  Those are moved in path order, so the list stays sorted.
+	bool in_moved_tree(const char* path) {
+		char buf[PATH_MAX];
+		strlcpy(buf, path, sizeof(buf));
+		char* slash;
+		while ((slash = strrchr(buf, '/')) != NULL && slash != buf) {
+			*slash = 0;
+			const char* key = buf;
+			if (bsearch(&key, moved_trees, moved_tree_count, sizeof(char*), 
+						compare_moved_trees)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static int compare_moved_trees(const void* a, const void* b) {
+		return strcmp(*(const char**)a, *(const char**)b);
+	}
+
+	int add_moved_tree(const char* path) {
+		char** trees = (char**)realloc(moved_trees, (moved_tree_count + 1) * sizeof(char*));
+		if (!trees) return -1;
+		moved_trees = trees;
+		moved_trees[moved_tree_count++] = strdup(path);
+		return 0;
 	}
 	
 	Depot* depot;
@@ -370,7 +473,14 @@ struct InstallContext {
 	uint64_t files_added;
 	uint64_t files_removed;
 	SerialSet* files_to_remove;	// for uninstall
+	uint64_t files_seen; // for install, files visited so far
+	uint64_t files_skip; // for install, files recovery knows were moved
+	bool journaled; // for install, record progress in the journal
 	bool reverse_files; // for uninstall
+	LinkGroups* links; // for backup, copies already made of linked files
+	Pack* pack; // for backup, where small files go
+	char** moved_trees; // for install, new directories moved with their contents
+	uint32_t moved_tree_count;
 };
 
 int Depot::iterate_archives(ArchiveIteratorFunc func, void* context) {
@@ -380,27 +490,25 @@ int Depot::iterate_archives(ArchiveIteratorFunc func, void* context) {
 	for (uint32_t i = 0; i < count; i++) {
 		if (list[i]) {
 			res = func(list[i], context);
-			delete list[i];
+			list[i]->release();
 		}
 	}
 	return res;
 }
 
-int Depot::iterate_files(Archive* archive, FileIteratorFunc func, void* context) {
+int Depot::iterate_files(Archive* archive, FileIteratorFunc func, void* context, 
+						 bool reverse) {
 	int res = DB_OK;
-	uint8_t** filelist;
-	uint32_t count;
-	bool reverse = false;
-	if (context) reverse = ((InstallContext*)context)->reverse_files;
-	res = this->m_db->get_files(&filelist, &count, archive, reverse);
+	FilePool files;
+	res = this->m_db->get_files(&files, archive, reverse);
 	if (FOUND(res)) {
-		for (uint32_t i=0; i < count; i++) {
-			File* file = this->m_db->make_file(filelist[i]);
+		for (uint32_t i=0; i < files.count(); i++) {
+			File* file = FileFactory(&files, files.record(i));
 			if (file) {
 				res = func(file, context);
 				delete file;
 			} else {
-				fprintf(stderr, "%s:%d: DB::make_file returned NULL\n", __FILE__, __LINE__);
+				fprintf(stderr, "%s:%d: FileFactory returned NULL\n", __FILE__, __LINE__);
 				res = -1;
 				break;
 			}
@@ -410,10 +518,68 @@ int Depot::iterate_files(Archive* archive, FileIteratorFunc func, void* context)
 	return res;
 }
 
+// files verified in parallel between each in-order round of output
+#define VERIFY_BATCH 1024
+
+struct VerifyBatch {
+	Depot*        depot;
+	verify_mode_t mode;
+	File**        files;
+	char*         status;
+};
+
+static void verify_batch_file(uint32_t index, void* context) {
+	VerifyBatch* batch = (VerifyBatch*)context;
+	batch->status[index] = batch->depot->verify_status(batch->files[index], 
+													   batch->mode);
+}
+
+int Depot::iterate_verified_files(Archive* archive, verify_mode_t mode,
+								  VerifyIteratorFunc func, void* context) {
+	int res = DB_OK;
+	FilePool records;
+	res = this->m_db->get_files(&records, archive, false);
+	if (!FOUND(res)) return res == DB_OK ? DEPOT_OK : DEPOT_ERROR;
+	uint32_t count = records.count();
+
+	File* files[VERIFY_BATCH];
+	char status[VERIFY_BATCH];
+	VerifyBatch batch = { this, mode, files, status };
+	ThreadPool* pool = this->thread_pool();
+	
+	res = DEPOT_OK;
+	uint32_t next = 0;
+	while (res == DEPOT_OK && next < count) {
+		// Files are made a batch at a time, on this thread
+		uint32_t made = 0;
+		while (made < VERIFY_BATCH && next < count) {
+			files[made] = FileFactory(&records, records.record(next++));
+			if (!files[made]) {
+				fprintf(stderr, "%s:%d: FileFactory returned NULL\n", __FILE__, __LINE__);
+				res = DEPOT_ERROR;
+				break;
+			}
+			made++;
+		}
+		if (res == DEPOT_OK) pool->apply(made, &verify_batch_file, &batch);
+		for (uint32_t i = 0; i < made; i++) {
+			if (res == DEPOT_OK) res = func(files[i], status[i], context);
+			delete files[i];
+		}
+	}
+
+	return res;
+}
+
+ThreadPool* Depot::thread_pool() {
+	if (!m_pool) m_pool = new ThreadPool(0);
+	return m_pool;
+}
+
 int Depot::analyze_stage(const char* path, Archive* archive, Archive* rollback,
 						 int* rollback_files) {
-	extern uint32_t force;
-	extern uint32_t dryrun;
+	uint32_t force = Context::current()->force;
+	uint32_t dryrun = Context::current()->dryrun;
 	int res = 0;
 	assert(archive != NULL);
 	assert(rollback != NULL);
@@ -425,10 +591,17 @@ int Depot::analyze_stage(const char* path, Archive* archive, Archive* rollback,
 	
 	IF_DEBUG("[analyze] analyzing path: %s\n", path);
 
+	// hard links in the root, and on disk, are only read once
+	LinkGroups links;
+
+	// the directory new to the prefix being walked, if any
+	char* new_tree = NULL;
+	size_t new_tree_len = 0;
+
 	FTS* fts = fts_open((char**)path_argv, FTS_PHYSICAL | FTS_COMFOLLOW | FTS_XDEV, fts_compare);
 	FTSENT* ent = fts_read(fts); // throw away the entry for path itself
 	while (res != -1 && (ent = fts_read(fts)) != NULL) {
-		File* file = FileFactory(archive, ent);
+		File* file = FileFactory(archive, ent, &links);
 		if (file) {
 			char state = '?';
 
@@ -437,6 +610,7 @@ int Depot::analyze_stage(const char* path, Archive* archive, Archive* rollback,
 			if (strcasestr(file->path(), ".DarwinDepot")) {
 				fprintf(stderr, "Error: Root contains a .DarwinDepot, "
 						"aborting to avoid damaging darwinup metadata.\n");
+				free(new_tree);
 				return DEPOT_ERROR;
 			}
 
@@ -446,7 +620,7 @@ int Depot::analyze_stage(const char* path, Archive* archive, Archive* rollback,
 		
 			char* actpath;
 			join_path(&actpath, this->prefix(), file->path());
-			File* actual = FileFactory(actpath);
+			File* actual = FileFactory(actpath, &links);
 			File* preceding = this->file_preceded_by(file);
 			
 			if (actual == NULL) {
@@ -490,7 +664,9 @@ int Depot::analyze_stage(const char* path, Archive* archive, Archive* rollback,
 							res = this->insert(rollback, subact);
 						}
 						*rollback_files += 1;
+						delete subact;
 					}
+					fts_close(subfts);
 				}
 				preceding = actual;
 			}
@@ -606,12 +782,39 @@ int Depot::analyze_stage(const char* path, Archive* archive, Archive* rollback,
 							if (!dryrun) res = this->insert(rollback, parent);
 						}
 						assert(res == 0);
+						delete parent;
 						pent = pent->fts_parent;
 					}
 				}
 			}
 
-			fprintf(stdout, "%c %s\n", state, file->path());
+			// a file whose data is already in place is left alone, so
+			// quick verify must expect the modification time on disk
+			if (!INFO_TEST(file->info(), FILE_INFO_INSTALL_DATA) &&
+				!INFO_TEST(actual->info(), FILE_INFO_NO_ENTRY)) {
+				file->mtime(actual->mtime());
+			}
+
+			// a directory which does not exist yet is moved into place
+			//  with everything beneath it, which can not exist either
+			if (new_tree && strncmp(file->path(), new_tree, new_tree_len) == 0 &&
+				file->path()[new_tree_len] == '/') {
+				file->info_set(FILE_INFO_NEW_TREE);
+			} else {
+				free(new_tree);
+				new_tree = NULL;
+				if (state == 'A' && S_ISDIR(file->mode())) {
+					IF_DEBUG("[analyze]    new directory tree\n");
+					new_tree = strdup(file->path());
+					new_tree_len = strlen(new_tree);
+					file->info_set(FILE_INFO_NEW_TREE);
+				}
+			}
+
+			PROBE2(analyze, file->path(), state);
+			PROGRESS(step(1, file->size()));
+			PROGRESS(clear());
+			fprintf(Context::current()->output, "%c %s\n", state, file->path());
 			if (!dryrun) res = this->insert(archive, file);
 			assert(res == 0);
 			if (preceding && preceding != actual) delete preceding;
@@ -621,6 +824,7 @@ int Depot::analyze_stage(const char* path, Archive* archive, Archive* rollback,
 		}
 	}
 	if (fts) fts_close(fts);
+	free(new_tree);
 	return res;
 }
 
@@ -629,6 +833,7 @@ int Depot::backup_file(File* file, void* ctx) {
 	int res = 0;
 
 	IF_DEBUG("[backup] backup_file: %s , %s \n", file->path(), context->archive->m_name);
+	PROGRESS(step(1, INFO_TEST(file->info(), FILE_INFO_ROLLBACK_DATA) ? file->size() : 0));
 
 	if (INFO_TEST(file->info(), FILE_INFO_ROLLBACK_DATA)) {
 		char *path;        // the file's path
@@ -647,7 +852,8 @@ int Depot::backup_file(File* file, void* ctx) {
 		strlcpy(backup_path, file->path(), sizeof(backup_path));
 		IF_DEBUG("[backup] backup_path = %s \n", backup_path);
 			
-		const char* dir = dirname(backup_path);
+		char dirbuf[PATH_MAX];
+		const char* dir = path_dirname(backup_path, dirbuf, sizeof(dirbuf));
 		assert(dir != NULL);
 		IF_DEBUG("[backup] dir = %s \n", dir);
 
@@ -658,15 +864,6 @@ int Depot::backup_file(File* file, void* ctx) {
 		join_path(&backup_dirpath, uuidpath, dir);
 		assert(backup_dirpath != NULL);
 		
-		IF_DEBUG("mkdir_p: %s\n", backup_dirpath);
-		res = mkdir_p(backup_dirpath);
-		if (res != 0 && errno != EEXIST) {
-			fprintf(stderr, "%s:%d: %s: %s (%d)\n", 
-					__FILE__, __LINE__, backup_dirpath, strerror(errno), errno);
-		} else {
-			res = 0;
-		}
-		
 		// we need the path minus our destination path for moving to the archive
 		size_t prefixlen = strlen(context->depot->m_prefix);
 		if (strncmp(context->archive->m_name, "<Rollback>", strlen("<Rollback>")) == 0) {
@@ -689,9 +886,40 @@ int Depot::backup_file(File* file, void* ctx) {
 
 		++context->files_modified;
 
+		struct stat sb;
+		bool stated = (lstat(path, &sb) == 0);
+		bool linked = (stated && S_ISREG(sb.st_mode) && sb.st_nlink > 1);
+
+		// small files are appended to the pack instead of copied
+		res = -1;
+		if (context->pack && stated && !linked && Pack::packable(path, &sb)) {
+			res = context->pack->add(file->serial(), file->path(), path, &sb);
+		}
+
+		if (res != 0) {
+			IF_DEBUG("mkdir_p: %s\n", backup_dirpath);
+			res = mkdir_p(backup_dirpath);
+			if (res != 0 && errno != EEXIST) {
+				fprintf(stderr, "%s:%d: %s: %s (%d)\n", 
+						__FILE__, __LINE__, backup_dirpath, strerror(errno), errno);
+			}
+			res = -1;
+		}
+
+		// a file linked to one already backed up is linked to its copy,
+		// so the rollback holds its data once and restores the link
+		HardLink* first = (res != 0 && linked) ? context->links->find(&sb) : NULL;
+		if (first) {
+			IF_DEBUG("[backup] link(%s, %s)\n", first->path, dstpath);
+			res = link(first->path, dstpath);
+		}
+
 		// XXX: res = file->backup()
-		IF_DEBUG("[backup] copyfile(%s, %s)\n", path, dstpath);
-		res = copyfile(path, dstpath, NULL, COPYFILE_ALL|COPYFILE_NOFOLLOW);
+		if (res != 0) {
+			IF_DEBUG("[backup] copyfile(%s, %s)\n", path, dstpath);
+			res = copyfile(path, dstpath, NULL, COPYFILE_ALL|COPYFILE_NOFOLLOW);
+			if (res == 0 && linked && !first) context->links->add(&sb, dstpath, NULL);
+		}
 
 		if (res != 0) fprintf(stderr, "%s:%d: backup failed: %s: %s (%d)\n", 
 							  __FILE__, __LINE__, dstpath, strerror(errno), errno);
@@ -712,13 +940,39 @@ int Depot::install_file(File* file, void* ctx) {
 	InstallContext* context = (InstallContext*)ctx;
 	int res = 0;
 
+	if (++context->files_seen <= context->files_skip) return res;
+	PROGRESS(step(1, INFO_TEST(file->info(), FILE_INFO_INSTALL_DATA) ? file->size() : 0));
+
+	bool new_tree = INFO_TEST(file->info(), FILE_INFO_NEW_TREE);
+	if (new_tree && context->in_moved_tree(file->path())) {
+		// already moved into place along with its directory
+		res = file->unquarantine_at(context->depot->m_prefix);
+		if (res == 0 && context->journaled && context->files_seen % JOURNAL_BATCH == 0) {
+			res = context->depot->journal_moved(context->files_seen);
+		}
+		return res;
+	}
+
 	// Strip the quarantine xattr off all files to avoid them being rendered useless.
 	if (file->unquarantine(context->depot->m_archives_path) != 0) {
 		fprintf(stderr, "Error: unable to unquarantine file in staging area.\n");
 		return DEPOT_ERROR;
 	}
 
-	if (INFO_TEST(file->info(), FILE_INFO_INSTALL_DATA)) {
+	// a new directory is renamed into place whole, unless a recovered
+	//  install already moved it
+	char* dstpath = NULL;
+	struct stat sb;
+	if (new_tree && S_ISDIR(file->mode())) {
+		join_path(&dstpath, context->depot->m_prefix, file->path());
+	}
+	if (dstpath && lstat(dstpath, &sb) == -1 && errno == ENOENT) {
+		++context->files_modified;
+		res = file->dirrename(context->depot->m_archives_path,
+							  context->depot->m_prefix,
+							  context->reverse_files);
+		if (res == 0) res = context->add_moved_tree(file->path());
+	} else if (INFO_TEST(file->info(), FILE_INFO_INSTALL_DATA)) {
 		++context->files_modified;
 
 		res = file->install(context->depot->m_archives_path,
@@ -727,8 +981,13 @@ int Depot::install_file(File* file, void* ctx) {
 	} else {
 		res = file->install_info(context->depot->m_prefix);
 	}
+	free(dstpath);
 	if (res != 0) fprintf(stderr, "%s:%d: install failed: %s: %s (%d)\n", 
 						  __FILE__, __LINE__, file->path(), strerror(errno), errno);
+
+	if (res == 0 && context->journaled && context->files_seen % JOURNAL_BATCH == 0) {
+		res = context->depot->journal_moved(context->files_seen);
+	}
 	return res;
 }
 
@@ -740,10 +999,10 @@ int Depot::install(const char* path) {
 	if (archive) {
 		res = this->install(archive);
 		if (res == 0) {
-			fprintf(stdout, "Installed archive: %llu %s \n", 
+			fprintf(Context::current()->output, "Installed archive: %llu %s \n", 
 					archive->serial(), archive->name());
 			uuid_unparse_upper(archive->uuid(), uuid);
-			fprintf(stdout, "%s\n", uuid);
+			fprintf(Context::current()->output, "%s\n", uuid);
 		} else {
 			fprintf(stderr, "Error: Install failed.\n");				
 			if (res != DEPOT_OBJ_CHANGE && res != DEPOT_PREINSTALL_ERR) {
@@ -756,13 +1015,16 @@ int Depot::install(const char* path) {
 					fprintf(stderr, "Error: Unable to rollback installation. "
 							"Your system is in an inconsistent state! File a bug!\n");
 				} else {
-					fprintf(stdout, "Rollback successful.\n");
+					fprintf(Context::current()->output, "Rollback successful.\n");
 				}
 			}
+			// this was the recovery the journal is kept for
+			this->journal_end();
 			res = DEPOT_ERROR;
 		}
 	} else {
-		fprintf(stdout, "Error: unable to load \"%s\". Either the path is missing, invalid or"
+		fprintf(Context::current()->output,
+				"Error: unable to load \"%s\". Either the path is missing, invalid or"
 				         " the file is in an unknown format.\n", path);
 		return DEPOT_ERROR;
 	}
@@ -772,7 +1034,7 @@ int Depot::install(const char* path) {
 
 
 int Depot::install(Archive* archive) {
-	extern uint32_t dryrun;
+	uint32_t dryrun = Context::current()->dryrun;
 	int res = 0;
 	Archive* rollback = new RollbackArchive();
 
@@ -808,16 +1070,22 @@ int Depot::install(Archive* archive) {
 	assert(rollback_path != NULL);
 
 	// Extract the archive into its backing store directory
+	PROBE3(phase, "install", archive->name(), "extract");
+	PROGRESS(begin("install", archive->name(), "extract", 0, 0));
 	if (res == 0) res = archive->extract(archive_path);
 
 	// Analyze the files in the archive backing store directory
 	// Inserts new file records into the database for both the new archive being
 	// installed and the rollback archive.
 	int rollback_files = 0;
+	PROBE3(phase, "install", archive->name(), "analyze");
+	PROGRESS(begin("install", archive->name(), "analyze", 0, 0));
 	if (res == 0) res = this->analyze_stage(archive_path, archive, rollback, &rollback_files);
 	
 	// we can stop now if analyze failed or this is a dry run
 	if (res || dryrun) {
+		PROBE3(done, "install", archive->name(), res);
+		PROGRESS(end());
 		remove_directory(archive_path);
 		remove_directory(rollback_path);
 		free(rollback_path);
@@ -834,6 +1102,11 @@ int Depot::install(Archive* archive) {
 		res = this->remove(rollback);
 	}
 
+	// Summarize the new archive, its rollback, and the older archives
+	// sharing its paths, which it may have superseded.
+	if (res == 0) res = this->m_db->stale_archive_summaries(archive);
+	if (res == 0) res = this->m_db->update_archive_summaries();
+
 	// Commit the archive and its list of files to the database.
 	// Note that the archive's "active" flag is still not set.
 	if (res == 0) {
@@ -842,8 +1115,14 @@ int Depot::install(Archive* archive) {
 		this->rollback_transaction();
 	}
 
+	// From here on a crash leaves inactive archives behind, which the
+	// journal lets the next writable open clean up.
+	if (res == 0) res = this->journal_begin(archive, rollback_files ? rollback : NULL);
+
 	// Save a copy of the backing store directory now, we will soon
 	// be moving the files into place.
+	PROBE3(phase, "install", archive->name(), "compact");
+	PROGRESS(begin("install", archive->name(), "compact", 0, 0));
 	if (res == 0) res = archive->compact_directory(m_archives_path);
 
 	//
@@ -851,15 +1130,42 @@ int Depot::install(Archive* archive) {
 	// then move files from the archive backing directory to the root filesystem
 	//
 	InstallContext rollback_context(this, rollback);
-	if (res == 0) res = this->iterate_files(rollback, &Depot::backup_file, &rollback_context);
+	char* packpath = rollback->packed_path(m_archives_path);
+	if (packpath) rollback_context.pack = new Pack(packpath);
+	free(packpath);
+	PROBE3(phase, "install", archive->name(), "backup");
+	if (res == 0 && Context::current()->progress) {
+		PROGRESS(begin("install", archive->name(), "backup",
+					   m_db->count_archive_files(rollback, FILE_INFO_NONE),
+					   m_db->size_archive_files(rollback, FILE_INFO_ROLLBACK_DATA)));
+	}
+	if (res == 0) res = this->iterate_files(rollback, &Depot::backup_file, &rollback_context,
+													   rollback_context.reverse_files);
+	if (res == 0 && rollback_context.pack) res = rollback_context.pack->flush();
 
 	// compact the rollback archive (if we actually added any files)
 	if (rollback_context.files_modified > 0) {
+		PROBE3(phase, "install", archive->name(), "compact");
+		PROGRESS(begin("install", archive->name(), "compact", 0, 0));
 		if (res == 0) res = rollback->compact_directory(m_archives_path);
 	}
 
+	// Both backing stores must be durable before the prefix changes,
+	// since recovery will rely on them.
+	if (res == 0) res = this->journal_backed_up();
+
 	InstallContext install_context(this, archive);
-	if (res == 0) res = this->iterate_files(archive, &Depot::install_file, &install_context);
+	install_context.journaled = true;
+	PROBE3(phase, "install", archive->name(), "move");
+	if (res == 0 && Context::current()->progress) {
+		PROGRESS(begin("install", archive->name(), "move",
+					   m_db->count_archive_files(archive, FILE_INFO_NONE),
+					   m_db->size_archive_files(archive, FILE_INFO_INSTALL_DATA)));
+	}
+	if (res == 0) res = this->iterate_files(archive, &Depot::install_file, &install_context,
+													   install_context.reverse_files);
+	if (res == 0) res = this->journal_moved(install_context.files_seen);
+	PROGRESS(end());
 
 	// Installation is complete.  Activate the archive in the database.
 	if (res == 0) res = this->begin_transaction();
@@ -872,6 +1178,7 @@ int Depot::install(Archive* archive) {
 		if (res) this->rollback_transaction();
 	}
 	if (res == 0) res = this->commit_transaction();
+	if (res == 0) res = this->journal_end();
 
 	// Remove the stage and rollback directories (save disk space)
 	remove_directory(archive_path);
@@ -879,6 +1186,7 @@ int Depot::install(Archive* archive) {
 	free(rollback_path);
 	free(archive_path);
 
+	PROBE3(done, "install", archive->name(), res);
 	return res;
 }
 
@@ -903,12 +1211,75 @@ int Depot::prune_directories() {
 	return res;
 }
 
+static int compare_uuids(const void* a, const void* b) {
+	return strcmp((const char*)a, (const char*)b);
+}
+
+// lists the entries in m_archives_path that belong to no archive
+int Depot::orphaned_backing_stores(char*** paths, uint32_t* count) {
+	int res = DB_OK;
+	uint8_t** archlist;
+	uint32_t archcount = 0;
+	*count = 0;
+	res = this->m_db->get_archives(&archlist, &archcount, true);
+	if (res == DB_ERROR) return DEPOT_ERROR;
+
+	char (*uuids)[37] = (char (*)[37])calloc(archcount + 1, 37);
+	for (uint32_t i = 0; i < archcount; i++) {
+		Archive* archive = this->m_db->make_archive(archlist[i]);
+		if (uuids && archive) uuid_unparse_upper(archive->uuid(), uuids[i]);
+		if (archive) archive->release();
+	}
+	free(archlist);
+	if (!uuids) {
+		fprintf(stderr, "Error: ran out of memory in Depot::orphaned_backing_stores\n");
+		return DEPOT_ERROR;
+	}
+	qsort(uuids, archcount, 37, &compare_uuids);
+
+	DIR* dir = opendir(m_archives_path);
+	if (!dir) {
+		perror(m_archives_path);
+		free(uuids);
+		return DEPOT_ERROR;
+	}
+	uint32_t maxpaths = 16;
+	*paths = (char**)malloc(maxpaths * sizeof(char*));
+	struct dirent* ent;
+	while (*paths && (ent = readdir(dir)) != NULL) {
+		if (ent->d_name[0] == '.') continue;
+		// either the compacted or the expanded backing store, or a pack
+		char name[37];
+		size_t len = strlen(ent->d_name);
+		if (has_suffix(ent->d_name, COMPACT_SUFFIX)) len -= strlen(COMPACT_SUFFIX);
+		if (has_suffix(ent->d_name, PACK_SUFFIX)) len -= strlen(PACK_SUFFIX);
+		if (len < sizeof(name)) {
+			strlcpy(name, ent->d_name, len + 1);
+			if (bsearch(name, uuids, archcount, 37, &compare_uuids)) continue;
+		}
+		if (*count >= maxpaths) {
+			maxpaths *= 2;
+			*paths = (char**)realloc(*paths, maxpaths * sizeof(char*));
+			if (!*paths) break;
+		}
+		join_path(&(*paths)[(*count)++], m_archives_path, ent->d_name);
+	}
+	closedir(dir);
+	free(uuids);
+	if (!*paths) {
+		fprintf(stderr, "Error: ran out of memory in Depot::orphaned_backing_stores\n");
+		*count = 0;
+		return DEPOT_ERROR;
+	}
+	return DEPOT_OK;
+}
+
 // delete the unexpanded tarball from archives storage
 int Depot::prune_archive(Archive* archive) {
 	int res = 0;
 	
-	// clean up database
-	res = this->m_db->delete_empty_archives();
+	// clean up database, and the rollbacks which are no longer needed
+	res = this->prune_empty_archives();
 	if (res) {
 		fprintf(stderr, "Error: unable to prune archives from database.\n");
 		return res;
@@ -919,13 +1290,97 @@ int Depot::prune_archive(Archive* archive) {
 	return res;
 }
 
+// delete archives without files, along with their backing stores
+int Depot::prune_empty_archives() {
+	int res = DB_OK;
+	uint8_t** list;
+	uint32_t count = 0;
+	res = this->m_db->get_empty_archives(&list, &count);
+	if (res == DB_ERROR) return DEPOT_ERROR;
+	for (uint32_t i = 0; i < count; i++) {
+		Archive* archive = this->m_db->make_archive(list[i]);
+		char* tarpath = archive ? archive->compacted_path(m_archives_path) : NULL;
+		// a failure is reported, and the file is left for gc
+		if (tarpath && access(tarpath, F_OK) == 0) {
+			archive->prune_compacted_archive(m_archives_path);
+		}
+		free(tarpath);
+		if (archive) archive->release();
+	}
+	free(list);
+
+	return this->m_db->delete_empty_archives();
+}
+
+// Puts preceding back in place of file, which actual on disk matches,
+//  or removes file if nothing preceded it, and sets state to what was
+//  done. The rollback record restored is queued for deletion.
+int Depot::restore_file(File* file, File* preceding, File* actual, void* ctx, char* state) {
+	uint32_t dryrun = Context::current()->dryrun;
+	InstallContext* context = (InstallContext*)ctx;
+	int res = 0;
+
+	if (INFO_TEST(preceding->info(), FILE_INFO_NO_ENTRY)) {
+		context->depot->m_is_dirty = true;
+		*state = 'R';
+		IF_DEBUG("[uninstall]    removing file\n");
+		if (!dryrun && actual && res == 0) res = actual->remove();
+	} else {
+		// copy the preceding file back out to the system
+		// if it's different from what's already there
+		uint32_t flags = File::compare(file, preceding);
+		if (INFO_TEST(flags, FILE_INFO_DATA_DIFFERS)) {
+			context->depot->m_is_dirty = true;
+			*state = 'U';
+			IF_DEBUG("[uninstall]    restoring\n");
+			if (!dryrun && res == 0) {
+				if (INFO_TEST(flags, FILE_INFO_TYPE_DIFFERS) &&
+					S_ISDIR(preceding->mode())) {
+					// use rename instead of mkdir so children are restored
+					res = preceding->dirrename(context->depot->m_archives_path, 
+											               context->depot->m_prefix,
+                                         context->reverse_files);							
+
+				} else {
+					res = preceding->install(context->depot->m_archives_path, 
+											             context->depot->m_prefix,
+                                       context->reverse_files);
+				}
+			}
+		} else if (INFO_TEST(flags, FILE_INFO_MODE_DIFFERS) ||
+			   INFO_TEST(flags, FILE_INFO_GID_DIFFERS) ||
+			   INFO_TEST(flags, FILE_INFO_UID_DIFFERS)) {
+			context->depot->m_is_dirty = true;
+			*state = 'M';
+			if (!dryrun && res == 0) {
+				res = preceding->install_info(context->depot->m_prefix);
+			}
+		} else {
+			IF_DEBUG("[uninstall]    no changes; leaving in place\n");
+		}
+		if (!context->depot->m_modified_extensions &&
+			(strncmp(file->path(), "/System/Library/Extensions", 26) == 0)) {
+			IF_DEBUG("[uninstall]    kernel extension detected\n");
+			context->depot->m_modified_extensions = true;
+		}
+	}
+	uint64_t info = preceding->info();
+	if (INFO_TEST(info, FILE_INFO_NO_ENTRY | FILE_INFO_ROLLBACK_DATA) &&
+	    !INFO_TEST(info, FILE_INFO_BASE_SYSTEM)) {
+		if (!dryrun && res == 0) {
+			res = context->files_to_remove->add(preceding->serial());
+		}
+	}
+	return res;
+}
+
 int Depot::uninstall_file(File* file, void* ctx) {
-	extern uint32_t dryrun;
 	InstallContext* context = (InstallContext*)ctx;
 	int res = 0;
 	char state = ' ';
 
 	IF_DEBUG("[uninstall] %s\n", file->path());
+	PROGRESS(step(1, 0));
 
 	// We never uninstall a file that was part of the base system
 	if (INFO_TEST(file->info(), FILE_INFO_BASE_SYSTEM)) {
@@ -951,57 +1406,7 @@ int Depot::uninstall_file(File* file, void* ctx) {
 			// no one's using this file anymore
 			File* preceding = context->depot->file_preceded_by(file);
 			assert(preceding != NULL);
-			if (INFO_TEST(preceding->info(), FILE_INFO_NO_ENTRY)) {
-				context->depot->m_is_dirty = true;
-				state = 'R';
-				IF_DEBUG("[uninstall]    removing file\n");
-				if (!dryrun && actual && res == 0) res = actual->remove();
-			} else {
-				// copy the preceding file back out to the system
-				// if it's different from what's already there
-				uint32_t flags = File::compare(file, preceding);
-				if (INFO_TEST(flags, FILE_INFO_DATA_DIFFERS)) {
-					context->depot->m_is_dirty = true;
-					state = 'U';
-					IF_DEBUG("[uninstall]    restoring\n");
-					if (!dryrun && res == 0) {
-						if (INFO_TEST(flags, FILE_INFO_TYPE_DIFFERS) &&
-							S_ISDIR(preceding->mode())) {
-							// use rename instead of mkdir so children are restored
-							res = preceding->dirrename(context->depot->m_archives_path, 
-													               context->depot->m_prefix,
-                                         context->reverse_files);							
-
-						} else {
-							res = preceding->install(context->depot->m_archives_path, 
-													             context->depot->m_prefix,
-                                       context->reverse_files);
-						}
-					}
-				} else if (INFO_TEST(flags, FILE_INFO_MODE_DIFFERS) ||
-					   INFO_TEST(flags, FILE_INFO_GID_DIFFERS) ||
-					   INFO_TEST(flags, FILE_INFO_UID_DIFFERS)) {
-					context->depot->m_is_dirty = true;
-					state = 'M';
-					if (!dryrun && res == 0) {
-						res = preceding->install_info(context->depot->m_prefix);
-					}
-				} else {
-					IF_DEBUG("[uninstall]    no changes; leaving in place\n");
-				}
-				if (!context->depot->m_modified_extensions &&
-					(strncmp(file->path(), "/System/Library/Extensions", 26) == 0)) {
-					IF_DEBUG("[uninstall]    kernel extension detected\n");
-					context->depot->m_modified_extensions = true;
-				}
-			}
-			uint64_t info = preceding->info();
-			if (INFO_TEST(info, FILE_INFO_NO_ENTRY | FILE_INFO_ROLLBACK_DATA) &&
-			    !INFO_TEST(info, FILE_INFO_BASE_SYSTEM)) {
-				if (!dryrun && res == 0) {
-					res = context->files_to_remove->add(preceding->serial());
-				}
-			}
+			res = Depot::restore_file(file, preceding, actual, context, &state);
 			delete preceding;
 		} else {
 			IF_DEBUG("[uninstall]    in use by newer installation; leaving in place\n");
@@ -1009,33 +1414,139 @@ int Depot::uninstall_file(File* file, void* ctx) {
 		}
 	}
 
-	fprintf(stdout, "%c %s\n", state, file->path());
+	PROBE2(uninstall, file->path(), state);
+	PROGRESS(clear());
+	fprintf(Context::current()->output, "%c %s\n", state, file->path());
 
 	if (res != 0) fprintf(stderr, "%s:%d: uninstall failed: %s\n", 
 						  __FILE__, __LINE__, file->path());
 
+	delete actual;
 	free(actpath);
 	return res;
 }
 
-int Depot::uninstall(Archive* archive) {
-	extern uint32_t verbosity;
-	extern uint32_t force;
-	extern uint32_t dryrun;
-	int res = 0;
+// The files an uninstall restores, grouped by the archive whose backing
+//  store holds them, so only those are expanded instead of every store.
+struct RestoreArchive {
+	Archive* archive;
+	char** paths;
+	uint32_t count;
+	bool whole; // a directory is renamed back with its contents
+	int result;
+};
 
-	assert(archive != NULL);
-	uint64_t serial = archive->serial();
+struct RestorePlan {
+	RestorePlan(Depot* d) {
+		depot = d;
+		archives = NULL;
+		count = 0;
+	}
 
-	if (INFO_TEST(archive->info(), ARCHIVE_INFO_ROLLBACK)) {
-		// if in debug mode, get_all_archives returns rollbacks too, so just ignore
-		if (verbosity & VERBOSE_DEBUG) {
-			fprintf(stderr, "[uninstall] skipping uninstall since archive is a rollback.\n");
-			return DEPOT_OK;
+	~RestorePlan() {
+		for (uint32_t i = 0; i < count; i++) {
+			for (uint32_t j = 0; j < archives[i].count; j++) free(archives[i].paths[j]);
+			free(archives[i].paths);
+			archives[i].archive->release();
 		}
-		fprintf(stderr, "%s:%d: cannot uninstall a rollback archive.\n", __FILE__, __LINE__);
-		return DEPOT_ERROR;
+		free(archives);
+	}
+
+	RestoreArchive* find(Archive* archive) {
+		for (uint32_t i = count; i > 0; i--) {
+			if (archives[i - 1].archive->serial() == archive->serial()) return &archives[i - 1];
+		}
+		RestoreArchive* list = (RestoreArchive*)realloc(archives, (count + 1) * sizeof(RestoreArchive));
+		if (!list) return NULL;
+		archives = list;
+		RestoreArchive* entry = &archives[count++];
+		entry->archive = archive->retain();
+		entry->paths = NULL;
+		entry->count = 0;
+		entry->whole = false;
+		entry->result = 0;
+		return entry;
+	}
+
+	int add(File* file, bool whole) {
+		RestoreArchive* entry = this->find(file->archive());
+		if (!entry) return -1;
+		if (whole) {
+			entry->whole = true;
+			return 0;
+		}
+		char** paths = (char**)realloc(entry->paths, (entry->count + 1) * sizeof(char*));
+		if (!paths) return -1;
+		entry->paths = paths;
+		entry->paths[entry->count] = strdup(file->path());
+		if (!entry->paths[entry->count]) return -1;
+		entry->count++;
+		return 0;
+	}
+
+	Depot* depot;
+	RestoreArchive* archives;
+	uint32_t count;
+};
+
+// adds what restore_file will take from a backing store to put preceding
+//  back in place of file
+static int plan_restore_file(RestorePlan* plan, File* file, File* preceding) {
+	int res = 0;
+	if (preceding && !INFO_TEST(preceding->info(), FILE_INFO_NO_ENTRY)) {
+		uint32_t flags = File::compare(file, preceding);
+		if (INFO_TEST(flags, FILE_INFO_DATA_DIFFERS)) {
+			if (!S_ISDIR(preceding->mode())) {
+				res = plan->add(preceding, false);
+			} else if (INFO_TEST(flags, FILE_INFO_TYPE_DIFFERS)) {
+				res = plan->add(preceding, true);
+			}
+			// other directories are made anew, not taken from the store
+		}
+	}
+	if (res) fprintf(stderr, "Error: ran out of memory planning a restore\n");
+	return res;
+}
+
+int Depot::plan_restore(File* file, void* ctx) {
+	RestorePlan* plan = (RestorePlan*)ctx;
+
+	// the same tests as uninstall_file, except for the comparison with
+	//  the disk; a file it ends up skipping is only expanded in vain
+	if (INFO_TEST(file->info(), FILE_INFO_BASE_SYSTEM)) return DEPOT_OK;
+	File* superseded = plan->depot->file_superseded_by(file);
+	if (superseded) {
+		delete superseded;
+		return DEPOT_OK;
+	}
+	File* preceding = plan->depot->file_preceded_by(file);
+	int res = plan_restore_file(plan, file, preceding);
+	delete preceding;
+	return res;
+}
+
+static void expand_restore_archive(uint32_t index, void* context) {
+	RestorePlan* plan = (RestorePlan*)context;
+	RestoreArchive* entry = &plan->archives[index];
+	const char* prefix = plan->depot->archives_path();
+	if (entry->whole) {
+		entry->result = entry->archive->expand_directory(prefix);
+	} else {
+		entry->result = entry->archive->expand_files(prefix, entry->paths, entry->count);
 	}
+	if (entry->result) {
+		// whatever did come out is removed, so File::install falls back
+		//  to expanding the whole store when it misses a file
+		IF_DEBUG("[uninstall] could not expand files of %s, expanding on demand\n",
+				 entry->archive->name());
+		char* dirpath = entry->archive->directory_name(prefix);
+		if (dirpath) remove_directory(dirpath);
+		free(dirpath);
+	}
+}
+
+int Depot::check_build(Archive* archive) {
+	uint32_t force = Context::current()->force;
 
 	/** 
 	 * require -f to force uninstalling an archive installed on top of an older
@@ -1060,7 +1571,28 @@ int Depot::uninstall(Archive* archive) {
 				archive->name(), archive->build(), m_build);
 		return DEPOT_BUILD_MISMATCH;
 	}
+	return DEPOT_OK;
+}
+
+int Depot::uninstall(Archive* archive) {
+	uint32_t verbosity = Context::current()->verbosity;
+	uint32_t dryrun = Context::current()->dryrun;
+	int res = 0;
+
+	assert(archive != NULL);
+	uint64_t serial = archive->serial();
+
+	if (INFO_TEST(archive->info(), ARCHIVE_INFO_ROLLBACK)) {
+		// if in debug mode, get_all_archives returns rollbacks too, so just ignore
+		if (verbosity & VERBOSE_DEBUG) {
+			fprintf(stderr, "[uninstall] skipping uninstall since archive is a rollback.\n");
+			return DEPOT_OK;
+		}
+		fprintf(stderr, "%s:%d: cannot uninstall a rollback archive.\n", __FILE__, __LINE__);
+		return DEPOT_ERROR;
+	}
 
+	res = this->check_build(archive);
 	if (res != 0) return res;
 
 	if (!dryrun) {
@@ -1074,11 +1606,27 @@ int Depot::uninstall(Archive* archive) {
 		if (res == 0) res = this->commit_transaction();
 	}
 	
+	// expand just the files to be restored, one backing store per thread
+	RestorePlan plan(this);
+	PROBE3(phase, "uninstall", archive->name(), "expand");
+	if (!dryrun) {
+		if (res == 0) res = this->iterate_files(archive, &Depot::plan_restore, &plan, true);
+		if (res == 0) this->thread_pool()->apply(plan.count, &expand_restore_archive, &plan);
+	}
+
 	InstallContext context(this, archive);
 	context.reverse_files = true; // uninstall children before parents
-	if (res == 0) res = this->iterate_files(archive, &Depot::uninstall_file, &context);
+	PROBE3(phase, "uninstall", archive->name(), "restore");
+	if (res == 0 && Context::current()->progress) {
+		PROGRESS(begin("uninstall", archive->name(), "restore",
+					   m_db->count_archive_files(archive, FILE_INFO_NONE), 0));
+	}
+	if (res == 0) res = this->iterate_files(archive, &Depot::uninstall_file, &context,
+													   context.reverse_files);
+	PROGRESS(end());
 	
 	if (!dryrun) {
+		PROBE3(phase, "uninstall", archive->name(), "remove");
 		if (res == 0) res = this->begin_transaction();
 		uint32_t i;
 		for (i = 0; i < context.files_to_remove->count; ++i) {
@@ -1097,61 +1645,1146 @@ int Depot::uninstall(Archive* archive) {
 		if (res == 0) res = this->prune_archive(archive);
 	}
 	
-	if (res == 0) fprintf(stdout, "Uninstalled archive: %llu %s \n",
+	if (res == 0) fprintf(Context::current()->output, "Uninstalled archive: %llu %s \n",
 						  archive->serial(), archive->name());
+	PROBE3(done, "uninstall", archive->name(), res);
 
 	return res;
 }
 
-int Depot::verify_file(File* file, void* context) {
-	File* actual = FileFactory(file->path());
-	if (actual) {
-		uint32_t flags = File::compare(file, actual);
-		
-		if (flags != FILE_INFO_IDENTICAL) {
-			fprintf(stdout, "M ");
+int Depot::checkpoint(const char* name) {
+	int res = DEPOT_OK;
+
+	if (name) {
+		if (strlen(name) == 0) {
+			fprintf(stderr, "Error: invalid checkpoint name: '%s'\n", name);
+			return DEPOT_USAGE_ERROR;
+		}
+
+		// the newest archive, rollbacks included, marks where it is
+		uint8_t** archlist = NULL;
+		uint32_t archcount = 0;
+		uint64_t newest = 0;
+		if (m_db->get_archives(&archlist, &archcount, true) == DB_ERROR) return DEPOT_ERROR;
+		for (uint32_t i = 0; i < archcount; i++) {
+			uint64_t serial;
+			memcpy(&serial, &archlist[i][m_db->archive_offset(0)], sizeof(uint64_t));
+			if (serial > newest) newest = serial;
+			m_db->free_archive(archlist[i]);
+		}
+		free(archlist);
+
+		if (Context::current()->dryrun) return DEPOT_OK;
+		res = this->begin_transaction();
+		if (res == 0) res = m_db->insert_checkpoint(name, newest, time(NULL));
+		if (res == 0) {
+			res = this->commit_transaction();
 		} else {
-			fprintf(stdout, "  ");
+			this->rollback_transaction();
 		}
-	} else {
-		fprintf(stdout, "R ");
+		if (res == 0) fprintf(Context::current()->output,
+				"Checkpoint '%s' after archive %llu.\n", name, newest);
+		return res;
 	}
-	file->print(stdout);
-	return DEPOT_OK;
-}
-
-void Depot::archive_header() {
-	fprintf(stdout, "%-6s %-36s  %-12s  %-7s  %s\n", 
-			"Serial", "UUID", "Date", "Build", "Name");
-	fprintf(stdout, "====== ====================================  "
-			"============  =======  =================\n");	
-}
 
-int Depot::verify(Archive* archive) {
-	int res = 0;
-	this->archive_header();
-	list_archive(archive, stdout);	
-	hr();
-	if (res == 0) res = this->iterate_files(archive, &Depot::verify_file, NULL);
-	hr();
-	fprintf(stdout, "\n");
+	uint8_t** list = NULL;
+	uint32_t count = 0;
+	if (m_db->get_checkpoints(&list, &count) == DB_ERROR) return DEPOT_ERROR;
+	fprintf(Context::current()->output, "%-6s %-12s  %s\n", "After", "Date", "Name");
+	fprintf(Context::current()->output, "====== ============  =================\n");
+	for (uint32_t i = 0; i < count; i++) {
+		char* cpname;
+		uint64_t archive;
+		uint64_t date_added;
+		memcpy(&cpname, &list[i][m_db->checkpoint_offset(1)], sizeof(char*));
+		memcpy(&archive, &list[i][m_db->checkpoint_offset(2)], sizeof(uint64_t));
+		memcpy(&date_added, &list[i][m_db->checkpoint_offset(3)], sizeof(uint64_t));
+
+		char date[100];
+		struct tm local;
+		time_t seconds = (time_t)date_added;
+		localtime_r(&seconds, &local);
+		strftime(date, sizeof(date), "%b %e %H:%M", &local);
+		fprintf(Context::current()->output, "%-6llu %-12s  %s\n", archive, date, cpname);
+		m_db->free_checkpoint(list[i]);
+	}
+	free(list);
 	return res;
 }
 
-int Depot::list_archive(Archive* archive, void* context) {	
-	uint64_t serial = archive->serial();
-	
-	char uuid[37];
-	uuid_unparse_upper(archive->uuid(), uuid);
-
-	char date[100];
-	struct tm local;
-	time_t seconds = archive->date_installed();
-	localtime_r(&seconds, &local);
-	strftime(date, sizeof(date), "%b %e %H:%M", &local);
+int Depot::undo(const char* name) {
+	uint32_t dryrun = Context::current()->dryrun;
+	int res = DEPOT_OK;
 
-	fprintf((FILE*)context, "%-6llu %-36s  %-12s  %-7s  %s\n", 
-			serial, uuid, date, (archive->build()?archive->build():""), archive->name());
+	uint8_t* data = NULL;
+	res = m_db->get_checkpoint(&data, name);
+	if (res == DB_ERROR) return DEPOT_ERROR;
+	if (!FOUND(res)) {
+		if (name) {
+			fprintf(stderr, "Error: no checkpoint named '%s'.\n", name);
+		} else {
+			fprintf(stderr, "Error: there are no checkpoints to undo to.\n");
+		}
+		return DEPOT_NOT_EXIST;
+	}
+	uint64_t since;
+	char* cpname;
+	memcpy(&cpname, &data[m_db->checkpoint_offset(1)], sizeof(char*));
+	memcpy(&since, &data[m_db->checkpoint_offset(2)], sizeof(uint64_t));
+	char* label = strdup(cpname);
+	m_db->free_checkpoint(data);
+	res = DEPOT_OK;
+
+	// every archive installed since, with the rollbacks their installs
+	//  made, newest first
+	uint8_t** archlist = NULL;
+	uint32_t archcount = 0;
+	if (m_db->get_archives_after(&archlist, &archcount, since) == DB_ERROR) {
+		res = DEPOT_ERROR;
+	}
+	Archive** archives = (Archive**)calloc(archcount + 1, sizeof(Archive*));
+	if (!archives) res = DEPOT_ERROR;
+	uint32_t undone = 0;
+	for (uint32_t i = 0; i < archcount; i++) {
+		if (archives) {
+			archives[i] = m_db->make_archive(archlist[i]);
+		} else {
+			m_db->free_archive(archlist[i]);
+		}
+	}
+	free(archlist);
+	for (uint32_t i = 0; res == 0 && i < archcount; i++) {
+		if (INFO_TEST(archives[i]->info(), ARCHIVE_INFO_ROLLBACK)) continue;
+		res = this->check_build(archives[i]);
+		undone++;
+	}
+	if (res == 0 && undone == 0) {
+		fprintf(Context::current()->output,
+				"Nothing to undo since checkpoint '%s'.\n", label);
+	}
+	if (res || undone == 0) {
+		for (uint32_t i = 0; archives && i < archcount; i++) archives[i]->release();
+		free(archives);
+		free(label);
+		return res;
+	}
+
+	// marked inactive first, as uninstall does, so an interrupted undo
+	//  is noticed and finished by uninstalling what is left
+	if (!dryrun) {
+		if (res == 0) res = this->prune_directories();
+		if (res == 0) res = this->begin_transaction();
+		for (uint32_t i = 0; res == 0 && i < archcount; i++) {
+			if (INFO_TEST(archives[i]->info(), ARCHIVE_INFO_ROLLBACK)) continue;
+			res = m_db->deactivate_archive(archives[i]->serial());
+		}
+		if (res == 0) res = this->commit_transaction();
+	}
+
+	// the records of those archives by path, children before parents.
+	//  The newest record of a path is what should be on disk now, and
+	//  whatever preceded the oldest is what was there at the checkpoint,
+	//  so each path is put back once, however many archives changed it.
+	//  The records are kept compactly in one pool, along with what
+	//  preceded each path, and Files are only made for one path at a time.
+	FilePool files;
+	if (res == 0 && m_db->get_undo_files(&files, since) == DB_ERROR) {
+		res = DEPOT_ERROR;
+	}
+	uint32_t filecount = files.count();
+	FileRecord** preceding = (FileRecord**)calloc(filecount + 1, sizeof(FileRecord*));
+	if (!preceding) res = DEPOT_ERROR;
+
+	// expand just the files to be restored, one backing store per thread
+	RestorePlan plan(this);
+	PROBE3(phase, "undo", label, "expand");
+	for (uint32_t i = 0, last; res == 0 && i < filecount; i = last + 1) {
+		last = i;
+		while (last + 1 < filecount && 
+			   FilePool::same_path(files.record(last + 1), files.record(i))) last++;
+		if (INFO_TEST(files.record(last)->info, FILE_INFO_BASE_SYSTEM)) continue;
+		File* oldest = FileFactory(&files, files.record(i));
+		File* newest = FileFactory(&files, files.record(last));
+		File* before = oldest ? this->file_preceded_by(oldest) : NULL;
+		assert(!oldest || before != NULL);
+		if (!newest || !before) res = DEPOT_ERROR;
+		if (res == 0) {
+			preceding[i] = files.add(before);
+			if (!preceding[i]) res = DEPOT_ERROR;
+		}
+		if (res == 0 && !dryrun) res = plan_restore_file(&plan, newest, before);
+		delete oldest;
+		delete newest;
+		delete before;
+	}
+	if (res == 0 && !dryrun) this->thread_pool()->apply(plan.count, &expand_restore_archive, &plan);
+
+	InstallContext context(this, NULL);
+	context.reverse_files = true;
+	PROBE3(phase, "undo", label, "restore");
+	if (res == 0 && Context::current()->progress) {
+		PROGRESS(begin("undo", label, "restore", filecount, 0));
+	}
+	for (uint32_t i = 0, last; res == 0 && i < filecount; i = last + 1) {
+		last = i;
+		while (last + 1 < filecount && 
+			   FilePool::same_path(files.record(last + 1), files.record(i))) last++;
+		char state = ' ';
+		PROGRESS(step(last + 1 - i, 0));
+		if (INFO_TEST(files.record(last)->info, FILE_INFO_BASE_SYSTEM)) continue;
+		File* file = FileFactory(&files, files.record(last));
+		File* before = FileFactory(&files, preceding[i]);
+		if (!file || !before) {
+			delete file;
+			delete before;
+			res = DEPOT_ERROR;
+			break;
+		}
+
+		// the same tests as uninstall_file, against the newest record
+		char* actpath;
+		join_path(&actpath, m_prefix, file->path());
+		File* actual = FileFactory(actpath);
+		if (actual == NULL) {
+			state = '!';
+		} else if (File::compare(file, actual) != FILE_INFO_IDENTICAL) {
+			IF_DEBUG("[undo]    changes since install; skipping\n");
+		} else {
+			res = Depot::restore_file(file, before, actual, &context, &state);
+		}
+		delete actual;
+		free(actpath);
+
+		PROBE2(uninstall, file->path(), state);
+		PROGRESS(clear());
+		fprintf(Context::current()->output, "%c %s\n", state, file->path());
+		if (res != 0) fprintf(stderr, "%s:%d: undo failed: %s\n", 
+							  __FILE__, __LINE__, file->path());
+		delete file;
+		delete before;
+	}
+	PROGRESS(end());
+
+	// forget the archives, their rollbacks, and the checkpoints made
+	//  since, all at once
+	if (!dryrun) {
+		PROBE3(phase, "undo", label, "remove");
+		if (res == 0) res = this->begin_transaction();
+		for (uint32_t i = 0; res == 0 && i < context.files_to_remove->count; ++i) {
+			res = m_db->delete_file(context.files_to_remove->values[i]);
+		}
+		for (uint32_t i = 0; res == 0 && i < archcount; i++) {
+			res = this->remove(archives[i]);
+		}
+		if (res == 0) res = m_db->delete_checkpoints_after(since);
+		if (res == 0) {
+			res = this->commit_transaction();
+		} else {
+			this->rollback_transaction();
+		}
+
+		// rollbacks of installs which replaced nothing have no store
+		if (res == 0) res = this->prune_directories();
+		for (uint32_t i = 0; res == 0 && i < archcount; i++) {
+			char* tarpath = archives[i]->compacted_path(m_archives_path);
+			if (tarpath && access(tarpath, F_OK) == 0) {
+				res = archives[i]->prune_compacted_archive(m_archives_path);
+			}
+			free(tarpath);
+		}
+	}
+
+	for (uint32_t i = 0; archives && i < archcount; i++) {
+		if (res == 0 && !INFO_TEST(archives[i]->info(), ARCHIVE_INFO_ROLLBACK)) {
+			fprintf(Context::current()->output, "Uninstalled archive: %llu %s \n",
+					archives[i]->serial(), archives[i]->name());
+		}
+		archives[i]->release();
+	}
+	if (res == 0) fprintf(Context::current()->output,
+			"Undid %u archive%s since checkpoint '%s'.\n",
+						  undone, undone == 1 ? "" : "s", label);
+	PROBE3(done, "undo", label, res);
+
+	free(preceding);
+	free(archives);
+	free(label);
+	return res;
+}
+
+char Depot::verify_status(File* file, verify_mode_t mode) {
+	char status = ' ';
+	char* path;
+	join_path(&path, this->prefix(), file->path());
+
+	// records from before mtime was tracked always get digested
+	if (mode == VERIFY_QUICK && file->mtime() != 0) {
+		struct stat sb;
+		if (lstat(path, &sb) == -1) {
+			status = 'R';
+		} else if (sb.st_mode != file->mode() || sb.st_uid != file->uid() 
+				   || sb.st_gid != file->gid()) {
+			status = 'M';
+		} else if ((S_ISREG(sb.st_mode) || S_ISLNK(sb.st_mode))
+				   && (sb.st_size != file->size() || sb.st_mtime != file->mtime())) {
+			// directory sizes and times change with their contents
+			status = 'M';
+		}
+	} else {
+		File* actual = FileFactory(path);
+		if (!actual) {
+			status = 'R';
+		} else if (File::compare(file, actual) != FILE_INFO_IDENTICAL) {
+			status = 'M';
+		}
+		delete actual;
+	}
+
+	free(path);
+	return status;
+}
+
+int Depot::verify_file(File* file, char status, void* context) {
+	// context, if given, counts the files which match the disk
+	if (context && status == ' ') (*(uint64_t*)context)++;
+	fprintf(Context::current()->output, "%c ", status);
+	file->print(Context::current()->output);
+	return DEPOT_OK;
+}
+
+void Depot::archive_header() {
+	fprintf(Context::current()->output, "%-6s %-36s  %-12s  %-7s  %s\n", 
+			"Serial", "UUID", "Date", "Build", "Name");
+	fprintf(Context::current()->output, "====== ====================================  "
+			"============  =======  =================\n");	
+}
+
+int Depot::verify(Archive* archive) {
+	uint32_t dryrun = Context::current()->dryrun;
+	int res = 0;
+	uint64_t unchanged = 0;
+	time_t started = time(NULL);
+	this->archive_header();
+	list_archive(archive, Context::current()->output);	
+	hr();
+	if (res == 0) res = this->iterate_verified_files(archive, m_verify_mode,
+													  &Depot::verify_file, &unchanged);
+	hr();
+	fprintf(Context::current()->output, "\n");
+
+	// remember whether anything still matches the disk, which decides if
+	//  the archive was superseded by external changes. Only possible for
+	//  those who can write the database, and not worth failing over.
+	if (res == 0 && !dryrun && access(m_database_path, W_OK) == 0 &&
+		this->begin_transaction() == 0) {
+		if (this->m_db->set_archive_verified(archive, unchanged, started) == 0) {
+			this->commit_transaction();
+		} else {
+			this->rollback_transaction();
+		}
+	}
+	return res;
+}
+
+int Depot::verify(int count, char** args) {
+	int res = 0;
+	m_verify_mode = VERIFY_DEEP;
+	for (int i = 0; res == 0 && i < count; i++) {
+		if (strcmp(args[i], "-q") == 0) {
+			m_verify_mode = VERIFY_QUICK;
+		} else if (strcmp(args[i], "-d") == 0) {
+			m_verify_mode = VERIFY_DEEP;
+		} else {
+			res = this->process_archive("verify", args[i]);
+		}
+	}
+	m_verify_mode = VERIFY_DEEP;
+	return res;
+}
+
+// the backing store of one archive, checked by fsck on the thread pool
+struct FsckArchive {
+	Archive*  archive;
+	char*     tarpath;
+	char**    paths;     // records that must be in the backing store
+	uint32_t  count;
+	bool      expected;  // whether the archive should have a backing store
+	bool      list;      // read the backing store even if it is unchanged
+	uint32_t* missing;   // indexes of paths not in the backing store
+	uint32_t  missing_count;
+	char      status;    // ' ', 'R' (no backing store), '!' (unreadable)
+};
+
+struct FsckArchives {
+	const char*  prefix;
+	time_t       since;
+	FsckArchive* checks;
+};
+
+static int fsck_compare_names(const void* a, const void* b) {
+	return strcmp(*(char**)a, *(char**)b);
+}
+
+static void fsck_backing_store(uint32_t index, void* context) {
+	FsckArchives* batch = (FsckArchives*)context;
+	FsckArchive* check = &batch->checks[index];
+	if (!check->expected) return;
+
+	struct stat sb;
+	if (stat(check->tarpath, &sb) == -1) {
+		check->status = 'R';
+		return;
+	}
+	// unchanged since the last clean fsck
+	if (!check->list && sb.st_ctime < batch->since) return;
+
+	char** names;
+	uint32_t count;
+	if (check->archive->list_compacted(batch->prefix, &names, &count)) {
+		check->status = '!';
+		return;
+	}
+	qsort(names, count, sizeof(char*), &fsck_compare_names);
+	check->missing = (uint32_t*)malloc(check->count * sizeof(uint32_t));
+	for (uint32_t i = 0; check->missing && i < check->count; i++) {
+		if (!bsearch(&check->paths[i], names, count, sizeof(char*), 
+					 &fsck_compare_names)) {
+			check->missing[check->missing_count++] = i;
+		}
+	}
+	for (uint32_t i = 0; i < count; i++) free(names[i]);
+	free(names);
+}
+
+static void fsck_archive_problem(Archive* archive, const char* problem, 
+								 const char* detail) {
+	fprintf(Context::current()->output, "Archive %llu (%s): %s%s%s\n", archive->serial(), 
+			archive->name(), problem, (detail ? " " : ""), (detail ? detail : ""));
+}
+
+int Depot::fsck_archives(uint64_t since_serial, time_t since, 
+						 uint64_t* newest, uint32_t* problems) {
+	int res = DB_OK;
+	uint8_t** archlist;
+	uint32_t count = 0;
+	res = this->m_db->get_archives(&archlist, &count, true);
+	if (res == DB_ERROR) return DEPOT_ERROR;
+
+	FsckArchive* checks = (FsckArchive*)calloc(count, sizeof(FsckArchive));
+	if (count && !checks) {
+		fprintf(stderr, "Error: ran out of memory in Depot::fsck_archives\n");
+		return DEPOT_ERROR;
+	}
+
+	// collect what each backing store should hold; the database
+	//  is only used from this thread
+	res = DEPOT_OK;
+	for (uint32_t i = 0; res == DEPOT_OK && i < count; i++) {
+		FsckArchive* check = &checks[i];
+		check->archive = this->m_db->make_archive(archlist[i]);
+		if (!check->archive) {
+			fprintf(stderr, "%s:%d: DB::make_archive returned NULL\n", __FILE__, __LINE__);
+			res = DEPOT_ERROR;
+			break;
+		}
+		if (check->archive->serial() > *newest) *newest = check->archive->serial();
+		check->tarpath = check->archive->compacted_path(m_archives_path);
+		check->list = check->archive->serial() > since_serial;
+		check->status = ' ';
+
+		// rollback archives only store the data they displaced
+		bool rollback = INFO_TEST(check->archive->info(), ARCHIVE_INFO_ROLLBACK);
+		FilePool records;
+		if (!FOUND(this->m_db->get_files(&records, check->archive, false))) continue;
+		check->paths = (char**)malloc(records.count() * sizeof(char*));
+		for (uint32_t j = 0; j < records.count(); j++) {
+			FileRecord* record = records.record(j);
+			char path[PATH_MAX];
+			if (rollback ? INFO_TEST(record->info, FILE_INFO_ROLLBACK_DATA)
+				         : !INFO_TEST(record->info, FILE_INFO_NO_ENTRY)) {
+				if (check->paths && records.path(record, path, sizeof(path)) && 
+					strcmp(path, "/") != 0) {
+					check->paths[check->count++] = strdup(path);
+				}
+				check->expected = true;
+			}
+		}
+	}
+	free(archlist);
+
+	FsckArchives batch = { m_archives_path, since, checks };
+	if (res == DEPOT_OK) this->thread_pool()->apply(count, &fsck_backing_store, &batch);
+
+	// report oldest first
+	for (uint32_t i = count; res == DEPOT_OK && i > 0; i--) {
+		FsckArchive* check = &checks[i - 1];
+		if (check->status == 'R') {
+			fsck_archive_problem(check->archive, "missing backing store", check->tarpath);
+			(*problems)++;
+		} else if (check->status == '!') {
+			fsck_archive_problem(check->archive, "unreadable backing store", check->tarpath);
+			(*problems)++;
+		}
+		for (uint32_t j = 0; j < check->missing_count; j++) {
+			fsck_archive_problem(check->archive, "not in backing store:", 
+								 check->paths[check->missing[j]]);
+			(*problems)++;
+		}
+	}
+
+	char** orphans;
+	uint32_t orphan_count = 0;
+	if (res == DEPOT_OK) res = this->orphaned_backing_stores(&orphans, &orphan_count);
+	for (uint32_t i = 0; res == DEPOT_OK && i < orphan_count; i++) {
+		fprintf(Context::current()->output, "Orphaned backing store: %s\n", orphans[i]);
+		free(orphans[i]);
+		(*problems)++;
+	}
+	if (res == DEPOT_OK) free(orphans);
+
+	for (uint32_t i = 0; i < count; i++) {
+		for (uint32_t j = 0; j < checks[i].count; j++) free(checks[i].paths[j]);
+		free(checks[i].paths);
+		free(checks[i].missing);
+		free(checks[i].tarpath);
+		if (checks[i].archive) checks[i].archive->release();
+	}
+	free(checks);
+	return res;
+}
+
+int Depot::fsck_records(uint32_t* problems) {
+	int res = DB_OK;
+	uint64_t* serials;
+	uint32_t count = 0;
+	res = this->m_db->get_inactive_archive_serials(&serials, &count);
+	if (res == DB_ERROR) return DEPOT_ERROR;
+	for (uint32_t i = 0; FOUND(res) && i < count; i++) {
+		Archive* archive = this->archive(serials[i]);
+		if (archive) fsck_archive_problem(archive, "inactive", NULL);
+		if (archive) archive->release();
+		(*problems)++;
+	}
+	free(serials);
+
+	uint8_t** list;
+	res = this->m_db->get_empty_archives(&list, &count);
+	if (res == DB_ERROR) return DEPOT_ERROR;
+	for (uint32_t i = 0; i < count; i++) {
+		Archive* archive = this->m_db->make_archive(list[i]);
+		if (archive) fsck_archive_problem(archive, "no files", NULL);
+		if (archive) archive->release();
+		(*problems)++;
+	}
+	free(list);
+
+	res = this->m_db->get_dangling_files(&list, &count);
+	if (res == DB_ERROR) return DEPOT_ERROR;
+	for (uint32_t i = 0; i < count; i++) {
+		uint64_t serial;
+		char* path;
+		memcpy(&serial, &list[i][this->m_db->file_offset(1)], sizeof(uint64_t));
+		memcpy(&path, &list[i][this->m_db->file_offset(8)], sizeof(char*));
+		fprintf(Context::current()->output,
+				"Dangling record: archive %llu: %s\n", serial, path);
+		this->m_db->free_file(list[i]);
+		(*problems)++;
+	}
+	free(list);
+
+	return DEPOT_OK;
+}
+
+// files compared against their current owners between each in-order
+//  round of output
+struct FsckFiles {
+	Depot*  depot;
+	time_t  since;
+	File**  files;
+	bool*   known;   // owner archive was present at the last clean fsck
+	char*   status;
+};
+
+static void fsck_owner_file(uint32_t index, void* context) {
+	FsckFiles* batch = (FsckFiles*)context;
+	File* file = batch->files[index];
+	char* path;
+	join_path(&path, batch->depot->prefix(), file->path());
+	struct stat sb;
+	bool unchanged = batch->known[index] && lstat(path, &sb) == 0 
+		&& sb.st_ctime < batch->since;
+	free(path);
+	if (unchanged) {
+		batch->status[index] = ' ';
+	} else {
+		batch->status[index] = batch->depot->verify_status(file, VERIFY_DEEP);
+	}
+}
+
+int Depot::fsck_files(uint64_t since_serial, time_t since, uint32_t* problems) {
+	int res = DB_OK;
+	FilePool records;
+	res = this->m_db->get_current_files(&records);
+	if (!FOUND(res)) return res == DB_OK ? DEPOT_OK : DEPOT_ERROR;
+	uint32_t count = records.count();
+
+	File* files[VERIFY_BATCH];
+	bool known[VERIFY_BATCH];
+	char status[VERIFY_BATCH];
+	FsckFiles batch = { this, since, files, known, status };
+	ThreadPool* pool = this->thread_pool();
+
+	res = DEPOT_OK;
+	uint32_t next = 0;
+	while (res == DEPOT_OK && next < count) {
+		uint32_t made = 0;
+		while (made < VERIFY_BATCH && next < count) {
+			FileRecord* record = records.record(next++);
+			files[made] = FileFactory(&records, record);
+			if (!files[made]) {
+				fprintf(stderr, "%s:%d: FileFactory returned NULL\n", __FILE__, __LINE__);
+				res = DEPOT_ERROR;
+				break;
+			}
+			known[made] = record->archive->serial() <= since_serial;
+			made++;
+		}
+		if (res == DEPOT_OK) pool->apply(made, &fsck_owner_file, &batch);
+		for (uint32_t i = 0; i < made; i++) {
+			if (res == DEPOT_OK && status[i] != ' ') {
+				verify_file(files[i], status[i], NULL);
+				(*problems)++;
+			}
+			delete files[i];
+		}
+	}
+
+	return res;
+}
+
+int Depot::fsck(int count, char** args) {
+	int res = DEPOT_OK;
+	bool all = false;
+	for (int i = 0; i < count; i++) {
+		if (strcmp(args[i], "-a") == 0) {
+			all = true;
+		} else {
+			fprintf(stderr, "Error: unknown fsck option: %s\n", args[i]);
+			return DEPOT_USAGE_ERROR;
+		}
+	}
+
+	// anything that changes during the scan is rechecked next time
+	time_t started = time(NULL);
+	uint64_t since_serial = 0;
+	time_t since = 0;
+	if (!all && this->m_db->get_fsck_checkpoint(&since_serial, &since) == DB_ERROR) {
+		return DEPOT_ERROR;
+	}
+
+	uint32_t problems = 0;
+	uint64_t newest = 0;
+	res = this->fsck_archives(since_serial, since, &newest, &problems);
+	if (res == DEPOT_OK) res = this->fsck_records(&problems);
+	if (res == DEPOT_OK) res = this->fsck_files(since_serial, since, &problems);
+	if (res) return res;
+
+	if (problems) {
+		fprintf(Context::current()->output,
+				"fsck: %u problem%s found\n", problems, (problems == 1 ? "" : "s"));
+		return DEPOT_ERROR;
+	}
+	fprintf(Context::current()->output, "fsck: no problems found\n");
+	if (this->m_db->set_fsck_checkpoint(newest, started) != DB_OK) {
+		fprintf(stderr, "Error: unable to save fsck checkpoint.\n");
+		return DEPOT_ERROR;
+	}
+	return DEPOT_OK;
+}
+
+// size of the compacted backing store and pack, 0 if there are none
+static uint64_t compacted_size(Archive* archive, const char* prefix) {
+	uint64_t size = 0;
+	char* tarpath = archive->compacted_path(prefix);
+	char* packpath = archive->packed_path(prefix);
+	struct stat sb;
+	if (tarpath && stat(tarpath, &sb) == 0) size = sb.st_size;
+	if (packpath && stat(packpath, &sb) == 0) size += sb.st_size;
+	free(tarpath);
+	free(packpath);
+	return size;
+}
+
+uint64_t Depot::backing_store_size() {
+	uint64_t size = 0;
+	DIR* dir = opendir(m_archives_path);
+	if (!dir) return 0;
+	struct dirent* ent;
+	while ((ent = readdir(dir)) != NULL) {
+		char* path;
+		struct stat sb;
+		join_path(&path, m_archives_path, ent->d_name);
+		if (lstat(path, &sb) == 0 && S_ISREG(sb.st_mode)) size += sb.st_size;
+		free(path);
+	}
+	closedir(dir);
+	return size;
+}
+
+Archive* Depot::rollback_of(Archive* archive) {
+	// the rollback archive is always inserted just before its archive
+	Archive* rollback = this->archive(archive->serial() - 1);
+	if (rollback && !INFO_TEST(rollback->info(), ARCHIVE_INFO_ROLLBACK)) {
+		rollback->release();
+		rollback = NULL;
+	}
+	return rollback;
+}
+
+struct DuTotals {
+	Depot*   depot;
+	uint64_t installed;
+	uint64_t rollback;
+	uint64_t stored;
+};
+
+int Depot::du_archive(Archive* archive, void* context) {
+	DuTotals* totals = (DuTotals*)context;
+	Depot* depot = totals->depot;
+	uint64_t files = 0;
+	uint64_t installed = 0;
+	uint64_t rollback = 0;
+	depot->m_db->get_archive_summary(archive, &files, &installed, &rollback);
+	uint64_t stored = compacted_size(archive, depot->m_archives_path);
+	Archive* rollback_archive = depot->rollback_of(archive);
+	if (rollback_archive) {
+		stored += compacted_size(rollback_archive, depot->m_archives_path);
+		rollback_archive->release();
+	}
+	totals->installed += installed;
+	totals->rollback += rollback;
+	totals->stored += stored;
+
+	char sizes[3][16];
+	fprintf(Context::current()->output, "%-6llu %9s  %9s  %9s  %s\n", archive->serial(), 
+			format_size(installed, sizes[0], sizeof(sizes[0])),
+			format_size(rollback, sizes[1], sizeof(sizes[1])),
+			format_size(stored, sizes[2], sizeof(sizes[2])),
+			archive->name());
+	return DEPOT_OK;
+}
+
+int Depot::du(int count, char** args) {
+	int res = DEPOT_OK;
+	DuTotals totals = { this, 0, 0, 0 };
+
+	fprintf(Context::current()->output, "%-6s %9s  %9s  %9s  %s\n", 
+			"Serial", "Installed", "Rollback", "Stored", "Name");
+	fprintf(Context::current()->output,
+			"====== =========  =========  =========  =================\n");
+
+	if (count == 0) {
+		res = this->iterate_archives(&Depot::du_archive, &totals);
+	}
+	for (int i = 0; res == DEPOT_OK && i < count; i++) {
+		uint32_t archcount = 0;
+		Archive** list = this->get_archives(args[i], &archcount);
+		if (!list) return DEPOT_ERROR;
+		for (uint32_t j = 0; j < archcount; j++) {
+			if (!list[j]) {
+				fprintf(Context::current()->output, "Archive not found: %s\n", args[i]);
+				res = DEPOT_NOT_EXIST;
+				continue;
+			}
+			if (res == DEPOT_OK) res = du_archive(list[j], &totals);
+			if (list[j]) list[j]->release();
+		}
+		free(list);
+	}
+
+	// the archives directory also holds the rollbacks of uninstalled
+	//  archives, and anything gc can remove
+	char sizes[4][16];
+	fprintf(Context::current()->output,
+			"====== =========  =========  =========  =================\n");
+	fprintf(Context::current()->output, "%-6s %9s  %9s  %9s\n", "Total",
+			format_size(totals.installed, sizes[0], sizeof(sizes[0])),
+			format_size(totals.rollback, sizes[1], sizeof(sizes[1])),
+			format_size(totals.stored, sizes[2], sizeof(sizes[2])));
+	fprintf(Context::current()->output, "Backing store: %s in %s\n", 
+			format_size(this->backing_store_size(), sizes[3], sizeof(sizes[3])),
+			m_archives_path);
+	return res;
+}
+
+int Depot::gc(int count, char** args) {
+	uint32_t dryrun = Context::current()->dryrun;
+	int res = DEPOT_OK;
+	bool budgeted = false;
+	uint64_t budget = 0;
+	for (int i = 0; i < count; i++) {
+		if (strcmp(args[i], "-s") == 0 && i + 1 < count && 
+			parse_size(args[i + 1], &budget) == 0) {
+			budgeted = true;
+			i++;
+		} else {
+			fprintf(stderr, "Error: invalid gc argument: %s\n", args[i]);
+			return DEPOT_USAGE_ERROR;
+		}
+	}
+
+	uint64_t before = this->backing_store_size();
+	uint64_t freed = 0;
+	char sizes[3][16];
+
+	// anything in the archives directory that no archive refers to
+	char** orphans;
+	uint32_t orphan_count = 0;
+	res = this->orphaned_backing_stores(&orphans, &orphan_count);
+	for (uint32_t i = 0; res == DEPOT_OK && i < orphan_count; i++) {
+		struct stat sb;
+		fprintf(Context::current()->output,
+				"Removing orphaned backing store: %s\n", orphans[i]);
+		if (lstat(orphans[i], &sb) == 0 && S_ISREG(sb.st_mode)) freed += sb.st_size;
+		if (!dryrun && S_ISDIR(sb.st_mode)) {
+			res = remove_directory(orphans[i]);
+		} else if (!dryrun && unlink(orphans[i]) == -1) {
+			perror(orphans[i]);
+			res = DEPOT_ERROR;
+		}
+	}
+	for (uint32_t i = 0; i < orphan_count; i++) free(orphans[i]);
+	if (orphan_count) free(orphans);
+
+	// rollbacks keep records, and their backing store, for files that
+	//  no archive will ever restore, and archives may be left without
+	//  any files. A dry run reports what would go, then rolls back.
+	if (res == DEPOT_OK) res = this->begin_transaction();
+	if (res == DEPOT_OK) res = this->m_db->delete_unreachable_rollback_files();
+	uint32_t archcount = 0;
+	Archive** list = NULL;
+	if (res == DEPOT_OK) {
+		uint8_t** archlist;
+		if (this->m_db->get_archives(&archlist, &archcount, true) == DB_ERROR) {
+			res = DEPOT_ERROR;
+			archcount = 0;
+		}
+		list = (Archive**)calloc(archcount + 1, sizeof(Archive*));
+		for (uint32_t i = 0; i < archcount; i++) {
+			if (list) {
+				list[i] = this->m_db->make_archive(archlist[i]);
+			} else {
+				this->m_db->free_archive(archlist[i]);
+			}
+		}
+		free(archlist);
+		if (!list) {
+			fprintf(stderr, "Error: ran out of memory in Depot::gc\n");
+			res = DEPOT_ERROR;
+			archcount = 0;
+		}
+	}
+	for (uint32_t i = 0; res == DEPOT_OK && i < archcount; i++) {
+		Archive* archive = list[i];
+		if (!archive) continue;
+		uint64_t size = compacted_size(archive, m_archives_path);
+		if (this->m_db->count_archive_files(archive, FILE_INFO_NONE) == 0) {
+			// removed with its record below
+			fprintf(Context::current()->output, "Removing empty archive: %llu %s\n", 
+					archive->serial(), archive->name());
+			freed += size;
+		} else if (size && INFO_TEST(archive->info(), ARCHIVE_INFO_ROLLBACK) &&
+				   this->m_db->count_archive_files(archive, FILE_INFO_ROLLBACK_DATA) == 0) {
+			fprintf(Context::current()->output,
+					"Removing unused backing store of archive: %llu %s\n",
+					archive->serial(), archive->name());
+			freed += size;
+			if (!dryrun) res = archive->prune_compacted_archive(m_archives_path);
+		}
+	}
+	for (uint32_t i = 0; i < archcount; i++) {
+		if (list[i]) list[i]->release();
+	}
+	free(list);
+	if (res == DEPOT_OK && !dryrun) res = this->prune_empty_archives();
+	if (res == DEPOT_OK && !dryrun) {
+		res = this->commit_transaction();
+	} else {
+		this->rollback_transaction();
+	}
+
+	// then uninstall the oldest archives whose every file a newer archive
+	//  replaced, until under budget. Uninstalling those only drops records
+	//  and backing stores, so this changes nothing on disk outside the
+	//  depot; archives superseded by external changes are left alone.
+	uint64_t size = before - freed;
+	if (res == DEPOT_OK && budgeted && size > budget) {
+		Archive** superseded = this->get_superseded_archives(&archcount, true);
+		if (!superseded) return DEPOT_ERROR;
+		for (uint32_t i = archcount; i > 0; i--) {
+			Archive* archive = superseded[i - 1];
+			if (res == DEPOT_OK && size > budget) {
+				uint64_t stored = compacted_size(archive, m_archives_path);
+				res = this->uninstall(archive);
+				if (res == DEPOT_OK) {
+					size -= stored;
+					freed += stored;
+				}
+			}
+			if (archive) archive->release();
+		}
+		free(superseded);
+		if (res == DEPOT_OK && size > budget) {
+			fprintf(Context::current()->output,
+					"Backing store of %s is over the budget of %s; "
+					"uninstall archives to free more.\n",
+					format_size(size, sizes[0], sizeof(sizes[0])),
+					format_size(budget, sizes[1], sizeof(sizes[1])));
+		}
+	}
+
+	if (res == DEPOT_OK) {
+		if (!dryrun) size = this->backing_store_size();
+		fprintf(Context::current()->output, "gc: freed %s, backing store is %s\n",
+				format_size(freed, sizes[0], sizeof(sizes[0])),
+				format_size(size, sizes[2], sizeof(sizes[2])));
+	}
+	return res;
+}
+
+// links a backing store into another depot, or clones or copies it when
+//  the depots are on different filesystems. Backing stores are never
+//  modified once written, so sharing the inode is safe. Rollbacks which
+//  saved no data may have none.
+static int link_backing_store(const char* src, const char* dst) {
+	if (unlink(dst) == -1 && errno != ENOENT) {
+		perror(dst);
+		return DEPOT_ERROR;
+	}
+	if (link(src, dst) == 0) return DEPOT_OK;
+	if (errno == ENOENT && access(src, F_OK) == -1) return DEPOT_OK;
+	IF_DEBUG("[clone] link(%s, %s): %s\n", src, dst, strerror(errno));
+#ifdef COPYFILE_CLONE
+	int res = copyfile(src, dst, NULL, COPYFILE_ALL | COPYFILE_CLONE);
+#else
+	int res = copyfile(src, dst, NULL, COPYFILE_ALL);
+#endif
+	if (res) {
+		fprintf(stderr, "%s:%d: %s: %s (%d)\n", 
+				__FILE__, __LINE__, src, strerror(errno), errno);
+		return DEPOT_ERROR;
+	}
+	return DEPOT_OK;
+}
+
+struct CloneExpand {
+	Archive** archives;
+	const char* prefix;
+	int* results;
+};
+
+static void clone_expand_archive(uint32_t index, void* context) {
+	CloneExpand* expand = (CloneExpand*)context;
+	expand->results[index] = expand->archives[index]->expand_directory(expand->prefix);
+}
+
+int Depot::clone(const char* srcprefix) {
+	uint32_t dryrun = Context::current()->dryrun;
+	int res = DEPOT_OK;
+
+	if (this->m_db->count_archives(true) > 0) {
+		fprintf(stderr, "Error: %s already has roots installed; "
+				"only an empty depot can be cloned into.\n", m_prefix);
+		return DEPOT_ERROR;
+	}
+
+	char srcreal[PATH_MAX];
+	char dstreal[PATH_MAX];
+	if (!realpath(srcprefix, srcreal)) {
+		perror(srcprefix);
+		return DEPOT_ERROR;
+	}
+	if (realpath(m_prefix, dstreal) && strcmp(srcreal, dstreal) == 0) {
+		fprintf(stderr, "Error: cannot clone %s onto itself.\n", srcprefix);
+		return DEPOT_ERROR;
+	}
+
+	// the source lock is held throughout, so its database and backing
+	//  stores cannot change while they are copied
+	Depot* source = new Depot(srcprefix);
+	res = source->initialize(false);
+	if (res == DEPOT_NOT_EXIST) {
+		fprintf(stderr, "Error: there is no depot in %s\n", srcprefix);
+	}
+	if (res == DEPOT_OK) {
+		uint64_t* serials;
+		uint32_t inactive = 0;
+		if (source->m_db->get_inactive_archive_serials(&serials, &inactive) == DB_ERROR) {
+			res = DEPOT_ERROR;
+		} else if (inactive) {
+			free(serials);
+			fprintf(stderr, "Error: %s has an unfinished install; run darwinup "
+					"there to recover it before cloning.\n", srcprefix);
+			res = DEPOT_ERROR;
+		}
+	}
+	if (res) {
+		delete source;
+		return DEPOT_ERROR;
+	}
+
+	// every backing store, including those of rollback archives, so
+	//  uninstalls in the clone restore what they would in the source
+	uint8_t** archlist = NULL;
+	uint32_t archcount = 0;
+	uint32_t roots = 0;
+	if (source->m_db->get_archives(&archlist, &archcount, true) == DB_ERROR) {
+		res = DEPOT_ERROR;
+		archcount = 0;
+	}
+	for (uint32_t i = 0; i < archcount; i++) {
+		Archive* archive = source->m_db->make_archive(archlist[i]);
+		if (!INFO_TEST(archive->info(), ARCHIVE_INFO_ROLLBACK)) roots++;
+		if (res == DEPOT_OK && !dryrun) {
+			char* src = archive->compacted_path(source->m_archives_path);
+			char* dst = archive->compacted_path(m_archives_path);
+			IF_DEBUG("[clone] %s -> %s\n", src, dst);
+			res = link_backing_store(src, dst);
+			free(src);
+			free(dst);
+			src = archive->packed_path(source->m_archives_path);
+			dst = archive->packed_path(m_archives_path);
+			if (res == DEPOT_OK) res = link_backing_store(src, dst);
+			free(src);
+			free(dst);
+		}
+		archive->release();
+	}
+	free(archlist);
+
+	// then only the newest record of each path is placed, in path order
+	//  so parents come before their children. Nothing is digested; the
+	//  next fsck checks the clone from scratch.
+	// the records hold the source's archives, so they go before it does
+	FilePool* files = new FilePool();
+	if (res == DEPOT_OK && 
+		source->m_db->get_current_files(files) == DB_ERROR) {
+		res = DEPOT_ERROR;
+	}
+	uint32_t filecount = files->count();
+	Archive** expand = (Archive**)calloc(filecount + 1, sizeof(Archive*));
+	int* results = (int*)calloc(filecount + 1, sizeof(int));
+	if (!expand || !results) {
+		fprintf(stderr, "Error: ran out of memory in Depot::clone\n");
+		res = DEPOT_ERROR;
+	}
+	uint32_t expand_count = 0;
+	for (uint32_t i = 0; res == DEPOT_OK && i < filecount; i++) {
+		Archive* archive = files->record(i)->archive;
+		bool seen = false;
+		for (uint32_t j = expand_count; j > 0 && !seen; j--) {
+			seen = (expand[j - 1]->serial() == archive->serial());
+		}
+		if (!seen) expand[expand_count++] = archive;
+	}
+
+	if (res == DEPOT_OK && !dryrun) {
+		CloneExpand context = { expand, m_archives_path, results };
+		this->thread_pool()->apply(expand_count, &clone_expand_archive, &context);
+		for (uint32_t i = 0; i < expand_count && res == DEPOT_OK; i++) {
+			if (results[i]) res = DEPOT_ERROR;
+		}
+	}
+
+	uint64_t placed = 0;
+	for (uint32_t i = 0; res == DEPOT_OK && i < filecount; i++) {
+		if (INFO_TEST(files->record(i)->info, FILE_INFO_NO_ENTRY)) continue;
+		File* file = FileFactory(files, files->record(i));
+		if (!file) {
+			res = DEPOT_ERROR;
+		} else {
+			IF_DEBUG("[clone] %s\n", file->path());
+			if (!dryrun) {
+				res = file->unquarantine(m_archives_path);
+				if (res == 0) res = file->install(m_archives_path, m_prefix, false);
+				if (res) {
+					fprintf(stderr, "%s:%d: clone failed: %s: %s (%d)\n", 
+							__FILE__, __LINE__, file->path(), strerror(errno), errno);
+					res = DEPOT_ERROR;
+				}
+			}
+			++placed;
+			m_is_dirty = true;
+			if (strncmp(file->path(), "/System/Library/Extensions", 26) == 0) {
+				m_modified_extensions = true;
+			}
+			if ((strstr(file->path(), ".xpc/") != NULL && has_suffix(file->path(), "Info.plist")) ||
+				strncmp(file->path(), "/System/Library/Sandbox/Profiles", 32) == 0 ||
+				has_suffix(file->path(), "framework.sb")) {
+				m_modified_xpc_services = true;
+			}
+		}
+		delete file;
+	}
+	delete files;
+	free(expand);
+	free(results);
+	this->prune_directories();
+
+	// the database goes last, so an interrupted clone leaves an empty
+	//  depot that can simply be cloned into again
+	char* tmppath = NULL;
+	if (res == DEPOT_OK && !dryrun) {
+		asprintf(&tmppath, "%s.clone", m_database_path);
+		if (!tmppath || copyfile(source->m_database_path, tmppath, NULL, COPYFILE_DATA)) {
+			fprintf(stderr, "%s:%d: %s: %s (%d)\n", __FILE__, __LINE__, 
+					source->m_database_path, strerror(errno), errno);
+			res = DEPOT_ERROR;
+		}
+	}
+	delete source;
+	if (res == DEPOT_OK && !dryrun) {
+		delete m_db;
+		m_db = NULL;
+		m_data_version = 0;
+		if (rename(tmppath, m_database_path) == -1) {
+			perror(m_database_path);
+			res = DEPOT_ERROR;
+		}
+		if (this->connect() != DB_OK) res = DEPOT_ERROR;
+		if (res == DEPOT_OK && this->m_db->set_fsck_checkpoint(0, 0) != DB_OK) {
+			res = DEPOT_ERROR;
+		}
+	}
+	if (tmppath) {
+		unlink(tmppath);
+		free(tmppath);
+	}
+
+	if (res == DEPOT_OK) {
+		fprintf(Context::current()->output, "Cloned %u root%s and %llu file%s from %s\n", 
+				roots, (roots == 1 ? "" : "s"), 
+				placed, (placed == 1 ? "" : "s"), srcprefix);
+	} else {
+		fprintf(stderr, "Error: Clone failed.\n");
+	}
+	return res;
+}
+
+int Depot::list_archive(Archive* archive, void* context) {	
+	uint64_t serial = archive->serial();
+	
+	char uuid[37];
+	uuid_unparse_upper(archive->uuid(), uuid);
+
+	char date[100];
+	struct tm local;
+	time_t seconds = archive->date_installed();
+	localtime_r(&seconds, &local);
+	strftime(date, sizeof(date), "%b %e %H:%M", &local);
+
+	fprintf((FILE*)context, "%-6llu %-36s  %-12s  %-7s  %s\n", 
+			serial, uuid, date, (archive->build()?archive->build():""), archive->name());
 	
 	return DEPOT_OK;
 }
@@ -1166,7 +2799,8 @@ int Depot::list(int count, char** args) {
 	this->archive_header();
 	
 	// handle the default case of "all"
-	if (count == 0) return this->iterate_archives(&Depot::list_archive, stdout);
+	if (count == 0) return this->iterate_archives(&Depot::list_archive,
+			Context::current()->output);
 
 	Archive** list;
 	Archive* archive;
@@ -1179,17 +2813,17 @@ int Depot::list(int count, char** args) {
 		if (strncasecmp(args[i], "all", 3) == 0 && strlen(args[i]) == 3) {
 			list = this->get_all_archives(&archcnt);
 		} else if (strncasecmp(args[i], "superseded", 10) == 0 && strlen(args[i]) == 10) {
-			list = this->get_superseded_archives(&archcnt);
+			list = this->get_superseded_archives(&archcnt, false);
 		} 
 		if (archcnt) {
 			// loop over special keyword results
 			for (uint32_t j = 0; res == 0 && j < archcnt; j++) {
-				res = this->list_archive(list[j], stdout);
+				res = this->list_archive(list[j], Context::current()->output);
 			}
 		} else {
 			// arg is a single-archive specifier
 			archive = this->get_archive(args[i]);
-			if (archive) res = this->list_archive(archive, stdout);
+			if (archive) res = this->list_archive(archive, Context::current()->output);
 		}
 	}
 
@@ -1197,7 +2831,7 @@ int Depot::list(int count, char** args) {
 }
 
 int Depot::print_file(File* file, void* context) {
-	extern uint32_t verbosity;
+	uint32_t verbosity = Context::current()->verbosity;
 	if (verbosity & VERBOSE_DEBUG) fprintf((FILE*)context, "%04llx ", file->info());
 	file->print((FILE*)context);
 	return DEPOT_OK;
@@ -1206,31 +2840,36 @@ int Depot::print_file(File* file, void* context) {
 int Depot::files(Archive* archive) {
 	int res = 0;
 	this->archive_header();
-	list_archive(archive, stdout);
+	list_archive(archive, Context::current()->output);
 	hr();
-	if (res == 0) res = this->iterate_files(archive, &Depot::print_file, stdout);
+	if (res == 0) res = this->iterate_files(archive, &Depot::print_file,
+			Context::current()->output, false);
 	hr();
-	fprintf(stdout, "\n");
+	fprintf(Context::current()->output, "\n");
 	return res;
 }
 
 int Depot::dump_archive(Archive* archive, void* context) {
 	Depot* depot = (Depot*)context;
 	int res = 0;
-	list_archive(archive, stdout);
+	list_archive(archive, Context::current()->output);
 	hr();
-	if (res == 0) res = depot->iterate_files(archive, &Depot::print_file, stdout);
+	if (res == 0) res = depot->iterate_files(archive, &Depot::print_file,
+			Context::current()->output, false);
 	hr();
-	fprintf(stdout, "\n");
+	fprintf(Context::current()->output, "\n");
 	return res;
 }
 
 int Depot::dump() {
-	extern uint32_t verbosity;
-	verbosity = 0xFFFFFFFF; // dump is intrinsically a debug command
+	// dump is intrinsically a debug command, but only for itself, so
+	//  batch commands after it run as asked
+	uint32_t saved_verbosity = Context::current()->verbosity;
+	Context::current()->verbosity = 0xFFFFFFFF;
 	int res = 0;
 	this->archive_header();
 	if (res == 0) res = this->iterate_archives(&Depot::dump_archive, this);
+	Context::current()->verbosity = saved_verbosity;
 	return res;
 }
 
@@ -1273,8 +2912,8 @@ int Depot::check_consistency() {
 		for (i = 0; i < inactive->count; ++i) {
 			Archive* archive = this->archive(inactive->values[i]);
 			if (archive) {
-				list_archive(archive, stdout);
-				delete archive;
+				list_archive(archive, Context::current()->output);
+				archive->release();
 			}
 		}
 		fprintf(stderr, "\nWould you like to uninstall %s now? [y/n] ", 
@@ -1286,7 +2925,7 @@ int Depot::check_consistency() {
 				Archive* archive = this->archive(inactive->values[i]);
 				if (archive) {
 					res = this->uninstall(archive);
-					delete archive;
+					archive->release();
 				}
 				if (res != 0) break;
 			}
@@ -1297,6 +2936,192 @@ int Depot::check_consistency() {
 }
 
 
+int Depot::journal_begin(Archive* archive, Archive* rollback) {
+	m_journal_fd = open(m_journal_path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0600);
+	if (m_journal_fd == -1) {
+		perror(m_journal_path);
+		return DEPOT_ERROR;
+	}
+	// the archive records are already committed, this makes sure
+	//  whatever follows can find them
+	dprintf(m_journal_fd, "install %llu %llu\n", archive->serial(), 
+			rollback ? rollback->serial() : 0);
+	if (fsync(m_journal_fd) == -1) {
+		perror(m_journal_path);
+		return DEPOT_ERROR;
+	}
+	return DEPOT_OK;
+}
+
+int Depot::journal_backed_up() {
+	// the compacted stores must be on disk before the record saying
+	//  so, and the record before the first move
+	if (sync_filesystem(m_journal_fd) == -1 ||
+		dprintf(m_journal_fd, "backup\n") < 0 ||
+		fsync(m_journal_fd) == -1) {
+		perror(m_journal_path);
+		return DEPOT_ERROR;
+	}
+	return DEPOT_OK;
+}
+
+int Depot::journal_moved(uint64_t count) {
+	// one sync covers the whole batch of moves. The record itself is
+	//  made durable by the next one, and until then recovery just
+	//  moves the batch again.
+	IF_DEBUG("[journal] %llu files moved\n", count);
+	if (sync_filesystem(m_journal_fd) == -1 ||
+		dprintf(m_journal_fd, "moved %llu\n", count) < 0) {
+		perror(m_journal_path);
+		return DEPOT_ERROR;
+	}
+	return DEPOT_OK;
+}
+
+int Depot::journal_end() {
+	if (m_journal_fd != -1) close(m_journal_fd);
+	m_journal_fd = -1;
+	if (unlink(m_journal_path) == -1 && errno != ENOENT) {
+		perror(m_journal_path);
+		return DEPOT_ERROR;
+	}
+	return DEPOT_OK;
+}
+
+// removes the expanded backing store of archive, if any
+static void remove_expanded(Archive* archive, const char* prefix) {
+	char* path = archive->directory_name(prefix);
+	if (path && is_directory(path)) remove_directory(path);
+	free(path);
+}
+
+// removes the expanded and compacted backing stores of archive, if any
+static void remove_backing_store(Archive* archive, const char* prefix) {
+	remove_expanded(archive, prefix);
+	char* path = archive->compacted_path(prefix);
+	if (path && unlink(path) == -1 && errno != ENOENT) perror(path);
+	free(path);
+	path = archive->packed_path(prefix);
+	if (path && unlink(path) == -1 && errno != ENOENT) perror(path);
+	free(path);
+}
+
+int Depot::recover() {
+	FILE* f = fopen(m_journal_path, "r");
+	if (f == NULL) {
+		if (errno == ENOENT) return DEPOT_OK;
+		perror(m_journal_path);
+		return DEPOT_ERROR;
+	}
+	
+	// a torn last line only makes recovery start further back
+	unsigned long long serial = 0, rollback_serial = 0, moved = 0;
+	unsigned long long a, b;
+	bool backed_up = false;
+	char line[128];
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "install %llu %llu\n", &a, &b) == 2) {
+			serial = a;
+			rollback_serial = b;
+		} else if (strcmp(line, "backup\n") == 0) {
+			backed_up = true;
+		} else if (sscanf(line, "moved %llu\n", &a) == 1) {
+			moved = a;
+		}
+	}
+	fclose(f);
+	IF_DEBUG("[recover] install %llu %llu, backup %d, moved %llu\n", 
+			 serial, rollback_serial, backed_up, moved);
+
+	// archives which were activated need nothing more
+	Archive* archive = NULL;
+	Archive* rollback = NULL;
+	uint64_t* serials;
+	uint32_t count = 0;
+	if (this->m_db->get_inactive_archive_serials(&serials, &count) == DB_ERROR) {
+		return DEPOT_ERROR;
+	}
+	for (uint32_t i = 0; i < count; i++) {
+		if (serial && serials[i] == serial) archive = this->archive(serial);
+		if (rollback_serial && serials[i] == rollback_serial) {
+			rollback = this->archive(rollback_serial);
+		}
+	}
+	if (count) free(serials);
+
+	int res = DEPOT_OK;
+	if (archive && backed_up) {
+		// some files may already be in place, so move the rest from a
+		//  fresh expansion of the compacted backing store
+		fprintf(stderr, "Finishing interrupted install of archive: %llu %s\n",
+				archive->serial(), archive->name());
+		remove_expanded(archive, m_archives_path);
+		res = archive->expand_directory(m_archives_path);
+
+		if (res == 0) m_journal_fd = open(m_journal_path, O_WRONLY | O_APPEND);
+		if (res == 0 && m_journal_fd == -1) {
+			perror(m_journal_path);
+			res = DEPOT_ERROR;
+		}
+		InstallContext context(this, archive);
+		context.files_skip = moved;
+		context.journaled = true;
+		PROBE3(phase, "recover", archive->name(), "move");
+		if (res == 0 && Context::current()->progress) {
+			uint64_t total = m_db->count_archive_files(archive, FILE_INFO_NONE);
+			PROGRESS(begin("recover", archive->name(), "move", 
+						   total > moved ? total - moved : 0, 0));
+		}
+		if (res == 0) res = this->iterate_files(archive, &Depot::install_file, &context,
+												context.reverse_files);
+		if (res == 0) res = this->journal_moved(context.files_seen);
+		PROGRESS(end());
+		if (res == 0) res = this->begin_transaction();
+		if (res == 0) {
+			if (rollback) res = this->m_db->activate_archive(rollback->serial());
+			if (res == 0) res = this->m_db->activate_archive(archive->serial());
+			if (res == 0) {
+				res = this->commit_transaction();
+			} else {
+				this->rollback_transaction();
+			}
+		}
+		if (res) {
+			fprintf(stderr, "Error: unable to finish the install, rolling it back.\n");
+			res = this->uninstall(archive);
+		}
+		if (res) {
+			fprintf(stderr, "Error: Unable to rollback installation. "
+					"Your system is in an inconsistent state! File a bug!\n");
+		}
+		remove_expanded(archive, m_archives_path);
+		if (rollback) remove_expanded(rollback, m_archives_path);
+	} else if (archive || rollback) {
+		// only the depot was written to, so forget the install
+		fprintf(stderr, "Removing interrupted install of archive: %llu %s\n",
+				serial, archive ? archive->name() : "");
+		res = this->begin_transaction();
+		if (res == 0) {
+			if (rollback) res = this->remove(rollback);
+			if (res == 0 && archive) res = this->remove(archive);
+			if (res == 0) {
+				res = this->commit_transaction();
+			} else {
+				this->rollback_transaction();
+			}
+		}
+		if (res == 0 && rollback) remove_backing_store(rollback, m_archives_path);
+		if (res == 0 && archive) remove_backing_store(archive, m_archives_path);
+	}
+	if (archive) archive->release();
+	if (rollback) rollback->release();
+
+	// whatever happened was reported, so do not try again next time
+	int endres = this->journal_end();
+	return res ? res : endres;
+}
+
+
 int Depot::begin_transaction() {
 	return this->m_db->begin_transaction();
 }
@@ -1306,11 +3131,192 @@ int Depot::rollback_transaction() {
 }
 
 int Depot::commit_transaction() {
-	return this->m_db->commit_transaction();
+	int res = this->m_db->commit_transaction();
+	if (res == 0) m_snapshot_stale = true;
+	return res;
+}
+
+// archives of a snapshot by serial, for finding a file's archive
+static int compare_snapshot_archives(const void* a, const void* b) {
+	uint64_t left = ((const snapshot_archive_t*)a)->serial;
+	uint64_t right = ((const snapshot_archive_t*)b)->serial;
+	return left < right ? -1 : left > right;
+}
+
+int Depot::write_snapshot() {
+	int res = DEPOT_OK;
+	uint8_t** archlist = NULL;
+	uint32_t archcount = 0;
+	FilePool files;
+	if (m_db->get_archives(&archlist, &archcount, false) == DB_ERROR ||
+		m_db->get_installed_files(&files) == DB_ERROR) {
+		fprintf(stderr, "Error: unable to read the database for the snapshot.\n");
+		res = DEPOT_ERROR;
+	}
+
+	// the tables, with the strings each entry refers to by offset
+	snapshot_archive_t* archives = (snapshot_archive_t*)calloc(archcount + 1, 
+															   sizeof(snapshot_archive_t));
+	char** archnames = (char**)calloc(archcount + 1, sizeof(char*));
+	uint32_t filecount = files.count();
+	snapshot_path_t* paths = (snapshot_path_t*)calloc(filecount + 1, 
+													  sizeof(snapshot_path_t));
+	FileRecord** pathrecords = (FileRecord**)calloc(filecount + 1, sizeof(FileRecord*));
+	uint32_t* fileindex = (uint32_t*)calloc(filecount + 1, sizeof(uint32_t));
+	uint32_t* filearchive = (uint32_t*)calloc(filecount + 1, sizeof(uint32_t));
+	uint32_t* members = (uint32_t*)calloc(filecount + 1, sizeof(uint32_t));
+	if (!archives || !archnames || !paths || !pathrecords || !fileindex || 
+		!filearchive || !members) {
+		fprintf(stderr, "Error: out of memory.\n");
+		res = DEPOT_ERROR;
+	}
+	uint64_t strings = 0;
+
+	// oldest archive first, as the list comes newest first
+	for (uint32_t i = 0; res == DEPOT_OK && i < archcount; i++) {
+		Archive* archive = m_db->make_archive(archlist[i]);
+		archlist[i] = NULL;
+		snapshot_archive_t* entry = &archives[archcount - 1 - i];
+		entry->serial = archive->serial();
+		entry->info = archive->info();
+		entry->date_installed = archive->date_installed();
+		memcpy(entry->uuid, archive->uuid(), sizeof(entry->uuid));
+		archnames[archcount - 1 - i] = strdup(archive->name() ? archive->name() : "");
+		archive->release();
+	}
+	for (uint32_t i = 0; res == DEPOT_OK && i < archcount; i++) {
+		archives[i].name = (uint32_t)strings;
+		strings += strlen(archnames[i]) + 1;
+	}
+
+	// the first record of each path is its owner's, and the rest are
+	//  older archives'
+	uint32_t pathcount = 0;
+	uint32_t membercount = 0;
+	for (uint32_t i = 0; res == DEPOT_OK && i < filecount; i++) {
+		FileRecord* record = files.record(i);
+		uint64_t serial = record->archive->serial();
+		snapshot_archive_t key;
+		key.serial = serial;
+		snapshot_archive_t* entry = (snapshot_archive_t*)bsearch(&key, archives, archcount, 
+																 sizeof(snapshot_archive_t),
+																 compare_snapshot_archives);
+		if (!entry || INFO_TEST(record->info, FILE_INFO_NO_ENTRY)) continue;
+		if (pathcount == 0 || !FilePool::same_path(pathrecords[pathcount - 1], record)) {
+			paths[pathcount].owner = serial;
+			paths[pathcount].name = (uint32_t)strings;
+			pathrecords[pathcount] = record;
+			strings += strlen(files.directory(record)) + strlen(record->name) + 1;
+			pathcount++;
+		}
+		fileindex[membercount] = pathcount - 1;
+		filearchive[membercount] = (uint32_t)(entry - archives);
+		entry->count++;
+		membercount++;
+	}
+	if (strings > UINT32_MAX) {
+		fprintf(stderr, "Error: too many paths for the snapshot.\n");
+		res = DEPOT_ERROR;
+	}
+
+	// group the files by archive, keeping them in path order
+	uint32_t first = 0;
+	for (uint32_t i = 0; res == DEPOT_OK && i < archcount; i++) {
+		archives[i].first = first;
+		first += archives[i].count;
+		archives[i].count = 0;
+	}
+	for (uint32_t i = 0; res == DEPOT_OK && i < membercount; i++) {
+		snapshot_archive_t* entry = &archives[filearchive[i]];
+		members[entry->first + entry->count++] = fileindex[i];
+	}
+
+	snapshot_header_t header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE);
+	header.archive_count = archcount;
+	header.path_count = pathcount;
+	header.member_count = membercount;
+	header.archives_offset = sizeof(header);
+	header.paths_offset = header.archives_offset + archcount * sizeof(snapshot_archive_t);
+	header.members_offset = header.paths_offset + pathcount * sizeof(snapshot_path_t);
+	// padded so the strings start where a following table could
+	uint64_t padding = (8 - (membercount * sizeof(uint32_t)) % 8) % 8;
+	header.strings_offset = header.members_offset + membercount * sizeof(uint32_t) + padding;
+	header.size = header.strings_offset + strings;
+
+	// readers keep whichever snapshot they mapped, so replace it whole
+	char* tmppath = NULL;
+	FILE* f = NULL;
+	if (res == DEPOT_OK) {
+		asprintf(&tmppath, "%s.new", m_snapshot_path);
+		f = tmppath ? fopen(tmppath, "w") : NULL;
+		if (!f) {
+			fprintf(stderr, "Error: unable to write the snapshot: %s (%d)\n", 
+					strerror(errno), errno);
+			res = DEPOT_ERROR;
+		}
+	}
+	if (f) {
+		static const uint8_t zeros[8] = { 0 };
+		bool failed = fwrite(&header, sizeof(header), 1, f) != 1 ||
+			fwrite(archives, sizeof(snapshot_archive_t), archcount, f) != archcount ||
+			fwrite(paths, sizeof(snapshot_path_t), pathcount, f) != pathcount ||
+			fwrite(members, sizeof(uint32_t), membercount, f) != membercount ||
+			fwrite(zeros, 1, padding, f) != padding;
+		for (uint32_t i = 0; !failed && i < archcount; i++) {
+			failed = fwrite(archnames[i], strlen(archnames[i]) + 1, 1, f) != 1;
+		}
+		for (uint32_t i = 0; !failed && i < pathcount; i++) {
+			failed = fputs(files.directory(pathrecords[i]), f) == EOF ||
+				fwrite(pathrecords[i]->name, strlen(pathrecords[i]->name) + 1, 1, f) != 1;
+		}
+		// on disk before it is renamed, or a crash could leave readers
+		//  an empty or partial snapshot
+		if (!failed && (fflush(f) != 0 || fsync(fileno(f)) == -1)) failed = true;
+		if (fclose(f) != 0) failed = true;
+		if (failed || rename(tmppath, m_snapshot_path) == -1) {
+			fprintf(stderr, "Error: unable to write the snapshot: %s (%d)\n", 
+					strerror(errno), errno);
+			unlink(tmppath);
+			res = DEPOT_ERROR;
+		}
+	}
+	if (res == DEPOT_OK) {
+		IF_DEBUG("[snapshot] %u archives, %u paths\n", archcount, pathcount);
+		m_snapshot_stale = false;
+	}
+
+	for (uint32_t i = 0; archlist && i < archcount; i++) {
+		if (archlist[i]) m_db->free_archive(archlist[i]);
+	}
+	for (uint32_t i = 0; archnames && i < archcount; i++) free(archnames[i]);
+	free(archlist);
+	free(archives);
+	free(archnames);
+	free(paths);
+	free(pathrecords);
+	free(fileindex);
+	free(filearchive);
+	free(members);
+	free(tmppath);
+	return res;
 }
 
 int Depot::is_locked() { return m_is_locked; }
 
+int Depot::revalidate() {
+	uint64_t version = 0;
+	int res = this->m_db->data_version(&version);
+	// if we cannot tell, assume the worst
+	if (res || version != m_data_version) {
+		IF_DEBUG("[revalidate] database changed, clearing memoized archives\n");
+		this->m_db->clear_archive_cache();
+		m_data_version = version;
+	}
+	return DEPOT_OK;
+}
+
 bool Depot::is_superseded(Archive* archive) {
 	// return early if already known
 	if (archive->m_is_superseded != -1) { 
@@ -1319,18 +3325,21 @@ bool Depot::is_superseded(Archive* archive) {
 	
 	// need to find out if superseded
 	int res = DB_OK;
-	uint8_t** filelist;
+	FilePool files;
 	uint8_t* data;
-	uint32_t count;	
-	res = this->m_db->get_files(&filelist, &count, archive, false);
+	res = this->m_db->get_files(&files, archive, false);
 	if (FOUND(res)) {
-		for (uint32_t i=0; i < count; i++) {
-			File* file = this->m_db->make_file(filelist[i]);
+		for (uint32_t i=0; i < files.count(); i++) {
+			File* file = FileFactory(&files, files.record(i));
+			if (!file) continue;
 			
 			// check for being superseded by a root
 			res = this->m_db->get_next_file(&data, file, FILE_SUPERSEDED);
 			this->m_db->free_file(data);
-			if (FOUND(res)) continue;
+			if (FOUND(res)) {
+				delete file;
+				continue;
+			}
 			
 			// check for being superseded by external changes
 			char* actpath;
@@ -1338,6 +3347,8 @@ bool Depot::is_superseded(Archive* archive) {
 			File* actual = FileFactory(actpath);
 			free(actpath);
 			uint32_t flags = File::compare(file, actual);
+			delete actual;
+			delete file;
 
 			// not found in database and no changes on disk, 
 			// so file is the current version of actual
@@ -1373,6 +3384,8 @@ int Depot::lock(int operation) {
 
 int Depot::unlock(void) {
 	int res = 0;
+	// not worth failing over, the next commit tries again
+	if (m_snapshot_stale && m_db) this->write_snapshot();
 	res = flock(m_lock_fd, LOCK_UN);
 	if (res == -1) {
 		perror(m_depot_path);
@@ -1404,7 +3417,8 @@ int Depot::insert(Archive* archive, File* file) {
 	}
 
 	file->m_serial = m_db->insert_file(file->info(), file->mode(), file->uid(), file->gid(), 
-									   file->digest(), archive, relpath);
+									   file->size(), file->mtime(), file->digest(), 
+									   archive, relpath);
 	if (!file->m_serial) {
 		fprintf(stderr, "Error: unable to insert file at path %s for archive %s \n", 
 				relpath, archive->name());
@@ -1434,7 +3448,9 @@ int Depot::has_file(Archive* archive, File* file) {
 
 int Depot::remove(Archive* archive) {
 	int res = 0;
-	res = m_db->delete_files(archive);
+	// archives sharing paths with this one may become current again
+	res = m_db->stale_archive_summaries(archive);
+	if (res == 0) res = m_db->delete_files(archive);
 	if (res) {
 		fprintf(stderr, "Error: unable to delete files for archive %llu \n", archive->serial());
 		return res;
@@ -1444,6 +3460,10 @@ int Depot::remove(Archive* archive) {
 		fprintf(stderr, "Error: unable to delete archive %llu \n", archive->serial());
 		return res;
 	}
+	res = m_db->update_archive_summaries();
+	if (res) {
+		fprintf(stderr, "Error: unable to update archive summaries\n");
+	}
 	return res;
 }
 
@@ -1465,48 +3485,38 @@ int Depot::dispatch_command(Archive* archive, const char* command) {
 		fprintf(stderr, "Error: unknown command given to dispatch_command.\n");
 	}
 	if (res != 0) {
-		fprintf(stdout, "An error occurred.\n");
+		fprintf(Context::current()->output, "An error occurred.\n");
 	}
 	return res;
 }
 
 // perform a command on an archive specification
 int Depot::process_archive(const char* command, const char* archspec) {
-	extern uint32_t verbosity;
+	uint32_t verbosity = Context::current()->verbosity;
 	int res = 0;
 	uint32_t count = 0;
-	Archive** list = NULL;
-	
-	if (strncasecmp(archspec, "all", 3) == 0 && strlen(archspec) == 3) {
-		list = this->get_all_archives(&count);
-	} else if (strncasecmp(archspec, "superseded", 10) == 0 && strlen(archspec) == 10) {
-		list = this->get_superseded_archives(&count);
-	} else {
-		// make a list of 1 Archive
-		list = (Archive**)malloc(sizeof(Archive*));
-		list[0] = this->get_archive(archspec);
-		count = 1;
-	}
+	Archive** list = this->get_archives(archspec, &count);
+	if (!list) return DEPOT_ERROR;
 	
 	for (size_t i = 0; i < count; i++) {
 		if (!list[i]) {
-			fprintf(stdout, "Archive not found: %s\n", archspec);
+			fprintf(Context::current()->output, "Archive not found: %s\n", archspec);
 			return DEPOT_ERROR;
 		}
 		if (verbosity & VERBOSE_DEBUG) {
 			char uuid[37];
 			uuid_unparse_upper(list[i]->uuid(), uuid);
-			fprintf(stdout, "Found archive: %s\n", uuid);
+			fprintf(Context::current()->output, "Found archive: %s\n", uuid);
 		}
 		res = this->dispatch_command(list[i], command);
-		delete list[i];
+		if (list[i]) list[i]->release();
 	} 
 	free(list);
 	return res;
 }
 
 int Depot::rename_archive(const char* archspec, const char* name) {
-	extern uint32_t verbosity;
+	uint32_t verbosity = Context::current()->verbosity;
 	int res = 0;
 	
 	if ((strncasecmp(archspec, "all", 3) == 0 && strlen(archspec) == 3) ||
@@ -1518,14 +3528,14 @@ int Depot::rename_archive(const char* archspec, const char* name) {
 	
 	Archive* archive = this->get_archive(archspec);
 	if (!archive) {
-		fprintf(stdout, "Archive not found: %s\n", archspec);
+		fprintf(Context::current()->output, "Archive not found: %s\n", archspec);
 		return DEPOT_NOT_EXIST;
 	}
 	
 	char uuid[37];
 	uuid_unparse_upper(archive->uuid(), uuid);
 	if (verbosity & VERBOSE_DEBUG) {
-		fprintf(stdout, "Found archive: %s\n", uuid);
+		fprintf(Context::current()->output, "Found archive: %s\n", uuid);
 	}
 
 	if (!name || strlen(name) == 0) {
@@ -1544,9 +3554,12 @@ int Depot::rename_archive(const char* archspec, const char* name) {
 							   archive->info(),
 							   archive->build());
 
-	if (res == 0) fprintf(stdout, "Renamed archive %s to '%s'.\n", 
-						  uuid, archive->name());
+	if (res == 0) {
+		fprintf(Context::current()->output, "Renamed archive %s to '%s'.\n", 
+				uuid, archive->name());
+		m_snapshot_stale = true;
+	}
 	
-	delete archive;
+	if (archive) archive->release();
 	return res;
 }
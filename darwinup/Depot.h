@@ -55,6 +55,16 @@ struct DarwinupDatabase;
 
 typedef int (*ArchiveIteratorFunc)(Archive* archive, void* context);
 typedef int (*FileIteratorFunc)(File* file, void* context);
+// status is ' ' unchanged, 'M' modified or 'R' removed
+typedef int (*VerifyIteratorFunc)(File* file, char status, void* context);
+
+// how verify compares database records against the files on disk
+typedef enum {
+	VERIFY_DEEP,   // digest the contents of every file
+	VERIFY_QUICK,  // trust matching size and mtime instead of digesting
+} verify_mode_t;
+
+struct ThreadPool;
 
 struct Depot {
 	Depot();
@@ -77,6 +87,9 @@ struct Depot {
 	const char*	database_path();
 	const char*	archives_path();
 	const char*	downloads_path();
+	const char*	service_path();
+	const char*	jobs_path();
+	const char*	hooks_path();
 
 	virtual int	begin_transaction();
 	virtual int	commit_transaction();
@@ -90,7 +103,12 @@ struct Depot {
 
 	// returns a list of Archive*. Caller must free the list. 
 	Archive** get_all_archives(uint32_t *count);
-	Archive** get_superseded_archives(uint32_t *count);
+	// replaced_only limits the list to archives every file of which has
+	//  a newer record, so uninstalling them leaves the disk alone
+	Archive** get_superseded_archives(uint32_t *count, bool replaced_only);
+	// all, superseded, or a single archive. Single archives which are
+	//  not found are returned as a NULL entry.
+	Archive** get_archives(const char* archspec, uint32_t *count);
 	uint64_t count_archives();
 	
 	int dump();
@@ -107,14 +125,58 @@ struct Depot {
 
 	int uninstall(Archive* archive);
 	static int uninstall_file(File* file, void* context);
+	static int restore_file(File* file, File* preceding, File* actual, 
+							void* context, char* state);
+	// notes which files of older archives uninstall_file will restore
+	static int plan_restore(File* file, void* context);
+
+	// Names the depot as it is now, or lists the names given before if
+	//  name is NULL.
+	int checkpoint(const char* name);
+	// Uninstalls every archive installed since the named checkpoint, or
+	//  the newest one if name is NULL, in a single pass: each path is
+	//  restored at most once, to what it was at the checkpoint, and the
+	//  database is updated in one transaction.
+	int undo(const char* name);
 
 	int verify(Archive* archive);
-	static int verify_file(File* file, void* context);
+	// args are archive specifiers, optionally preceded by -q (quick)
+	//  or -d (deep, the default)
+	int verify(int count, char** args);
+	static int verify_file(File* file, char status, void* context);
+
+	// compares one file record against the disk. Safe to call from
+	//  the verify threads since it does not touch the database.
+	char verify_status(File* file, verify_mode_t mode);
+
+	// checks every archive, its backing store and the current owner of
+	//  every path. Only what changed since the last clean run is rechecked
+	//  unless args holds -a
+	int fsck(int count, char** args);
+
+	// reports the space used by archives, their rollbacks and backing stores
+	int du(int count, char** args);
+	static int du_archive(Archive* archive, void* context);
+
+	// removes backing stores and archives nothing refers to. With -s size,
+	//  also uninstalls the oldest archives newer archives fully replaced
+	//  while the backing store is larger than size
+	int gc(int count, char** args);
+
+	// gives an empty depot the roots installed in the depot of srcprefix
+	//  by sharing its backing stores and placing only the files that are
+	//  current there, then copying its database
+	int clone(const char* srcprefix);
 
 	int files(Archive* archive);
 	static int print_file(File* file, void* context);
 
-	int iterate_files(Archive* archive, FileIteratorFunc func, void* context);
+	// reverse iterates children before their parents
+	int iterate_files(Archive* archive, FileIteratorFunc func, void* context, bool reverse);
+	// verifies the files of archive on a thread pool, then calls func
+	//  for each of them in path order
+	int iterate_verified_files(Archive* archive, verify_mode_t mode,
+							   VerifyIteratorFunc func, void* context);
 	int iterate_archives(ArchiveIteratorFunc func, void* context);
 
 	// processes an archive according to command
@@ -127,6 +189,10 @@ struct Depot {
 	// test if the depot is currently locked 
 	int is_locked();
 
+	// forget memoized database state if another process has
+	//  committed changes since the last call
+	int revalidate();
+
 	bool is_superseded(Archive* archive);
 
 	void    archive_header();
@@ -136,6 +202,7 @@ struct Depot {
 	bool    has_modified_xpc_services();
 	
 protected:
+	friend struct DepotService;
 
 	// Serialize access to the Depot via flock(2).
 	int     lock(int operation);
@@ -162,16 +229,52 @@ protected:
 
 	int		analyze_stage(const char* path, Archive* archive, Archive* rollback, int* rollback_files);
 
+	// refuses to uninstall an archive installed on a different OS build,
+	//  unless forced
+	int		check_build(Archive* archive);
+
 	// removes expand and unexpanded files from archives path
 	int		prune_directories();
 	int		prune_archive(Archive* archive);
+	int		prune_empty_archives();
+	int		orphaned_backing_stores(char*** paths, uint32_t* count);
+	uint64_t	backing_store_size();
+	// the rollback archive created by the install of archive, if any
+	Archive*	rollback_of(Archive* archive);
 	
 	File*	file_superseded_by(File* file);
 	File*	file_preceded_by(File* file);
 
 	int		check_consistency();
+
+	// The journal records how far an install has moved files into the
+	//  prefix, so the next writable open can finish it, or undo it if
+	//  nothing in the prefix was touched yet. Moves are made durable a
+	//  batch at a time rather than file by file.
+	int		journal_begin(Archive* archive, Archive* rollback);
+	int		journal_backed_up();
+	int		journal_moved(uint64_t count);
+	int		journal_end();
+	int		recover();
+
+	// Rewrites the snapshot index of installed archives and paths, if a
+	//  transaction committed since it was last written; see Snapshot.h.
+	//  Called before the lock is released, so readers never see a
+	//  snapshot older than the database they could have locked.
+	int		write_snapshot();
+
+	// parts of fsck(), each adding the problems they print to problems
+	int		fsck_archives(uint64_t since_serial, time_t since, 
+						  uint64_t* newest, uint32_t* problems);
+	int		fsck_records(uint32_t* problems);
+	int		fsck_files(uint64_t since_serial, time_t since, uint32_t* problems);
+
+	// created on first use, shared by everything that fans out work
+	ThreadPool*	thread_pool();
 	
 	DarwinupDatabase* m_db;
+	ThreadPool*       m_pool;
+	verify_mode_t     m_verify_mode;
 	
 	mode_t		m_depot_mode;
 	char*       m_prefix;
@@ -179,9 +282,17 @@ protected:
 	char*		m_database_path;
 	char*		m_archives_path;
 	char*		m_downloads_path;
+	char*		m_service_path;
+	char*		m_journal_path;
+	char*		m_jobs_path;
+	char*		m_hooks_path;
+	char*		m_snapshot_path;
 	char*       m_build;
+	int         m_journal_fd;
 	int		    m_lock_fd;
 	int         m_is_locked;
+	uint64_t    m_data_version;
+	bool        m_snapshot_stale; // a commit since the snapshot was written
 	bool        m_is_dirty; // track if we need to update dyld cache
 	bool        m_modified_extensions; // track if we need to touch /S/L/E
 	bool        m_modified_xpc_services; // track if we need to run xpchelper
@@ -96,16 +96,20 @@ SHA1Digest::~SHA1Digest() {
     
 }
 
+Digest* SHA1Digest::copy() {
+	SHA1Digest* result = new SHA1Digest();
+	memcpy(result->m_data, m_data, m_size);
+	return result;
+}
+
 void SHA1Digest::digest(unsigned char* md, int fd) {
 	CC_SHA1_CTX c;
 	CC_SHA1_Init(&c);
 	
 	ssize_t len;
+	// on the stack so several threads can digest at once
 	const unsigned int blocklen = 8192;
-	static uint8_t* block = NULL;
-	if (block == NULL) {
-		block = (uint8_t*)malloc(blocklen);
-	}
+	uint8_t block[blocklen];
 	while(1) {
 		len = read(fd, block, blocklen);
 		if (len == 0) { close(fd); break; }
@@ -67,6 +67,9 @@ struct Digest {
 	
 	// Returns the digest as an ASCII string, represented in hexidecimal.
 	virtual char*		string();
+
+	// Returns a new digest with the same value.
+	virtual Digest*		copy() = 0;
     
     virtual ~Digest();
 	
@@ -89,6 +92,7 @@ struct Digest {
 	
 	friend struct Depot;
 	friend struct DarwinupDatabase;
+	friend struct FilePool;
 };
 
 ////
@@ -109,6 +113,8 @@ struct SHA1Digest : Digest {
 	
     ~SHA1Digest();
 
+	Digest*	copy();
+
 	void	digest(unsigned char* md, int fd);
 	void	digest(unsigned char* md, uint8_t* data, uint32_t size);
 
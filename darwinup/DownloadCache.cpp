@@ -0,0 +1,436 @@
+/*
+ * Copyright (c) 2013 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#include "DownloadCache.h"
+#include "Digest.h"
+#include "Utils.h"
+#include <copyfile.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+// curl exit codes
+#define CURL_HTTP_ERROR  22
+#define CURL_RANGE_ERROR 33
+
+static char* field_or_null(const char* field) {
+	if (!field || !*field || strcmp(field, "-") == 0) return NULL;
+	return strdup(field);
+}
+
+static void free_download(download_t* download) {
+	free(download->url);
+	free(download->digest);
+	free(download->etag);
+	free(download->modified);
+}
+
+// reads the status and validators of the final response in a header
+//  dump, after any redirects
+static int read_headers(const char* path, int* status, char** etag, char** modified) {
+	*status = 0;
+	*etag = NULL;
+	*modified = NULL;
+	FILE* f = fopen(path, "r");
+	if (!f) return -1;
+	char line[1024];
+	while (fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\r\n")] = 0;
+		char** value = NULL;
+		const char* start = NULL;
+		if (strncmp(line, "HTTP/", 5) == 0) {
+			char* space = strchr(line, ' ');
+			*status = space ? atoi(space + 1) : 0;
+			free(*etag);
+			free(*modified);
+			*etag = NULL;
+			*modified = NULL;
+		} else if (strncasecmp(line, "ETag:", 5) == 0) {
+			value = etag;
+			start = line + 5;
+		} else if (strncasecmp(line, "Last-Modified:", 14) == 0) {
+			value = modified;
+			start = line + 14;
+		}
+		if (value) {
+			while (*start == ' ' || *start == '\t') start++;
+			free(*value);
+			*value = field_or_null(start);
+		}
+	}
+	fclose(f);
+	return 0;
+}
+
+static off_t file_size(const char* path) {
+	struct stat sb;
+	if (stat(path, &sb) == -1) return -1;
+	return sb.st_size;
+}
+
+DownloadCache::DownloadCache(const char* downloads_path, uint64_t limit) {
+	m_downloads_path = strdup(downloads_path);
+	join_path(&m_path, m_downloads_path, "Cache");
+	join_path(&m_index_path, m_path, "index");
+	m_index_fd = -1;
+	m_entries = NULL;
+	m_count = 0;
+	m_limit = limit;
+}
+
+DownloadCache::~DownloadCache() {
+	if (m_index_fd != -1) this->unlock();
+	free(m_downloads_path);
+	free(m_path);
+	free(m_index_path);
+}
+
+// creates the cache, then locks and reads its index
+int DownloadCache::lock() {
+	const char* dirs[] = { "objects", "partial", NULL };
+	for (int i = 0; dirs[i]; i++) {
+		char* dir;
+		join_path(&dir, m_path, dirs[i]);
+		int res = mkdir_p(dir);
+		if (res && errno != EEXIST) {
+			perror(dir);
+			free(dir);
+			return -1;
+		}
+		free(dir);
+	}
+
+	m_index_fd = open(m_index_path, O_RDWR | O_CREAT, 0644);
+	if (m_index_fd == -1 || flock(m_index_fd, LOCK_EX) == -1) {
+		perror(m_index_path);
+		if (m_index_fd != -1) close(m_index_fd);
+		m_index_fd = -1;
+		return -1;
+	}
+
+	// digest, size, used, etag, modified and url, separated by tabs
+	FILE* f = fdopen(dup(m_index_fd), "r");
+	char line[4096];
+	while (f && fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\n")] = 0;
+		char* fields[6];
+		char* rest = line;
+		int n = 0;
+		while (n < 6 && rest) fields[n++] = strsep(&rest, "\t");
+		if (n < 6 || !*fields[5]) continue;
+		download_t* entries = (download_t*)realloc(m_entries, (m_count + 1) * sizeof(download_t));
+		if (!entries) break;
+		m_entries = entries;
+		download_t* entry = &m_entries[m_count++];
+		entry->digest = strdup(fields[0]);
+		entry->size = strtoull(fields[1], NULL, 10);
+		entry->used = (time_t)strtoll(fields[2], NULL, 10);
+		entry->etag = field_or_null(fields[3]);
+		entry->modified = field_or_null(fields[4]);
+		entry->url = strdup(fields[5]);
+	}
+	if (f) fclose(f);
+	return 0;
+}
+
+int DownloadCache::unlock() {
+	for (uint32_t i = 0; i < m_count; i++) free_download(&m_entries[i]);
+	free(m_entries);
+	m_entries = NULL;
+	m_count = 0;
+	close(m_index_fd);
+	m_index_fd = -1;
+	return 0;
+}
+
+int DownloadCache::save() {
+	if (ftruncate(m_index_fd, 0) == -1 || lseek(m_index_fd, 0, SEEK_SET) == -1) {
+		perror(m_index_path);
+		return -1;
+	}
+	FILE* f = fdopen(dup(m_index_fd), "w");
+	if (!f) {
+		perror(m_index_path);
+		return -1;
+	}
+	for (uint32_t i = 0; i < m_count; i++) {
+		download_t* entry = &m_entries[i];
+		fprintf(f, "%s\t%llu\t%lld\t%s\t%s\t%s\n", entry->digest, 
+				(unsigned long long)entry->size, (long long)entry->used,
+				(entry->etag ? entry->etag : "-"), 
+				(entry->modified ? entry->modified : "-"), entry->url);
+	}
+	if (fclose(f) == EOF) {
+		perror(m_index_path);
+		return -1;
+	}
+	return 0;
+}
+
+download_t* DownloadCache::find(const char* url) {
+	for (uint32_t i = 0; i < m_count; i++) {
+		if (strcmp(m_entries[i].url, url) == 0) return &m_entries[i];
+	}
+	return NULL;
+}
+
+char* DownloadCache::object_path(const char* digest) {
+	char* path;
+	asprintf(&path, "%s/objects/%s", m_path, digest);
+	return path;
+}
+
+int DownloadCache::transfer(const char* url, download_t* cached, const char* partial,
+							const char* headers, bool resume) {
+	uint32_t verbosity = Context::current()->verbosity;
+	const char* args[16];
+	int argc = 0;
+	args[argc++] = "/usr/bin/curl";
+	args[argc++] = (verbosity ? "-v" : "-s");
+	args[argc++] = "-f";
+	args[argc++] = "-L";
+	args[argc++] = "-D";
+	args[argc++] = headers;
+	args[argc++] = "-o";
+	args[argc++] = partial;
+
+	char* none_match = NULL;
+	char* modified_since = NULL;
+	char* range = NULL;
+	if (cached) {
+		// only send the body if it changed
+		if (cached->etag) asprintf(&none_match, "If-None-Match: %s", cached->etag);
+		if (cached->modified) asprintf(&modified_since, "If-Modified-Since: %s", cached->modified);
+	} else if (resume) {
+		// and only continue where it left off if it did not
+		int status;
+		char* etag;
+		char* modified;
+		read_headers(headers, &status, &etag, &modified);
+		if (etag && strncmp(etag, "W/", 2) != 0) {
+			asprintf(&range, "If-Range: %s", etag);
+		} else if (modified) {
+			asprintf(&range, "If-Range: %s", modified);
+		}
+		free(etag);
+		free(modified);
+		args[argc++] = "-C";
+		args[argc++] = "-";
+	} else {
+		unlink(partial);
+	}
+	if (none_match) {
+		args[argc++] = "-H";
+		args[argc++] = none_match;
+	}
+	if (modified_since) {
+		args[argc++] = "-H";
+		args[argc++] = modified_since;
+	}
+	if (range) {
+		args[argc++] = "-H";
+		args[argc++] = range;
+	}
+	args[argc++] = url;
+	args[argc] = NULL;
+
+	IF_DEBUG("[download] fetching %s%s\n", url, 
+			 (cached ? " if changed" : (resume ? " from where it stopped" : "")));
+	int res = exec_with_args(args);
+	free(none_match);
+	free(modified_since);
+	free(range);
+	return res;
+}
+
+int DownloadCache::trim(uint32_t keep) {
+	// entries sharing content count once
+	uint64_t total = 0;
+	for (uint32_t i = 0; i < m_count; i++) {
+		bool first = true;
+		for (uint32_t j = 0; j < i && first; j++) {
+			first = (strcmp(m_entries[j].digest, m_entries[i].digest) != 0);
+		}
+		if (first) total += m_entries[i].size;
+	}
+
+	while (total > m_limit && m_count > 1) {
+		uint32_t oldest = (keep == 0) ? 1 : 0;
+		for (uint32_t i = 0; i < m_count; i++) {
+			if (i != keep && m_entries[i].used < m_entries[oldest].used) oldest = i;
+		}
+		download_t victim = m_entries[oldest];
+		memmove(&m_entries[oldest], &m_entries[oldest + 1], 
+				(m_count - oldest - 1) * sizeof(download_t));
+		m_count--;
+		if (keep > oldest) keep--;
+		IF_DEBUG("[download] evicting %s\n", victim.url);
+
+		bool shared = false;
+		for (uint32_t i = 0; i < m_count && !shared; i++) {
+			shared = (strcmp(m_entries[i].digest, victim.digest) == 0);
+		}
+		if (!shared) {
+			// along with the copy in the downloads directory made from it
+			char* object = this->object_path(victim.digest);
+			char name[PATH_MAX];
+			char* local;
+			join_path(&local, m_downloads_path, path_basename(victim.url, name, sizeof(name)));
+			struct stat osb, lsb;
+			if (stat(object, &osb) == 0 && lstat(local, &lsb) == 0 && 
+				osb.st_dev == lsb.st_dev && osb.st_ino == lsb.st_ino) {
+				unlink(local);
+			}
+			if (unlink(object) == -1 && errno != ENOENT) perror(object);
+			free(local);
+			free(object);
+			total -= victim.size;
+		}
+		free_download(&victim);
+	}
+	return 0;
+}
+
+char* DownloadCache::fetch(const char* url) {
+	if (this->lock()) return NULL;
+
+	int res = 0;
+	download_t* entry = this->find(url);
+	char* object = entry ? this->object_path(entry->digest) : NULL;
+	bool cached = object && is_regular_file(object);
+
+	// partial downloads are named after the url they come from
+	SHA1Digest urldigest((uint8_t*)url, (uint32_t)strlen(url));
+	char* key = urldigest.string();
+	char* partial;
+	char* headers;
+	asprintf(&partial, "%s/partial/%s", m_path, key);
+	asprintf(&headers, "%s/partial/%s.headers", m_path, key);
+	free(key);
+
+	bool resume = !cached && file_size(partial) > 0;
+	res = this->transfer(url, (cached ? entry : NULL), partial, headers, resume);
+	if (resume && (res == CURL_RANGE_ERROR || res == CURL_HTTP_ERROR)) {
+		// the server cannot continue it, or it changed in the meantime
+		IF_DEBUG("[download] could not resume %s (%d), starting over\n", url, res);
+		res = this->transfer(url, NULL, partial, headers, false);
+	}
+
+	int status = 0;
+	char* etag = NULL;
+	char* modified = NULL;
+	if (res == 0) read_headers(headers, &status, &etag, &modified);
+
+	if (res == 0 && cached && status == 304) {
+		IF_DEBUG("[download] %s has not changed\n", url);
+		unlink(partial);
+	} else if (res == 0) {
+		// new content, stored under its digest
+		SHA1Digest digest(partial);
+		char* hex = digest.string();
+		char* path = this->object_path(hex);
+		if (is_regular_file(path)) {
+			unlink(partial);
+		} else if (rename(partial, path) == -1) {
+			perror(path);
+			res = -1;
+		}
+		if (res == 0 && !entry) {
+			download_t* entries = (download_t*)realloc(m_entries, (m_count + 1) * sizeof(download_t));
+			if (entries) {
+				m_entries = entries;
+				entry = &m_entries[m_count++];
+				memset(entry, 0, sizeof(download_t));
+				entry->url = strdup(url);
+			} else {
+				res = -1;
+			}
+		}
+		if (res == 0) {
+			free(entry->digest);
+			free(entry->etag);
+			free(entry->modified);
+			entry->digest = hex;
+			entry->size = file_size(path);
+			entry->etag = etag;
+			entry->modified = modified;
+			etag = NULL;
+			modified = NULL;
+			hex = NULL;
+			free(object);
+			object = path;
+			path = NULL;
+			cached = true;
+		}
+		free(hex);
+		free(path);
+	} else if (cached && res != CURL_HTTP_ERROR) {
+		fprintf(stderr, "Warning: could not reach %s, using the copy downloaded before.\n", url);
+		res = 0;
+	}
+	if (res == 0 || res == CURL_HTTP_ERROR) unlink(headers);
+	if (res == CURL_HTTP_ERROR) unlink(partial);
+	free(etag);
+	free(modified);
+	free(partial);
+	free(headers);
+
+	// installs read the root from the downloads directory, as before
+	char* local = NULL;
+	if (res == 0) {
+		char name[PATH_MAX];
+		join_path(&local, m_downloads_path, path_basename(url, name, sizeof(name)));
+		if (unlink(local) == -1 && errno != ENOENT) perror(local);
+		if (link(object, local) == -1 && 
+			copyfile(object, local, NULL, COPYFILE_DATA) == -1) {
+			perror(local);
+			free(local);
+			local = NULL;
+			res = -1;
+		}
+	}
+	if (res == 0) {
+		entry->used = time(NULL);
+		this->trim((uint32_t)(entry - m_entries));
+		this->save();
+	}
+
+	free(object);
+	this->unlock();
+	return local;
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2013 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#ifndef _DOWNLOADCACHE_H
+#define _DOWNLOADCACHE_H
+
+#include <stdint.h>
+#include <time.h>
+
+// bytes of downloaded roots kept for later installs, the least recently
+//  used going first
+#define DOWNLOAD_CACHE_LIMIT (1024ULL * 1024 * 1024)
+
+// one cached url, as listed in the cache index
+struct download_t {
+	char*    url;
+	char*    digest;    // hex SHA-1 of the content, the cached file's name
+	uint64_t size;
+	time_t   used;      // the last time it was fetched
+	char*    etag;      // validators the server sent, or NULL
+	char*    modified;
+};
+
+/**
+ *
+ * DownloadCache keeps the roots fetched over http(s) in the depot's
+ * Downloads/Cache directory, named by the digest of their content, so
+ * a root is stored once however many urls it was fetched from. A url
+ * seen before is revalidated with the ETag and Last-Modified the server
+ * sent, and only downloaded again if it changed. Interrupted downloads
+ * are resumed with a range request. The cached copy is used as is when
+ * the server cannot be reached.
+ *
+ */
+struct DownloadCache {
+	DownloadCache(const char* downloads_path, uint64_t limit);
+	virtual ~DownloadCache();
+
+	// returns a path in the downloads directory named after the last
+	//  component of url, or NULL. Caller must free it.
+	char* fetch(const char* url);
+
+protected:
+
+	int   lock();
+	int   unlock();
+	int   save();
+	download_t* find(const char* url);
+	char* object_path(const char* digest);
+	// runs curl for url into partial, resuming it if resume is set
+	int   transfer(const char* url, download_t* cached, const char* partial,
+				   const char* headers, bool resume);
+	// evicts the least recently used entries, other than entry keep, until
+	//  the cache is under its limit
+	int   trim(uint32_t keep);
+
+	char*       m_downloads_path;
+	char*       m_path;
+	char*       m_index_path;
+	int         m_index_fd;
+	download_t* m_entries;
+	uint32_t    m_count;
+	uint64_t    m_limit;
+};
+
+#endif
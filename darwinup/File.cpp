@@ -53,6 +53,7 @@ File::File() {
 	m_uid = 0;
 	m_gid = 0;
 	m_size = 0;
+	m_mtime = 0;
 	m_digest = NULL;
 }
 
@@ -64,6 +65,7 @@ File::File(const char* path) {
 	m_uid = 0;
 	m_gid = 0;
 	m_size = 0;
+	m_mtime = 0;
 	m_digest = NULL;
 	if (path) m_path = strdup(path);
 }
@@ -73,12 +75,13 @@ File::File(Archive* archive, FTSENT* ent) {
 	path[0] = 0;
 	ftsent_filename(ent, path, PATH_MAX);
 	m_path = strdup(path);
-	m_archive = archive;
+	m_archive = archive ? archive->retain() : NULL;
 	m_info = FILE_INFO_NONE;
 	m_mode = ent->fts_statp->st_mode;
 	m_uid = ent->fts_statp->st_uid;
 	m_gid = ent->fts_statp->st_gid;
 	m_size = ent->fts_statp->st_size;
+	m_mtime = ent->fts_statp->st_mtime;
 	
 	m_digest = NULL;
 }
@@ -86,13 +89,14 @@ File::File(Archive* archive, FTSENT* ent) {
 File::File(uint64_t serial, Archive* archive, uint32_t info, const char* path, 
 		   mode_t mode, uid_t uid, gid_t gid, off_t size, Digest* digest) {
 	m_serial = serial;
-	m_archive = archive;
+	m_archive = archive ? archive->retain() : NULL;
 	m_info = info;
 	m_path = strdup(path);
 	m_mode = mode;
 	m_uid = uid;
 	m_gid = gid;
 	m_size = size;
+	m_mtime = 0;
 	m_digest = digest;
 }
 
@@ -100,6 +104,7 @@ File::File(uint64_t serial, Archive* archive, uint32_t info, const char* path,
 File::~File() {
 	if (m_path) free(m_path);
 	if (m_digest) delete m_digest;
+	if (m_archive) m_archive->release();
 }
 
 uint64_t	File::serial()	{ return m_serial; }
@@ -111,10 +116,16 @@ uid_t		File::uid()	{ return m_uid; }
 gid_t		File::gid()	{ return m_gid; }
 off_t		File::size()	{ return m_size; }
 Digest*		File::digest()	{ return m_digest; }
+time_t		File::mtime()	{ return m_mtime; }
 
 void		File::info_set(uint64_t flag)	{ m_info = INFO_SET(m_info, flag); }
 void		File::info_clr(uint64_t flag)	{ m_info = INFO_CLR(m_info, flag); }
-void		File::archive(Archive* archive) { m_archive = archive; }
+void		File::archive(Archive* archive) {
+	if (archive) archive->retain();
+	if (m_archive) m_archive->release();
+	m_archive = archive;
+}
+void		File::mtime(time_t mtime)	{ m_mtime = mtime; }
 
 uint32_t File::compare(File* a, File* b) {
 	if (a == b) return FILE_INFO_IDENTICAL; // identity
@@ -149,7 +160,7 @@ void File::print(FILE* stream) {
 }
 
 int File::install(const char* prefix, const char* dest, bool uninstall) {
-	extern uint32_t force;
+	uint32_t force = Context::current()->force;
 	int res = 0;
 	Archive* archive = this->archive();
 	assert(archive != NULL);
@@ -245,14 +256,8 @@ int File::remove() {
 	return -1;
 }
 
-int File::unquarantine(const char *prefix) {
-	int res = 0;
-	Archive *archive = this->archive();
-	const char *srcpath = archive->directory_name(prefix);
-	char path[PATH_MAX];
-	snprintf(path, sizeof(path), "%s/%s", srcpath, this->path());
-
-	res = removexattr(path, "com.apple.quarantine", XATTR_NOFOLLOW);
+static int remove_quarantine(const char* path) {
+	int res = removexattr(path, "com.apple.quarantine", XATTR_NOFOLLOW);
 	IF_DEBUG("[unquarantine] removexattr %s\n", path);
 	if (res == -1 && errno == ENOATTR) {
 		// Safely ignore ENOATTR, we didn't have the quarantine
@@ -260,11 +265,26 @@ int File::unquarantine(const char *prefix) {
 		res = 0;
 	} else if (res != 0) {
 		fprintf(stderr, "%s:%d: %s: %s (%d)\n",
-				__FILE__, __LINE__, m_path, strerror(errno), errno);
+				__FILE__, __LINE__, path, strerror(errno), errno);
 	}
 	return res;
 }
 
+int File::unquarantine(const char *prefix) {
+	Archive *archive = this->archive();
+	char *srcpath = archive->directory_name(prefix);
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", srcpath, this->path());
+	free(srcpath);
+	return remove_quarantine(path);
+}
+
+int File::unquarantine_at(const char *dest) {
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", dest, this->path());
+	return remove_quarantine(path);
+}
+
 int File::install_info(const char* dest) {
 	int res = 0;
 	char* path;
@@ -294,10 +314,14 @@ Regular::Regular(Archive* archive, FTSENT* ent) : File(archive, ent) {
 	m_digest = new SHA1Digest(ent->fts_accpath);
 }
 
+Regular::Regular(Archive* archive, FTSENT* ent, Digest* digest) : File(archive, ent) {
+	m_digest = digest;
+}
+
 Regular::Regular(uint64_t serial, Archive* archive, uint32_t info, const char* path, 
 				 mode_t mode, uid_t uid, gid_t gid, off_t size, Digest* digest) 
 : File(serial, archive, info, path, mode, uid, gid, size, digest) {
-	if (digest == NULL || serial == 0) {
+	if (digest == NULL) {
 		m_digest = new SHA1Digest(path);
 	}
 }
@@ -383,7 +407,7 @@ int Directory::_install(const char* prefix, const char* dest, bool uninstall, bo
 	// existing one, since that would move the entire
 	// sub-tree, and lead to a lot of ENOENT errors.
 	int res = 0;
-	extern uint32_t force;
+	uint32_t force = Context::current()->force;
 	char* dstpath;
 	join_path(&dstpath, dest, this->path());
 	
@@ -543,11 +567,37 @@ File* FileFactory(Archive* archive, FTSENT* ent) {
 	return file;
 }
 
+File* FileFactory(Archive* archive, FTSENT* ent, LinkGroups* links) {
+	struct stat* sb = ent->fts_statp;
+	if (ent->fts_info == FTS_F && archive) {
+		char path[PATH_MAX];
+		path[0] = 0;
+		ftsent_filename(ent, path, sizeof(path));
+		Digest* digest = archive->staged_digest(path, sb);
+		if (digest) return new Regular(archive, ent, digest);
+	}
+	if (ent->fts_info != FTS_F || sb->st_nlink < 2) {
+		return FileFactory(archive, ent);
+	}
+	HardLink* link = links->find(sb);
+	if (link && link->digest) {
+		IF_DEBUG("[factory]    %s is a link to %s\n", ent->fts_path, link->path);
+		return new Regular(archive, ent, link->digest->copy());
+	}
+	File* file = FileFactory(archive, ent);
+	if (file && !link) links->add(sb, ent->fts_path, file->digest());
+	return file;
+}
+
 File* FileFactory(const char* path) {
+	return FileFactory(path, NULL);
+}
+
+File* FileFactory(const char* path, LinkGroups* links) {
 	File* file = NULL;
 	struct stat sb;
 	int res = 0;
-	extern uint32_t force;
+	uint32_t force = Context::current()->force;
 	
 	res = lstat(path, &sb);
 	if (res == -1 && errno == ENOENT) {
@@ -567,7 +617,292 @@ File* FileFactory(const char* path) {
 		return NULL;
 	}
 	
+	HardLink* link = NULL;
+	if (links && S_ISREG(sb.st_mode) && sb.st_nlink > 1) {
+		link = links->find(&sb);
+	}
+	Digest* digest = NULL;
+	if (link && link->digest) {
+		IF_DEBUG("[factory]    %s is a link to %s\n", path, link->path);
+		digest = link->digest->copy();
+	}
 	file = FileFactory(0, NULL, FILE_INFO_NONE, path, sb.st_mode, sb.st_uid, 
-					   sb.st_gid, sb.st_size, NULL);
+					   sb.st_gid, sb.st_size, digest);
+	if (file) file->mtime(sb.st_mtime);
+	if (file && links && !link && S_ISREG(sb.st_mode) && sb.st_nlink > 1) {
+		links->add(&sb, path, file->digest());
+	}
+	return file;
+}
+
+LinkGroups::LinkGroups() {
+	count = 0;
+	capacity = 0;
+	links = NULL;
+}
+
+LinkGroups::~LinkGroups() {
+	for (uint32_t i = 0; i < count; i++) {
+		free(links[i].path);
+		if (links[i].digest) delete links[i].digest;
+	}
+	free(links);
+}
+
+// index of the first link not before dev and ino
+static uint32_t link_index(HardLink* links, uint32_t count, dev_t dev, ino_t ino) {
+	uint32_t lo = 0;
+	uint32_t hi = count;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (links[mid].dev < dev || (links[mid].dev == dev && links[mid].ino < ino)) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+HardLink* LinkGroups::find(const struct stat* sb) {
+	uint32_t i = link_index(links, count, sb->st_dev, sb->st_ino);
+	if (i < count && links[i].dev == sb->st_dev && links[i].ino == sb->st_ino) {
+		return &links[i];
+	}
+	return NULL;
+}
+
+int LinkGroups::add(const struct stat* sb, const char* path, Digest* digest) {
+	uint32_t i = link_index(links, count, sb->st_dev, sb->st_ino);
+	if (i < count && links[i].dev == sb->st_dev && links[i].ino == sb->st_ino) {
+		return 0;
+	}
+	if (count >= capacity) {
+		uint32_t newcap = capacity ? capacity * 2 : 16;
+		HardLink* grown = (HardLink*)realloc(links, newcap * sizeof(HardLink));
+		if (!grown) {
+			fprintf(stderr, "Error: ran out of memory in LinkGroups::add\n");
+			return -1;
+		}
+		links = grown;
+		capacity = newcap;
+	}
+	memmove(&links[i + 1], &links[i], (count - i) * sizeof(HardLink));
+	links[i].dev = sb->st_dev;
+	links[i].ino = sb->st_ino;
+	links[i].path = strdup(path);
+	links[i].digest = digest ? digest->copy() : NULL;
+	count++;
+	return 0;
+}
+
+// records and string space are allocated in blocks of these sizes
+#define FILE_POOL_BLOCK 1024
+#define FILE_POOL_STRINGS 65536
+
+FilePool::FilePool() {
+	m_blocks = NULL;
+	m_block_count = 0;
+	m_count = 0;
+	m_strings = NULL;
+	m_string_count = 0;
+	m_string_used = 0;
+	m_string_size = 0;
+	m_dirs = NULL;
+	m_dir_count = 0;
+	m_dir_table = NULL;
+	m_dir_table_size = 0;
+	m_archives = NULL;
+	m_archive_count = 0;
+}
+
+FilePool::~FilePool() {
+	for (uint32_t i = 0; i < m_block_count; i++) free(m_blocks[i]);
+	free(m_blocks);
+	for (uint32_t i = 0; i < m_string_count; i++) free(m_strings[i]);
+	free(m_strings);
+	free(m_dirs);
+	free(m_dir_table);
+	for (uint32_t i = 0; i < m_archive_count; i++) m_archives[i]->release();
+	free(m_archives);
+}
+
+uint32_t FilePool::count() {
+	return m_count;
+}
+
+FileRecord* FilePool::record(uint32_t index) {
+	assert(index < m_count);
+	return &m_blocks[index / FILE_POOL_BLOCK][index % FILE_POOL_BLOCK];
+}
+
+const char* FilePool::copy_string(const char* string, size_t length) {
+	if (m_string_used + length + 1 > m_string_size) {
+		size_t size = FILE_POOL_STRINGS;
+		if (length + 1 > size) size = length + 1;
+		char** strings = (char**)realloc(m_strings, (m_string_count + 1) * sizeof(char*));
+		if (!strings) return NULL;
+		m_strings = strings;
+		m_strings[m_string_count] = (char*)malloc(size);
+		if (!m_strings[m_string_count]) return NULL;
+		m_string_count++;
+		m_string_used = 0;
+		m_string_size = size;
+	}
+	char* copy = m_strings[m_string_count - 1] + m_string_used;
+	memcpy(copy, string, length);
+	copy[length] = 0;
+	m_string_used += length + 1;
+	return copy;
+}
+
+static uint32_t hash_string(const char* string, size_t length) {
+	uint32_t hash = 2166136261U;
+	for (size_t i = 0; i < length; i++) {
+		hash = (hash ^ (uint8_t)string[i]) * 16777619U;
+	}
+	return hash;
+}
+
+// index of dir in m_dirs, adding it if it is new, or UINT32_MAX if out 
+//  of memory
+uint32_t FilePool::intern(const char* dir, size_t length) {
+	uint32_t mask = m_dir_table_size - 1;
+	uint32_t slot = hash_string(dir, length) & mask;
+	while (m_dir_table_size && m_dir_table[slot]) {
+		const char* other = m_dirs[m_dir_table[slot] - 1];
+		if (strncmp(other, dir, length) == 0 && other[length] == 0) {
+			return m_dir_table[slot] - 1;
+		}
+		slot = (slot + 1) & mask;
+	}
+
+	// kept at most half full, so the search above always ends
+	if ((m_dir_count + 1) * 2 > m_dir_table_size) {
+		uint32_t size = m_dir_table_size ? m_dir_table_size * 2 : 256;
+		uint32_t* table = (uint32_t*)calloc(size, sizeof(uint32_t));
+		const char** dirs = (const char**)realloc(m_dirs, size / 2 * sizeof(char*));
+		if (dirs) m_dirs = dirs;
+		if (!table || !dirs) {
+			free(table);
+			return UINT32_MAX;
+		}
+		for (uint32_t i = 0; i < m_dir_count; i++) {
+			uint32_t s = hash_string(m_dirs[i], strlen(m_dirs[i])) & (size - 1);
+			while (table[s]) s = (s + 1) & (size - 1);
+			table[s] = i + 1;
+		}
+		free(m_dir_table);
+		m_dir_table = table;
+		m_dir_table_size = size;
+		mask = size - 1;
+		slot = hash_string(dir, length) & mask;
+		while (m_dir_table[slot]) slot = (slot + 1) & mask;
+	}
+
+	const char* copy = this->copy_string(dir, length);
+	if (!copy) return UINT32_MAX;
+	m_dirs[m_dir_count] = copy;
+	m_dir_table[slot] = ++m_dir_count;
+	return m_dir_count - 1;
+}
+
+FileRecord* FilePool::add(Archive* archive, const char* path) {
+	if (m_count == m_block_count * FILE_POOL_BLOCK) {
+		FileRecord** list = (FileRecord**)realloc(m_blocks, (m_block_count + 1) * sizeof(FileRecord*));
+		if (!list) return NULL;
+		m_blocks = list;
+		m_blocks[m_block_count] = (FileRecord*)malloc(FILE_POOL_BLOCK * sizeof(FileRecord));
+		if (!m_blocks[m_block_count]) return NULL;
+		m_block_count++;
+	}
+
+	// the records of an operation come from a handful of archives
+	uint32_t i = m_archive_count;
+	while (archive && i > 0 && m_archives[i - 1]->serial() != archive->serial()) i--;
+	if (archive && i == 0) {
+		Archive** list = (Archive**)realloc(m_archives, (m_archive_count + 1) * sizeof(Archive*));
+		if (!list) return NULL;
+		m_archives = list;
+		m_archives[m_archive_count++] = archive->retain();
+		i = m_archive_count;
+	}
+
+	const char* slash = strrchr(path, '/');
+	size_t length = slash ? slash - path + 1 : 0;
+	uint32_t dir = this->intern(path, length);
+	const char* name = this->copy_string(path + length, strlen(path + length));
+	if (dir == UINT32_MAX || !name) return NULL;
+
+	FileRecord* record = &m_blocks[m_count / FILE_POOL_BLOCK][m_count % FILE_POOL_BLOCK];
+	memset(record, 0, sizeof(FileRecord));
+	record->archive = archive ? m_archives[i - 1] : NULL;
+	record->dir = dir;
+	record->name = name;
+	m_count++;
+	return record;
+}
+
+FileRecord* FilePool::add(File* file) {
+	Digest* digest = file->digest();
+	if (digest && digest->size() > sizeof(((FileRecord*)0)->digest)) {
+		fprintf(stderr, "%s:%d: digest of %s is too large for its record\n",
+				__FILE__, __LINE__, file->path());
+		return NULL;
+	}
+	FileRecord* record = this->add(file->archive(), file->path());
+	if (!record) return NULL;
+	record->serial = file->serial();
+	record->info = (uint32_t)file->info();
+	record->size = file->size();
+	record->mtime = file->mtime();
+	record->mode = file->mode();
+	record->uid = file->uid();
+	record->gid = file->gid();
+	if (digest) {
+		record->digest_size = (uint8_t)digest->size();
+		memcpy(record->digest, digest->data(), digest->size());
+	}
+	return record;
+}
+
+const char* FilePool::directory(FileRecord* record) {
+	return m_dirs[record->dir];
+}
+
+char* FilePool::path(FileRecord* record, char* path, size_t size) {
+	int len = snprintf(path, size, "%s%s", m_dirs[record->dir], record->name);
+	if (len < 0 || (size_t)len >= size) return NULL;
+	return path;
+}
+
+bool FilePool::same_path(FileRecord* a, FileRecord* b) {
+	return a->dir == b->dir && strcmp(a->name, b->name) == 0;
+}
+
+Digest* FilePool::digest(FileRecord* record) {
+	if (record->digest_size == 0) return NULL;
+	SHA1Digest* digest = new SHA1Digest();
+	digest->m_size = record->digest_size;
+	memcpy(digest->m_data, record->digest, record->digest_size);
+	return digest;
+}
+
+File* FileFactory(FilePool* pool, FileRecord* record) {
+	char path[PATH_MAX];
+	if (!pool->path(record, path, sizeof(path))) {
+		fprintf(stderr, "%s:%d: path too long: %s%s\n", 
+				__FILE__, __LINE__, pool->directory(record), record->name);
+		return NULL;
+	}
+	Digest* digest = pool->digest(record);
+	File* file = FileFactory(record->serial, record->archive, record->info, path, 
+							 record->mode, record->uid, record->gid, record->size, 
+							 digest);
+	if (file) {
+		file->mtime(record->mtime);
+	} else {
+		delete digest;
+	}
 	return file;
 }
@@ -74,6 +74,7 @@ const uint32_t FILE_INFO_BASE_SYSTEM		= 0x0001;	// file was part of base system,
 const uint32_t FILE_INFO_NO_ENTRY		= 0x0002;	// placeholder in the database for non-existent file
 const uint32_t FILE_INFO_INSTALL_DATA		= 0x0010;	// actually install the file
 const uint32_t FILE_INFO_ROLLBACK_DATA		= 0x0020;	// file exists in rollback archive
+const uint32_t FILE_INFO_NEW_TREE		= 0x0040;	// file is in a directory new to the destination
 
 //
 // FILE_INFO flags returned by File::compare()
@@ -109,9 +110,19 @@ struct File;
 //  concrete subclass for a given filesystem object.
 ////
 
+struct LinkGroups;
+struct FilePool;
+struct FileRecord;
+
 File* FileFactory(uint64_t serial, Archive* archive, uint32_t info, const char* path, mode_t mode, uid_t uid, gid_t gid, off_t size, Digest* digest);
 File* FileFactory(const char* path);
 File* FileFactory(Archive* archive, FTSENT* ent);
+// Regular files with more than one link take the digest of the first
+// of their links seen in links, instead of reading the data again.
+File* FileFactory(const char* path, LinkGroups* links);
+File* FileFactory(Archive* archive, FTSENT* ent, LinkGroups* links);
+// A new File for the record, which the caller deletes. See FileRecord.
+File* FileFactory(FilePool* pool, FileRecord* record);
 
 
 struct File {
@@ -157,6 +168,10 @@ struct File {
 	// Digest of the file's data.
 	virtual Digest* digest();
 
+	// Modification time of the file, or 0 if not known.
+	virtual time_t mtime();
+	virtual void mtime(time_t mtime);
+
 	////
 	//  Class functions
 	////
@@ -185,6 +200,8 @@ struct File {
 
 	// Removes any quarantine xattrs present
 	int unquarantine(const char *prefix);
+	// same, for a file already moved into dest
+	int unquarantine_at(const char *dest);
 
 	// Prints one line to the output stream indicating
 	// the file mode, ownership, digest and name.
@@ -200,6 +217,7 @@ struct File {
 	uid_t		m_uid;
 	gid_t		m_gid;
 	off_t		m_size;
+	time_t		m_mtime;
 	Digest*		m_digest;
 	
 	friend struct Depot;
@@ -224,6 +242,7 @@ struct NoEntry : File {
 ////
 struct Regular : File {
 	Regular(Archive* archive, FTSENT* ent);
+	Regular(Archive* archive, FTSENT* ent, Digest* digest);
 	Regular(uint64_t serial, Archive* archive, uint32_t info, const char* path, mode_t mode, uid_t uid, gid_t gid, off_t size, Digest* digest);
 	virtual int remove();
 };
@@ -252,4 +271,104 @@ struct Directory : File {
 	virtual int remove();
 };
 
+////
+//  Hard links seen while walking a tree, by device and inode.
+//  The first link added for an inode keeps its path, and a copy
+//  of its digest, for the links found after it.
+////
+struct HardLink {
+	dev_t		dev;
+	ino_t		ino;
+	char*		path;
+	Digest*		digest;
+};
+
+struct LinkGroups {
+	LinkGroups();
+	~LinkGroups();
+
+	// The first link added for sb's inode, or NULL.
+	HardLink* find(const struct stat* sb);
+
+	// Adds path as the first link of sb's inode. digest may be NULL.
+	int add(const struct stat* sb, const char* path, Digest* digest);
+
+	uint32_t	count;
+	uint32_t	capacity;
+	HardLink*	links;		// sorted by dev and ino
+};
+
+////
+//  FileRecord
+//
+//  The compact form of a file's database record, for operations
+//  that hold the records of many files at once. Records are
+//  allocated from a FilePool, which owns the directory and name
+//  strings they point to and holds their archives. The path is
+//  the directory, interned once per pool, followed by the name,
+//  and the digest is stored inline.
+//
+//  Records have no behavior of their own; FileFactory(pool, record)
+//  makes a File for one record when one is needed.
+////
+struct FileRecord {
+	uint64_t	serial;
+	Archive*	archive;
+	uint32_t	info;
+	uint32_t	dir;		// index of the directory in the pool
+	const char*	name;		// path within the directory
+	off_t		size;
+	time_t		mtime;
+	mode_t		mode;
+	uid_t		uid;
+	gid_t		gid;
+	uint8_t		digest_size;	// 0 if there is no digest
+	uint8_t		digest[CC_SHA1_DIGEST_LENGTH];
+};
+
+struct FilePool {
+	FilePool();
+	~FilePool();
+
+	// Number of records added, and the index'th of them.
+	uint32_t count();
+	FileRecord* record(uint32_t index);
+
+	// Adds a record for path, with its other fields zeroed, and
+	// holds a reference to archive. Returns NULL if out of memory.
+	FileRecord* add(Archive* archive, const char* path);
+	// Adds a copy of file's record.
+	FileRecord* add(File* file);
+
+	// Directory of the record, ending in a slash.
+	const char* directory(FileRecord* record);
+	// Copies the record's path into path, or returns NULL if it
+	// does not fit.
+	char* path(FileRecord* record, char* path, size_t size);
+	// Whether two records of the pool have the same path.
+	static bool same_path(FileRecord* a, FileRecord* b);
+
+	// A new digest with the record's value, or NULL.
+	Digest* digest(FileRecord* record);
+
+	protected:
+
+	const char* copy_string(const char* string, size_t length);
+	uint32_t intern(const char* dir, size_t length);
+
+	FileRecord**	m_blocks;	// FILE_POOL_BLOCK records each
+	uint32_t		m_block_count;
+	uint32_t		m_count;
+	char**			m_strings;	// string blocks, the last being filled
+	uint32_t		m_string_count;
+	size_t			m_string_used;
+	size_t			m_string_size;
+	const char**	m_dirs;
+	uint32_t		m_dir_count;
+	uint32_t*		m_dir_table;	// open hash of dir index + 1
+	uint32_t		m_dir_table_size;
+	Archive**		m_archives;
+	uint32_t		m_archive_count;
+};
+
 #endif
@@ -0,0 +1,350 @@
+/*
+ * Copyright (c) 2013 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#include "Jobs.h"
+#include "Utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+typedef int (*job_func_t)(const char* prefix);
+
+struct job_t {
+	const char* name;
+	job_func_t  func;
+};
+
+static const job_t jobs[] = {
+	{ "dyld", update_dyld_shared_cache },
+	{ "xpc",  update_xpc_services_cache },
+	{ NULL,   NULL },
+};
+
+// opens and locks the state file at path, then reads it into state
+static int lock_state(const char* path, job_state_t* state) {
+	memset(state, 0, sizeof(*state));
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd == -1) {
+		perror(path);
+		return -1;
+	}
+	if (flock(fd, LOCK_EX) == -1) {
+		perror(path);
+		close(fd);
+		return -1;
+	}
+
+	char buf[512];
+	ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+	buf[len > 0 ? len : 0] = 0;
+	char* line = buf;
+	while (line && *line) {
+		char* next = strchr(line, '\n');
+		if (next) *next++ = 0;
+		unsigned long long value;
+		long long when;
+		int number;
+		if (sscanf(line, "requests %llu", &value) == 1) state->requests = value;
+		else if (sscanf(line, "ran %llu", &value) == 1) state->ran = value;
+		else if (sscanf(line, "requested %lld", &when) == 1) state->requested = when;
+		else if (sscanf(line, "started %lld", &when) == 1) state->started = when;
+		else if (sscanf(line, "finished %lld", &when) == 1) state->finished = when;
+		else if (sscanf(line, "running %d", &number) == 1) state->running = number;
+		else if (sscanf(line, "status %d", &number) == 1) state->status = number;
+		else if (sscanf(line, "pid %d", &number) == 1) state->pid = number;
+		line = next;
+	}
+	return fd;
+}
+
+// writes state back to fd, unless state is NULL, then unlocks it
+static int unlock_state(int fd, job_state_t* state) {
+	int res = 0;
+	if (state) {
+		char buf[512];
+		int len = snprintf(buf, sizeof(buf), 
+						   "requests %llu\nran %llu\nrequested %lld\n"
+						   "started %lld\nfinished %lld\nrunning %d\n"
+						   "status %d\npid %d\n",
+						   (unsigned long long)state->requests,
+						   (unsigned long long)state->ran,
+						   (long long)state->requested,
+						   (long long)state->started,
+						   (long long)state->finished,
+						   state->running, state->status, (int)state->pid);
+		if (ftruncate(fd, 0) == -1 || pwrite(fd, buf, len, 0) != len) {
+			perror("job state");
+			res = -1;
+		}
+	}
+	close(fd);
+	return res;
+}
+
+// a runner holds an exclusive lock on its job's lock file for as long as
+//  it lives, which no stale pid or reboot can fake
+static bool is_alive(const char* lockpath) {
+	int fd = open(lockpath, O_RDONLY);
+	if (fd == -1) return false;
+	bool alive = (flock(fd, LOCK_EX | LOCK_NB) == -1 && errno == EWOULDBLOCK);
+	close(fd);
+	return alive;
+}
+
+JobQueue::JobQueue(const char* jobs_path, const char* hooks_path, const char* prefix) {
+	m_jobs_path = strdup(jobs_path);
+	m_hooks_path = strdup(hooks_path);
+	m_prefix = strdup(prefix);
+}
+
+JobQueue::~JobQueue() {
+	free(m_jobs_path);
+	free(m_hooks_path);
+	free(m_prefix);
+}
+
+char* JobQueue::state_path(const char* job) {
+	char* path;
+	join_path(&path, m_jobs_path, job);
+	return path;
+}
+
+char* JobQueue::lock_path(const char* job) {
+	char* path;
+	asprintf(&path, "%s/%s.lock", m_jobs_path, job);
+	return path;
+}
+
+int JobQueue::request(const char* job) {
+	int res = 0;
+	if (mkdir(m_jobs_path, 0750) == -1 && errno != EEXIST) {
+		perror(m_jobs_path);
+		return -1;
+	}
+
+	char* path = this->state_path(job);
+	job_state_t state;
+	int fd = lock_state(path, &state);
+	free(path);
+	if (fd == -1) return -1;
+
+	state.requests++;
+	state.requested = time(NULL);
+	IF_DEBUG("[jobs] %s requested (%llu)\n", job, 
+			 (unsigned long long)state.requests);
+
+	// a waiting runner sees the new request once we unlock. Otherwise
+	//  take the runner lock here and hand it to the new runner, so no
+	//  other request can start a second one in between.
+	path = this->lock_path(job);
+	int lock = path ? open(path, O_RDONLY | O_CREAT, 0644) : -1;
+	// only the runner may hold the lock, not the hooks it runs or
+	//  anything they leave behind
+	if (lock != -1) fcntl(lock, F_SETFD, FD_CLOEXEC);
+	if (lock == -1) {
+		perror(path ? path : "job lock");
+		res = -1;
+	} else if (flock(lock, LOCK_EX | LOCK_NB) == 0) {
+		// don't let the child flush what we have buffered
+		fflush(stdout);
+		fflush(stderr);
+		pid_t pid = fork();
+		if (pid == 0) {
+			_exit(this->run(job, lock));
+		} else if (pid == -1) {
+			perror("fork");
+			res = -1;
+		} else {
+			state.pid = pid;
+		}
+	}
+	if (lock != -1) close(lock);
+	free(path);
+
+	int unlockres = unlock_state(fd, &state);
+	return res ? res : unlockres;
+}
+
+// body of the runner process, which exits when nothing is left to run
+int JobQueue::run(const char* job, int lock) {
+	// drop everything inherited from the parent but the runner lock, the
+	//  parent's locks included. The parent has no threads doing work by now.
+	setsid();
+	for (int fd = getdtablesize() - 1; fd >= 0; fd--) {
+		if (fd != lock) close(fd);
+	}
+	char* logpath;
+	asprintf(&logpath, "%s/%s.log", m_jobs_path, job);
+	open("/dev/null", O_RDONLY);
+	if (logpath == NULL ||
+		open(logpath, O_WRONLY | O_CREAT | O_TRUNC, 0644) == -1) {
+		open("/dev/null", O_WRONLY);
+	}
+	dup2(STDOUT_FILENO, STDERR_FILENO);
+	free(logpath);
+
+	char* path = this->state_path(job);
+	job_state_t state;
+	for (;;) {
+		int fd = lock_state(path, &state);
+		if (fd == -1) break;
+		if (state.ran >= state.requests) {
+			// a request made once we unlock must start a new runner
+			state.pid = 0;
+			close(lock);
+			unlock_state(fd, &state);
+			break;
+		}
+		time_t now = time(NULL);
+		time_t due = state.requested + JOB_DELAY;
+		if (now < due) {
+			unlock_state(fd, NULL);
+			sleep(due - now);
+			continue;
+		}
+		state.ran = state.requests;
+		state.started = now;
+		state.running = 1;
+		unlock_state(fd, &state);
+
+		int res = this->run_hook(job);
+
+		fd = lock_state(path, &state);
+		if (fd == -1) break;
+		state.finished = time(NULL);
+		state.running = 0;
+		state.status = res;
+		unlock_state(fd, &state);
+	}
+	free(path);
+	return 0;
+}
+
+int JobQueue::run_hook(const char* job) {
+	int res = 0;
+	char* hook;
+	join_path(&hook, m_hooks_path, job);
+	bool hooked = (hook && access(hook, X_OK) == 0);
+	fprintf(stdout, "%s: running %s\n", job, hooked ? hook : "built-in");
+	fflush(stdout);
+	if (hooked) {
+		const char* args[] = { hook, m_prefix, NULL };
+		res = exec_with_args(args);
+	} else {
+		res = -1;
+		for (const job_t* j = jobs; j->name; j++) {
+			if (strcmp(j->name, job) == 0) res = j->func(m_prefix);
+		}
+	}
+	fprintf(stdout, "%s: finished with status %d\n", job, res);
+	fflush(stdout);
+	free(hook);
+	return res;
+}
+
+int JobQueue::wait() {
+	bool pending = true;
+	while (pending) {
+		pending = false;
+		for (const job_t* j = jobs; j->name; j++) {
+			char* path = this->state_path(j->name);
+			struct stat sb;
+			job_state_t state;
+			int fd = -1;
+			if (stat(path, &sb) == 0) fd = lock_state(path, &state);
+			free(path);
+			if (fd == -1) continue;
+			unlock_state(fd, NULL);
+			// a runner which died leaves nothing to wait for
+			path = this->lock_path(j->name);
+			if ((state.running || state.ran < state.requests) && is_alive(path)) {
+				pending = true;
+			}
+			free(path);
+		}
+		if (pending) sleep(1);
+	}
+	return 0;
+}
+
+int JobQueue::status(bool wait) {
+	if (wait) this->wait();
+
+	fprintf(stdout, "%-6s %-12s  %-8s  %-12s  %s\n", 
+			"Job", "State", "Requests", "Last run", "Status");
+	fprintf(stdout, "====== ============  ========  ============  ======\n");
+	for (const job_t* j = jobs; j->name; j++) {
+		char* path = this->state_path(j->name);
+		struct stat sb;
+		job_state_t state;
+		memset(&state, 0, sizeof(state));
+		int fd = -1;
+		if (stat(path, &sb) == 0) fd = lock_state(path, &state);
+		free(path);
+		if (fd != -1) unlock_state(fd, NULL);
+
+		path = this->lock_path(j->name);
+		bool alive = is_alive(path);
+		free(path);
+		const char* name;
+		if (state.running) {
+			name = alive ? "running" : "interrupted";
+		} else if (state.ran < state.requests) {
+			name = alive ? "queued" : "stalled";
+		} else if (state.requests == 0) {
+			name = "idle";
+		} else {
+			name = state.status ? "failed" : "done";
+		}
+
+		char date[100] = "";
+		if (state.started) {
+			struct tm local;
+			localtime_r(&state.started, &local);
+			strftime(date, sizeof(date), "%b %e %H:%M", &local);
+		}
+		fprintf(stdout, "%-6s %-12s  %-8llu  %-12s  ", j->name, name,
+				(unsigned long long)state.requests, date);
+		if (state.started && !state.running) {
+			fprintf(stdout, "%d\n", state.status);
+		} else {
+			fprintf(stdout, "\n");
+		}
+	}
+	return 0;
+}
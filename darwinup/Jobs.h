@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2013 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#ifndef _JOBS_H
+#define _JOBS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+// seconds a job waits after the latest request for it, so requests
+//  from back to back commands are covered by one run
+#define JOB_DELAY 3
+
+// what is recorded in the depot about a job
+struct job_state_t {
+	uint64_t requests;  // requests made so far
+	uint64_t ran;       // requests covered by the latest run
+	time_t   requested; // time of the latest request
+	time_t   started;   // time the latest run started
+	time_t   finished;  // time the latest run finished
+	int      running;   // the latest run has not finished
+	int      status;    // exit status of the latest finished run
+	pid_t    pid;       // the process running the job, if any
+};
+
+/**
+ *
+ * JobQueue runs the work that follows changes to the system, such as
+ * regenerating the dyld shared cache, in the background. Each job
+ * has a state file in the depot's Jobs directory, and at most one
+ * runner process which waits until no request has come in for
+ * JOB_DELAY seconds before running the job, so a series of installs
+ * pays for a single run.
+ *
+ * An executable in the depot's Hooks directory named after a job is
+ * run with the prefix as its argument instead of the built-in work.
+ *
+ */
+struct JobQueue {
+	JobQueue(const char* jobs_path, const char* hooks_path, const char* prefix);
+	virtual ~JobQueue();
+
+	// record a request for job, starting a runner if none is waiting
+	int request(const char* job);
+
+	// wait for every requested job to finish
+	int wait();
+
+	// print the state of every job, after waiting if wait is set
+	int status(bool wait);
+
+protected:
+
+	char* state_path(const char* job);
+	// held by the job's runner while it lives
+	char* lock_path(const char* job);
+	int   run(const char* job, int lock);
+	int   run_hook(const char* job);
+
+	char* m_jobs_path;
+	char* m_hooks_path;
+	char* m_prefix;
+};
+
+#endif
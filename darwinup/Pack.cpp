@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2013 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#include "Pack.h"
+#include "Utils.h"
+#include <copyfile.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#define PACK_MAGIC "DUPACK1\n"
+#define PACK_MAGIC_SIZE 8
+
+Pack::Pack(const char* path) {
+	m_path = strdup(path);
+	m_file = NULL;
+	m_failed = false;
+}
+
+Pack::~Pack() {
+	if (m_file) fclose(m_file);
+	free(m_path);
+}
+
+bool Pack::packable(const char* path, const struct stat* sb) {
+	if (!S_ISLNK(sb->st_mode) && 
+		!(S_ISREG(sb->st_mode) && sb->st_size <= PACK_FILE_LIMIT)) {
+		return false;
+	}
+	// the metadata copyfile(3) would copy besides the data and stat
+	int extra = copyfile(path, NULL, NULL, 
+						 COPYFILE_CHECK | COPYFILE_ACL | COPYFILE_XATTR | COPYFILE_NOFOLLOW);
+	return extra == 0;
+}
+
+int Pack::add(uint64_t serial, const char* path, const char* srcpath, 
+			  const struct stat* sb) {
+	uint8_t data[PACK_FILE_LIMIT > PATH_MAX ? PACK_FILE_LIMIT : PATH_MAX];
+	ssize_t size = -1;
+	if (S_ISLNK(sb->st_mode)) {
+		size = readlink(srcpath, (char*)data, sizeof(data));
+	} else if (sb->st_size <= (off_t)sizeof(data)) {
+		int fd = open(srcpath, O_RDONLY | O_NOFOLLOW);
+		if (fd != -1) {
+			size = read(fd, data, sizeof(data));
+			close(fd);
+		}
+	}
+	// the file changed since it was looked at
+	if (size == -1 || size != sb->st_size) {
+		IF_DEBUG("[pack] not packing %s\n", srcpath);
+		return -1;
+	}
+
+	if (!m_file) {
+		m_file = fopen(m_path, "w");
+		if (!m_file || fwrite(PACK_MAGIC, PACK_MAGIC_SIZE, 1, m_file) != 1) {
+			perror(m_path);
+			m_failed = true;
+			return -1;
+		}
+	}
+
+	pack_record_t record;
+	memset(&record, 0, sizeof(record));
+	record.serial = serial;
+	record.mtime = sb->st_mtime;
+	record.mode = sb->st_mode;
+	record.uid = sb->st_uid;
+	record.gid = sb->st_gid;
+	record.path_size = (uint32_t)strlen(path) + 1;
+	record.data_size = (uint32_t)size;
+	IF_DEBUG("[pack] %s: %u bytes\n", path, record.data_size);
+	if (fwrite(&record, sizeof(record), 1, m_file) != 1 ||
+		fwrite(path, record.path_size, 1, m_file) != 1 ||
+		(size && fwrite(data, size, 1, m_file) != 1)) {
+		perror(m_path);
+		m_failed = true;
+	}
+	// a record was written, or the pack is unusable anyway
+	return 0;
+}
+
+int Pack::flush() {
+	int res = m_failed ? -1 : 0;
+	if (m_file && fclose(m_file) == EOF) {
+		perror(m_path);
+		res = -1;
+	}
+	m_file = NULL;
+	return res;
+}
+
+int Pack::map(uint8_t** base, size_t* size) {
+	*base = NULL;
+	*size = 0;
+	int fd = open(m_path, O_RDONLY);
+	if (fd == -1) {
+		if (errno == ENOENT) return 1;
+		perror(m_path);
+		return -1;
+	}
+	struct stat sb;
+	int res = fstat(fd, &sb);
+	if (res == 0 && sb.st_size < PACK_MAGIC_SIZE) {
+		errno = EINVAL;
+		res = -1;
+	}
+	if (res == 0) {
+		void* addr = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (addr == MAP_FAILED) {
+			res = -1;
+		} else {
+			*base = (uint8_t*)addr;
+			*size = sb.st_size;
+			madvise(addr, sb.st_size, MADV_SEQUENTIAL);
+		}
+	}
+	close(fd);
+	if (res == 0 && memcmp(*base, PACK_MAGIC, PACK_MAGIC_SIZE) != 0) {
+		munmap(*base, *size);
+		*base = NULL;
+		errno = EINVAL;
+		res = -1;
+	}
+	if (res) fprintf(stderr, "Error: unable to read %s: %s\n", m_path, strerror(errno));
+	return res;
+}
+
+// reads the record at *offset and moves past it, returning false at the
+//  end of the pack. *bad is set if the record is truncated.
+static bool next_record(const uint8_t* base, size_t size, size_t* offset, 
+						pack_record_t* record, const char** path, 
+						const uint8_t** data, bool* bad) {
+	if (*offset == size) return false;
+	if (size - *offset < sizeof(pack_record_t)) {
+		*bad = true;
+		return false;
+	}
+	memcpy(record, base + *offset, sizeof(pack_record_t));
+	size_t length = sizeof(pack_record_t) + (size_t)record->path_size + record->data_size;
+	if (size - *offset < length || record->path_size == 0 ||
+		base[*offset + sizeof(pack_record_t) + record->path_size - 1] != 0) {
+		*bad = true;
+		return false;
+	}
+	*path = (const char*)base + *offset + sizeof(pack_record_t);
+	*data = base + *offset + sizeof(pack_record_t) + record->path_size;
+	*offset += length;
+	return true;
+}
+
+static int compare_paths(const void* a, const void* b) {
+	return strcmp(*(const char**)a, *(const char**)b);
+}
+
+int Pack::extract(const char* destdir, char** paths, uint32_t count, bool* found) {
+	uint8_t* base;
+	size_t size;
+	int res = this->map(&base, &size);
+	if (res == 1) return 0;
+	if (res) return res;
+
+	pack_record_t record;
+	const char* path;
+	const uint8_t* data;
+	size_t offset = PACK_MAGIC_SIZE;
+	bool bad = false;
+	while (res == 0 && next_record(base, size, &offset, &record, &path, &data, &bad)) {
+		if (paths) {
+			char** match = (char**)bsearch(&path, paths, count, sizeof(char*), compare_paths);
+			if (!match) continue;
+			found[match - paths] = true;
+		}
+		res = this->extract_record(destdir, &record, path, data);
+	}
+	if (bad) {
+		fprintf(stderr, "Error: %s is truncated\n", m_path);
+		res = -1;
+	}
+	munmap(base, size);
+	return res;
+}
+
+int Pack::extract_record(const char* destdir, const pack_record_t* record, 
+						 const char* path, const uint8_t* data) {
+	int res = 0;
+	char* dstpath;
+	join_path(&dstpath, destdir, path);
+	if (!dstpath) return -1;
+	IF_DEBUG("[pack] extracting %s\n", dstpath);
+
+	char dirbuf[PATH_MAX];
+	const char* dir = path_dirname(dstpath, dirbuf, sizeof(dirbuf));
+	if (dir && mkdir_p(dir) != 0 && errno != EEXIST) res = -1;
+
+	if (res == 0 && S_ISLNK(record->mode)) {
+		char target[PATH_MAX];
+		size_t length = record->data_size < sizeof(target) ? record->data_size : sizeof(target) - 1;
+		memcpy(target, data, length);
+		target[length] = 0;
+		if (unlink(dstpath) == -1 && errno != ENOENT) res = -1;
+		if (res == 0) res = symlink(target, dstpath);
+		if (res == 0) res = lchown(dstpath, record->uid, record->gid);
+	} else if (res == 0) {
+		int fd = open(dstpath, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0600);
+		if (fd == -1) res = -1;
+		if (res == 0 && record->data_size &&
+			write(fd, data, record->data_size) != (ssize_t)record->data_size) {
+			res = -1;
+		}
+		if (res == 0) res = fchown(fd, record->uid, record->gid);
+		if (res == 0) res = fchmod(fd, record->mode & ALLPERMS);
+		if (res == 0) {
+			struct timeval times[2];
+			times[0].tv_sec = times[1].tv_sec = (time_t)record->mtime;
+			times[0].tv_usec = times[1].tv_usec = 0;
+			res = futimes(fd, times);
+		}
+		if (fd != -1) close(fd);
+	}
+	if (res) fprintf(stderr, "%s:%d: %s: %s (%d)\n", 
+					 __FILE__, __LINE__, dstpath, strerror(errno), errno);
+	free(dstpath);
+	return res;
+}
+
+int Pack::list(char*** names, uint32_t* count) {
+	*names = NULL;
+	*count = 0;
+	uint8_t* base;
+	size_t size;
+	int res = this->map(&base, &size);
+	if (res == 1) return 0;
+	if (res) return res;
+
+	pack_record_t record;
+	const char* path;
+	const uint8_t* data;
+	size_t offset = PACK_MAGIC_SIZE;
+	bool bad = false;
+	uint32_t max = 0;
+	while (res == 0 && next_record(base, size, &offset, &record, &path, &data, &bad)) {
+		if (*count == max) {
+			max = max ? max * 2 : 64;
+			char** list = (char**)realloc(*names, max * sizeof(char*));
+			if (!list) {
+				res = -1;
+				break;
+			}
+			*names = list;
+		}
+		(*names)[(*count)++] = strdup(path);
+	}
+	if (bad) {
+		fprintf(stderr, "Error: %s is truncated\n", m_path);
+		res = -1;
+	}
+	munmap(base, size);
+	return res;
+}
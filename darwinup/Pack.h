@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2013 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#ifndef _PACK_H
+#define _PACK_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+// regular files up to this many bytes are backed up into the pack
+#define PACK_FILE_LIMIT 4096
+
+// one file in a pack, followed by its path and then its data, which
+//  for a symlink is the link's target
+struct pack_record_t {
+	uint64_t serial;    // the file's serial in the database
+	uint64_t mtime;
+	uint32_t mode;
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t path_size; // including the terminating NUL
+	uint32_t data_size;
+	uint32_t unused;
+};
+
+/**
+ *
+ * A Pack holds the small files and symlinks of a rollback archive one
+ * after another in a single file next to its compacted backing store,
+ * so backing them up and restoring them are sequential writes and reads
+ * rather than a file created, tarred and renamed for each. Files with
+ * extended attributes or ACLs are left to the backing store, since the
+ * pack only keeps their data, owner, mode and modification time.
+ *
+ */
+struct Pack {
+	Pack(const char* path);
+	virtual ~Pack();
+
+	// whether the file at path, described by sb, can go in a pack
+	static bool packable(const char* path, const struct stat* sb);
+
+	// Appends the file at srcpath, described by sb, to the pack under
+	//  path and serial. Returns non-zero if it could not be read, in
+	//  which case nothing was added.
+	int add(uint64_t serial, const char* path, const char* srcpath, 
+			const struct stat* sb);
+	// Writes out what was added so far. Returns non-zero on errors,
+	//  including those of earlier calls to add().
+	int flush();
+
+	// Recreates the files of the pack below destdir. With paths, which
+	//  must be sorted, only those are, and found[i] is set for each of
+	//  them that was in the pack. A missing pack holds no files.
+	int extract(const char* destdir, char** paths, uint32_t count, bool* found);
+	// Lists the paths of the files in the pack. Caller must free each
+	//  name and the list.
+	int list(char*** names, uint32_t* count);
+
+protected:
+
+	// maps the pack for reading; returns 1 if there is no pack
+	int map(uint8_t** base, size_t* size);
+	int extract_record(const char* destdir, const pack_record_t* record, 
+					   const char* path, const uint8_t* data);
+
+	char* m_path;
+	FILE* m_file;
+	bool  m_failed;
+};
+
+#endif
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2013 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#ifndef _PROBES_H
+#define _PROBES_H
+
+////
+//  Static probes for tracing darwinup in place, with dtrace(1) on
+//  Darwin, or with perf and bpftrace where the systemtap <sys/sdt.h>
+//  is installed. They are compiled in wherever the compiler finds that
+//  header, or when HAVE_SYS_SDT_H is set to 1, and are no-ops otherwise
+//  or when it is set to 0. As with dtrace, "__" in a probe name reads as
+//  "-", so PROBE1(cache__hit, ...) is darwinup:::cache-hit.
+//
+//  darwinup:::cache-hit(name)             statement found in the cache
+//  darwinup:::cache-miss(name)            statement prepared and cached
+//  darwinup:::execute(sql, result, rows)  statement run, rows changed
+//  darwinup:::step(sql, result)           one row fetched
+//  darwinup:::rows(sql, count)            all rows of a query fetched
+//  darwinup:::phase(operation, archive, phase)  next phase begun
+//  darwinup:::done(operation, archive, result)  operation finished
+//  darwinup:::analyze(path, state)        file analyzed for install
+//  darwinup:::uninstall(path, state)      file uninstalled
+////
+
+#if !defined(HAVE_SYS_SDT_H) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define HAVE_SYS_SDT_H 1
+#endif
+#endif
+#if HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define PROBE1(name, a)       DTRACE_PROBE1(darwinup, name, a)
+#define PROBE2(name, a, b)    DTRACE_PROBE2(darwinup, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(darwinup, name, a, b, c)
+#else
+#define PROBE1(name, a)       do { } while (0)
+#define PROBE2(name, a, b)    do { } while (0)
+#define PROBE3(name, a, b, c) do { } while (0)
+#endif
+
+#endif
@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2013 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#include "Progress.h"
+#include "Utils.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+// seconds between status lines, and between JSON events
+#define PROGRESS_INTERVAL 0.25
+#define PROGRESS_JSON_INTERVAL 1.0
+// status lines are cut to fit a terminal of this width
+#define PROGRESS_WIDTH 79
+
+static double progress_now() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+// writes s as a JSON string
+static void print_json_string(FILE* stream, const char* s) {
+	fputc('"', stream);
+	for (; s && *s; s++) {
+		unsigned char c = (unsigned char)*s;
+		if (c == '"' || c == '\\') {
+			fprintf(stream, "\\%c", c);
+		} else if (c < 0x20) {
+			fprintf(stream, "\\u%04x", c);
+		} else {
+			fputc(c, stream);
+		}
+	}
+	fputc('"', stream);
+}
+
+// appends to the len characters already in line, which is cut to
+//  size - 1 characters, and returns its new length
+static int append(char* line, size_t size, int len, const char* format, ...) {
+	va_list args;
+	va_start(args, format);
+	int res = vsnprintf(line + len, size - len, format, args);
+	va_end(args);
+	if (res < 0) return len;
+	len += res;
+	if (len >= (int)size) len = size - 1;
+	return len;
+}
+
+Progress::Progress(FILE* stream, bool json) {
+	m_stream = stream;
+	m_json = json;
+	m_shown = false;
+	m_operation = NULL;
+	m_archive = NULL;
+	m_phase = NULL;
+	m_files = 0;
+	m_bytes = 0;
+	m_total_files = 0;
+	m_total_bytes = 0;
+	m_started = 0;
+	m_reported = 0;
+}
+
+Progress::~Progress() {
+	this->clear();
+	free(m_operation);
+	free(m_archive);
+	free(m_phase);
+}
+
+void Progress::begin(const char* operation, const char* archive, const char* phase,
+					 uint64_t total_files, uint64_t total_bytes) {
+	if (m_phase) this->end();
+	m_operation = strdup(operation);
+	m_archive = strdup(archive ? archive : "");
+	m_phase = strdup(phase);
+	m_files = 0;
+	m_bytes = 0;
+	m_total_files = total_files;
+	m_total_bytes = total_bytes;
+	m_started = progress_now();
+	m_reported = m_started;
+	// a terminal shows each phase as it starts, even one which is
+	//  all spent in another process
+	if (!m_json) this->report(m_started, false);
+}
+
+void Progress::step(uint64_t files, uint64_t bytes) {
+	if (!m_phase) return;
+	m_files += files;
+	m_bytes += bytes;
+	double now = progress_now();
+	if (now - m_reported >= (m_json ? PROGRESS_JSON_INTERVAL : PROGRESS_INTERVAL)) {
+		this->report(now, false);
+	}
+}
+
+void Progress::end() {
+	if (!m_phase) return;
+	// phases spent in another process are only reported as they end
+	double now = progress_now();
+	if (m_json && (m_shown || now - m_started >= PROGRESS_JSON_INTERVAL)) {
+		this->report(now, true);
+	}
+	this->clear();
+	m_shown = false;
+	free(m_operation);
+	free(m_archive);
+	free(m_phase);
+	m_operation = NULL;
+	m_archive = NULL;
+	m_phase = NULL;
+}
+
+void Progress::clear() {
+	if (!m_json && m_shown) {
+		fprintf(m_stream, "\r\033[K");
+		fflush(m_stream);
+	}
+	m_shown = m_json && m_shown;
+}
+
+void Progress::report(double now, bool done) {
+	m_reported = now;
+	double elapsed = now - m_started;
+	double rate = elapsed > 0 ? m_files / elapsed : 0;
+
+	// the time left goes by bytes when they are known, files otherwise
+	double eta = -1;
+	if (m_total_bytes && m_bytes && m_bytes <= m_total_bytes) {
+		eta = elapsed * (m_total_bytes - m_bytes) / m_bytes;
+	} else if (m_total_files && m_files && m_files <= m_total_files) {
+		eta = elapsed * (m_total_files - m_files) / m_files;
+	}
+
+	if (m_json) {
+		fprintf(m_stream, "{\"operation\":");
+		print_json_string(m_stream, m_operation);
+		fprintf(m_stream, ",\"archive\":");
+		print_json_string(m_stream, m_archive);
+		fprintf(m_stream, ",\"phase\":");
+		print_json_string(m_stream, m_phase);
+		fprintf(m_stream, ",\"files\":%llu,\"total_files\":%llu,"
+				"\"bytes\":%llu,\"total_bytes\":%llu,"
+				"\"elapsed\":%.2f,\"rate\":%.1f",
+				(unsigned long long)m_files, (unsigned long long)m_total_files,
+				(unsigned long long)m_bytes, (unsigned long long)m_total_bytes,
+				elapsed, rate);
+		if (eta >= 0) fprintf(m_stream, ",\"eta\":%.1f", eta);
+		fprintf(m_stream, ",\"done\":%s}\n", done ? "true" : "false");
+		fflush(m_stream);
+		m_shown = true;
+		return;
+	}
+
+	char line[256];
+	line[0] = 0;
+	int len = append(line, sizeof(line), 0, "%s %s: %s", m_operation, m_archive, m_phase);
+	if (m_files || m_total_files) {
+		char size[16];
+		if (m_total_files) {
+			len = append(line, sizeof(line), len, " %llu/%llu files (%llu%%)",
+						 (unsigned long long)m_files, (unsigned long long)m_total_files,
+						 (unsigned long long)(m_files * 100 / m_total_files));
+		} else {
+			len = append(line, sizeof(line), len, " %llu files",
+						 (unsigned long long)m_files);
+		}
+		len = append(line, sizeof(line), len, ", %s, %.0f files/s",
+					 format_size(m_bytes, size, sizeof(size)), rate);
+	}
+	if (eta >= 0) {
+		unsigned long seconds = (unsigned long)(eta + 0.5);
+		len = append(line, sizeof(line), len, ", %lu:%02lu left", 
+					 seconds / 60, seconds % 60);
+	}
+	line[PROGRESS_WIDTH] = 0;
+	fprintf(m_stream, "\r%s\033[K", line);
+	fflush(m_stream);
+	m_shown = true;
+}
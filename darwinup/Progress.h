@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2013 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#ifndef _PROGRESS_H
+#define _PROGRESS_H
+
+#include "Context.h"
+#include <stdint.h>
+#include <stdio.h>
+
+// reports to the current context's Progress, if it has one
+#define PROGRESS(call) do { Progress* _progress = Context::current()->progress; if (_progress) _progress->call; } while (0)
+
+////
+//  Progress
+//
+//  Reports how far a long operation has come, one phase at a time:
+//  files and bytes done, the rate, and when the totals are known, the
+//  time left. On a terminal it keeps a status line on the stream, at
+//  most a few times a second. Otherwise it writes one line of JSON
+//  every second for phases which take longer than that, and a last
+//  one with "done" set when such a phase ends.
+////
+struct Progress {
+	Progress(FILE* stream, bool json);
+	virtual ~Progress();
+
+	// Starts phase of operation on the named archive. The totals are 0
+	//  when they are not known ahead.
+	void begin(const char* operation, const char* archive, const char* phase,
+			   uint64_t total_files, uint64_t total_bytes);
+	// Counts work done in the current phase.
+	void step(uint64_t files, uint64_t bytes);
+	// Ends the current phase.
+	void end();
+	// Erases the status line, so other output to the terminal can follow.
+	void clear();
+
+protected:
+
+	void report(double now, bool done);
+
+	FILE*    m_stream;
+	bool     m_json;
+	bool     m_shown;      // something was written for this phase
+	char*    m_operation;
+	char*    m_archive;
+	char*    m_phase;
+	uint64_t m_files;
+	uint64_t m_bytes;
+	uint64_t m_total_files;
+	uint64_t m_total_bytes;
+	double   m_started;
+	double   m_reported;
+};
+
+#endif
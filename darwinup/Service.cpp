@@ -0,0 +1,446 @@
+/*
+ * Copyright (c) 2013 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#include "Service.h"
+#include "Utils.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+static volatile sig_atomic_t service_stop = 0;
+
+static void service_signal(int sig) {
+	service_stop = 1;
+}
+
+// read exactly size bytes, retrying short reads
+static int read_fully(int fd, void* buf, size_t size) {
+	uint8_t* p = (uint8_t*)buf;
+	while (size > 0) {
+		ssize_t n = read(fd, p, size);
+		if (n == -1 && errno == EINTR) continue;
+		if (n <= 0) return -1;
+		p += n;
+		size -= n;
+	}
+	return 0;
+}
+
+static int write_fully(int fd, const void* buf, size_t size) {
+	const uint8_t* p = (const uint8_t*)buf;
+	while (size > 0) {
+		ssize_t n = write(fd, p, size);
+		if (n == -1 && errno == EINTR) continue;
+		if (n <= 0) return -1;
+		p += n;
+		size -= n;
+	}
+	return 0;
+}
+
+// bounds every read and write on fd by seconds, or lifts the bound if 0
+static int set_timeout(int fd, int seconds) {
+	struct timeval tv;
+	tv.tv_sec = seconds;
+	tv.tv_usec = 0;
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1 ||
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) == -1) {
+		return -1;
+	}
+	return 0;
+}
+
+static int fill_address(struct sockaddr_un* addr, const char* path) {
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlcpy(addr->sun_path, path, sizeof(addr->sun_path)) 
+		>= sizeof(addr->sun_path)) {
+		return -1;
+	}
+	return 0;
+}
+
+DepotService::DepotService(Depot* depot) {
+	m_depot = depot;
+	m_socket = -1;
+}
+
+DepotService::~DepotService() {
+	if (m_socket != -1) close(m_socket);
+}
+
+bool DepotService::handles(int argc, char** argv) {
+	if (strcmp(argv[0], "list") == 0 || strcmp(argv[0], "du") == 0) return true;
+	if (strcmp(argv[0], "dump") == 0) return argc == 1;
+	if (strcmp(argv[0], "files") == 0 || strcmp(argv[0], "verify") == 0) {
+		return argc > 1;
+	}
+	return false;
+}
+
+int DepotService::bind_socket() {
+	struct sockaddr_un addr;
+	const char* path = m_depot->service_path();
+	if (fill_address(&addr, path)) {
+		fprintf(stderr, "Error: service socket path is too long: %s\n", path);
+		return DEPOT_ERROR;
+	}
+
+	m_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (m_socket == -1) {
+		perror("socket");
+		return DEPOT_ERROR;
+	}
+
+	// a leftover socket that nobody answers on is stale
+	if (connect(m_socket, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+		fprintf(stderr, "Error: a darwinup service is already running for %s\n", 
+				m_depot->prefix());
+		return DEPOT_ERROR;
+	}
+	close(m_socket);
+	unlink(path);
+
+	m_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (m_socket == -1) {
+		perror("socket");
+		return DEPOT_ERROR;
+	}
+	if (bind(m_socket, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+		perror(path);
+		return DEPOT_ERROR;
+	}
+	// access is governed by the depot directory's permissions
+	chmod(path, 0770);
+	if (listen(m_socket, 16) == -1) {
+		perror(path);
+		unlink(path);
+		return DEPOT_ERROR;
+	}
+	return DEPOT_OK;
+}
+
+int DepotService::serve() {
+	int res = this->bind_socket();
+	if (res) return res;
+
+	// initialize() left us holding the depot lock, but we only
+	//  want it while handling a request
+	m_depot->unlock();
+	m_depot->m_is_locked = 0;
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = service_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	// a client going away mid-request must not take us with it
+	signal(SIGPIPE, SIG_IGN);
+
+	IF_DEBUG("[service] listening on %s\n", m_depot->service_path());
+	while (!service_stop) {
+		int fd = accept(m_socket, NULL, NULL);
+		if (fd == -1) {
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			perror("accept");
+			res = DEPOT_ERROR;
+			break;
+		}
+		// a client that stops talking only holds up the others briefly
+		if (set_timeout(fd, SERVICE_TIMEOUT) == -1) {
+			perror("setsockopt");
+		} else {
+			this->handle_client(fd);
+		}
+		close(fd);
+	}
+
+	IF_DEBUG("[service] shutting down\n");
+	close(m_socket);
+	m_socket = -1;
+	unlink(m_depot->service_path());
+	return res;
+}
+
+int DepotService::handle_client(int fd) {
+	int res = 0;
+	uid_t uid = (uid_t)-1;
+	gid_t gid = (gid_t)-1;
+	if (getpeereid(fd, &uid, &gid) == -1) {
+		perror("getpeereid");
+		return DEPOT_ERROR;
+	}
+
+	struct service_request_t req;
+	if (read_fully(fd, &req, sizeof(req))) return DEPOT_ERROR;
+	if (req.version != SERVICE_PROTOCOL_VERSION || req.argc == 0 ||
+		req.length > SERVICE_MAX_REQUEST || req.argc > req.length) {
+		fprintf(stderr, "Error: malformed service request.\n");
+		res = DEPOT_ERROR;
+	}
+
+	// arguments are NUL-terminated and packed back to back
+	char* buf = NULL;
+	char** argv = NULL;
+	if (res == 0) {
+		buf = (char*)malloc(req.length + 1);
+		argv = (char**)calloc(req.argc + 1, sizeof(char*));
+		if (!buf || !argv) {
+			fprintf(stderr, "Error: ran out of memory in DepotService::handle_client\n");
+			res = DEPOT_ERROR;
+		}
+	}
+	if (res == 0 && read_fully(fd, buf, req.length)) res = DEPOT_ERROR;
+	if (res == 0) {
+		buf[req.length] = '\0';
+		uint32_t i = 0;
+		char* p = buf;
+		while (i < req.argc && p < buf + req.length) {
+			argv[i++] = p;
+			p += strlen(p) + 1;
+		}
+		if (i != req.argc || p != buf + req.length) {
+			fprintf(stderr, "Error: malformed service request.\n");
+			res = DEPOT_ERROR;
+		}
+	}
+
+	// nothing runs until the client confirms it has not given up on us
+	//  and run the command itself. The confirmation carries its stdout
+	//  and stderr, so a client that gave up never leaves them with us.
+	int fds[2] = { -1, -1 };
+	if (res == 0) {
+		uint32_t ack = SERVICE_PROTOCOL_VERSION;
+		uint32_t go = 0;
+		struct iovec iov;
+		iov.iov_base = &go;
+		iov.iov_len = sizeof(go);
+		char control[CMSG_SPACE(sizeof(fds))];
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		ssize_t n = -1;
+		if (write_fully(fd, &ack, sizeof(ack)) == 0) {
+			do {
+				n = recvmsg(fd, &msg, MSG_WAITALL);
+			} while (n == -1 && errno == EINTR);
+		}
+		struct cmsghdr* cmsg = (n > 0) ? CMSG_FIRSTHDR(&msg) : NULL;
+		if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS
+			&& cmsg->cmsg_len == CMSG_LEN(sizeof(fds))) {
+			memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+		}
+		if (n != (ssize_t)sizeof(go) || go != ack) {
+			IF_DEBUG("[service] client went away before its request ran\n");
+			res = DEPOT_ERROR;
+		} else if (fds[0] == -1 || fds[1] == -1) {
+			fprintf(stderr, "Error: service request did not include output descriptors.\n");
+			res = DEPOT_ERROR;
+		}
+	}
+
+	int32_t status = DEPOT_ERROR;
+	if (res == 0) {
+		IF_DEBUG("[service] uid %u requested %s\n", uid, argv[0]);
+
+		// borrow the client's output for the duration of the command
+		fflush(stdout);
+		fflush(stderr);
+		int saved_out = dup(STDOUT_FILENO);
+		int saved_err = dup(STDERR_FILENO);
+		dup2(fds[0], STDOUT_FILENO);
+		dup2(fds[1], STDERR_FILENO);
+
+		Context context;
+		context.verbosity = req.verbosity;
+		context.force = req.force;
+		Context* saved_context = Context::set_current(&context);
+
+		res = m_depot->lock(LOCK_EX);
+		if (res == 0) {
+			m_depot->m_is_locked = 1;
+			m_depot->revalidate();
+			status = this->run_command(uid, (int)req.argc, argv);
+			m_depot->unlock();
+			m_depot->m_is_locked = 0;
+		}
+
+		Context::set_current(saved_context);
+
+		fflush(stdout);
+		fflush(stderr);
+		dup2(saved_out, STDOUT_FILENO);
+		dup2(saved_err, STDERR_FILENO);
+		close(saved_out);
+		close(saved_err);
+	}
+
+	if (fds[0] != -1) close(fds[0]);
+	if (fds[1] != -1) close(fds[1]);
+	free(argv);
+	free(buf);
+
+	if (write_fully(fd, &status, sizeof(status))) res = DEPOT_ERROR;
+	return res;
+}
+
+// mirrors the handling of read-only commands in main()
+int DepotService::run_command(uid_t uid, int argc, char** argv) {
+	int res = 0;
+	if (strcmp(argv[0], "list") == 0) {
+		return m_depot->list(argc-1, argv+1);
+	}
+	if (strcmp(argv[0], "du") == 0) {
+		return m_depot->du(argc-1, argv+1);
+	}
+	if (strcmp(argv[0], "dump") == 0) {
+		return m_depot->dump();
+	}
+	if (strcmp(argv[0], "verify") == 0 && uid != 0) {
+		// verify normally requires a writable depot
+		fprintf(stdout, "You must be root to perform that operation.\n");
+		return 3;
+	}
+	if (strcmp(argv[0], "verify") == 0) {
+		return m_depot->verify(argc-1, argv+1);
+	}
+	for (int i = 1; i < argc && res == 0; i++) {
+		res = m_depot->process_archive(argv[0], argv[i]);
+	}
+	return res;
+}
+
+int DepotService::forward(Depot* depot, int argc, char** argv, int* status) {
+	if (!handles(argc, argv)) return -1;
+
+	struct sockaddr_un addr;
+	if (fill_address(&addr, depot->service_path())) return -1;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1) return -1;
+	if (set_timeout(fd, SERVICE_TIMEOUT) == -1 ||
+		connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+		// no service running, caller will do the work itself
+		close(fd);
+		return -1;
+	}
+	IF_DEBUG("[service] forwarding %s to %s\n", argv[0], depot->service_path());
+
+	struct service_request_t req;
+	req.version = SERVICE_PROTOCOL_VERSION;
+	req.verbosity = Context::current()->verbosity;
+	req.force = Context::current()->force;
+	req.argc = argc;
+	req.length = 0;
+	for (int i = 0; i < argc; i++) {
+		req.length += (uint32_t)strlen(argv[i]) + 1;
+	}
+	if (req.length > SERVICE_MAX_REQUEST) {
+		close(fd);
+		return -1;
+	}
+	char* buf = (char*)malloc(req.length);
+	if (!buf) {
+		close(fd);
+		return -1;
+	}
+	char* p = buf;
+	for (int i = 0; i < argc; i++) {
+		size_t len = strlen(argv[i]) + 1;
+		memcpy(p, argv[i], len);
+		p += len;
+	}
+
+	// nothing has been run until we confirm, so falling back is safe
+	//  if the service is busy or stuck
+	uint32_t ack = 0;
+	if (write_fully(fd, &req, sizeof(req)) || write_fully(fd, buf, req.length) ||
+		read_fully(fd, &ack, sizeof(ack)) || ack != SERVICE_PROTOCOL_VERSION) {
+		IF_DEBUG("[service] no answer from %s, running %s here\n", 
+				 depot->service_path(), argv[0]);
+		free(buf);
+		close(fd);
+		return -1;
+	}
+	free(buf);
+
+	// anything we buffered must come out before the service's output
+	fflush(stdout);
+	fflush(stderr);
+
+	// confirm, handing over our stdout and stderr
+	int fds[2] = { STDOUT_FILENO, STDERR_FILENO };
+	char control[CMSG_SPACE(sizeof(fds))];
+	memset(control, 0, sizeof(control));
+	struct iovec iov;
+	iov.iov_base = &ack;
+	iov.iov_len = sizeof(ack);
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	ssize_t n;
+	do {
+		n = sendmsg(fd, &msg, 0);
+	} while (n == -1 && errno == EINTR);
+	if (n != (ssize_t)sizeof(ack)) {
+		close(fd);
+		return -1;
+	}
+
+	// the command itself may take as long as it needs
+	int32_t result;
+	if (set_timeout(fd, 0) || read_fully(fd, &result, sizeof(result))) {
+		fprintf(stderr, "Error: lost connection to the darwinup service.\n");
+		result = DEPOT_ERROR;
+	}
+	close(fd);
+	*status = result;
+	return 0;
+}
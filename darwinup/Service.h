@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2013 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#ifndef _SERVICE_H
+#define _SERVICE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "Depot.h"
+
+// bumped whenever the request layout changes
+#define SERVICE_PROTOCOL_VERSION 2
+
+// seconds either side waits on the other before dropping a request.
+//  A client which gives up runs the command itself.
+#define SERVICE_TIMEOUT          5
+
+// largest request we will accept, in bytes of arguments
+#define SERVICE_MAX_REQUEST      65536
+
+// request header, followed by argc NUL-terminated arguments
+struct service_request_t {
+	uint32_t version;
+	uint32_t verbosity;
+	uint32_t force;
+	uint32_t argc;
+	uint32_t length;
+};
+
+/**
+ *
+ * DepotService keeps a Depot open between invocations and answers
+ * read-only commands (list, files, verify, dump) over a unix domain
+ * socket in the depot directory. The depot lock is only held while a
+ * request is being handled, so installs and uninstalls from other
+ * processes proceed as usual and invalidate our memoized state.
+ *
+ * The service acknowledges a request, and only runs it once the client
+ * confirms it is still waiting, so a command is never run by both. The
+ * confirmation passes the client's stdout and stderr along, so output
+ * looks exactly as if the command had run in-process.
+ *
+ */
+struct DepotService {
+	DepotService(Depot* depot);
+	virtual ~DepotService();
+
+	// bind the socket and answer requests until signaled
+	int serve();
+
+	// true if the command line can be answered by a running service
+	static bool handles(int argc, char** argv);
+
+	// send argv to a running service for depot and store its exit
+	//  status in status. Returns non-zero if no service is running or
+	//  it did not take the request within SERVICE_TIMEOUT, in which
+	//  case the caller should run the command itself.
+	static int forward(Depot* depot, int argc, char** argv, int* status);
+
+protected:
+
+	int bind_socket();
+	int handle_client(int fd);
+	int run_command(uid_t uid, int argc, char** argv);
+
+	Depot*  m_depot;
+	int     m_socket;
+};
+
+#endif
@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2013 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+/**
+ *
+ * The snapshot index is a read-only copy of what the depot knows about
+ * installed archives and their paths, which darwinup rewrites after each
+ * operation that changes the database. It is meant for tools that only
+ * ask which archive owns a path or which paths an archive has, and can
+ * map it and answer thousands of such questions without opening the
+ * database or taking the depot lock. It is replaced with rename(2), so
+ * a mapped snapshot never changes under its reader; open it again to
+ * see later operations.
+ *
+ * The file is a header, then the archive table sorted by serial, the
+ * path table sorted by path, the path indexes of each archive's files,
+ * and the NUL terminated strings the tables refer to. Integers are in
+ * the byte order of the machine that wrote it. Rollback archives are
+ * left out.
+ *
+ * This header is all a reader needs, and works from C as well as C++:
+ *
+ *	snapshot_t snap;
+ *	if (snapshot_open("/.DarwinDepot/Snapshot", &snap) == 0) {
+ *		uint64_t serial = snapshot_owner(&snap, "/usr/lib/libfoo.dylib");
+ *		const snapshot_archive_t* archive = snapshot_archive(&snap, serial);
+ *		...
+ *		snapshot_close(&snap);
+ *	}
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SNAPSHOT_MAGIC "DUSNAP1\n"
+#define SNAPSHOT_MAGIC_SIZE 8
+
+typedef struct {
+	char     magic[SNAPSHOT_MAGIC_SIZE];
+	uint32_t archive_count;
+	uint32_t path_count;
+	uint32_t member_count;
+	uint32_t unused;
+	uint64_t archives_offset; // snapshot_archive_t[archive_count]
+	uint64_t paths_offset;    // snapshot_path_t[path_count]
+	uint64_t members_offset;  // uint32_t[member_count], indexes of paths
+	uint64_t strings_offset;
+	uint64_t size;            // of the whole file
+} snapshot_header_t;
+
+typedef struct {
+	uint64_t serial;
+	uint64_t info;
+	uint64_t date_installed;
+	uint8_t  uuid[16];
+	uint32_t name;            // offset in the strings
+	uint32_t first;           // of the archive's files in the members
+	uint32_t count;
+	uint32_t unused;
+} snapshot_archive_t;
+
+typedef struct {
+	uint64_t owner;           // serial of the newest archive with the path
+	uint32_t name;            // offset in the strings
+	uint32_t unused;
+} snapshot_path_t;
+
+typedef struct {
+	const uint8_t*            base;
+	size_t                    size;
+	const snapshot_header_t*  header;
+	const snapshot_archive_t* archives;
+	const snapshot_path_t*    paths;
+	const uint32_t*           members;
+	const char*               strings;
+} snapshot_t;
+
+// checks that the table of count entries of width bytes at offset fits
+//  in the snapshot before the strings
+static inline int snapshot_fits(const snapshot_header_t* header, uint64_t offset,
+								uint64_t count, uint64_t width) {
+	return offset % 8 == 0 && offset <= header->strings_offset &&
+		count <= (header->strings_offset - offset) / width;
+}
+
+// Maps the snapshot at path. Returns 0 on success, or -1 with errno set
+//  if it could not be read or is not a snapshot.
+static inline int snapshot_open(const char* path, snapshot_t* snap) {
+	memset(snap, 0, sizeof(*snap));
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) return -1;
+	struct stat sb;
+	if (fstat(fd, &sb) == -1) {
+		close(fd);
+		return -1;
+	}
+	if ((uint64_t)sb.st_size < sizeof(snapshot_header_t)) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	void* base = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) return -1;
+
+	snap->base = (const uint8_t*)base;
+	snap->size = (size_t)sb.st_size;
+	snap->header = (const snapshot_header_t*)base;
+	const snapshot_header_t* header = snap->header;
+	if (memcmp(header->magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE) != 0 ||
+		header->size != (uint64_t)sb.st_size ||
+		header->strings_offset > header->size ||
+		(header->size > header->strings_offset &&
+		 snap->base[header->size - 1] != 0) ||
+		!snapshot_fits(header, header->archives_offset, header->archive_count, 
+					   sizeof(snapshot_archive_t)) ||
+		!snapshot_fits(header, header->paths_offset, header->path_count, 
+					   sizeof(snapshot_path_t)) ||
+		!snapshot_fits(header, header->members_offset, header->member_count, 
+					   sizeof(uint32_t))) {
+		munmap(base, snap->size);
+		memset(snap, 0, sizeof(*snap));
+		errno = EINVAL;
+		return -1;
+	}
+	snap->archives = (const snapshot_archive_t*)(snap->base + header->archives_offset);
+	snap->paths = (const snapshot_path_t*)(snap->base + header->paths_offset);
+	snap->members = (const uint32_t*)(snap->base + header->members_offset);
+	snap->strings = (const char*)(snap->base + header->strings_offset);
+	return 0;
+}
+
+static inline void snapshot_close(snapshot_t* snap) {
+	if (snap->base) munmap((void*)snap->base, snap->size);
+	memset(snap, 0, sizeof(*snap));
+}
+
+// the string at offset, or "" for one outside the snapshot
+static inline const char* snapshot_string(const snapshot_t* snap, uint32_t offset) {
+	if (offset >= snap->header->size - snap->header->strings_offset) return "";
+	return snap->strings + offset;
+}
+
+// the entry for path, or NULL if no installed archive has it
+static inline const snapshot_path_t* snapshot_path(const snapshot_t* snap, 
+												   const char* path) {
+	uint32_t low = 0;
+	uint32_t high = snap->header->path_count;
+	while (low < high) {
+		uint32_t mid = low + (high - low) / 2;
+		int cmp = strcmp(path, snapshot_string(snap, snap->paths[mid].name));
+		if (cmp == 0) return &snap->paths[mid];
+		if (cmp < 0) {
+			high = mid;
+		} else {
+			low = mid + 1;
+		}
+	}
+	return NULL;
+}
+
+// the serial of the archive that owns path, or 0 if none does
+static inline uint64_t snapshot_owner(const snapshot_t* snap, const char* path) {
+	const snapshot_path_t* entry = snapshot_path(snap, path);
+	return entry ? entry->owner : 0;
+}
+
+// the archive with serial, or NULL if there is no such archive
+static inline const snapshot_archive_t* snapshot_archive(const snapshot_t* snap, 
+														 uint64_t serial) {
+	uint32_t low = 0;
+	uint32_t high = snap->header->archive_count;
+	while (low < high) {
+		uint32_t mid = low + (high - low) / 2;
+		if (snap->archives[mid].serial == serial) return &snap->archives[mid];
+		if (serial < snap->archives[mid].serial) {
+			high = mid;
+		} else {
+			low = mid + 1;
+		}
+	}
+	return NULL;
+}
+
+// the path of the archive's file at index, which is less than its count,
+//  in path order. The archive may no longer own it.
+static inline const char* snapshot_archive_file(const snapshot_t* snap, 
+												const snapshot_archive_t* archive,
+												uint32_t index) {
+	uint64_t member = (uint64_t)archive->first + index;
+	if (index >= archive->count || member >= snap->header->member_count) return "";
+	uint32_t path = snap->members[member];
+	if (path >= snap->header->path_count) return "";
+	return snapshot_string(snap, snap->paths[path].name);
+}
+
+#endif
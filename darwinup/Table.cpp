@@ -59,19 +59,23 @@ Table::Table(const char* name) {
 }
 
 Table::~Table() {
+	// results reference the column types, so free them first.
+	// free_result() compacts the array, so walk it from the end.
+	while (m_result_count > 0) {
+		uint8_t* result = m_results[m_result_count - 1];
+		if (result) {
+			this->free_result(result);
+		} else {
+			m_result_count--;
+		}
+	}
+	free(m_results);
+
 	for (uint32_t i = 0; i < m_column_count; i++) {
 		delete m_columns[i];
 	}
 	free(m_columns);
 	
-
-	for (uint32_t i=0; i < m_result_count; i++) {
-		if (m_results[i]) {
-			this->free_result(m_results[i]);
-		}
-	}
-	free(m_results);
-	
 	free(m_name);
 
 	free(m_create_sql);
@@ -134,7 +138,11 @@ uint32_t Table::row_size() {
 	return m_columns_size;
 }
 
-uint8_t* Table::alloc_result() {
+// each record is preceded by its index in m_results, so freeing
+//  one does not have to search for it
+#define RESULT_HEADER_SIZE sizeof(uint64_t)
+
+uint8_t* Table::alloc_result(size_t data_size) {
 	if (m_result_count >= m_result_max) {
 		m_results = (uint8_t**)realloc(m_results, m_result_max * sizeof(uint8_t*) * REALLOC_FACTOR);
 		if (!m_results) {
@@ -143,27 +151,33 @@ uint8_t* Table::alloc_result() {
 		}
 		m_result_max *= REALLOC_FACTOR;
 	}
-	m_result_count++;
-	m_results[m_result_count-1] = (uint8_t*)calloc(1, this->row_size());
-	return m_results[m_result_count-1];
+	uint8_t* block = (uint8_t*)calloc(1, RESULT_HEADER_SIZE + this->row_size() + data_size);
+	if (!block) {
+		fprintf(stderr, "Error: unable to allocate memory for a result row\n");
+		return NULL;
+	}
+	*(uint64_t*)block = m_result_count;
+	m_results[m_result_count] = block + RESULT_HEADER_SIZE;
+	return m_results[m_result_count++];
 }
 
 int Table::free_result(uint8_t* result) {
-	for (uint32_t i=0; i < m_result_count; i++) {
-		// look for matching result
-		if (result == m_results[i]) {
-			this->free_row((uint8_t*)m_results[i]);
-			free(m_results[i]);
-			m_results[i] = NULL;
-			// if we did not free the last result,
-			// move last result to the empty slot
-			if (i != (m_result_count - 1)) {
-				m_results[i] = m_results[m_result_count-1];
-				m_results[m_result_count-1] = NULL;
-			}
-			m_result_count--;
-		}
+	if (!result) return 0;
+	uint8_t* block = result - RESULT_HEADER_SIZE;
+	uint64_t index = *(uint64_t*)block;
+	if (index >= m_result_count || m_results[index] != result) {
+		fprintf(stderr, "Error: freeing unknown result row %p from table %s\n",
+				result, m_name);
+		return 1;
 	}
+	free(block);
+	// move the last result to the empty slot
+	m_result_count--;
+	if (index != m_result_count) {
+		m_results[index] = m_results[m_result_count];
+		*(uint64_t*)(m_results[index] - RESULT_HEADER_SIZE) = index;
+	}
+	m_results[m_result_count] = NULL;
 	return 0;
 }
 
@@ -367,6 +381,20 @@ sqlite3_stmt** Table::count(sqlite3* db, uint32_t count, va_list args) {
 	return pps;	
 }
 
+sqlite3_stmt** Table::sum(sqlite3* db, Column* value_column, uint32_t count, va_list args) {
+	__alloc_stmt_query;
+	strlcpy(query, "SELECT SUM(", size);
+	__check_and_cat(value_column->name());
+	__check_and_cat(") FROM ");
+	__check_and_cat(m_name);
+	__check_and_cat(" WHERE 1");
+	this->where_va_columns(count, query, size, &used, args);
+	strlcat(query, ";", size);
+	__prepare_stmt;
+
+	return pps;
+}
+
 sqlite3_stmt** Table::get_column(sqlite3* db, Column* value_column, uint32_t count, va_list args) {
 	__alloc_stmt_query;
 	strlcpy(query, "SELECT ", size);
@@ -508,7 +536,7 @@ int Table::where_va_columns(uint32_t count, char* query, size_t size,
 		if (len >= 255) {
 			fprintf(stderr, "Error: column name is too big (limit: 248): %s\n", 
 					col->name());
-			return NULL;
+			return -1;
 		}
 		*used = strlcat(query, tmpstr, size);
 		if (*used >= size-1) {
@@ -533,24 +561,6 @@ uint32_t Table::column_count() {
 	return this->m_column_count;
 }
 
-int Table::free_row(uint8_t* row) {
-	uint8_t* current = row;
-	void* ptr;
-	for (uint32_t i=0; i < m_column_count; i++) {
-		switch (m_columns[i]->type()) {
-			case SQLITE_INTEGER:
-				current += sizeof(uint64_t);
-				// nothing to free
-				break;
-			default:
-				memcpy(&ptr, current, sizeof(void*));
-				free(ptr);
-				current += sizeof(void*);
-		}
-	}
-	return 0;
-}
-
 void Table::dump_results(FILE* f) {
 	fprintf(f, "====================================================================\n");
 	for (uint32_t i=0; i < m_result_count; i++) {
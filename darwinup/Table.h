@@ -58,7 +58,9 @@ struct Table {
 	uint32_t       row_size();	
 
 	// Result record handling
-	uint8_t*       alloc_result();
+	//  a record is one allocation: the column values, followed by
+	//  data_size bytes for the text and blob values they point to
+	uint8_t*       alloc_result(size_t data_size);
 	int            free_result(uint8_t* result);
 
 	/**
@@ -77,13 +79,16 @@ struct Table {
 	 * - args should have sets of 3 (integer and text) or 4 (blob) 
 	 *     parameters for WHERE clause like Column*, char, value
 	 *      - Column* is the column to match against
-	 *      - char is how to compare, one of '=', '!', '>', or '<'
+	 *      - char is how to compare, one of '=', '!', '>', '<', or '&'
+	 *          (integer has any of the given bits set)
 	 *      - value is the value to match (1 for integer and text, 2 for blobs)
 	 *          which is ignored by these API since they leave placeholders 
 	 *          instead
 	 *
 	 */
 	sqlite3_stmt**    count(sqlite3* db, uint32_t count, va_list args);
+	sqlite3_stmt**    sum(sqlite3* db, Column* value_column, 
+						  uint32_t count, va_list args);
 	sqlite3_stmt**    get_column(sqlite3* db, Column* value_column, 
 								uint32_t count, va_list args);
 	sqlite3_stmt**    get_row(sqlite3* db, uint32_t count, va_list args);
@@ -103,8 +108,6 @@ protected:
 	const Column** columns();
 	uint32_t       column_count();
 
-	// free the out-of-band columns (text, blob) from a result record
-	int            free_row(uint8_t* row);
 	void           dump_results(FILE* f);	
 	
 	char*          m_name;
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2013 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#include "ThreadPool.h"
+#include "Context.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+ThreadPool::ThreadPool(uint32_t nthreads) {
+	if (nthreads == 0) {
+		long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		nthreads = ncpu > 0 ? (uint32_t)ncpu : 1;
+	}
+	pthread_mutex_init(&m_lock, NULL);
+	pthread_cond_init(&m_work_cond, NULL);
+	pthread_cond_init(&m_done_cond, NULL);
+	m_generation = 0;
+	m_shutdown = false;
+	m_func = NULL;
+	m_func_context = NULL;
+	m_context = NULL;
+	m_count = 0;
+	m_next = 0;
+	m_busy = 0;
+
+	m_thread_count = 0;
+	m_threads = (pthread_t*)malloc(sizeof(pthread_t) * nthreads);
+	for (uint32_t i = 1; m_threads && i < nthreads; i++) {
+		if (pthread_create(&m_threads[m_thread_count], NULL, 
+						   &ThreadPool::worker, this)) {
+			// make do with the threads we have
+			fprintf(stderr, "Warning: unable to create worker thread: %s\n",
+					strerror(errno));
+			break;
+		}
+		m_thread_count++;
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	pthread_mutex_lock(&m_lock);
+	m_shutdown = true;
+	pthread_cond_broadcast(&m_work_cond);
+	pthread_mutex_unlock(&m_lock);
+	for (uint32_t i = 0; i < m_thread_count; i++) {
+		pthread_join(m_threads[i], NULL);
+	}
+	free(m_threads);
+	pthread_cond_destroy(&m_done_cond);
+	pthread_cond_destroy(&m_work_cond);
+	pthread_mutex_destroy(&m_lock);
+}
+
+uint32_t ThreadPool::size() {
+	return m_thread_count + 1;
+}
+
+void ThreadPool::apply(uint32_t count, ThreadPoolFunc func, void* context) {
+	if (count == 0) return;
+	pthread_mutex_lock(&m_lock);
+	m_func = func;
+	m_func_context = context;
+	m_context = Context::current();
+	m_count = count;
+	m_next = 0;
+	m_busy = m_thread_count;
+	m_generation++;
+	pthread_cond_broadcast(&m_work_cond);
+	pthread_mutex_unlock(&m_lock);
+
+	this->run_items();
+
+	pthread_mutex_lock(&m_lock);
+	while (m_busy > 0) pthread_cond_wait(&m_done_cond, &m_lock);
+	m_func = NULL;
+	m_func_context = NULL;
+	m_context = NULL;
+	pthread_mutex_unlock(&m_lock);
+}
+
+void ThreadPool::run_items() {
+	for (;;) {
+		pthread_mutex_lock(&m_lock);
+		uint32_t index = m_next;
+		if (index < m_count) m_next++;
+		pthread_mutex_unlock(&m_lock);
+		if (index >= m_count) break;
+		m_func(index, m_func_context);
+	}
+}
+
+void* ThreadPool::worker(void* arg) {
+	ThreadPool* pool = (ThreadPool*)arg;
+	uint64_t seen = 0;
+	pthread_mutex_lock(&pool->m_lock);
+	for (;;) {
+		while (!pool->m_shutdown && pool->m_generation == seen) {
+			pthread_cond_wait(&pool->m_work_cond, &pool->m_lock);
+		}
+		if (pool->m_shutdown) break;
+		seen = pool->m_generation;
+		Context::set_current(pool->m_context);
+		pthread_mutex_unlock(&pool->m_lock);
+
+		pool->run_items();
+
+		pthread_mutex_lock(&pool->m_lock);
+		Context::set_current(NULL);
+		if (--pool->m_busy == 0) pthread_cond_signal(&pool->m_done_cond);
+	}
+	pthread_mutex_unlock(&pool->m_lock);
+	return NULL;
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2013 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#ifndef _THREADPOOL_H
+#define _THREADPOOL_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+struct Context;
+
+typedef void (*ThreadPoolFunc)(uint32_t index, void* context);
+
+////
+//  ThreadPool
+//
+//  A fixed set of worker threads for fanning independent work items,
+//  such as digesting files, out across the CPUs. The thread calling
+//  apply() works on items too, so a pool of size 1 has no workers and
+//  simply runs everything inline.
+//
+//  Workers only ever run the function given to apply(). They must not
+//  touch the database, which is only used from the calling thread.
+////
+
+struct ThreadPool {
+	// Creates a pool of nthreads threads in total, counting the caller.
+	// Zero means one per online CPU.
+	ThreadPool(uint32_t nthreads);
+	virtual ~ThreadPool();
+
+	uint32_t size();
+
+	// Calls func(i, context) for every i in [0, count) and returns once
+	//  all of them have finished. Calls happen in no particular order.
+	// The caller's Context is current on the workers while they run.
+	void apply(uint32_t count, ThreadPoolFunc func, void* context);
+
+protected:
+	static void* worker(void* arg);
+	void run_items();
+
+	pthread_t*      m_threads;
+	uint32_t        m_thread_count;  // workers, not counting the caller
+	pthread_mutex_t m_lock;
+	pthread_cond_t  m_work_cond;
+	pthread_cond_t  m_done_cond;
+	uint64_t        m_generation;    // bumped for each apply()
+	bool            m_shutdown;
+
+	ThreadPoolFunc  m_func;
+	void*           m_func_context;
+	Context*        m_context;
+	uint32_t        m_count;
+	uint32_t        m_next;
+	uint32_t        m_busy;          // workers still in the current apply()
+};
+
+#endif
@@ -45,7 +45,7 @@ size_t ftsent_filename(FTSENT* ent, char* filename, size_t bufsiz) {
 	}
 	strlcat(filename, "/", bufsiz);
 	bufsiz -= 1;
-	if (ent->fts_name) {
+	if (ent->fts_namelen) {
 		strlcat(filename, ent->fts_name, bufsiz);
 		bufsiz -= strlen(ent->fts_name);
 	}
@@ -148,6 +148,56 @@ int has_suffix(const char* str, const char* sfx) {
 	return false;
 }
 
+int split_words(char* line, char*** words, int* count) {
+	size_t max = 8;
+	*count = 0;
+	*words = (char**)malloc(sizeof(char*) * max);
+	if (!*words) return -1;
+
+	char* src = line;
+	char* dst = line;
+	while (*src) {
+		while (*src == ' ' || *src == '\t' || *src == '\n' || *src == '\r') src++;
+		if (*src == '\0' || *src == '#') break;
+
+		if ((size_t)*count + 1 >= max) {
+			max *= 2;
+			*words = (char**)realloc(*words, sizeof(char*) * max);
+			if (!*words) return -1;
+		}
+		(*words)[(*count)++] = dst;
+
+		// copy one word, collapsing quotes and escapes as we go
+		char quote = '\0';
+		while (*src) {
+			if (quote) {
+				if (*src == quote) {
+					quote = '\0';
+					src++;
+					continue;
+				}
+				if (quote == '"' && *src == '\\' && src[1]) src++;
+			} else {
+				if (*src == ' ' || *src == '\t' || *src == '\n' || *src == '\r') break;
+				if (*src == '"' || *src == '\'') {
+					quote = *src++;
+					continue;
+				}
+				if (*src == '\\' && src[1]) src++;
+			}
+			*dst++ = *src++;
+		}
+		if (quote) {
+			fprintf(stderr, "Error: unterminated quote.\n");
+			return -1;
+		}
+		if (*src) src++;
+		*dst++ = '\0';
+	}
+	(*words)[*count] = NULL;
+	return 0;
+}
+
 int exec_with_args(const char** args) {
 	return exec_with_args_fa(args, NULL);
 }
@@ -249,26 +299,41 @@ int join_path(char **out, const char *p1, const char *p2) {
 	return 0;
 }
 
-char* fetch_url(const char* srcpath, const char* dstpath) {
-	extern uint32_t verbosity;
-	char* localfile;
-	int res = join_path(&localfile, dstpath, basename((char*)srcpath));
-	if (res || !localfile) return NULL;
-	
-	const char* args[] = {
-		"/usr/bin/curl",
-		(verbosity ? "-v" : "-s"),
-		"-L", srcpath,
-		"-o", localfile,
-		NULL
-	};
-	if (res == 0) res = exec_with_args(args);
-	if (res == 0) return localfile;
-	return NULL;
+char* path_dirname(const char* path, char* buf, size_t bufsize) {
+	size_t len = strlen(path);
+	// ignore trailing slashes, then the last component, then its slashes
+	while (len > 1 && path[len-1] == '/') len--;
+	while (len > 0 && path[len-1] != '/') len--;
+	while (len > 1 && path[len-1] == '/') len--;
+	if (len == 0) {
+		strlcpy(buf, ".", bufsize);
+	} else {
+		if (len >= bufsize) len = bufsize - 1;
+		memcpy(buf, path, len);
+		buf[len] = '\0';
+	}
+	return buf;
+}
+
+char* path_basename(const char* path, char* buf, size_t bufsize) {
+	size_t end = strlen(path);
+	if (end == 0) {
+		strlcpy(buf, ".", bufsize);
+		return buf;
+	}
+	while (end > 1 && path[end-1] == '/') end--;
+	size_t start = end;
+	while (start > 0 && path[start-1] != '/') start--;
+	if (start == end) start = end - 1; // path was all slashes
+	size_t len = end - start;
+	if (len >= bufsize) len = bufsize - 1;
+	memcpy(buf, path + start, len);
+	buf[len] = '\0';
+	return buf;
 }
 
 char* fetch_userhost(const char* srcpath, const char* dstpath) {
-	extern uint32_t verbosity;
+	uint32_t verbosity = Context::current()->verbosity;
 	int res = 0;
 
 	// clean up srcpath by adding trailing slash
@@ -278,8 +343,8 @@ char* fetch_userhost(const char* srcpath, const char* dstpath) {
 
 	// make sure dstpath ends in basename of cleansrc for consistent rsync behavior
 	char* cleandst;
-	char* srccopy = strdup(cleansrc); // basename might modify input, so make a copy
-	res = join_path(&cleandst, dstpath, basename(srccopy));
+	char name[PATH_MAX];
+	res = join_path(&cleandst, dstpath, path_basename(cleansrc, name, sizeof(name)));
 	if (res != 0) return NULL;
 
 	IF_DEBUG("rsync -a --delete %s %s %s \n", 
@@ -295,7 +360,6 @@ char* fetch_userhost(const char* srcpath, const char* dstpath) {
 	};
 
 	if (res == 0) res = exec_with_args(args);
-	free(srccopy);
 	free(cleansrc);
 	if (res == 0) return cleandst;
 	return NULL;	
@@ -317,7 +381,10 @@ int find_base_system_path(char** output, const char* path) {
 			// we hit the top of the filesystem
 			break;
 		}
-		if (res) snprintf(parent, PATH_MAX, "%s", dirname(parent));
+		if (res) {
+			char dir[PATH_MAX];
+			strlcpy(parent, path_dirname(parent, dir, sizeof(dir)), PATH_MAX);
+		}
 	}
 	if (res) {
 		fprintf(stderr, "Error: (%d) unable to find base system path.\n", res);
@@ -329,7 +396,7 @@ int find_base_system_path(char** output, const char* path) {
 }
 
 int update_dyld_shared_cache(const char* path) {
-	extern uint32_t verbosity;
+	uint32_t verbosity = Context::current()->verbosity;
 	int res;
 	char* base;
 	res = find_base_system_path(&base, path);
@@ -365,7 +432,7 @@ int update_dyld_shared_cache(const char* path) {
 }
 
 int update_xpc_services_cache(const char* path) {
-	extern uint32_t verbosity;
+	uint32_t verbosity = Context::current()->verbosity;
 	int res;
 	char* base;
 	res = find_base_system_path(&base, path);
@@ -435,7 +502,7 @@ int update_xpc_services_cache(const char* path) {
 int build_number_for_path(char** build, const char* path) {
 	ssize_t res = 0;
 	char system[PATH_MAX];
-	char* base;
+	char* base = NULL;
 	
 	*build = (char*)calloc(1, 16);
 	
@@ -520,6 +587,48 @@ void __data_hex(FILE* f, uint8_t* data, uint32_t size) {
 }
 
 void hr() {
-	fprintf(stdout, "=============================================="
+	fprintf(Context::current()->output, "=============================================="
 			"=======================================\n");	
 }
+
+static const char size_units[] = "BKMGT";
+
+char* format_size(uint64_t bytes, char* buf, size_t bufsize) {
+	double size = (double)bytes;
+	int unit = 0;
+	while (size >= 1024.0 && size_units[unit + 1]) {
+		size /= 1024.0;
+		unit++;
+	}
+	if (unit == 0 || size >= 10.0) {
+		snprintf(buf, bufsize, "%.0f%c", size, size_units[unit]);
+	} else {
+		snprintf(buf, bufsize, "%.1f%c", size, size_units[unit]);
+	}
+	return buf;
+}
+
+int parse_size(const char* str, uint64_t* bytes) {
+	char* end;
+	errno = 0;
+	double size = strtod(str, &end);
+	if (errno || end == str || size < 0) return -1;
+	if (*end) {
+		const char* unit = strchr(size_units, toupper(*end));
+		if (!unit || end[1]) return -1;
+		for (long i = unit - size_units; i > 0; i--) size *= 1024.0;
+	}
+	*bytes = (uint64_t)size;
+	return 0;
+}
+
+int sync_filesystem(int fd) {
+	// there is no syncfs(2) here, so schedule every dirty buffer and
+	//  then wait on fd, which with F_FULLFSYNC also flushes the
+	//  filesystem journal and the drive's cache
+	sync();
+#ifdef F_FULLFSYNC
+	if (fcntl(fd, F_FULLFSYNC) == 0) return 0;
+#endif
+	return fsync(fd);
+}
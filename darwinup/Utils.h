@@ -40,6 +40,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <libgen.h>
@@ -50,13 +51,14 @@
 #include <spawn.h>
 #include <sys/stat.h>
 
+#include "Context.h"
 
 const uint32_t VERBOSE		    = 0x1;
 const uint32_t VERBOSE_DEBUG	= 0x2;
 const uint32_t VERBOSE_SQL      = 0x4;
 
-#define IF_DEBUG(...) do { extern uint32_t verbosity; if (verbosity & VERBOSE_DEBUG) fprintf(stderr, "DEBUG: " __VA_ARGS__); } while (0)
-#define IF_SQL(...) do { extern uint32_t verbosity; if (verbosity & VERBOSE_SQL) fprintf(stderr, "DEBUG: " __VA_ARGS__); } while (0)
+#define IF_DEBUG(...) do { if (Context::current()->verbosity & VERBOSE_DEBUG) fprintf(stderr, "DEBUG: " __VA_ARGS__); } while (0)
+#define IF_SQL(...) do { if (Context::current()->verbosity & VERBOSE_SQL) fprintf(stderr, "DEBUG: " __VA_ARGS__); } while (0)
 
 int fts_compare(const FTSENT **a, const FTSENT **b);
 size_t ftsent_filename(FTSENT* ent, char* filename, size_t bufsiz);
@@ -68,15 +70,20 @@ int is_regular_file(const char* path);
 int is_url_path(const char* path);
 int is_userhost_path(const char* path);
 int has_suffix(const char* str, const char* sfx);
+// split line in place on whitespace, honoring quotes and backslashes.
+//  words is malloc'd and points into line. Caller must free words.
+int split_words(char* line, char*** words, int* count);
 
 int exec_with_args(const char** args);
 int exec_with_args_pipe(const char** args, int fd);
 int exec_with_args_fa(const char** args, posix_spawn_file_actions_t* fa);
 
 int join_path(char** out, const char* p1, const char* p2);
+// reentrant dirname(3) and basename(3); write into buf and return it
+char* path_dirname(const char* path, char* buf, size_t bufsize);
+char* path_basename(const char* path, char* buf, size_t bufsize);
 int compact_slashes(char* orig, int slashes);
 
-char* fetch_url(const char* srcpath, const char* dstpath);
 char* fetch_userhost(const char* srcpath, const char* dstpath);
 
 int find_base_system_path(char** output, const char* path);
@@ -93,6 +100,15 @@ void __data_hex(FILE* f, uint8_t* data, uint32_t size);
 // print a horizontal line to stdout
 void hr();
 
+// human readable byte counts, like "512B" or "1.5M"; writes into buf
+char* format_size(uint64_t bytes, char* buf, size_t bufsize);
+// parses a byte count with an optional K, M, G or T suffix
+int parse_size(const char* str, uint64_t* bytes);
+
+// makes everything written so far to the filesystem holding fd durable,
+//  not just fd itself
+int sync_filesystem(int fd);
+
 inline bool INFO_TEST(uint64_t word, uint64_t flag) { return ((word & flag) != 0); }
 inline uint64_t INFO_SET(uint64_t word, uint64_t flag) { return (word | flag); }
 inline uint64_t INFO_CLR(uint64_t word, uint64_t flag) { return (word & (~flag)); }
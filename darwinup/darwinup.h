@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2013 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#ifndef _LIBDARWINUP_H
+#define _LIBDARWINUP_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+////
+//  libdarwinup
+//
+//  C interface to the darwinup depot, for tools that would otherwise
+//  run the darwinup command once per query. A depot handle carries its
+//  own options, so several depots may be used at once, each from its
+//  own thread. A single handle must not be used by two threads at once.
+//
+//  Results are only reported through the callbacks below. The lines
+//  the darwinup command prints, such as each file installed, are
+//  discarded unless darwinup_set_output() names a stream for them.
+//  Errors are printed to stderr.
+////
+
+// return codes, shared with the darwinup command
+#define DARWINUP_OK               0
+#define DARWINUP_ERROR           -1
+#define DARWINUP_NOT_EXIST       -2
+#define DARWINUP_PERM_DENIED     -3
+#define DARWINUP_OBJ_CHANGE      -4
+#define DARWINUP_BUILD_MISMATCH  -5
+#define DARWINUP_USAGE_ERROR     -6
+#define DARWINUP_PREINSTALL_ERR  -7
+
+// option flags for darwinup_set_options()
+#define DARWINUP_OPTION_FORCE    0x0001
+#define DARWINUP_OPTION_DRYRUN   0x0002
+#define DARWINUP_OPTION_QUICK    0x0004  // verify by size and mtime, not digest
+
+// verbosity levels for darwinup_set_options()
+#define DARWINUP_VERBOSE         0x0001
+#define DARWINUP_VERBOSE_DEBUG   0x0003
+#define DARWINUP_VERBOSE_SQL     0x0007
+
+typedef struct darwinup_depot* darwinup_depot_t;
+
+// Strings are only valid for the duration of the callback.
+typedef struct {
+	uint64_t    serial;
+	const char* uuid;
+	const char* name;
+	const char* build;
+	time_t      date_installed;
+	int         is_rollback;
+} darwinup_archive_t;
+
+typedef struct {
+	uint64_t    serial;
+	uint64_t    archive;
+	const char* path;
+	mode_t      mode;
+	uid_t       uid;
+	gid_t       gid;
+	const char* digest;  // hexadecimal, or NULL if the file has none
+	char        status;  // verify only: ' ' same, 'M' modified, 'R' removed
+} darwinup_file_t;
+
+// Return non-zero from a callback to stop iterating; that value is
+//  then returned to the caller.
+typedef int (*darwinup_archive_func_t)(const darwinup_archive_t* archive, void* context);
+typedef int (*darwinup_file_func_t)(const darwinup_file_t* file, void* context);
+
+// Opens the depot under prefix ("/" for the boot volume). Writable
+//  depots are created if needed and require root. On failure, returns
+//  NULL and stores a DARWINUP_* code in error if it is not NULL.
+darwinup_depot_t darwinup_open(const char* prefix, int writable, int* error);
+
+// Releases the depot lock and database connection.
+void darwinup_close(darwinup_depot_t depot);
+
+// Sets DARWINUP_OPTION_* flags and a DARWINUP_VERBOSE* level.
+void darwinup_set_options(darwinup_depot_t depot, uint32_t options, uint32_t verbosity);
+
+// Prints what the darwinup command would to output, or nothing if
+//  output is NULL, which is the default.
+void darwinup_set_output(darwinup_depot_t depot, FILE* output);
+
+// Installs the root at path, which is anything the darwinup command
+//  accepts. Use darwinup_list(depot, "newest", ...) to find it after.
+int darwinup_install(darwinup_depot_t depot, const char* path);
+
+// The archspec arguments below accept anything the darwinup command
+//  does: serial, uuid, name, newest, oldest, superseded or all.
+int darwinup_uninstall(darwinup_depot_t depot, const char* archspec);
+
+// archspec may be NULL, which is the same as "all".
+int darwinup_list(darwinup_depot_t depot, const char* archspec,
+				  darwinup_archive_func_t func, void* context);
+
+int darwinup_files(darwinup_depot_t depot, const char* archspec,
+				   darwinup_file_func_t func, void* context);
+
+int darwinup_verify(darwinup_depot_t depot, const char* archspec,
+					darwinup_file_func_t func, void* context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2013 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#include "darwinup.h"
+#include "Archive.h"
+#include "Context.h"
+#include "Depot.h"
+#include "File.h"
+#include "Utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct darwinup_depot {
+	Depot*   depot;
+	Context  context;
+	uint32_t options;
+	FILE*    silent;  // /dev/null, where output goes unless redirected
+};
+
+// makes a depot's options current for the calling thread while in scope
+struct ContextScope {
+	ContextScope(darwinup_depot_t d) { previous = Context::set_current(&d->context); }
+	~ContextScope() { Context::set_current(previous); }
+	Context* previous;
+};
+
+struct FileCallback {
+	darwinup_depot_t     depot;
+	darwinup_file_func_t func;
+	void*                context;
+	bool                 verify;
+};
+
+static int call_archive_func(Archive* archive, darwinup_archive_func_t func, 
+							 void* context) {
+	char uuid[37];
+	uuid_unparse_upper(archive->uuid(), uuid);
+	darwinup_archive_t info;
+	info.serial = archive->serial();
+	info.uuid = uuid;
+	info.name = archive->name();
+	info.build = archive->build();
+	info.date_installed = archive->date_installed();
+	info.is_rollback = INFO_TEST(archive->info(), ARCHIVE_INFO_ROLLBACK);
+	return func(&info, context);
+}
+
+static int call_verified_file_func(File* file, char status, void* ctx) {
+	FileCallback* cb = (FileCallback*)ctx;
+	darwinup_file_t info;
+	info.serial = file->serial();
+	info.archive = file->archive() ? file->archive()->serial() : 0;
+	info.path = file->path();
+	info.mode = file->mode();
+	info.uid = file->uid();
+	info.gid = file->gid();
+	info.digest = file->digest() ? file->digest()->string() : NULL;
+	info.status = status;
+	int res = cb->func(&info, cb->context);
+	free((char*)info.digest);
+	return res;
+}
+
+static int call_file_func(File* file, void* ctx) {
+	return call_verified_file_func(file, ' ', ctx);
+}
+
+// run func over the files of every archive matching archspec
+static int iterate_matching_files(darwinup_depot_t d, const char* archspec, 
+								  FileCallback* cb) {
+	int res = DEPOT_OK;
+	verify_mode_t mode = VERIFY_DEEP;
+	if (d->options & DARWINUP_OPTION_QUICK) mode = VERIFY_QUICK;
+	uint32_t count = 0;
+	Archive** list = d->depot->get_archives(archspec, &count);
+	if (!list) return DEPOT_ERROR;
+	for (uint32_t i = 0; i < count; i++) {
+		if (!list[i]) {
+			res = DEPOT_NOT_EXIST;
+			continue;
+		}
+		if (res == DEPOT_OK && cb->verify) {
+			res = d->depot->iterate_verified_files(list[i], mode, 
+												   &call_verified_file_func, cb);
+		} else if (res == DEPOT_OK) {
+			res = d->depot->iterate_files(list[i], &call_file_func, cb, false);
+		}
+		if (list[i]) list[i]->release();
+	}
+	free(list);
+	return res;
+}
+
+darwinup_depot_t darwinup_open(const char* prefix, int writable, int* error) {
+	int res = DEPOT_OK;
+	darwinup_depot_t d = new darwinup_depot;
+	d->depot = NULL;
+	d->options = 0;
+	// the host's stdout is not ours to print to
+	d->silent = fopen("/dev/null", "w");
+	d->context.output = d->silent;
+	ContextScope scope(d);
+
+	// Depot expects a prefix with a trailing slash, as main() gives it
+	char* path = NULL;
+	if (!d->silent) {
+		perror("/dev/null");
+		res = DEPOT_ERROR;
+	} else if (!prefix || prefix[0] != '/') {
+		res = DEPOT_USAGE_ERROR;
+	} else {
+		join_path(&path, prefix, "/");
+		d->depot = new Depot(path);
+		free(path);
+		res = d->depot->initialize(writable != 0);
+	}
+	if (res) {
+		if (error) *error = res;
+		delete d->depot;
+		if (d->silent) fclose(d->silent);
+		delete d;
+		return NULL;
+	}
+	if (error) *error = DEPOT_OK;
+	return d;
+}
+
+void darwinup_close(darwinup_depot_t d) {
+	if (!d) return;
+	ContextScope scope(d);
+	delete d->depot;
+	fclose(d->silent);
+	delete d;
+}
+
+void darwinup_set_options(darwinup_depot_t d, uint32_t options, uint32_t verbosity) {
+	d->options = options;
+	d->context.force = (options & DARWINUP_OPTION_FORCE) ? 1 : 0;
+	d->context.dryrun = (options & DARWINUP_OPTION_DRYRUN) ? 1 : 0;
+	d->context.verbosity = verbosity;
+}
+
+void darwinup_set_output(darwinup_depot_t d, FILE* output) {
+	d->context.output = output ? output : d->silent;
+}
+
+int darwinup_install(darwinup_depot_t d, const char* path) {
+	ContextScope scope(d);
+	return d->depot->install(path);
+}
+
+int darwinup_uninstall(darwinup_depot_t d, const char* archspec) {
+	ContextScope scope(d);
+	return d->depot->process_archive("uninstall", archspec);
+}
+
+int darwinup_list(darwinup_depot_t d, const char* archspec,
+				  darwinup_archive_func_t func, void* context) {
+	ContextScope scope(d);
+	int res = DEPOT_OK;
+	uint32_t count = 0;
+	Archive** list = d->depot->get_archives(archspec ? archspec : "all", &count);
+	if (!list) return DEPOT_ERROR;
+	for (uint32_t i = 0; i < count; i++) {
+		if (!list[i]) {
+			res = DEPOT_NOT_EXIST;
+			continue;
+		}
+		if (res == DEPOT_OK) res = call_archive_func(list[i], func, context);
+		if (list[i]) list[i]->release();
+	}
+	free(list);
+	return res;
+}
+
+int darwinup_files(darwinup_depot_t d, const char* archspec,
+				   darwinup_file_func_t func, void* context) {
+	ContextScope scope(d);
+	FileCallback cb = { d, func, context, false };
+	return iterate_matching_files(d, archspec, &cb);
+}
+
+int darwinup_verify(darwinup_depot_t d, const char* archspec,
+					darwinup_file_func_t func, void* context) {
+	ContextScope scope(d);
+	FileCallback cb = { d, func, context, true };
+	return iterate_matching_files(d, archspec, &cb);
+}
@@ -31,11 +31,14 @@
  */
 
 #include <Availability.h>
+#include <ctype.h>
+#include <errno.h>
 #include <libgen.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include <limits.h>
 
@@ -43,32 +46,47 @@
 #include "Depot.h"
 #include "Utils.h"
 #include "DB.h"
+#include "Jobs.h"
+#include "Progress.h"
+#include "Service.h"
 
 
 void usage(char* progname) {
 	fprintf(stderr, "usage:    %s [-v] [-p DIR] [command] [args]          \n", progname);
+	fprintf(stderr, "          %s [-v] [-p DIR] -b FILE|-                 \n", progname);
 	fprintf(stderr, "version: 36                                                    \n");
 	fprintf(stderr, "                                                               \n");
 	fprintf(stderr, "options:                                                       \n");
+	fprintf(stderr, "          -b FILE   read commands from FILE (- for stdin)      \n");
 #if __MAC_OS_X_VERSION_MIN_REQUIRED >= 1060
 	fprintf(stderr, "          -d        disable helpful automation                 \n");	
 #endif
 	fprintf(stderr, "          -f        force operation to succeed at all costs    \n");
 	fprintf(stderr, "          -n        dry run                                    \n");
 	fprintf(stderr, "          -p DIR    operate on roots under DIR (default: /)    \n");
+	fprintf(stderr, "                    repeat to operate on several DIRs at once  \n");
+	fprintf(stderr, "          -P FILE   operate on every DIR listed in FILE        \n");
 #if __MAC_OS_X_VERSION_MIN_REQUIRED >= 1060
 	fprintf(stderr, "          -r        gracefully restart when finished           \n");	
 #endif
 	fprintf(stderr, "          -v        verbose (use -vv for extra verbosity)      \n");
 	fprintf(stderr, "                                                               \n");
 	fprintf(stderr, "commands:                                                      \n");
+	fprintf(stderr, "          checkpoint [name]                                    \n");
+	fprintf(stderr, "          clone      <prefix>                                  \n");
+	fprintf(stderr, "          du         [archive]                                 \n");
 	fprintf(stderr, "          files      <archive>                                 \n");
+	fprintf(stderr, "          fsck       [-a]                                      \n");
+	fprintf(stderr, "          gc         [-s size]                                 \n");
 	fprintf(stderr, "          install    <path>                                    \n");
 	fprintf(stderr, "          list       [archive]                                 \n");
 	fprintf(stderr, "          rename     <archive> <name>                          \n");
+	fprintf(stderr, "          serve                                                \n");
+	fprintf(stderr, "          status     [-w]                                      \n");
 	fprintf(stderr, "          uninstall  <archive>                                 \n");
+	fprintf(stderr, "          undo       [checkpoint]                              \n");
 	fprintf(stderr, "          upgrade    <path>                                    \n");
-	fprintf(stderr, "          verify     <archive>                                 \n");
+	fprintf(stderr, "          verify     [-q|-d] <archive>                         \n");
 	fprintf(stderr, "                                                               \n");
 	fprintf(stderr, "<path> is one of:                                              \n");
 	fprintf(stderr, "          /path/to/local/dir-or-file                           \n");
@@ -78,7 +96,7 @@ void usage(char* progname) {
 	fprintf(stderr, "Files must be in one of the supported archive formats:         \n");
 	fprintf(stderr, "          cpio, cpio.gz, cpio.bz2                              \n");
 	fprintf(stderr, "          pax, pax.gz, pax.bz2                                 \n");
-	fprintf(stderr, "          tar, tar.gz, tar.bz2                                 \n");
+	fprintf(stderr, "          tar, tar.gz, tar.bz2, tar.xz, tar.zst                \n");
 #if __MAC_OS_X_VERSION_MIN_REQUIRED >= 1060	
 	fprintf(stderr, "          xar, zip                                             \n");
 #else
@@ -98,87 +116,25 @@ void usage(char* progname) {
 	exit(1);
 }
 
-// our globals
-uint32_t verbosity;
-uint32_t force;
-uint32_t dryrun;
+// initialize depot, or exit with code as the CLI always has
+void initialize_or_exit(Depot* depot, bool writable, int code) {
+	int res = depot->initialize(writable);
+	if (res == DEPOT_PERM_DENIED && writable) exit(3);
+	if (res) exit(code);
+}
 
 
-int main(int argc, char* argv[]) {
-	char* progname = strdup(basename(argv[0]));      
-	char* path = NULL;
-	bool disable_automation = false;
-#if __MAC_OS_X_VERSION_MIN_REQUIRED >= 1060
-	bool restart = false;
-#endif
-	
-	int ch;
-#if __MAC_OS_X_VERSION_MIN_REQUIRED >= 1060
-	while ((ch = getopt(argc, argv, "dfnp:rvh")) != -1) {
-#else
-	while ((ch = getopt(argc, argv, "dfnp:vh")) != -1) {
-#endif
-		switch (ch) {
-		case 'd':
-				disable_automation = true;
-				break;
-		case 'f':
-				force = 1;
-				break;
-		case 'n':
-				dryrun = 1;
-				disable_automation = true;
-				break;
-		case 'p':
-				if (optarg[0] != '/') {
-					fprintf(stderr, "Error: -p option must be an absolute path\n");
-					exit(4);
-				}
-				if (strlen(optarg) > (PATH_MAX - 1)) {
-					fprintf(stderr, "Error: -p option value is too long \n");
-					exit(4);
-				}
-				join_path(&path, optarg, "/");
-				break;
-#if __MAC_OS_X_VERSION_MIN_REQUIRED >= 1060	
-		case 'r':
-				restart = true;
-				break;
-#endif
-		case 'v':
-				verbosity <<= 1;
-				verbosity |= VERBOSE;
-				break;
-		case '?':
-		case 'h':
-		default:
-				usage(progname);
-		}
-	}
-	argc -= optind;
-    argv += optind;
-	if (argc == 0) usage(progname);
-	
+// Run one command line against depot. The depot is initialized on first
+//  use, so batch mode can initialize it once up front. If progname is
+//  NULL, usage errors are returned rather than printing usage and exiting.
+int run_command(Depot* depot, const char* path, char* progname, 
+				int argc, char* argv[]) {
 	int res = 0;
-
-	if (dryrun) IF_DEBUG("option: dry run\n");
-	if (force)  IF_DEBUG("option: forcing operations\n");
-	if (disable_automation) IF_DEBUG("option: helpful automation disabled\n");
-#if __MAC_OS_X_VERSION_MIN_REQUIRED >= 1060
-    if (restart) IF_DEBUG("option: restart when finished\n");
-#endif
+	bool initialized = depot->is_initialized();
 	
-	if (!path) {
-		asprintf(&path, "/");
-	} else {
-		IF_DEBUG("option: path is %s\n", path);
-	}
-
-	Depot* depot = new Depot(path);
-		
 	// list handles args optional and in special ways
 	if (strcmp(argv[0], "list") == 0) {
-		res = depot->initialize(false);
+		if (!initialized) res = depot->initialize(false);
 		if (res == DEPOT_NOT_EXIST) {
 			// we are not asking to write, 
 			// but no depot exists yet either,
@@ -193,20 +149,73 @@ int main(int argc, char* argv[]) {
 			exit(6);
 		}
 		if (res == 0) depot->list(argc-1, (char**)(argv+1));
+	} else if (strcmp(argv[0], "du") == 0) {
+		// du takes optional archives, like list
+		if (!initialized) initialize_or_exit(depot, false, 22);
+		res = depot->du(argc-1, (char**)(argv+1));
+	} else if (strcmp(argv[0], "gc") == 0) {
+		if (!initialized) initialize_or_exit(depot, true, 23);
+		res = depot->gc(argc-1, (char**)(argv+1));
+		if (res == DEPOT_USAGE_ERROR && progname) usage(progname);
+	} else if (strcmp(argv[0], "status") == 0) {
+		// background jobs only need the depot's paths, not its lock
+		bool wait = (argc == 2 && strcmp(argv[1], "-w") == 0);
+		if (argc > 2 || (argc == 2 && !wait)) {
+			fprintf(stderr, "Error: invalid status argument: %s\n", argv[1]);
+			if (progname) usage(progname);
+			return DEPOT_USAGE_ERROR;
+		}
+		JobQueue jobs(depot->jobs_path(), depot->hooks_path(), depot->prefix());
+		res = jobs.status(wait);
+	} else if (strcmp(argv[0], "fsck") == 0) {
+		// fsck takes only options, and records a checkpoint when clean
+		if (!initialized) initialize_or_exit(depot, true, 21);
+		res = depot->fsck(argc-1, (char**)(argv+1));
+		if (res == DEPOT_USAGE_ERROR && progname) usage(progname);
+	} else if (strcmp(argv[0], "checkpoint") == 0 || strcmp(argv[0], "undo") == 0) {
+		// both take an optional checkpoint name
+		if (argc > 2) {
+			fprintf(stderr, "Error: %s takes at most one checkpoint name.\n", argv[0]);
+			if (progname) usage(progname);
+			return DEPOT_USAGE_ERROR;
+		}
+		const char* name = (argc == 2) ? argv[1] : NULL;
+		if (strcmp(argv[0], "checkpoint") == 0) {
+			if (!initialized) initialize_or_exit(depot, name != NULL, 25);
+			res = depot->checkpoint(name);
+		} else {
+			if (!initialized) initialize_or_exit(depot, true, 26);
+			res = depot->undo(name);
+		}
+	} else if (strcmp(argv[0], "clone") == 0) {
+		// clone takes exactly one source prefix
+		if (argc != 2) {
+			fprintf(stderr, "Error: clone takes the prefix to clone from.\n");
+			if (progname) usage(progname);
+			return DEPOT_USAGE_ERROR;
+		}
+		if (!initialized) initialize_or_exit(depot, true, 24);
+		res = depot->clone(argv[1]);
 	} else if (argc == 1) {
 		// other commands which take no arguments
 		if (strcmp(argv[0], "dump") == 0) {
-			if (depot->initialize(false)) exit(11);
+			if (!initialized) initialize_or_exit(depot, false, 11);
 			depot->dump();
+		} else if (strcmp(argv[0], "serve") == 0) {
+			initialize_or_exit(depot, true, 19);
+			DepotService* service = new DepotService(depot);
+			res = service->serve();
+			delete service;
 		} else {
 			fprintf(stderr, "Error: unknown command: '%s' \n", argv[0]);
-			usage(progname);
+			if (progname) usage(progname);
+			res = DEPOT_USAGE_ERROR;
 		}
 	} else {
 		// loop over arguments
 		for (int i = 1; i < argc && res == 0; i++) {
 			if (strcmp(argv[0], "install") == 0) {
-				if (i==1 && depot->initialize(true)) exit(13);
+				if (i==1 && !initialized) initialize_or_exit(depot, true, 13);
 				// gaurd against installing paths ontop of themselves
 				if (strncmp(path, argv[i], strlen(argv[i])) == 0 
 					&& (strlen(path) == strlen(argv[i]) 
@@ -225,7 +234,7 @@ int main(int argc, char* argv[]) {
 				}							
 				if (res == 0) res = depot->install(argv[i]);
 			} else if (strcmp(argv[0], "upgrade") == 0) {
-				if (i==1 && depot->initialize(true)) exit(14);
+				if (i==1 && !initialized) initialize_or_exit(depot, true, 14);
 				// find most recent matching archive by name
 				Archive* old = depot->get_archive(basename(argv[i]));
 				if (!old) {
@@ -237,63 +246,431 @@ int main(int argc, char* argv[]) {
 				// uninstall old archive
 				if (res == 0) res = depot->uninstall(old);
 			} else if (strcmp(argv[0], "files") == 0) {
-				if (i==1 && depot->initialize(false)) exit(12);
+				if (i==1 && !initialized) initialize_or_exit(depot, false, 12);
 				res = depot->process_archive(argv[0], argv[i]);
 			} else if (strcmp(argv[0], "uninstall") == 0) {
-				if (i==1 && depot->initialize(true)) exit(15);
+				if (i==1 && !initialized) initialize_or_exit(depot, true, 15);
 				res = depot->process_archive(argv[0], argv[i]);
 			} else if (strcmp(argv[0], "verify") == 0) {
-				if (i==1 && depot->initialize(true)) exit(16);
-				res = depot->process_archive(argv[0], argv[i]);
+				if (!initialized) initialize_or_exit(depot, true, 16);
+				// verify handles its own -q and -d options
+				res = depot->verify(argc-1, (char**)(argv+1));
+				break;
 			} else if (strcmp(argv[0], "rename") == 0) {
-				if (i==1 && depot->initialize(true)) exit(17);
+				if (i==1 && !initialized) initialize_or_exit(depot, true, 17);
 				if ((i+1) >= argc) {
 					fprintf(stderr, 
 							"Error: rename command for '%s' takes 2 arguments.\n", 
 							argv[i]);
-					exit(18);
+					if (progname) exit(18);
+					res = DEPOT_USAGE_ERROR;
+					break;
 				}
 				res = depot->rename_archive(argv[i], argv[i+1]);
 				i++;
 			} else {
 				fprintf(stderr, "Error: unknown command: '%s' \n", argv[0]);
-				usage(progname);
+				if (progname) usage(progname);
+				res = DEPOT_USAGE_ERROR;
 			}
 		}
+	}
+	return res;
+}
+
+// Read one command per line from batchfile ("-" for stdin) and run them
+//  in order with the depot already initialized. Stops at the first error.
+int run_batch(Depot* depot, const char* path, const char* batchfile) {
+	int res = 0;
+	FILE* f = stdin;
+	if (strcmp(batchfile, "-") != 0) {
+		f = fopen(batchfile, "r");
+		if (!f) {
+			perror(batchfile);
+			return DEPOT_ERROR;
+		}
+	}
+	
+	char* line = NULL;
+	size_t linecap = 0;
+	uint32_t lineno = 0;
+	while (res == 0 && getline(&line, &linecap, f) > 0) {
+		lineno++;
+		char** words = NULL;
+		int count = 0;
+		res = split_words(line, &words, &count);
+		if (res == 0 && count > 0) {
+			IF_DEBUG("batch: line %u: %s\n", lineno, words[0]);
+			if (strcmp(words[0], "serve") == 0) {
+				fprintf(stderr, "Error: serve cannot be used in batch mode.\n");
+				res = DEPOT_USAGE_ERROR;
+			} else {
+				res = run_command(depot, path, NULL, count, words);
+			}
+		}
+		free(words);
+		if (res) {
+			fprintf(stderr, "Error: batch stopped at line %u of %s\n", 
+					lineno, batchfile);
+		}
+	}
+	free(line);
+	if (f != stdin) fclose(f);
+	return res;
+}
+
+// Run post-install automation for everything the depot has changed.
+//  Cache updates are queued to run in the background, where those
+//  requested by back to back commands are done once.
+int run_automation(Depot* depot, const char* path, bool restart) {
+	int res = 0;
+	JobQueue jobs(depot->jobs_path(), depot->hooks_path(), path);
 #if __MAC_OS_X_VERSION_MIN_REQUIRED >= 1060
-		if (!disable_automation && depot->is_dirty() && res == 0) {
-			res = update_dyld_shared_cache(path);
-			if (res) fprintf(stderr, "Warning: could not update dyld cache.\n");
+	if (depot->is_dirty()) {
+		res = jobs.request("dyld");
+		if (res) fprintf(stderr, "Warning: could not queue dyld cache update.\n");
+		res = 0;
+	}
+	if (depot->has_modified_extensions()) {
+		char *sle_path;
+		res = join_path(&sle_path, depot->prefix(), "/System/Library/Extensions");
+		IF_DEBUG("Touching /System/Library/Extensions\n");
+		if (res == 0) res = utimes(sle_path, NULL);
+		if (res) {
+			fprintf(stderr, "Warning: unable to touch %s \n", sle_path);
 			res = 0;
 		}
-		if (!disable_automation && depot->has_modified_extensions() && res == 0) {
-			char *sle_path;
-			res = join_path(&sle_path, depot->prefix(), "/System/Library/Extensions");
-			IF_DEBUG("Touching /System/Library/Extensions\n");
-			if (res == 0) res = utimes(sle_path, NULL);
-			if (res) {
-				fprintf(stderr, "Warning: unable to touch %s \n", sle_path);
-				res = 0;
+		free(sle_path);
+	}
+#endif
+	if (depot->has_modified_xpc_services()) {
+		res = jobs.request("xpc");
+		if (res) fprintf(stderr, "Warning: could not queue xpc services cache update.\n");
+		res = 0;
+	}
+#if __MAC_OS_X_VERSION_MIN_REQUIRED >= 1060
+	if (restart) {
+		// restart into the updated caches
+		jobs.wait();
+		res = tell_finder_to_restart();
+		if (res) fprintf(stderr, "Warning: tried to tell Finder to restart"
+						         "but failed.\n");
+		res = 0;
+	}
+#endif
+	return res;
+}
+
+
+// Add a -p (or -P list) value to prefixes, exiting if it is unusable.
+void add_prefix(char*** prefixes, uint32_t* count, const char* prefix) {
+	if (prefix[0] != '/') {
+		fprintf(stderr, "Error: -p option must be an absolute path\n");
+		exit(4);
+	}
+	if (strlen(prefix) > (PATH_MAX - 1)) {
+		fprintf(stderr, "Error: -p option value is too long \n");
+		exit(4);
+	}
+	*prefixes = (char**)realloc(*prefixes, (*count + 1) * sizeof(char*));
+	if (!*prefixes) {
+		fprintf(stderr, "Error: out of memory\n");
+		exit(4);
+	}
+	join_path(&(*prefixes)[(*count)++], prefix, "/");
+}
+
+// Add every line of listfile, other than blanks and # comments, as a prefix.
+void add_prefix_list(char*** prefixes, uint32_t* count, const char* listfile) {
+	FILE* f = fopen(listfile, "r");
+	if (!f) {
+		perror(listfile);
+		exit(4);
+	}
+	char* line = NULL;
+	size_t linecap = 0;
+	ssize_t len;
+	while ((len = getline(&line, &linecap, f)) > 0) {
+		while (len > 0 && isspace(line[len - 1])) line[--len] = 0;
+		if (len > 0 && line[0] != '#') add_prefix(prefixes, count, line);
+	}
+	free(line);
+	fclose(f);
+}
+
+// Run the command line, or the batch file, against the depot at path.
+int run_prefix(const char* path, char* progname, const char* batchfile,
+			   bool automation, bool restart, int argc, char* argv[]) {
+	int res = 0;
+	Depot* depot = new Depot(path);
+
+	if (batchfile) {
+		// one lock and one database connection for every command
+		initialize_or_exit(depot, true, 20);
+		res = run_batch(depot, path, batchfile);
+	} else {
+		// read-only commands can be answered by a running service
+		if (DepotService::forward(depot, argc, argv, &res) == 0) {
+			return res;
+		}
+		res = run_command(depot, path, progname, argc, argv);
+	}
+
+	// automation covers everything changed by the command (or batch),
+	//  and does not apply to commands which only read or tidy the depot
+	bool modifies = batchfile || ((argc > 1 || strcmp(argv[0], "undo") == 0)
+								  && strcmp(argv[0], "list") != 0
+								  && strcmp(argv[0], "du") != 0
+								  && strcmp(argv[0], "fsck") != 0
+								  && strcmp(argv[0], "gc") != 0
+								  && strcmp(argv[0], "checkpoint") != 0
+								  && strcmp(argv[0], "status") != 0);
+	if (automation && modifies && res == 0) {
+		res = run_automation(depot, path, restart);
+	}
+	// releases the lock, after writing the snapshot of what was committed
+	delete depot;
+	return res;
+}
+
+// Run the command line against several prefixes at once, each in its own
+//  process with its own depot, lock and database connection. Roots to
+//  install are fetched, extracted and digested here first, and each
+//  depot clones them instead of repeating that work. The output of each
+//  prefix is printed as a block, in the order the prefixes were given.
+int run_prefixes(char** prefixes, uint32_t count, char* progname, 
+				 const char* batchfile, bool automation, bool restart, 
+				 int argc, char* argv[]) {
+	int res = 0;
+
+	if (!batchfile && strcmp(argv[0], "serve") == 0) {
+		fprintf(stderr, "Error: serve takes a single prefix.\n");
+		return DEPOT_USAGE_ERROR;
+	}
+
+	// the stage lives in the first depot, so it can usually be cloned
+	Depot* first = new Depot(prefixes[0]);
+	if (!batchfile && argc > 1 && getuid() == 0 &&
+		(strcmp(argv[0], "install") == 0 || strcmp(argv[0], "upgrade") == 0) &&
+		first->create_storage() == 0) {
+		for (int i = 1; i < argc; i++) {
+			// failures are reported, and each depot tries on its own
+			stage_archive(argv[i], first->downloads_path());
+		}
+	}
+	delete first;
+
+	pid_t* pids = (pid_t*)calloc(count, sizeof(pid_t));
+	FILE** outputs = (FILE**)calloc(count, sizeof(FILE*));
+	int* statuses = (int*)calloc(count, sizeof(int));
+	bool* done = (bool*)calloc(count, sizeof(bool));
+	if (!pids || !outputs || !statuses || !done) {
+		fprintf(stderr, "Error: out of memory\n");
+		exit(1);
+	}
+
+	// every prefix runs the whole batch, so stdin is read once here and
+	//  each process gets a copy of its own
+	char* batch = NULL;
+	size_t batchlen = 0;
+	if (batchfile && strcmp(batchfile, "-") == 0) {
+		size_t capacity = 0;
+		size_t len;
+		do {
+			if (batchlen == capacity) {
+				capacity = capacity ? capacity * 2 : 8192;
+				batch = (char*)realloc(batch, capacity);
+				if (!batch) {
+					fprintf(stderr, "Error: out of memory\n");
+					exit(1);
+				}
 			}
-			free(sle_path);
+			len = fread(batch + batchlen, 1, capacity - batchlen, stdin);
+			batchlen += len;
+		} while (len > 0);
+		if (ferror(stdin)) {
+			perror(batchfile);
+			exit(1);
 		}
-#endif
-		if (!disable_automation && depot->has_modified_xpc_services() && res == 0) {
-			res = update_xpc_services_cache(path);
-			if (res) fprintf(stderr, "Warning: could not update xpc services cache.\n");
-			res = 0;
+	}
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	uint32_t limit = cpus > 0 ? (uint32_t)cpus : 1;
+	uint32_t started = 0;
+	uint32_t running = 0;
+	uint32_t printed = 0;
+	while (printed < count) {
+		while (started < count && running < limit) {
+			outputs[started] = tmpfile();
+			if (!outputs[started]) {
+				perror("tmpfile");
+				exit(1);
+			}
+			FILE* input = NULL;
+			if (batch) {
+				input = tmpfile();
+				if (!input || fwrite(batch, 1, batchlen, input) != batchlen ||
+					fflush(input) != 0) {
+					perror("tmpfile");
+					exit(1);
+				}
+				rewind(input);
+			}
+			fflush(stdout);
+			fflush(stderr);
+			pid_t pid = fork();
+			if (pid == 0) {
+				int fd = fileno(outputs[started]);
+				dup2(fd, STDOUT_FILENO);
+				dup2(fd, STDERR_FILENO);
+				if (input) {
+					dup2(fileno(input), STDIN_FILENO);
+					rewind(stdin);
+				}
+				exit(run_prefix(prefixes[started], progname, batchfile,
+								automation, restart, argc, argv));
+			} else if (pid == -1) {
+				perror("fork");
+				exit(1);
+			}
+			if (input) fclose(input);
+			pids[started++] = pid;
+			running++;
+		}
+
+		int status;
+		pid_t pid = wait(&status);
+		if (pid == -1 && errno == EINTR) continue;
+		if (pid == -1) break;
+		for (uint32_t i = 0; i < started; i++) {
+			if (pids[i] != pid) continue;
+			statuses[i] = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+			done[i] = true;
+			running--;
 		}
+
+		while (printed < count && done[printed]) {
+			FILE* f = outputs[printed];
+			fprintf(stdout, "%s==> %s <==\n", printed ? "\n" : "", prefixes[printed]);
+			rewind(f);
+			char buf[8192];
+			size_t len;
+			while ((len = fread(buf, 1, sizeof(buf), f)) > 0) {
+				fwrite(buf, 1, len, stdout);
+			}
+			fclose(f);
+			fflush(stdout);
+			if (res == 0) res = statuses[printed];
+			printed++;
+		}
+	}
+
+	unstage_archives();
+	free(batch);
+	free(pids);
+	free(outputs);
+	free(statuses);
+	free(done);
+	return res;
+}
+
+
+int main(int argc, char* argv[]) {
+	char* progname = strdup(basename(argv[0]));      
+	char** prefixes = NULL;
+	uint32_t prefix_count = 0;
+	char* batchfile = NULL;
+	bool disable_automation = false;
+	Context context;
+	Context::set_current(&context);
+	bool restart = false;
+	
+	int ch;
 #if __MAC_OS_X_VERSION_MIN_REQUIRED >= 1060
-		if (restart && res == 0) {
-			res = tell_finder_to_restart();
-			if (res) fprintf(stderr, "Warning: tried to tell Finder to restart"
-							         "but failed.\n");
-			res = 0;
+	while ((ch = getopt(argc, argv, "b:dfnp:P:rvh")) != -1) {
+#else
+	while ((ch = getopt(argc, argv, "b:dfnp:P:vh")) != -1) {
+#endif
+		switch (ch) {
+		case 'b':
+				batchfile = optarg;
+				break;
+		case 'd':
+				disable_automation = true;
+				break;
+		case 'f':
+				context.force = 1;
+				break;
+		case 'n':
+				context.dryrun = 1;
+				disable_automation = true;
+				break;
+		case 'p':
+				add_prefix(&prefixes, &prefix_count, optarg);
+				break;
+		case 'P':
+				add_prefix_list(&prefixes, &prefix_count, optarg);
+				break;
+#if __MAC_OS_X_VERSION_MIN_REQUIRED >= 1060	
+		case 'r':
+				restart = true;
+				break;
+#endif
+		case 'v':
+				context.verbosity <<= 1;
+				context.verbosity |= VERBOSE;
+				break;
+		case '?':
+		case 'h':
+		default:
+				usage(progname);
 		}
+	}
+	argc -= optind;
+    argv += optind;
+	// batch mode takes its commands from the file instead
+	if (argc == 0 && !batchfile) usage(progname);
+	if (argc != 0 && batchfile) usage(progname);
+	
+	int res = 0;
+
+	if (context.dryrun) IF_DEBUG("option: dry run\n");
+	if (context.force)  IF_DEBUG("option: forcing operations\n");
+	if (disable_automation) IF_DEBUG("option: helpful automation disabled\n");
+#if __MAC_OS_X_VERSION_MIN_REQUIRED >= 1060
+    if (restart) IF_DEBUG("option: restart when finished\n");
 #endif
+	if (batchfile) IF_DEBUG("option: batch commands from %s\n", batchfile);
+	
+	if (prefix_count == 0) {
+		add_prefix(&prefixes, &prefix_count, "/");
+	} else {
+		for (uint32_t i = 0; i < prefix_count; i++) {
+			IF_DEBUG("option: path is %s\n", prefixes[i]);
+		}
+	}
+
+	// long operations say how far they are, as a status line on a terminal
+	//  and as JSON otherwise, unless the output of several prefixes is
+	//  being collected
+	Progress* progress = NULL;
+	if (prefix_count == 1) {
+		progress = new Progress(stderr, !isatty(STDOUT_FILENO) || !isatty(STDERR_FILENO));
+		context.progress = progress;
+	}
+
+	if (prefix_count == 1) {
+		res = run_prefix(prefixes[0], progname, batchfile, 
+						 !disable_automation, restart, argc, argv);
+	} else {
+		res = run_prefixes(prefixes, prefix_count, progname, batchfile,
+						   !disable_automation, restart, argc, argv);
 	}
 	
-	free(path);
+	context.progress = NULL;
+	delete progress;
+	for (uint32_t i = 0; i < prefix_count; i++) free(prefixes[i]);
+	free(prefixes);
 	exit(res);
 	return res;
 }
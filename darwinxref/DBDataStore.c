@@ -53,6 +53,25 @@ void* _DBPluginGetDataStorePtr() {
 //
 //////
 
+// Static probes for dtrace(1), or perf and bpftrace with the systemtap
+// <sys/sdt.h>, compiled in where that header is found, unless
+// HAVE_SYS_SDT_H is set to 0:
+//   darwinxref:::sql(query, result, rows changed)
+//   darwinxref:::step(query, result)
+#if !defined(HAVE_SYS_SDT_H) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define HAVE_SYS_SDT_H 1
+#endif
+#endif
+#if HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define PROBE2(name, a, b)    DTRACE_PROBE2(darwinxref, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(darwinxref, name, a, b, c)
+#else
+#define PROBE2(name, a, b)    do { } while (0)
+#define PROBE3(name, a, b, c) do { } while (0)
+#endif
+
 #define __SQL(callback, context, fmt) \
 	va_list args; \
 	char* errmsg; \
@@ -61,6 +80,7 @@ void* _DBPluginGetDataStorePtr() {
 	if (db) { \
 		char *query = sqlite3_vmprintf(fmt, args); \
 		res = sqlite3_exec(db, query, callback, context, &errmsg); \
+		PROBE3(sql, query, res, sqlite3_changes(db)); \
 		if (res != SQLITE_OK) { \
 			fprintf(stderr, "Error: %s (%d)\n  SQL: %s\n", errmsg, res, query); \
 		} \
@@ -130,6 +150,7 @@ CFDataRef SQL_CFDATA(const char* fmt, ...) {
 		char *query = sqlite3_vmprintf(fmt, args);
 		sqlite3_prepare(db, query, -1, &stmt, NULL);
 		res = sqlite3_step(stmt);
+		PROBE2(step, query, res);
 		if (res == SQLITE_ROW) {
 			const void* buf = sqlite3_column_blob(stmt, 0);
 			data = CFDataCreate(NULL, buf, sqlite3_column_bytes(stmt, 0));
@@ -212,6 +233,7 @@ void SQL_NOERR(char* sql) {
 	sqlite3* db = _DBPluginGetDataStorePtr();
 	if (db) {
 		int res = sqlite3_exec(db, sql, NULL, NULL, &errmsg);
+		PROBE3(sql, sql, res, sqlite3_changes(db));
 		if (res != SQLITE_OK && res != SQLITE_ERROR) {
 			fprintf(stderr, "Error: %s (%d)\n", errmsg, res);
 		}
@@ -623,6 +645,7 @@ int DBSetPropData(CFStringRef build, CFStringRef project, CFStringRef property,
 	sqlite3_bind_text(stmt, i++, cprop, -1, NULL);
 	sqlite3_bind_blob(stmt, i++, CFDataGetBytePtr(value), (int)CFDataGetLength(value), NULL);
 	res = sqlite3_step(stmt);
+	PROBE2(step, sql, res);
 	if (res != SQLITE_DONE) fprintf(stderr, "%s:%d result = %d\n", __FILE__, __LINE__, res);
 	sqlite3_finalize(stmt);
 
@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2013 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+/*
+ * libdarwinup-test.c
+ * Drives a depot through the libdarwinup C interface, for run-tests.sh.
+ *
+ * usage: libdarwinup-test PREFIX ROOT FILES
+ *
+ * Installs ROOT, which holds FILES files, into the depot under PREFIX,
+ * checks what list, files and verify report about it, and uninstalls it
+ * again. Nothing may be printed to stdout until the output is asked for.
+ */
+
+#include <inttypes.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "darwinup.h"
+
+struct found {
+	const char* name;
+	uint64_t    serial;
+	uint32_t    count;
+	uint32_t    wrong;
+};
+
+static int find_archive(const darwinup_archive_t* archive, void* context) {
+	struct found* found = (struct found*)context;
+	if (!archive->is_rollback && strcmp(archive->name, found->name) == 0) {
+		found->serial = archive->serial;
+		found->count++;
+	}
+	return 0;
+}
+
+static int count_file(const darwinup_file_t* file, void* context) {
+	struct found* found = (struct found*)context;
+	found->count++;
+	if (file->archive != found->serial || file->path[0] != '/') found->wrong++;
+	return 0;
+}
+
+static int count_verified_file(const darwinup_file_t* file, void* context) {
+	struct found* found = (struct found*)context;
+	if (file->status != ' ') {
+		fprintf(stderr, "verify: %c %s\n", file->status, file->path);
+		found->wrong++;
+	}
+	return count_file(file, context);
+}
+
+static int check(const char* what, int res, int expected) {
+	if (res != expected) {
+		fprintf(stderr, "%s: returned %d, expected %d\n", what, res, expected);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char* argv[]) {
+	if (argc != 4) {
+		fprintf(stderr, "usage: %s PREFIX ROOT FILES\n", argv[0]);
+		return 2;
+	}
+	char* root = strdup(argv[2]);
+	uint32_t files = (uint32_t)strtoul(argv[3], NULL, 10);
+	struct found found;
+	memset(&found, 0, sizeof(found));
+	found.name = basename(root);
+
+	// anything the library prints to stdout lands here
+	fflush(stdout);
+	int saved = dup(STDOUT_FILENO);
+	FILE* captured = tmpfile();
+	FILE* output = tmpfile();
+	if (saved == -1 || !captured || !output) {
+		perror("tmpfile");
+		return 1;
+	}
+	dup2(fileno(captured), STDOUT_FILENO);
+
+	int res = 0;
+	int error = DARWINUP_ERROR;
+	darwinup_depot_t depot = darwinup_open(argv[1], 1, &error);
+	if (!depot) {
+		fprintf(stderr, "darwinup_open: %s: error %d\n", argv[1], error);
+		return 1;
+	}
+
+	res |= check("darwinup_install", darwinup_install(depot, argv[2]), DARWINUP_OK);
+	res |= check("darwinup_list", darwinup_list(depot, "newest", &find_archive, &found),
+				 DARWINUP_OK);
+	if (found.count != 1) {
+		fprintf(stderr, "darwinup_list: %s listed %u times\n", found.name, found.count);
+		res = 1;
+	}
+
+	found.count = 0;
+	res |= check("darwinup_files", darwinup_files(depot, "newest", &count_file, &found),
+				 DARWINUP_OK);
+	if (found.count != files || found.wrong) {
+		fprintf(stderr, "darwinup_files: %u files, %u wrong, expected %u\n", 
+				found.count, found.wrong, files);
+		res = 1;
+	}
+
+	found.count = 0;
+	res |= check("darwinup_verify", 
+				 darwinup_verify(depot, "newest", &count_verified_file, &found),
+				 DARWINUP_OK);
+	if (found.count != files || found.wrong) {
+		fprintf(stderr, "darwinup_verify: %u files, %u wrong, expected %u\n", 
+				found.count, found.wrong, files);
+		res = 1;
+	}
+
+	// what the darwinup command prints is only there when asked for
+	darwinup_set_output(depot, output);
+	res |= check("darwinup_uninstall", darwinup_uninstall(depot, "newest"), DARWINUP_OK);
+	darwinup_set_output(depot, NULL);
+
+	found.count = 0;
+	res |= check("darwinup_list", darwinup_list(depot, NULL, &find_archive, &found),
+				 DARWINUP_OK);
+	if (found.count != 0) {
+		fprintf(stderr, "darwinup_list: %s still installed\n", found.name);
+		res = 1;
+	}
+	res |= check("darwinup_list", darwinup_list(depot, "no-such-archive", 
+												 &find_archive, &found),
+				 DARWINUP_NOT_EXIST);
+	darwinup_close(depot);
+
+	fflush(stdout);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+	struct stat sb;
+	if (fstat(fileno(captured), &sb) == 0 && sb.st_size != 0) {
+		fprintf(stderr, "libdarwinup printed %lld bytes to stdout\n", (long long)sb.st_size);
+		res = 1;
+	}
+	char line[1024];
+	int uninstalled = 0;
+	rewind(output);
+	while (fgets(line, sizeof(line), output)) {
+		if (strncmp(line, "Uninstalled archive: ", 21) == 0) uninstalled++;
+	}
+	if (uninstalled != 1) {
+		fprintf(stderr, "darwinup_set_output: uninstall was not reported\n");
+		res = 1;
+	}
+
+	if (res == 0) printf("%s: %u files installed and uninstalled\n", found.name, files);
+	fclose(captured);
+	fclose(output);
+	free(root);
+	return res;
+}
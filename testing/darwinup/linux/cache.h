@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2013 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#ifndef _LINUX_CACHE_H
+#define _LINUX_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct cache_s cache_t;
+
+typedef struct {
+	uint32_t version;
+	uintptr_t (*key_hash_cb)(void* key, void* user_data);
+	bool (*key_is_equal_cb)(void* a, void* b, void* user_data);
+	void (*key_retain_cb)(void* key_in, void** key_out, void* user_data);
+	void (*key_release_cb)(void* key, void* user_data);
+	void (*value_release_cb)(void* value, void* user_data);
+	bool (*value_make_nonpurgeable_cb)(void* value, void* user_data);
+	void (*value_make_purgeable_cb)(void* value, void* user_data);
+	void* user_data;
+	void (*value_retain_cb)(void* value, void* user_data);
+} cache_attributes_t;
+
+#define CACHE_ATTRIBUTES_VERSION_2 2
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+int cache_create(const char* name, cache_attributes_t* attrs, cache_t** cache);
+int cache_destroy(cache_t* cache);
+int cache_get_and_retain(cache_t* cache, void* key, void** value);
+int cache_set_and_retain(cache_t* cache, void* key, void* value, size_t cost);
+int cache_release_value(cache_t* cache, void* value);
+int cache_remove(cache_t* cache, void* key);
+int cache_remove_all(cache_t* cache);
+#ifdef __cplusplus
+}
+#endif
+
+#endif
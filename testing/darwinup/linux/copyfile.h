@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2013 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#ifndef _LINUX_COPYFILE_H
+#define _LINUX_COPYFILE_H
+
+#include <stdint.h>
+
+typedef void* copyfile_state_t;
+typedef uint32_t copyfile_flags_t;
+
+#define COPYFILE_ACL      (1<<0)
+#define COPYFILE_STAT     (1<<1)
+#define COPYFILE_XATTR    (1<<2)
+#define COPYFILE_DATA     (1<<3)
+#define COPYFILE_SECURITY (COPYFILE_STAT | COPYFILE_ACL)
+#define COPYFILE_METADATA (COPYFILE_SECURITY | COPYFILE_XATTR)
+#define COPYFILE_ALL      (COPYFILE_METADATA | COPYFILE_DATA)
+#define COPYFILE_CHECK    (1<<16)
+#define COPYFILE_NOFOLLOW (1<<18)
+
+#ifdef __cplusplus
+extern "C"
+#endif
+int copyfile(const char* from, const char* to, copyfile_state_t state, copyfile_flags_t flags);
+
+#endif
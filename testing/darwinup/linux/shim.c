@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2013 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#define _GNU_SOURCE
+#include <libgen.h>
+
+// the POSIX versions, before shim.h replaces them
+static char* posix_dirname(char* path) { return dirname(path); }
+static char* posix_basename(char* path) { return basename(path); }
+
+#include "shim.h"
+#include "copyfile.h"
+#include "removefile.h"
+#include "cache.h"
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/xattr.h>
+
+size_t strlcpy(char* dst, const char* src, size_t size) {
+	size_t len = strlen(src);
+	if (size) {
+		size_t n = (len >= size) ? size - 1 : len;
+		memcpy(dst, src, n);
+		dst[n] = 0;
+	}
+	return len;
+}
+
+size_t strlcat(char* dst, const char* src, size_t size) {
+	size_t len = strnlen(dst, size);
+	if (len == size) return size + strlen(src);
+	return len + strlcpy(dst + len, src, size - len);
+}
+
+void strmode(mode_t mode, char* buf) {
+	const char* rwx = "rwxrwxrwx";
+	char type = '?';
+	switch (mode & S_IFMT) {
+		case S_IFDIR:  type = 'd'; break;
+		case S_IFREG:  type = '-'; break;
+		case S_IFLNK:  type = 'l'; break;
+		case S_IFCHR:  type = 'c'; break;
+		case S_IFBLK:  type = 'b'; break;
+		case S_IFIFO:  type = 'p'; break;
+		case S_IFSOCK: type = 's'; break;
+	}
+	buf[0] = type;
+	for (int i = 0; i < 9; i++) {
+		buf[1 + i] = (mode & (1 << (8 - i))) ? rwx[i] : '-';
+	}
+	if (mode & S_ISUID) buf[3] = (mode & S_IXUSR) ? 's' : 'S';
+	if (mode & S_ISGID) buf[6] = (mode & S_IXGRP) ? 's' : 'S';
+	if (mode & S_ISVTX) buf[9] = (mode & S_IXOTH) ? 't' : 'T';
+	buf[10] = ' ';
+	buf[11] = 0;
+}
+
+int getpeereid(int fd, uid_t* uid, gid_t* gid) {
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len)) return -1;
+	*uid = cred.uid;
+	*gid = cred.gid;
+	return 0;
+}
+
+static __thread char dirname_buf[PATH_MAX];
+static __thread char basename_buf[PATH_MAX];
+
+char* bsd_dirname(const char* path) {
+	strlcpy(dirname_buf, path, sizeof(dirname_buf));
+	return posix_dirname(dirname_buf);
+}
+
+char* bsd_basename(const char* path) {
+	strlcpy(basename_buf, path, sizeof(basename_buf));
+	return posix_basename(basename_buf);
+}
+
+// copies data, ownership, mode and times; there are no ACLs, and
+//  extended attributes are not copied, only reported by COPYFILE_CHECK
+int copyfile(const char* from, const char* to, copyfile_state_t state, copyfile_flags_t flags) {
+	struct stat sb;
+	int res = (flags & COPYFILE_NOFOLLOW) ? lstat(from, &sb) : stat(from, &sb);
+	if (res) return -1;
+
+	if (flags & COPYFILE_CHECK) {
+		ssize_t size = (flags & COPYFILE_NOFOLLOW) ? llistxattr(from, NULL, 0) 
+		                                           : listxattr(from, NULL, 0);
+		return (size > 0) ? (int)(flags & COPYFILE_XATTR) : 0;
+	}
+
+	if (S_ISLNK(sb.st_mode)) {
+		char target[PATH_MAX];
+		ssize_t len = readlink(from, target, sizeof(target) - 1);
+		if (len < 0) return -1;
+		target[len] = 0;
+		unlink(to);
+		if (symlink(target, to)) return -1;
+		return lchown(to, sb.st_uid, sb.st_gid) ? -1 : 0;
+	}
+	if (S_ISDIR(sb.st_mode)) {
+		if (mkdir(to, sb.st_mode & 07777) && errno != EEXIST) return -1;
+		if (chown(to, sb.st_uid, sb.st_gid)) return -1;
+		return chmod(to, sb.st_mode & 07777);
+	}
+
+	int in = open(from, O_RDONLY);
+	if (in == -1) return -1;
+	int out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (out == -1) {
+		close(in);
+		return -1;
+	}
+	char buf[65536];
+	ssize_t len;
+	res = 0;
+	if (flags & COPYFILE_DATA) {
+		while ((len = read(in, buf, sizeof(buf))) > 0) {
+			if (write(out, buf, len) != len) break;
+		}
+		if (len != 0) res = -1;
+	}
+	if (res == 0 && (flags & COPYFILE_STAT)) {
+		struct timespec times[2] = { sb.st_atim, sb.st_mtim };
+		if (fchown(out, sb.st_uid, sb.st_gid) ||
+			fchmod(out, sb.st_mode & 07777) ||
+			futimens(out, times)) {
+			res = -1;
+		}
+	}
+	close(in);
+	close(out);
+	return res;
+}
+
+removefile_state_t removefile_state_alloc(void) {
+	return malloc(1);
+}
+
+int removefile_state_free(removefile_state_t state) {
+	free(state);
+	return 0;
+}
+
+static int removefile_entry(const char* path, const struct stat* sb, int flag, struct FTW* ftw) {
+	return remove(path);
+}
+
+int removefile(const char* path, removefile_state_t state, removefile_flags_t flags) {
+	if (!(flags & REMOVEFILE_RECURSIVE)) return remove(path);
+	return nftw(path, removefile_entry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+// libcache: a fixed size hash table that never evicts, which is all
+//  the statement cache needs
+#define CACHE_BUCKETS 256
+
+struct cache_entry {
+	void* key;
+	void* value;
+	struct cache_entry* next;
+};
+
+struct cache_s {
+	cache_attributes_t attrs;
+	struct cache_entry* buckets[CACHE_BUCKETS];
+};
+
+uintptr_t cache_key_hash_cb_cstring(void* key, void* user_data) {
+	uintptr_t hash = 5381;
+	for (const char* s = key; *s; s++) hash = hash * 33 + *s;
+	return hash;
+}
+
+bool cache_key_is_equal_cb_cstring(void* a, void* b, void* user_data) {
+	return strcmp(a, b) == 0;
+}
+
+void cache_release_cb_free(void* ptr, void* user_data) {
+	free(ptr);
+}
+
+int cache_create(const char* name, cache_attributes_t* attrs, cache_t** cache) {
+	*cache = calloc(1, sizeof(cache_t));
+	if (!*cache) return ENOMEM;
+	(*cache)->attrs = *attrs;
+	return 0;
+}
+
+int cache_destroy(cache_t* cache) {
+	for (int i = 0; i < CACHE_BUCKETS; i++) {
+		struct cache_entry* entry = cache->buckets[i];
+		while (entry) {
+			struct cache_entry* next = entry->next;
+			if (cache->attrs.value_release_cb) cache->attrs.value_release_cb(entry->value, NULL);
+			if (cache->attrs.key_release_cb) cache->attrs.key_release_cb(entry->key, NULL);
+			free(entry);
+			entry = next;
+		}
+	}
+	free(cache);
+	return 0;
+}
+
+int cache_get_and_retain(cache_t* cache, void* key, void** value) {
+	uintptr_t hash = cache->attrs.key_hash_cb(key, NULL);
+	struct cache_entry* entry = cache->buckets[hash % CACHE_BUCKETS];
+	for (; entry; entry = entry->next) {
+		if (cache->attrs.key_is_equal_cb(entry->key, key, NULL)) {
+			*value = entry->value;
+			return 0;
+		}
+	}
+	*value = NULL;
+	return ENOENT;
+}
+
+int cache_set_and_retain(cache_t* cache, void* key, void* value, size_t cost) {
+	struct cache_entry* entry = calloc(1, sizeof(struct cache_entry));
+	if (!entry) return ENOMEM;
+	cache->attrs.key_retain_cb(key, &entry->key, NULL);
+	entry->value = value;
+	uintptr_t hash = cache->attrs.key_hash_cb(key, NULL);
+	entry->next = cache->buckets[hash % CACHE_BUCKETS];
+	cache->buckets[hash % CACHE_BUCKETS] = entry;
+	return 0;
+}
+
+int cache_release_value(cache_t* cache, void* value) {
+	return 0;
+}
+
+int cache_remove(cache_t* cache, void* key) {
+	return 0;
+}
+
+int cache_remove_all(cache_t* cache) {
+	return 0;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2013 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+//
+// Lets darwinup build on Linux for benchmarking, by standing in for the
+//  few Darwin interfaces it uses. Included ahead of every source file
+//  with -include; see run-benchmarks.sh. Not for installing real roots.
+//
+
+#ifndef _LINUX_SHIM_H
+#define _LINUX_SHIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <libgen.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+size_t strlcpy(char* dst, const char* src, size_t size);
+size_t strlcat(char* dst, const char* src, size_t size);
+void strmode(mode_t mode, char* buf);
+int getpeereid(int fd, uid_t* uid, gid_t* gid);
+// BSD dirname(3) and basename(3) leave their argument alone
+char* bsd_dirname(const char* path);
+char* bsd_basename(const char* path);
+#ifdef __cplusplus
+}
+#endif
+
+// glibc's <string.h> may already define basename as a macro
+#undef dirname
+#undef basename
+#define dirname(x) bsd_dirname(x)
+#define basename(x) bsd_basename(x)
+
+#ifndef S_IFWHT
+#define S_IFWHT 0160000
+#endif
+#define ENOATTR ENODATA
+#define XATTR_NOFOLLOW 1
+
+#endif
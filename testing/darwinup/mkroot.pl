@@ -0,0 +1,90 @@
+#!/usr/bin/perl
+
+# mkroot.pl
+# Generates synthetic roots for run-benchmarks.sh.
+#
+# Files are numbered, and the path and contents of each file depend only
+# on its number, the version and the seed, so roots made from overlapping
+# ranges of numbers install the same paths, and roots made with different
+# versions differ in every file.
+
+use strict;
+use Getopt::Std;
+use File::Path;
+
+sub usage {
+	print STDERR <<EOF;
+usage: mkroot.pl [options] DIR
+    -n COUNT     number of files (default 1000)
+    -f FIRST     number of the first file (default 0)
+    -d DEPTH     directory levels above each file (default 3)
+    -w WIDTH     files per directory and directories per level (default 32)
+    -s MIN:MAX   file sizes in bytes, spread evenly by magnitude (default 0:65536)
+    -l PERCENT   files which are hard links to the file before them (default 0)
+    -y PERCENT   files which are symlinks to the file before them (default 0)
+    -v VERSION   contents version (default 1)
+    -r SEED      random seed (default 1)
+EOF
+	exit 1;
+}
+
+my %opts;
+getopts('n:f:d:w:s:l:y:v:r:', \%opts) || usage();
+usage() unless @ARGV == 1;
+my $root = $ARGV[0];
+
+my $count = $opts{'n'} // 1000;
+my $first = $opts{'f'} // 0;
+my $depth = $opts{'d'} // 3;
+my $width = $opts{'w'} // 32;
+my ($min, $max) = split(/:/, $opts{'s'} // '0:65536');
+my $links = $opts{'l'} // 0;
+my $symlinks = $opts{'y'} // 0;
+my $version = $opts{'v'} // 1;
+my $seed = $opts{'r'} // 1;
+usage() unless $width > 0 && $depth >= 0 && defined($max) && $max >= $min;
+
+# the directory of file number n, relative to the root
+sub directory {
+	my $n = int(shift() / $width);
+	my @parts;
+	for (my $i = 0; $i < $depth; $i++) {
+		unshift @parts, sprintf("d%02d", $n % $width);
+		$n = int($n / $width);
+	}
+	return join('/', @parts);
+}
+
+my %made;
+for (my $n = $first; $n < $first + $count; $n++) {
+	# the same choices for file n in every root
+	srand($seed * 1000003 + $n);
+	my $kind = rand(100);
+	my $size = int(exp(log($min + 1) + rand() * (log($max + 1) - log($min + 1)))) - 1;
+
+	my $dir = directory($n);
+	my $path = "$root/$dir";
+	unless ($made{$dir}) {
+		mkpath($path);
+		$made{$dir} = 1;
+	}
+	$path .= sprintf("/f%07d", $n);
+
+	# links point at the previous file, when it is in the same directory
+	my $previous = sprintf("f%07d", $n - 1);
+	my $linkable = $n > $first && directory($n - 1) eq $dir;
+	if ($linkable && $kind < $symlinks) {
+		symlink($previous, $path) || die "$path: $!\n";
+		next;
+	}
+	if ($linkable && $kind >= 100 - $links && -f "$root/$dir/$previous") {
+		link("$root/$dir/$previous", $path) || die "$path: $!\n";
+		next;
+	}
+
+	my $line = "$version:$seed:$n\n";
+	my $data = $line x (int($size / length($line)) + 1);
+	open(FILE, '>', $path) || die "$path: $!\n";
+	print FILE substr($data, 0, $size);
+	close(FILE);
+}
@@ -0,0 +1,134 @@
+#!/bin/bash
+set -e
+pushd $(dirname $0) >> /dev/null
+
+#
+# Benchmark darwinup on synthetic roots
+#
+# Each scenario installs, verifies, upgrades and uninstalls generated roots
+# of the given number of files under a temporary prefix, and prints one
+# tab separated line per operation: files, operation, seconds. With -b the
+# results are compared against a baseline written earlier with -o, and the
+# run fails if any operation got slower by more than the threshold.
+#
+# On Linux, darwinup is built first from ../../darwinup with the stand-ins
+# for Darwin interfaces in linux/, unless DARWINUP names a binary.
+#
+
+SIZES="1000 10000 100000"
+OUTPUT=
+BASELINE=
+THRESHOLD=25
+# differences under this many seconds are noise
+NOISE=0.05
+
+function usage {
+	echo "usage: $0 [-s \"COUNT ...\"] [-o RESULTS] [-b BASELINE] [-t PERCENT]" 1>&2
+	exit 1
+}
+
+while getopts "s:o:b:t:" OPT; do
+	case $OPT in
+		s) SIZES="$OPTARG" ;;
+		o) OUTPUT="$OPTARG" ;;
+		b) BASELINE="$OPTARG" ;;
+		t) THRESHOLD="$OPTARG" ;;
+		*) usage ;;
+	esac
+done
+
+if [ $(id -u) -ne 0 ]; then
+	echo "ERROR: benchmarks install roots, and must be run as root." 1>&2
+	exit 1
+fi
+
+WORK=$(mktemp -d /tmp/darwinup-bench.XXXXXX)
+trap "rm -rf $WORK" EXIT
+
+if [ -z "$DARWINUP" -a "$(uname)" == "Linux" ]; then
+	echo "INFO: Building darwinup ..." 1>&2
+	# uint64_t is long on LP64 Linux, so the tree's %llu formats only warn
+	# here, and the CommonCrypto shim sits on OpenSSL's deprecated SHA1 calls
+	cc -c -O2 -Wall -o $WORK/shim.o linux/shim.c
+	c++ -std=gnu++98 -O2 -Wall -Wno-format -Wno-deprecated-declarations -Ilinux -include linux/shim.h -D_GNU_SOURCE -pthread \
+		-o $WORK/darwinup ../../darwinup/*.cpp $WORK/shim.o \
+		-lsqlite3 -luuid -lcrypto -pthread
+	DARWINUP=$WORK/darwinup
+	# stop getopt at the subcommand, as it does on Darwin
+	export POSIXLY_CORRECT=1
+fi
+DARWINUP=${DARWINUP:-darwinup}
+
+function now {
+	perl -MTime::HiRes=time -e 'printf("%.3f\n", time)'
+}
+
+RESULTS=$WORK/results.tsv
+printf "files\toperation\tseconds\n" > $RESULTS
+
+# time one darwinup command against the prefix of the current scenario
+function measure {
+	local NAME="$1"
+	shift
+	local START=$(now)
+	if ! $DARWINUP -d -p $DEST "$@" > $WORK/darwinup.log 2>&1; then
+		tail $WORK/darwinup.log 1>&2
+		echo "ERROR: $NAME of $N files failed." 1>&2
+		exit 1
+	fi
+	local END=$(now)
+	awk -v n=$N -v name="$NAME" -v start=$START -v end=$END \
+		'BEGIN { printf("%s\t%s\t%.3f\n", n, name, end - start) }' | tee -a $RESULTS
+}
+
+for N in $SIZES;
+do
+	echo "INFO: Generating roots of $N files ..." 1>&2
+	ROOTS=$WORK/roots-$N
+	mkdir -p $ROOTS/v1 $ROOTS/v2 $ROOTS/v3
+	# bench-a, an upgrade of it, and bench-b sharing half its paths
+	./mkroot.pl -n $N -v 1 -l 5 -y 5 $ROOTS/a1
+	./mkroot.pl -n $N -v 2 -l 5 -y 5 $ROOTS/a2
+	./mkroot.pl -n $N -f $((N / 2)) -v 3 -l 5 -y 5 $ROOTS/b
+	tar -cf $ROOTS/v1/bench-a.tar -C $ROOTS/a1 .
+	tar -cf $ROOTS/v2/bench-a.tar -C $ROOTS/a2 .
+	tar -cf $ROOTS/v3/bench-b.tar -C $ROOTS/b .
+	rm -rf $ROOTS/a1 $ROOTS/a2 $ROOTS/b
+
+	DEST=$WORK/dest-$N
+	mkdir -p $DEST/System
+
+	measure install install $ROOTS/v1/bench-a.tar
+	measure install-overlap install $ROOTS/v3/bench-b.tar
+	measure list list
+	measure files files bench-a.tar
+	measure verify verify bench-a.tar
+	measure verify-quick verify -q bench-a.tar
+	measure fsck fsck -a
+	measure upgrade upgrade $ROOTS/v2/bench-a.tar
+	measure uninstall uninstall bench-b.tar
+	measure uninstall-all uninstall all
+	rm -rf $DEST $ROOTS
+done
+
+if [ -n "$OUTPUT" ]; then
+	cp $RESULTS $OUTPUT
+fi
+
+if [ -n "$BASELINE" ]; then
+	echo "INFO: Comparing against $BASELINE ..." 1>&2
+	awk -F'\t' -v threshold=$THRESHOLD -v noise=$NOISE '
+		FNR == 1 { next }
+		NR == FNR { base[$1 "\t" $2] = $3; next }
+		($1 "\t" $2) in base {
+			old = base[$1 "\t" $2]
+			slower = ($3 - old > noise && $3 > old * (1 + threshold / 100))
+			printf("%s\t%s\t%s\t%s\t%s\n", $1, $2, old, $3, slower ? "SLOWER" : "ok")
+			if (slower) failed = 1
+		}
+		END { exit failed }
+	' $BASELINE $RESULTS
+fi
+
+popd >> /dev/null
+echo "INFO: Done benchmarking!" 1>&2
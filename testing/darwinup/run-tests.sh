@@ -109,6 +109,31 @@ echo "DIFF: diffing original test files to dest (should be no diffs) ..."
 $DIFF $ORIG $DEST 2>&1
 
 
+echo "========== TEST: Upgrading a depot with whole paths =========="
+# olddepot is dest with root and then root2 installed by a darwinup whose
+#  files table stored each whole path (schema version 1)
+tar zxvf olddepot.tar.gz -C $PREFIX
+OLDDB=$PREFIX/olddepot/.DarwinDepot/Database-V100
+OLDDARWINUP="darwinup $1 -p $PREFIX/olddepot "
+$OLDDARWINUP list
+test "$(sqlite3 $OLDDB "SELECT value FROM database_information WHERE variable = 'schema_version'")" == "5"
+C=$(sqlite3 $OLDDB "SELECT count(*) FROM files")
+test "$C" == "27"
+C=$(sqlite3 $OLDDB "SELECT count(*) FROM directories")
+test "$C" == "7"
+C=$($OLDDARWINUP files root2 | grep -E ' /' | wc -l | xargs)
+test "$C" == "11"
+C=$($OLDDARWINUP verify root2 | grep -E '^[MR] ' | wc -l | xargs)
+test "$C" == "0"
+$OLDDARWINUP fsck
+# both were installed on another OS build
+$OLDDARWINUP -f uninstall root2
+$OLDDARWINUP -f uninstall root
+C=$($OLDDARWINUP list | grep -E 'root2?$' | wc -l | xargs)
+test "$C" == "0"
+echo "DIFF: diffing original test files to olddepot (should be no diffs) ..."
+$DIFF $ORIG $PREFIX/olddepot 2>&1
+
 echo "========== TEST: Try installing a symlink-to-directory =========="
 ln -s root2 $PREFIX/root_link
 # test without trailing slash
@@ -348,6 +373,448 @@ $DARWINUP uninstall all
 echo "DIFF: diffing original test files to dest (should be no diffs) ..."
 $DIFF $ORIG $DEST 2>&1
 
+echo "========== TEST: Quick verify =========="
+$DARWINUP install $PREFIX/root
+$DARWINUP verify newest > $PREFIX/verify-deep.txt
+$DARWINUP verify -q newest > $PREFIX/verify-quick.txt
+diff $PREFIX/verify-deep.txt $PREFIX/verify-quick.txt
+cp -p $DEST/c.txt $PREFIX/c.txt.save
+echo "changed" >> $DEST/c.txt
+C=$($DARWINUP verify -q newest | grep -E '^M .*/c.txt$' | wc -l | xargs)
+test "$C" == "1"
+cp -p $PREFIX/c.txt.save $DEST/c.txt
+$DARWINUP uninstall newest
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+
+echo "========== TEST: fsck =========="
+$DARWINUP install $PREFIX/root
+$DARWINUP install $PREFIX/root2
+$DARWINUP fsck
+$DARWINUP fsck
+touch $DEST/.DarwinDepot/Archives/orphan
+cp -p $DEST/c.txt $PREFIX/c.txt.save
+echo "changed" >> $DEST/c.txt
+set +e
+$DARWINUP fsck > $PREFIX/fsck.txt
+res=$?
+set -e
+test "$res" != "0"
+C=$(grep -E '^Orphaned backing store: .*/orphan$' $PREFIX/fsck.txt | wc -l | xargs)
+test "$C" == "1"
+C=$(grep -E '^M .*/c.txt$' $PREFIX/fsck.txt | wc -l | xargs)
+test "$C" == "1"
+rm $DEST/.DarwinDepot/Archives/orphan
+cp -p $PREFIX/c.txt.save $DEST/c.txt
+$DARWINUP fsck -a
+$DARWINUP uninstall all
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+
+echo "========== TEST: du and gc =========="
+$DARWINUP install $PREFIX/root
+C=$($DARWINUP du | grep -E ' root$' | wc -l | xargs)
+test "$C" == "1"
+touch $DEST/.DarwinDepot/Archives/orphan
+$DARWINUP gc
+test ! -e $DEST/.DarwinDepot/Archives/orphan
+$DARWINUP install $PREFIX/root
+$DARWINUP gc -s 0
+C=$($DARWINUP list | grep -E ' root$' | wc -l | xargs)
+test "$C" == "1"
+# an archive superseded only by an edit on disk keeps its files there
+$DARWINUP install $PREFIX/root3
+echo "changed" >> $DEST/c.txt
+$DARWINUP verify root3
+C=$($DARWINUP list superseded | grep -E ' root3$' | wc -l | xargs)
+test "$C" == "1"
+$DARWINUP gc -s 0
+C=$($DARWINUP list | grep -E ' root3$' | wc -l | xargs)
+test "$C" == "1"
+cp -p $PREFIX/root3/c.txt $DEST/c.txt
+$DARWINUP uninstall all
+$DARWINUP gc
+$DARWINUP fsck -a
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+
+echo "========== TEST: Superseded follows uninstalls =========="
+$DARWINUP install $PREFIX/root
+$DARWINUP install $PREFIX/root
+C=$($DARWINUP list superseded | grep -E ' root$' | wc -l | xargs)
+test "$C" == "1"
+$DARWINUP uninstall newest
+C=$($DARWINUP list superseded | grep -E ' root$' | wc -l | xargs)
+test "$C" == "0"
+# a verify result is checked against the disk again before it is used
+$DARWINUP install $PREFIX/root3
+cp -p $DEST/c.txt $PREFIX/c.txt.save
+echo "changed" >> $DEST/c.txt
+$DARWINUP verify root3
+cp -p $PREFIX/c.txt.save $DEST/c.txt
+C=$($DARWINUP list superseded | grep -E ' root3$' | wc -l | xargs)
+test "$C" == "0"
+$DARWINUP uninstall superseded
+C=$($DARWINUP list | grep -E ' root3$' | wc -l | xargs)
+test "$C" == "1"
+$DARWINUP uninstall all
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+
+echo "========== TEST: Hard links =========="
+mkdir -p $PREFIX/hardlinks/links $DEST/links
+echo "new" > $PREFIX/hardlinks/links/tool
+ln $PREFIX/hardlinks/links/tool $PREFIX/hardlinks/links/tool-alias
+echo "old" > $DEST/links/tool
+ln $DEST/links/tool $DEST/links/tool-alias
+$DARWINUP install $PREFIX/hardlinks
+test $DEST/links/tool -ef $DEST/links/tool-alias
+grep -q new $DEST/links/tool-alias
+$DARWINUP uninstall hardlinks
+test $DEST/links/tool -ef $DEST/links/tool-alias
+grep -q old $DEST/links/tool-alias
+rm -rf $DEST/links
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+
+echo "========== TEST: Install journal =========="
+mkdir -p $PREFIX/journal/journal
+echo "new" > $PREFIX/journal/journal/a.txt
+echo "new" > $PREFIX/journal/journal/b.txt
+$DARWINUP install $PREFIX/journal
+# pretend the install crashed after moving its first two files
+S=$(sqlite3 $DEST/.DarwinDepot/Database-V100 "SELECT serial FROM archives WHERE name = 'journal'")
+sqlite3 $DEST/.DarwinDepot/Database-V100 "UPDATE archives SET active = 0 WHERE serial >= $((S - 1))"
+rm $DEST/journal/b.txt
+printf "install $S $((S - 1))\nbackup\nmoved 2\n" > $DEST/.DarwinDepot/Journal
+$DARWINUP verify journal
+test ! -e $DEST/.DarwinDepot/Journal
+grep -q new $DEST/journal/b.txt
+$DARWINUP uninstall journal
+# and one which crashed before moving anything is forgotten
+$DARWINUP install $PREFIX/journal
+S=$(sqlite3 $DEST/.DarwinDepot/Database-V100 "SELECT serial FROM archives WHERE name = 'journal'")
+sqlite3 $DEST/.DarwinDepot/Database-V100 "UPDATE archives SET active = 0 WHERE serial >= $((S - 1))"
+rm -rf $DEST/journal
+printf "install $S $((S - 1))\n" > $DEST/.DarwinDepot/Journal
+$DARWINUP fsck -a
+C=$($DARWINUP list | grep -E ' journal$' | wc -l | xargs)
+test "$C" == "0"
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+
+echo "========== TEST: Background jobs =========="
+$DARWINUP status -w
+mkdir -p $DEST/.DarwinDepot/Hooks
+cat > $DEST/.DarwinDepot/Hooks/dyld <<EOF
+#!/bin/sh
+echo "\$1" >> $PREFIX/dyld-hook.txt
+EOF
+chmod +x $DEST/.DarwinDepot/Hooks/dyld
+$DARWINUP install $PREFIX/root
+$DARWINUP install $PREFIX/root2
+$DARWINUP status -w
+C=$(cat $PREFIX/dyld-hook.txt | wc -l | xargs)
+test "$C" == "1"
+$DARWINUP status | grep -qE '^dyld +done'
+$DARWINUP uninstall all
+$DARWINUP status -w
+C=$(cat $PREFIX/dyld-hook.txt | wc -l | xargs)
+test "$C" == "2"
+# a state file left behind naming a live but unrelated process has no runner
+printf "requests 5\nran 4\nrunning 1\npid $$\n" > $DEST/.DarwinDepot/Jobs/dyld
+$DARWINUP status | grep -qE '^dyld +interrupted'
+$DARWINUP install $PREFIX/root
+$DARWINUP uninstall all
+$DARWINUP status -w
+C=$(cat $PREFIX/dyld-hook.txt | wc -l | xargs)
+test "$C" == "3"
+$DARWINUP status | grep -qE '^dyld +done'
+# a process a hook leaves running does not stop later requests
+#  from starting a runner
+cat > $DEST/.DarwinDepot/Hooks/dyld <<EOF
+#!/bin/sh
+echo "\$1" >> $PREFIX/dyld-hook.txt
+sleep 60 > /dev/null 2>&1 &
+echo \$! >> $PREFIX/dyld-hook.pid
+EOF
+$DARWINUP install $PREFIX/root
+$DARWINUP status -w
+$DARWINUP uninstall all
+$DARWINUP status -w
+C=$(cat $PREFIX/dyld-hook.txt | wc -l | xargs)
+test "$C" == "5"
+kill $(cat $PREFIX/dyld-hook.pid)
+rm -rf $DEST/.DarwinDepot/Hooks
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+
+echo "========== TEST: Multiple prefixes =========="
+DEST2=$PREFIX/dest2
+cp -Rp $DEST $DEST2
+rm -rf $DEST2/.DarwinDepot
+$DARWINUP -p $DEST2 install $PREFIX/300files.tbz2 > $PREFIX/prefixes.txt
+cat $PREFIX/prefixes.txt
+grep -q "^==> $DEST/ <==" $PREFIX/prefixes.txt
+grep -q "^==> $DEST2/ <==" $PREFIX/prefixes.txt
+$DIFF $DEST $DEST2 2>&1
+test ! -d $DEST/.DarwinDepot/Downloads/stage.*
+# a batch on stdin is run by every prefix
+printf "install $PREFIX/root\n" | darwinup $1 -p $DEST -p $DEST2 -b -
+C=$($DARWINUP list | grep -E ' root$' | wc -l | xargs)
+test "$C" == "1"
+C=$(darwinup $1 -p $DEST2 list | grep -E ' root$' | wc -l | xargs)
+test "$C" == "1"
+printf "uninstall root\n" | darwinup $1 -p $DEST -p $DEST2 -b -
+printf "# both test depots\n$DEST\n\n$DEST2\n" > $PREFIX/prefixes.lst
+darwinup $1 -P $PREFIX/prefixes.lst uninstall 300files.tbz2
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+$DIFF $ORIG $DEST2 2>&1
+rm -rf $DEST2
+
+echo "========== TEST: Clone a depot =========="
+DEST2=$PREFIX/dest2
+cp -Rp $DEST $DEST2
+rm -rf $DEST2/.DarwinDepot
+$DARWINUP install $PREFIX/root
+$DARWINUP install $PREFIX/root2
+$DARWINUP install $PREFIX/300files.tbz2
+darwinup $1 -p $DEST2 clone $DEST
+$DIFF $DEST $DEST2 2>&1
+darwinup $1 -p $DEST2 list | grep -q 300files.tbz2
+darwinup $1 -p $DEST2 fsck
+set +e
+darwinup $1 -p $DEST2 clone $DEST
+if [ $? -eq 0 ]; then exit 1; fi
+set -e
+darwinup $1 -p $DEST2 uninstall all
+$DARWINUP uninstall all
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+$DIFF $ORIG $DEST2 2>&1
+rm -rf $DEST2
+
+echo "========== TEST: Download cache =========="
+if which python3 > /dev/null; then
+	PORT=8631
+	python3 -m http.server $PORT --bind 127.0.0.1 --directory $PREFIX \
+		> $PREFIX/http.log 2>&1 &
+	HTTPD=$!
+	sleep 1
+	URL=http://127.0.0.1:$PORT/300files.tbz2
+	$DARWINUP install $URL
+	$DARWINUP uninstall 300files.tbz2
+	$DARWINUP install $URL
+	# the second install only revalidated the cached copy
+	C=$(grep "GET /300files.tbz2" $PREFIX/http.log | grep -c " 304 ")
+	test "$C" == "1"
+	C=$(ls $DEST/.DarwinDepot/Downloads/Cache/objects | wc -l | xargs)
+	test "$C" == "1"
+	$DARWINUP uninstall 300files.tbz2
+	kill $HTTPD
+	wait $HTTPD || true
+	# with the server gone the cached copy still installs
+	$DARWINUP install $URL
+	$DARWINUP uninstall 300files.tbz2
+	echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+	$DIFF $ORIG $DEST 2>&1
+fi
+
+echo "========== TEST: New directory trees =========="
+# 300files/1 exists already, the rest of the root is moved in whole
+mkdir -p $DEST/300files/1
+$DARWINUP install $PREFIX/300files.tbz2
+C=$($DARWINUP verify 300files.tbz2 | grep -E '^[^ ] /' | wc -l | xargs)
+test "$C" == "0"
+C=$(find $DEST/300files | wc -l | xargs)
+test "$C" == "$(tar tjf $PREFIX/300files.tbz2 | wc -l | xargs)"
+$DARWINUP uninstall 300files.tbz2
+test -d $DEST/300files/1
+rmdir $DEST/300files/1 $DEST/300files
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+
+echo "========== TEST: Archive formats by content =========="
+cp root2.tar.gz $PREFIX/root2-noname
+cp $PREFIX/300files.tbz2 $PREFIX/300files-misnamed.tar.gz
+$DARWINUP install $PREFIX/root2-noname
+$DARWINUP install $PREFIX/300files-misnamed.tar.gz
+test -f $DEST/300files/1/01.txt
+if which xz > /dev/null; then
+	tar cJf $PREFIX/root2.tar.xz -C $PREFIX/root2 .
+	$DARWINUP install $PREFIX/root2.tar.xz
+	$DARWINUP uninstall root2.tar.xz
+fi
+$DARWINUP uninstall 300files-misnamed.tar.gz
+$DARWINUP uninstall root2-noname
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+
+echo "========== TEST: Progress reporting =========="
+./mkroot.pl -n 10000 $PREFIX/progress
+tar cf $PREFIX/progress.tar -C $PREFIX/progress .
+$DARWINUP install $PREFIX/progress.tar > $PREFIX/progress.out 2> $PREFIX/progress.err
+# events go to stderr, as one JSON object per line
+grep -q '^{' $PREFIX/progress.out && exit 1
+C=$(grep -Ev '^\{"operation":"install","archive":"progress.tar","phase":"[a-z]+",.*"done":(true|false)\}$' $PREFIX/progress.err | wc -l | xargs)
+test "$C" == "0"
+$DARWINUP uninstall progress.tar
+rm -rf $PREFIX/progress
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+
+echo "========== TEST: Progress with a long archive name =========="
+# the status line starts with the archive name, which fills its buffer
+LONGNAME=$(printf 'l%.0s' $(seq 1 250)).tar
+tar cf $PREFIX/$LONGNAME -C $PREFIX/root .
+# status lines are only shown when stdout and stderr are a terminal
+script -q $PREFIX/progress.tty $DARWINUP install $PREFIX/$LONGNAME
+grep -q "Installed archive: .* $LONGNAME" $PREFIX/progress.tty
+$DARWINUP uninstall $LONGNAME
+rm -f $PREFIX/$LONGNAME
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+
+echo "========== TEST: Partial restore =========="
+./mkroot.pl -n 1000 -l 5 $PREFIX/partial1
+./mkroot.pl -n 20 -f 500 -l 5 -v 2 $PREFIX/partial2
+tar cf $PREFIX/partial1.tar -C $PREFIX/partial1 .
+tar cf $PREFIX/partial2.tar -C $PREFIX/partial2 .
+$DARWINUP install $PREFIX/partial1.tar
+$DARWINUP install $PREFIX/partial2.tar
+$DARWINUP uninstall partial2.tar
+# the 20 files came back from the backing store of partial1.tar
+for D in $(cd $PREFIX/partial1 && ls); do $DIFF $PREFIX/partial1/$D $DEST/$D; done
+C=$(find $DEST/.DarwinDepot/Archives -mindepth 1 -maxdepth 1 -type d | wc -l | xargs)
+test "$C" == "0"
+$DARWINUP uninstall partial1.tar
+rm -rf $PREFIX/partial1 $PREFIX/partial2
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+
+echo "========== TEST: Packed rollback data =========="
+mkdir -p $PREFIX/packed
+for F in $(cd $DEST && find . -path ./.DarwinDepot -prune -o -path ./System -prune -o -type f -size -4k -print | head -20);
+do
+	mkdir -p $PREFIX/packed/$(dirname $F)
+	echo packed > $PREFIX/packed/$F
+done
+tar cf $PREFIX/packed.tar -C $PREFIX/packed .
+$DARWINUP install $PREFIX/packed.tar
+# the files replaced went into a pack rather than the backing store
+C=$(find $DEST/.DarwinDepot/Archives -name '*.pack' -size +0 | wc -l | xargs)
+test "$C" != "0"
+$DARWINUP fsck
+$DARWINUP uninstall packed.tar
+rm -rf $PREFIX/packed
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+
+echo "========== TEST: Snapshot index =========="
+cc -Wall -I../../darwinup -o $PREFIX/snapshot-test snapshot-test.c
+$DARWINUP install $PREFIX/root2
+SNAPSHOT=$DEST/.DarwinDepot/Snapshot
+test "$(head -c 7 $SNAPSHOT)" == "DUSNAP1"
+$PREFIX/snapshot-test $SNAPSHOT /e/ee/e_data.txt root2
+# only operations which commit rewrite it
+BEFORE=$(cksum < $SNAPSHOT)
+$DARWINUP list
+$DARWINUP files root2
+test "$(cksum < $SNAPSHOT)" == "$BEFORE"
+$DARWINUP rename root2 snapshotted
+$PREFIX/snapshot-test $SNAPSHOT /e/ee/e_data.txt snapshotted
+$DARWINUP uninstall snapshotted
+$PREFIX/snapshot-test $SNAPSHOT /e/ee/e_data.txt
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+
+echo "========== TEST: Undo to a checkpoint =========="
+$DARWINUP install $PREFIX/root
+$DARWINUP checkpoint before
+$DARWINUP install $PREFIX/root2
+$DARWINUP install $PREFIX/root3
+$DARWINUP checkpoint after
+$DARWINUP upgrade $PREFIX/root2
+$DARWINUP -n undo before
+C=$($DARWINUP list | grep -E "root2|root3" | wc -l | xargs)
+test "$C" == "2"
+$DARWINUP undo before
+C=$($DARWINUP list | grep -E "root2|root3" | wc -l | xargs)
+test "$C" == "0"
+# checkpoints made since are forgotten, and there is nothing left to undo
+C=$($DARWINUP checkpoint | grep -E "before|after" | wc -l | xargs)
+test "$C" == "1"
+$DARWINUP undo
+$DARWINUP fsck
+$DARWINUP uninstall root
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+
+echo "========== TEST: Depot service =========="
+$DARWINUP install $PREFIX/root
+$DARWINUP list > $PREFIX/direct-list.txt
+$DARWINUP files root > $PREFIX/direct-files.txt
+$DARWINUP verify root > $PREFIX/direct-verify.txt
+$DARWINUP serve &
+SERVICE=$!
+while ! $DARWINUP -vv list 2>&1 | grep -q "forwarding list"; do sleep 1; done
+$DARWINUP list | diff $PREFIX/direct-list.txt -
+$DARWINUP files root | diff $PREFIX/direct-files.txt -
+$DARWINUP verify root | diff $PREFIX/direct-verify.txt -
+# a client which never sends its request only holds the service up briefly
+perl -MIO::Socket::UNIX -e '$s = IO::Socket::UNIX->new(Peer => shift) or die; sleep 30' \
+	$DEST/.DarwinDepot/darwinup.sock &
+IDLE=$!
+sleep 1
+$DARWINUP list | diff $PREFIX/direct-list.txt -
+kill $IDLE
+# and a service which does not answer is not waited for
+kill -STOP $SERVICE
+$DARWINUP verify root | diff $PREFIX/direct-verify.txt -
+$DARWINUP -vv list 2>&1 | grep -q "no answer"
+kill -CONT $SERVICE
+kill $SERVICE
+wait $SERVICE
+test ! -e $DEST/.DarwinDepot/darwinup.sock
+$DARWINUP uninstall root
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+
+echo "========== TEST: libdarwinup client =========="
+LIBDARWINUP=$(dirname $(which darwinup))/..
+cc -Wall -I$LIBDARWINUP/include -c -o $PREFIX/libdarwinup-test.o libdarwinup-test.c
+c++ -o $PREFIX/libdarwinup-test $PREFIX/libdarwinup-test.o -L$LIBDARWINUP/lib -ldarwinup -lsqlite3
+C=$(find $PREFIX/root -mindepth 1 | wc -l | xargs)
+$PREFIX/libdarwinup-test $DEST $PREFIX/root $C
+# the client exits non-zero if the library printed to its stdout
+C=$($DARWINUP list | grep root | wc -l | xargs)
+test "$C" == "0"
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+
+echo "========== TEST: Batch mode ============="
+cat > $PREFIX/batch.txt <<EOF
+# install a few roots under one lock
+install $PREFIX/root2
+install $PREFIX/root
+rename root "BATCH ROOT"
+list
+uninstall "BATCH ROOT"
+EOF
+$DARWINUP -b $PREFIX/batch.txt
+C=$($DARWINUP list | grep "BATCH ROOT" | wc -l | xargs)
+test "$C" == "0"
+C=$($DARWINUP list | grep "root2" | wc -l | xargs)
+test "$C" == "1"
+# dump's debug verbosity ends with it, so list after it hides rollbacks
+A=$(echo "dump" | $DARWINUP -b - | grep "<Rollback>" | wc -l | xargs)
+B=$(printf "dump\nlist\n" | $DARWINUP -b - | grep "<Rollback>" | wc -l | xargs)
+test "$A" == "$B"
+echo "uninstall all" | $DARWINUP -b -
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+
 echo "========== TEST: Modify /System/Library/Extensions =========="
 mkdir -p $DEST/System/Library/Extensions/Foo.kext
 BEFORE=$(ls -Tld $DEST/System/Library/Extensions/ | awk '{print $6$7$8$9}');
@@ -566,6 +1033,17 @@ echo "DIFF: diffing original test files to dest (should be no diffs) ..."
 $DIFF $ORIG $DEST 2>&1
 if [ $? -ne 0 ]; then exit 1; fi
 
+echo "========== TEST: Batch mode stops at the first error =========="
+printf "install $PREFIX/root\nuninstall NOTHERE\ninstall $PREFIX/root2\n" | $DARWINUP -b -
+if [ $? -eq 0 ]; then exit 1; fi
+C=$($DARWINUP list | grep "root2" | wc -l | xargs)
+test "$C" == "0"
+if [ $? -ne 0 ]; then exit 1; fi
+$DARWINUP uninstall all
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+if [ $? -ne 0 ]; then exit 1; fi
+
 popd >> /dev/null
 echo "INFO: Done testing!"
 
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2013 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+/*
+ * snapshot-test.c
+ * Checks the snapshot index of a depot through the reader in Snapshot.h,
+ * for run-tests.sh.
+ *
+ * usage: snapshot-test SNAPSHOT PATH [NAME]
+ *
+ * With NAME, PATH must be owned by an archive named NAME, which lists it
+ * among its files. Without, no archive may own PATH.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "Snapshot.h"
+
+int main(int argc, char* argv[]) {
+	if (argc != 3 && argc != 4) {
+		fprintf(stderr, "usage: %s SNAPSHOT PATH [NAME]\n", argv[0]);
+		return 2;
+	}
+	const char* path = argv[2];
+	const char* name = (argc == 4) ? argv[3] : NULL;
+
+	snapshot_t snap;
+	if (snapshot_open(argv[1], &snap) != 0) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	int res = 0;
+	uint64_t owner = snapshot_owner(&snap, path);
+	const snapshot_archive_t* archive = snapshot_archive(&snap, owner);
+	if (!name) {
+		if (owner != 0) {
+			fprintf(stderr, "%s: owned by archive %" PRIu64 "\n", path, owner);
+			res = 1;
+		}
+	} else if (!archive) {
+		fprintf(stderr, "%s: no owner\n", path);
+		res = 1;
+	} else if (strcmp(snapshot_string(&snap, archive->name), name) != 0) {
+		fprintf(stderr, "%s: owned by %s, not %s\n", path, 
+				snapshot_string(&snap, archive->name), name);
+		res = 1;
+	} else {
+		uint32_t i;
+		for (i = 0; i < archive->count; i++) {
+			if (strcmp(snapshot_archive_file(&snap, archive, i), path) == 0) break;
+		}
+		if (i == archive->count) {
+			fprintf(stderr, "%s: not among the files of %s\n", path, name);
+			res = 1;
+		}
+	}
+	if (snapshot_owner(&snap, "/no/such/path") != 0) {
+		fprintf(stderr, "/no/such/path: has an owner\n");
+		res = 1;
+	}
+
+	if (res == 0) printf("%s: %s\n", path, name ? name : "no owner");
+	snapshot_close(&snap);
+	return res;
+}